@@ -0,0 +1,212 @@
+#include "manager.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Compare the ways of serializing events for a downstream pipeline: the
+// manager text format, JSON built with an ostringstream by walking the
+// headers, json_writer with each instruction set it can escape with, and
+// the binary event_encoder and event_decoder.  Reports events/s and MB/s
+// of output (of input for decoding).  The default of 1000 events stays in
+// cache, as freshly parsed events do; many more measure memory instead.
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+//
+// usage: codec-bench [events]
+
+using namespace astxx::manager;
+
+namespace
+{
+    std::vector<message::event> synthesize(int count)
+    {
+        std::vector<message::event> events;
+        for (int i = 0; i < count; ++i)
+        {
+            std::string n = std::to_string(i);
+            std::string id = "1700000000." + n;
+            if (i % 3 == 0)
+            {
+                message::event e("Newchannel");
+                e["Privilege"] = "call,all";
+                e["Channel"] = "PJSIP/trunk-0000" + n;
+                e["ChannelState"] = "4";
+                e["ChannelStateDesc"] = "Ring";
+                e["CallerIDNum"] = "5551234567";
+                e["CallerIDName"] = "\"Sales\" <5551000>";
+                e["Context"] = "from-trunk";
+                e["Exten"] = "5551000";
+                e["Priority"] = "1";
+                e["Uniqueid"] = id;
+                e["Linkedid"] = id;
+                events.push_back(e);
+            }
+            else if (i % 3 == 1)
+            {
+                message::event e("QueueMemberStatus");
+                e["Privilege"] = "agent,all";
+                e["Queue"] = "support";
+                e["MemberName"] = "Agent/1001";
+                e["Interface"] = "PJSIP/agent-1001";
+                e["StateInterface"] = "PJSIP/agent-1001";
+                e["Membership"] = "dynamic";
+                e["Penalty"] = "0";
+                e["CallsTaken"] = n;
+                e["LastCall"] = "1700000000";
+                e["Status"] = "1";
+                e["Paused"] = "0";
+                events.push_back(e);
+            }
+            else
+            {
+                message::event e("VarSet");
+                e["Privilege"] = "dialplan,all";
+                e["Channel"] = "PJSIP/trunk-0000" + n;
+                e["Variable"] = "SIPCALLID";
+                e["Value"] = "a84b4c76e66710@pc33.atlanta.example.com\tline\\2";
+                e["Uniqueid"] = id;
+                e.insert(std::make_pair("ChanVariable", "CAMPAIGN=spring-2024"));
+                e.insert(std::make_pair("ChanVariable", "LEAD=0001234567"));
+                events.push_back(e);
+            }
+        }
+        return events;
+    }
+
+    // what converting to JSON looks like without a writer
+    std::string ostream_json(const message::event& e)
+    {
+        std::ostringstream ss;
+        ss << "{";
+        bool first = true;
+        for (message::event::header_t::const_iterator i = e.begin(); i != e.end(); ++i)
+        {
+            if (!first)
+                ss << ",";
+            first = false;
+            ss << "\"" << i->first << "\":\"";
+            for (std::string::const_iterator c = i->second.begin(); c != i->second.end(); ++c)
+            {
+                if (*c == '"' || *c == '\\')
+                    ss << '\\' << *c;
+                else if (*c == '\t')
+                    ss << "\\t";
+                else
+                    ss << *c;
+            }
+            ss << "\"";
+        }
+        ss << "}";
+        return ss.str();
+    }
+
+    template<typename F>
+    void run(const char* name, std::size_t events, int rounds, F f)
+    {
+        std::size_t bytes = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i)
+            bytes += f();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << "  " << events * rounds / seconds / 1e6 << " M events/s, "
+                  << bytes / seconds / (1024 * 1024) << " MB/s\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? std::atoi(argv[1]) : 1000;
+    const int rounds = std::max(10, 1000000 / count);
+    std::vector<message::event> events = synthesize(count);
+
+    std::string text;
+    run("format(string&)     ", events.size(), rounds, [&]()
+    {
+        text.clear();
+        for (std::size_t i = 0; i < events.size(); ++i)
+            events[i].format(text);
+        return text.size();
+    });
+
+    run("ostringstream json  ", events.size(), rounds, [&]()
+    {
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < events.size(); ++i)
+            bytes += ostream_json(events[i]).size() + 1;
+        return bytes;
+    });
+
+    scanner::isa_t isas[] = { scanner::scalar, scanner::sse2, scanner::avx2 };
+    for (std::size_t k = 0; k < sizeof(isas) / sizeof(isas[0]); ++k)
+    {
+        if (isas[k] > scanner::best())
+            continue;
+
+        json_writer json(isas[k]);
+        std::string name = std::string("json_writer ") + scanner::name(isas[k]);
+        name.resize(20, ' ');
+        run(name.c_str(), events.size(), rounds, [&]()
+        {
+            json.clear();
+            for (std::size_t i = 0; i < events.size(); ++i)
+            {
+                json.write(events[i]);
+                json.newline();
+            }
+            return json.buffer().size();
+        });
+    }
+
+    std::string binary;
+    event_encoder encoder;
+    run("event_encoder       ", events.size(), rounds, [&]()
+    {
+        binary.clear();
+        encoder.reset();
+        for (std::size_t i = 0; i < events.size(); ++i)
+            encoder.encode(events[i], binary);
+        return binary.size();
+    });
+
+    event_decoder decoder;
+    message::event e("");
+    std::size_t decoded = 0;
+    run("event_decoder       ", events.size(), rounds, [&]()
+    {
+        decoder.reset();
+        decoded = 0;
+        const char* p = binary.data();
+        std::size_t left = binary.size();
+        std::size_t used;
+        while ((used = decoder.decode(p, left, e)))
+        {
+            p += used;
+            left -= used;
+            ++decoded;
+        }
+        return binary.size();
+    });
+
+    std::cout << "text " << text.size() / events.size() << " bytes/event, binary "
+              << binary.size() / events.size() << " bytes/event\n";
+
+    // the decoded events had better be the same
+    decoder.reset();
+    const char* p = binary.data();
+    std::size_t left = binary.size();
+    for (std::size_t i = 0; i < events.size(); ++i)
+    {
+        std::size_t used = decoder.decode(p, left, e);
+        if (!used || e.format() != events[i].format())
+        {
+            std::cerr << "event " << i << " did not survive encoding" << std::endl;
+            return EXIT_FAILURE;
+        }
+        p += used;
+        left -= used;
+    }
+
+    return decoded == events.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,177 @@
+#include "manager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Measure the columnar exporter: how fast CDR events are turned into
+// column blocks on one core, how big the files get, and how long an
+// aggregate takes over the columns compared with the same aggregate over
+// the events themselves.  Rows go in batches of 256, the way the
+// connection hands them over.  Build with -DCMAKE_BUILD_TYPE=Release for
+// meaningful numbers.
+//
+// usage: columnar-bench [directory] [rows]
+
+using namespace astxx::manager;
+
+namespace
+{
+    const char* const dispositions[] = { "ANSWERED", "ANSWERED", "ANSWERED", "NO ANSWER", "BUSY", "FAILED" };
+
+    message::event cdr(int n)
+    {
+        int duration = 5 + n * 7919 % 600;
+        int answered = n % 6 < 3;
+
+        message::event e("Cdr");
+        e["Privilege"] = "cdr,all";
+        e["AccountCode"] = "";
+        e["Source"] = std::to_string(5550000000LL + n % 5000);
+        e["Destination"] = std::to_string(100 + n % 40);
+        e["DestinationContext"] = "from-internal";
+        e["CallerID"] = "\"Customer\" <" + std::to_string(5550000000LL + n % 5000) + ">";
+        e["Channel"] = "PJSIP/trunk-" + std::to_string(n);
+        e["DestinationChannel"] = "PJSIP/" + std::to_string(100 + n % 40) + "-" + std::to_string(n);
+        e["LastApplication"] = "Dial";
+        e["LastData"] = "PJSIP/" + std::to_string(100 + n % 40) + ",30";
+        e["StartTime"] = "2024-01-31 12:00:00";
+        e["AnswerTime"] = answered ? "2024-01-31 12:00:05" : "";
+        e["EndTime"] = "2024-01-31 12:10:00";
+        e["Duration"] = std::to_string(duration);
+        e["BillableSeconds"] = std::to_string(answered ? duration - 5 : 0);
+        e["Disposition"] = dispositions[n % 6];
+        e["AMAFlags"] = "DOCUMENTATION";
+        e["UniqueID"] = "1700000000." + std::to_string(n);
+        e["UserField"] = "";
+        return e;
+    }
+
+    double since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::vector<std::string> files(const std::string& directory)
+    {
+        std::vector<std::string> names;
+        if (DIR* dir = opendir(directory.c_str()))
+        {
+            while (dirent* d = readdir(dir))
+            {
+                std::string name = d->d_name;
+                if (name.size() > 5 and name.compare(name.size() - 5, 5, ".cols") == 0)
+                    names.push_back(directory + "/" + name);
+            }
+            closedir(dir);
+        }
+        return names;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string directory = argc > 1 ? argv[1] : "columnar-bench.d";
+    int total = argc > 2 ? std::atoi(argv[2]) : 2000000;
+
+    std::vector<message::event> events;
+    std::size_t text = 0;
+    for (int n = 0; n < 60000; ++n)
+    {
+        events.push_back(cdr(n));
+        text += events.back().format_size();
+    }
+
+    try
+    {
+        std::vector<std::string> old = files(directory);
+        for (std::size_t i = 0; i < old.size(); ++i)
+            unlink(old[i].c_str());
+
+        {
+            columnar_exporter table(directory, "cdr");
+            table.column("UniqueID")
+                .column("Source")
+                .column("Destination")
+                .column("Disposition")
+                .column("StartTime", time_column)
+                .column("AnswerTime", time_column)
+                .column("Duration", integer_column)
+                .column("BillableSeconds", integer_column);
+
+            const std::size_t batch = 256;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int done = 0; done < total; )
+            {
+                std::size_t at = done % events.size();
+                std::size_t n = std::min<std::size_t>(std::min<std::size_t>(batch, events.size() - at), total - done);
+                table.add(event_batcher::batch_t(&events[at], &events[at] + n));
+                done += n;
+            }
+            table.flush();
+            double seconds = since(start);
+            std::cout << "export     " << total / seconds << " rows/s, "
+                      << double(text) / events.size() * total / seconds / (1024 * 1024) << " MB/s of events as text\n";
+        }
+
+        std::vector<std::string> names = files(directory);
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            struct stat st;
+            if (stat(names[i].c_str(), &st) == 0)
+                bytes += st.st_size;
+        }
+        std::cout << "on disk    " << double(bytes) / total << " bytes/row in " << names.size() << " files, "
+                  << double(text) / events.size() / (double(bytes) / total) << "x smaller than text\n";
+
+        // billable seconds by disposition, from the columns
+        std::map<std::string, long long> billed;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (std::size_t f = 0; f < names.size(); ++f)
+        {
+            columnar_reader reader(names[f]);
+            std::size_t disposition = reader.column("Disposition");
+            std::size_t billable = reader.column("BillableSeconds");
+            for (std::size_t b = 0; b < reader.blocks(); ++b)
+            {
+                // sum per code, then name the codes once per block
+                std::vector<long long> sums(reader.dictionary_size(b, disposition));
+                const boost::uint32_t* codes = reader.codes(b, disposition);
+                const boost::int64_t* seconds = reader.integers(b, billable);
+                for (std::size_t r = 0; r < reader.rows(b); ++r)
+                    sums[codes[r]] += seconds[r];
+                for (std::size_t c = 0; c < sums.size(); ++c)
+                    billed[reader.word(b, disposition, c)] += sums[c];
+            }
+        }
+        double columns = since(start);
+
+        std::map<std::string, long long> check;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < total; ++i)
+        {
+            const message::event& e = events[i % events.size()];
+            check[*e.find("Disposition")] += e.get<long long>("BillableSeconds");
+        }
+        double rows = since(start);
+
+        std::cout << "aggregate  " << columns * 1e3 << " ms over columns, " << rows * 1e3 << " ms over events"
+                  << (billed == check ? "" : " (MISMATCH)") << "\n";
+        for (std::map<std::string, long long>::const_iterator i = billed.begin(); i != billed.end(); ++i)
+            std::cout << "           " << i->first << ": " << i->second << " s\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+#include "manager.h"
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Compare the ways of serializing an action: the stringstream based
+// format() the library used to have, format() into a fresh string, into a
+// reused string, into a fixed buffer, as a list of buffers, and a
+// prepared_action.  Build with -DCMAKE_BUILD_TYPE=Release for meaningful
+// numbers.
+
+using namespace astxx::manager;
+
+namespace
+{
+    // what basic_message::format() used to do
+    std::string stringstream_format(message::action& action)
+    {
+        std::stringstream ss;
+        ss << "Action: " << action["Action"] << "\r\n";
+        for (message::action::header_t::iterator i = action.begin(); i != action.end(); ++i)
+        {
+            if (i->first != "Action")
+                ss << i->first << ": " << i->second << "\r\n";
+        }
+        ss << "\r\n";
+        return ss.str();
+    }
+
+    template<typename F>
+    void run(const char* name, int rounds, F f)
+    {
+        std::size_t bytes = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i)
+            bytes += f();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << "  " << seconds / rounds * 1e9 << " ns/action, "
+                  << bytes / seconds / (1024 * 1024) << " MB/s\n";
+    }
+}
+
+int main()
+{
+    std::map<std::string, std::string> variables;
+    variables["CAMPAIGN"] = "spring-2024";
+    variables["LEAD"] = "0001234567";
+    variables["__TRACE"] = "1";
+
+    action::originate originate("PJSIP/trunk/5551234567", "campaign", "s", "1");
+    originate.caller_id("\"Sales\" <5551000>").account("sales").async(true)
+        .timeout(boost::posix_time::seconds(30)).variables(variables);
+
+    message::action action = originate.action();
+    action["ActionID"] = "astxx-123456";
+
+    const int rounds = 1000000;
+
+    run("stringstream     ", rounds, [&]() { return stringstream_format(action).size(); });
+    run("format()         ", rounds, [&]() { return action.format().size(); });
+
+    std::string buffer;
+    run("format(string&)  ", rounds, [&]()
+    {
+        buffer.clear();
+        action.format(buffer);
+        return buffer.size();
+    });
+
+    char raw[4096];
+    run("format(char*)    ", rounds, [&]() { return action.format(raw, sizeof(raw)); });
+
+    std::vector<boost::asio::const_buffer> buffers;
+    run("format(buffers&) ", rounds, [&]()
+    {
+        buffers.clear();
+        action.format(buffers);
+        return boost::asio::buffer_size(buffers);
+    });
+
+    std::vector<std::string> slots;
+    slots.push_back("Channel");
+    prepared_action prepared(originate, slots);
+    prepared_action::instance call = prepared();
+    call.set(0, "PJSIP/trunk/5551234567");
+    std::string name;
+    run("prepared_action  ", rounds, [&]()
+    {
+        call.serialize("astxx-123456", name, buffer);
+        return buffer.size();
+    });
+
+    return EXIT_SUCCESS;
+}
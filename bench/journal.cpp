@@ -0,0 +1,137 @@
+#include "manager.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+
+// Measure the journal: how fast events can be appended on one core, how
+// small they get on disk, and how long it takes to find a minute of events
+// and the events of one call in a few hours of traffic.  Events are
+// journaled 5 ms apart (200 a second) as if they had come in over time.
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+//
+// usage: journal-bench [directory] [events]
+
+using namespace astxx::manager;
+
+namespace
+{
+    // the life of a call: a channel, its dialplan, its queue and its hangup
+    void call(std::vector<message::event>& events, int n)
+    {
+        std::string id = "1700000000." + std::to_string(n);
+        std::string channel = "PJSIP/trunk-" + std::to_string(n);
+
+        message::event e("Newchannel");
+        e["Privilege"] = "call,all";
+        e["Channel"] = channel;
+        e["ChannelState"] = "4";
+        e["ChannelStateDesc"] = "Ring";
+        e["CallerIDNum"] = std::to_string(5550000000LL + n % 100000);
+        e["Context"] = "from-trunk";
+        e["Exten"] = "5551000";
+        e["Uniqueid"] = id;
+        e["Linkedid"] = id;
+        events.push_back(e);
+
+        for (int i = 0; i < 3; ++i)
+        {
+            message::event v("VarSet");
+            v["Privilege"] = "dialplan,all";
+            v["Channel"] = channel;
+            v["Variable"] = "STEP";
+            v["Value"] = std::to_string(i);
+            v["Uniqueid"] = id;
+            v["Linkedid"] = id;
+            events.push_back(v);
+        }
+
+        message::event q("QueueCallerJoin");
+        q["Privilege"] = "agent,all";
+        q["Channel"] = channel;
+        q["Queue"] = n % 2 ? "sales" : "support";
+        q["Position"] = "1";
+        q["Count"] = "1";
+        q["Uniqueid"] = id;
+        q["Linkedid"] = id;
+        events.push_back(q);
+
+        message::event h("Hangup");
+        h["Privilege"] = "call,all";
+        h["Channel"] = channel;
+        h["Cause"] = "16";
+        h["Cause-txt"] = "Normal Clearing";
+        h["Uniqueid"] = id;
+        h["Linkedid"] = id;
+        events.push_back(h);
+    }
+
+    void count(std::size_t& n, const message::event&, journal_reader::time_point)
+    {
+        ++n;
+    }
+
+    double since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string directory = argc > 1 ? argv[1] : "journal-bench.d";
+    int total = argc > 2 ? std::atoi(argv[2]) : 2000000;
+
+    // a few thousand distinct calls, journaled over and over
+    std::vector<message::event> events;
+    for (int n = 0; events.size() < 60000; ++n)
+        call(events, n);
+
+    journal_writer::time_point epoch = journal_writer::clock_type::now() - std::chrono::hours(24);
+    const std::chrono::milliseconds step(5);
+    std::size_t text = 0;
+    for (std::size_t i = 0; i < events.size(); ++i)
+        text += events[i].format_size();
+
+    try
+    {
+        unsigned long long written;
+        {
+            journal_writer journal(directory);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int i = 0; i < total; ++i)
+                journal.append_at(events[i % events.size()], epoch + step * i);
+            journal.flush();
+            double seconds = since(start);
+            written = journal.written();
+            std::cout << "append     " << total / seconds << " events/s, "
+                      << double(text) / events.size() * total / seconds / (1024 * 1024) << " MB/s of events as text\n";
+            std::cout << "on disk    " << double(written) / total << " bytes/event, "
+                      << double(text) / events.size() / (double(written) / total) << "x smaller than text\n";
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        journal_reader reader(directory);
+        std::cout << "open       " << since(start) * 1e3 << " ms, " << reader.segments() << " segments\n";
+
+        std::size_t found = 0;
+        journal_reader::time_point middle = epoch + step * (total / 2);
+        start = std::chrono::steady_clock::now();
+        reader.read(middle, middle + std::chrono::minutes(1), boost::bind(count, boost::ref(found), _1, _2));
+        std::cout << "one minute " << since(start) * 1e3 << " ms, " << found << " events\n";
+
+        found = 0;
+        start = std::chrono::steady_clock::now();
+        reader.find_call("1700000000.1234", boost::bind(count, boost::ref(found), _1, _2));
+        std::cout << "one call   " << since(start) * 1e3 << " ms, " << found << " events over the whole journal\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#include "manager.h"
+#include "simulator.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <boost/bind.hpp>
+
+// Measure how long events take from the socket to their handler while they
+// trickle in one at a time, the way agent state changes do, with the
+// connection sleeping in the kernel between them and with it spinning (see
+// connection::spin()), both reading on the application thread and on the
+// I/O thread.  Spinning needs a spare cpu for each spinning thread, on a
+// busy or single cpu machine it makes things worse.  Events come from
+// bench::simulator.
+//
+// usage: latency-bench [events] [microseconds between events] [spin cpu] [io thread cpu]
+
+using namespace astxx::manager;
+
+namespace
+{
+    const char agent_connect[] =
+        "Event: AgentConnect\r\nPrivilege: agent,all\r\nChannel: PJSIP/agent-00000001\r\n"
+        "Queue: support\r\nMemberName: Agent/1001\r\nHoldTime: 12\r\nRingTime: 3\r\n\r\n";
+
+    void count_event(int& received, message::event)
+    {
+        ++received;
+    }
+
+    void run(const char* name, unsigned short port, int count, int interval, const spin_policy& policy, bool io_thread, int io_cpu)
+    {
+        astxx::manager::connection connection("127.0.0.1", port);
+        int received = 0;
+        connection.register_event("", boost::bind(count_event, boost::ref(received), _1));
+        connection.spin(policy);
+        if (io_thread)
+            connection.start_io_thread(io_cpu);
+        connection.record_latency(true);
+
+        connection.send_action(bench::events(count, interval));
+        while (received < count)
+        {
+            connection.wait_event();
+            connection.process_events();
+        }
+
+        latency_histogram& h = connection.event_latency();
+        std::cout << name << "  p50 " << h.p50().count() / 1e3 << " us, p99 " << h.p99().count() / 1e3
+                  << " us, p999 " << h.p999().count() / 1e3 << " us, max " << h.max().count() / 1e3 << " us\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? std::atoi(argv[1]) : 10000;
+    int interval = argc > 2 ? std::atoi(argv[2]) : 100;
+    int spin_cpu = argc > 3 ? std::atoi(argv[3]) : -1;
+    int io_cpu = argc > 4 ? std::atoi(argv[4]) : -1;
+
+    try
+    {
+        bench::simulator::options opts;
+        opts.event = agent_connect;
+        opts.batch = 1;
+        bench::simulator simulator(opts);
+        unsigned short port = simulator.port();
+
+        spin_policy blocking;
+        spin_policy spinning;
+        spinning.spin = std::chrono::steady_clock::duration::max();
+        spinning.cpu = spin_cpu;
+
+        std::cout << count << " events, " << interval << " us apart\n";
+        run("blocking           ", port, count, interval, blocking, false, io_cpu);
+        run("spinning           ", port, count, interval, spinning, false, io_cpu);
+        run("io thread, blocking", port, count, interval, blocking, true, io_cpu);
+        run("io thread, spinning", port, count, interval, spinning, true, io_cpu);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
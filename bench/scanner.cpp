@@ -0,0 +1,137 @@
+#include "manager.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+// Compare the header scanner in each instruction set against the
+// std::string::find() loop the parser used before, and time the whole
+// parser.  Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+//
+// usage: scanner-bench [capture]
+//
+// The capture is raw manager traffic, for example recorded with
+// "tcpflow -c port 5038".  Without one a mix of typical events is
+// generated.
+
+using namespace astxx::manager;
+
+namespace
+{
+    std::string synthesize(std::size_t size)
+    {
+        std::ostringstream out;
+        for (std::size_t i = 0; out.tellp() < static_cast<std::streamoff>(size); ++i)
+        {
+            switch (i % 3)
+            {
+            case 0:
+                out << "Event: Newchannel\r\nPrivilege: call,all\r\nChannel: PJSIP/trunk-" << i
+                    << "\r\nChannelState: 0\r\nChannelStateDesc: Down\r\nCallerIDNum: 5551234\r\n"
+                    << "CallerIDName: <unknown>\r\nConnectedLineNum: <unknown>\r\nLanguage: en\r\n"
+                    << "AccountCode: \r\nContext: from-trunk\r\nExten: 100\r\nPriority: 1\r\n"
+                    << "Uniqueid: 1700000000." << i << "\r\nLinkedid: 1700000000." << i << "\r\n\r\n";
+                break;
+            case 1:
+                out << "Event: VarSet\r\nPrivilege: dialplan,all\r\nChannel: PJSIP/trunk-" << i
+                    << "\r\nVariable: RTPAUDIOQOS\r\nValue: ssrc=1;themssrc=2;lp=0;rxjitter=0.000\r\n"
+                    << "Uniqueid: 1700000000." << i << "\r\n\r\n";
+                break;
+            default:
+                out << "Response: Success\r\nActionID: astxx-" << i << "\r\nMessage: Pong\r\n\r\n";
+                break;
+            }
+        }
+        return out.str();
+    }
+
+    class counter : public parser::handler
+    {
+    public:
+        counter() : messages(0), output(0) { }
+        void on_greeting(const std::string&) { }
+        void on_event(message::event&) { ++messages; }
+        void on_response(message::response&) { ++messages; }
+        void on_output(const std::string&, const std::string&, bool) { ++output; }
+
+        std::size_t messages;
+        std::size_t output;
+    };
+
+    template<typename F>
+    double time(const std::string& data, int rounds, F f)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i)
+            f();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return data.size() * static_cast<double>(rounds) / seconds / (1024 * 1024);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string data;
+    if (argc > 1)
+    {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in)
+        {
+            std::cerr << "can't open " << argv[1] << std::endl;
+            return EXIT_FAILURE;
+        }
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        data = synthesize(16 * 1024 * 1024);
+    }
+
+    const int rounds = 10;
+    std::size_t lines = 0;
+
+    double mb = time(data, rounds, [&]()
+    {
+        lines = 0;
+        std::string::size_type pos = 0, rn;
+        while ((rn = data.find("\r\n", pos)) != std::string::npos)
+        {
+            std::string::size_type colon = data.find_first_of(':', pos);
+            if (colon < rn)
+                ++lines;
+            pos = rn + 2;
+        }
+    });
+    std::cout << "string::find  " << mb << " MB/s\n";
+
+    scanner::isa_t isas[] = { scanner::scalar, scanner::sse2, scanner::avx2 };
+    for (std::size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); ++i)
+    {
+        if (isas[i] > scanner::best())
+            continue;
+
+        scanner s(isas[i]);
+        scanner::index_t index;
+        index.reserve(data.size() / 16);
+        mb = time(data, rounds, [&]()
+        {
+            index.clear();
+            s.scan(data.data(), data.size(), index);
+        });
+        std::cout << "scanner " << scanner::name(isas[i]) << "  " << mb << " MB/s (" << index.size() << " lines)\n";
+    }
+
+    // the whole parser, fed in socket sized pieces
+    counter c;
+    mb = time(data, rounds, [&]()
+    {
+        parser p;
+        for (std::string::size_type pos = 0; pos < data.size(); pos += 8192)
+            p.feed(data.data() + pos, std::min<std::string::size_type>(8192, data.size() - pos), c);
+    });
+    std::cout << "parser (" << scanner::name(scanner::best()) << ")  " << mb << " MB/s (" << c.messages / rounds << " messages)\n";
+
+    return EXIT_SUCCESS;
+}
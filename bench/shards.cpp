@@ -0,0 +1,85 @@
+#include "manager.h"
+#include "simulator.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <boost/lexical_cast.hpp>
+
+// Stream events from a local AMI simulator to many connections spread over
+// a shard_pool, and report the event rate with one shard, two, and so on
+// up to one per cpu.  The simulator runs in a child process, so give it
+// cpus of its own (taskset) to see how the shards scale.  Build with
+// -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+//
+// usage: shards-bench [connections] [events per connection] [max shards]
+
+using namespace astxx::manager;
+
+namespace
+{
+    void run(unsigned short port, std::size_t shards, int connections, int count)
+    {
+        std::atomic<long> received(0);
+        std::atomic<int> ready(0);
+        std::atomic<int> failed(0);
+
+        shard_pool pool(shards);
+        for (int i = 0; i < connections; ++i)
+        {
+            pool.add("pbx" + boost::lexical_cast<std::string>(i), "127.0.0.1", port,
+                [&](astxx::manager::connection& c)
+                {
+                    c.register_event("", [&](message::event) { received.fetch_add(1, std::memory_order_relaxed); });
+                    ++ready;
+                },
+                [&](const std::string&, std::exception_ptr) { ++failed; });
+        }
+        while (ready + failed < connections)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < connections; ++i)
+        {
+            pool.post("pbx" + boost::lexical_cast<std::string>(i), [count](astxx::manager::connection& c)
+            {
+                c.send_action_async(bench::events(count), astxx::manager::connection::response_handler_t());
+            });
+        }
+
+        long total = static_cast<long>(ready) * count;
+        while (received < total and failed == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << shards << " shards  " << received / seconds / 1e6 << " M events/s";
+        if (failed)
+            std::cout << ", " << failed << " connections failed";
+        std::cout << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int connections = argc > 1 ? std::atoi(argv[1]) : 200;
+    int count = argc > 2 ? std::atoi(argv[2]) : 5000;
+    std::size_t max_shards = argc > 3 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    try
+    {
+        bench::simulator simulator;
+        unsigned short port = simulator.port();
+
+        std::cout << connections << " connections, " << count << " events each\n";
+        for (std::size_t shards = 1; shards <= std::max<std::size_t>(max_shards, 1); shards *= 2)
+            run(port, shards, connections, count);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
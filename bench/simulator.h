@@ -0,0 +1,187 @@
+#ifndef ASTXX_BENCH_SIMULATOR_H
+#define ASTXX_BENCH_SIMULATOR_H
+
+#include "manager.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <boost/lexical_cast.hpp>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A stand-in for Asterisk for the benchmarks.  It runs in a child process
+// so its CPU time is not counted, listens on a free loopback port, and
+// serves each connection on a thread of its own: the greeting, then
+// "Response: Success" to every action, and after the response to an Events
+// action (see bench::events) Count copies of its event.  With an Interval
+// the events go one at a time, that many microseconds apart; without one
+// they go in writes of options::batch events.
+
+namespace bench
+{
+    const char newchannel[] =
+        "Event: Newchannel\r\nPrivilege: call,all\r\nChannel: PJSIP/trunk-00000001\r\n"
+        "ChannelState: 0\r\nChannelStateDesc: Down\r\nCallerIDNum: 5551234\r\n"
+        "CallerIDName: <unknown>\r\nConnectedLineNum: <unknown>\r\nLanguage: en\r\n"
+        "AccountCode: \r\nContext: from-trunk\r\nExten: 100\r\nPriority: 1\r\n"
+        "Uniqueid: 1700000000.1\r\nLinkedid: 1700000000.1\r\n\r\n";
+
+    class simulator
+    {
+    public:
+        struct options
+        {
+            options() : event(newchannel), batch(64) { }
+
+            // the event to send, ending with its blank line
+            std::string event;
+            // how many events to send per write when they are not spaced out
+            int batch;
+        };
+
+        explicit simulator(const options& opts = options())
+        {
+            int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address = sockaddr_in();
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            if (listener < 0 or ::bind(listener, reinterpret_cast<sockaddr*>(&address), length) < 0 or ::listen(listener, 1024) < 0
+                or ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) < 0)
+            {
+                std::string error = std::strerror(errno);
+                if (listener >= 0)
+                    ::close(listener);
+                throw std::runtime_error("can't listen: " + error);
+            }
+            port_ = ntohs(address.sin_port);
+
+            child = fork();
+            if (child == 0)
+            {
+                for (;;)
+                {
+                    int fd = ::accept(listener, 0, 0);
+                    if (fd >= 0)
+                        std::thread(serve, fd, opts).detach();
+                }
+            }
+            ::close(listener);
+            if (child < 0)
+                throw std::runtime_error(std::string("can't fork: ") + std::strerror(errno));
+        }
+
+        ~simulator()
+        {
+            kill(child, SIGTERM);
+            waitpid(child, 0, 0);
+        }
+
+        unsigned short port() const { return port_; }
+
+    private:
+        simulator(const simulator&);
+        simulator& operator=(const simulator&);
+
+        static void write_all(int fd, const std::string& data)
+        {
+            std::string::size_type sent = 0;
+            while (sent < data.size())
+            {
+                ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                    return;
+                sent += n;
+            }
+        }
+
+        static std::string header(const std::string& message, const std::string& name)
+        {
+            std::string::size_type i = message.find(name + ": ");
+            if (i == std::string::npos)
+                return "";
+            i += name.size() + 2;
+            return message.substr(i, message.find("\r\n", i) - i);
+        }
+
+        static void serve(int fd, options opts)
+        {
+            std::string block;
+            for (int i = 0; i < opts.batch; ++i)
+                block += opts.event;
+
+            write_all(fd, "Asterisk Call Manager/5.0.1\r\n");
+
+            std::string buffer;
+            char data[65536];
+            for (;;)
+            {
+                ssize_t n = ::recv(fd, data, sizeof(data), 0);
+                if (n <= 0)
+                    break;
+                buffer.append(data, n);
+
+                std::string::size_type end;
+                while ((end = buffer.find("\r\n\r\n")) != std::string::npos)
+                {
+                    std::string message = buffer.substr(0, end + 2);
+                    buffer.erase(0, end + 4);
+
+                    write_all(fd, "Response: Success\r\nActionID: " + header(message, "ActionID") + "\r\n\r\n");
+                    if (header(message, "Action") != "Events")
+                        continue;
+
+                    int count = std::atoi(header(message, "Count").c_str());
+                    int interval = std::atoi(header(message, "Interval").c_str());
+                    if (interval > 0)
+                    {
+                        for (; count > 0; --count)
+                        {
+                            std::this_thread::sleep_for(std::chrono::microseconds(interval));
+                            write_all(fd, opts.event);
+                        }
+                    }
+                    for (; opts.batch > 1 and count >= opts.batch; count -= opts.batch)
+                        write_all(fd, block);
+                    for (; count > 0; --count)
+                        write_all(fd, opts.event);
+                }
+            }
+            ::close(fd);
+        }
+
+        pid_t child;
+        unsigned short port_;
+    };
+
+    // ask the simulator for count events, interval microseconds apart or
+    // as fast as it can
+    class events : public astxx::manager::basic_action
+    {
+    public:
+        explicit events(int count, int interval = 0) : count(count), interval(interval) { }
+
+        astxx::manager::message::action action() const
+        {
+            astxx::manager::message::action a("Events");
+            a["Count"] = boost::lexical_cast<std::string>(count);
+            if (interval > 0)
+                a["Interval"] = boost::lexical_cast<std::string>(interval);
+            return a;
+        }
+
+    private:
+        int count;
+        int interval;
+    };
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "manager.h"
+#include "simulator.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <boost/bind.hpp>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// Stream events from a local AMI simulator to a number of connections and
+// compare the CPU the client spends reading and parsing them with each I/O
+// path: asio with a thread per connection, one epoll loop (see
+// connection::start_external_io()) and one uring_loop.  The simulator runs
+// in a child process so its CPU time is not counted.  Build with
+// -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+//
+// usage: uring-bench [connections] [events per connection]
+
+using namespace astxx::manager;
+
+namespace
+{
+    // what one connection has received
+    struct client
+    {
+        client(unsigned short port) : connection("127.0.0.1", port), events(0), answered(false) { }
+
+        void on_event(message::event) { ++events; }
+        void on_response(message::response) { answered = true; }
+
+        bool done(int expected) const { return events == expected and answered; }
+
+        astxx::manager::connection connection;
+        int events;
+        bool answered;
+    };
+
+    typedef std::vector<std::shared_ptr<client> > clients_t;
+
+    // user and system cpu time of this process
+    std::pair<double, double> cpu_seconds()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return std::make_pair(usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6, usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+    }
+
+    clients_t connect(unsigned short port, int connections)
+    {
+        clients_t clients;
+        for (int i = 0; i < connections; ++i)
+        {
+            std::shared_ptr<client> c(new client(port));
+            c->connection.register_event("", boost::bind(&client::on_event, c.get(), _1));
+            clients.push_back(c);
+        }
+        return clients;
+    }
+
+    void start(clients_t& clients, int count)
+    {
+        for (std::size_t i = 0; i < clients.size(); ++i)
+            clients[i]->connection.send_action_async(bench::events(count), boost::bind(&client::on_response, clients[i].get(), _1));
+    }
+
+    void process(client& c)
+    {
+        c.connection.process_events();
+        c.connection.process_responses();
+    }
+
+    void run_asio(clients_t& clients, int count)
+    {
+        start(clients, count);
+
+        std::vector<std::shared_ptr<std::thread> > threads;
+        for (std::size_t i = 0; i < clients.size(); ++i)
+        {
+            client& c = *clients[i];
+            threads.push_back(std::shared_ptr<std::thread>(new std::thread([&c, count]()
+            {
+                while (not c.done(count))
+                {
+                    if (c.events < count)
+                        c.connection.wait_event();
+                    else
+                        c.connection.wait_response();
+                    c.connection.pump_messages();
+                    process(c);
+                }
+            })));
+        }
+
+        for (std::size_t i = 0; i < threads.size(); ++i)
+            threads[i]->join();
+    }
+
+    void run_epoll(clients_t& clients, int count)
+    {
+        int epfd = epoll_create1(0);
+        for (std::size_t i = 0; i < clients.size(); ++i)
+        {
+            clients[i]->connection.start_external_io();
+            epoll_event ev = epoll_event();
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.ptr = clients[i].get();
+            epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i]->connection.native_handle(), &ev);
+        }
+
+        start(clients, count);
+
+        std::size_t finished = 0;
+        while (finished < clients.size())
+        {
+            epoll_event ready[64];
+            int n = epoll_wait(epfd, ready, 64, -1);
+            for (int i = 0; i < n; ++i)
+            {
+                client& c = *static_cast<client*>(ready[i].data.ptr);
+                c.connection.on_readable();
+                process(c);
+            }
+
+            finished = 0;
+            for (std::size_t i = 0; i < clients.size(); ++i)
+            {
+                if (clients[i]->done(count))
+                    ++finished;
+            }
+        }
+
+        for (std::size_t i = 0; i < clients.size(); ++i)
+            clients[i]->connection.stop_external_io();
+        ::close(epfd);
+    }
+
+    void run_uring(clients_t& clients, int count)
+    {
+        uring_loop loop(256, 65536, 1024);
+        for (std::size_t i = 0; i < clients.size(); ++i)
+            loop.add(clients[i]->connection);
+
+        start(clients, count);
+
+        std::size_t finished = 0;
+        while (finished < clients.size())
+        {
+            loop.run_once();
+
+            finished = 0;
+            for (std::size_t i = 0; i < clients.size(); ++i)
+            {
+                process(*clients[i]);
+                if (clients[i]->done(count))
+                    ++finished;
+            }
+        }
+
+        for (std::size_t i = 0; i < clients.size(); ++i)
+            loop.remove(clients[i]->connection);
+    }
+
+    template<typename F>
+    void time(const char* name, unsigned short port, int connections, int count, F f)
+    {
+        clients_t clients = connect(port, connections);
+
+        std::pair<double, double> cpu = cpu_seconds();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        f(clients, count);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::pair<double, double> end = cpu_seconds();
+
+        // system time is where the I/O paths differ, user time is mostly
+        // parsing and dispatching, which they share
+        double total = static_cast<double>(connections) * count;
+        std::cout << name << "  " << total / seconds / 1e6 << " M events/s, per event "
+                  << (end.first - cpu.first) / total * 1e9 << " ns user, "
+                  << (end.second - cpu.second) / total * 1e9 << " ns system\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int connections = argc > 1 ? std::atoi(argv[1]) : 32;
+    int count = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    try
+    {
+        bench::simulator simulator;
+        unsigned short port = simulator.port();
+
+        std::cout << connections << " connections, " << count << " events each\n";
+        time("asio  ", port, connections, count, run_asio);
+        time("epoll ", port, connections, count, run_epoll);
+        if (uring_loop::available())
+            time("uring ", port, connections, count, run_uring);
+        else
+            std::cout << "uring  not available\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
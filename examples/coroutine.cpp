@@ -0,0 +1,65 @@
+#include "manager.h"
+#include <iostream>
+#include <string>
+
+#if defined(__cpp_impl_coroutine)
+astxx::manager::task login_and_ping(astxx::manager::connection& connection, const std::string& user, const std::string& secret, int& running)
+{
+    using namespace astxx::manager;
+
+    ++running;
+    try
+    {
+        message::response r = co_await connection.async_send(action::login(user, secret));
+        std::cout << "Login: " << r.main_header() << std::endl;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            r = co_await connection.async_send(action::ping(), std::chrono::seconds(5));
+            std::cout << "Ping: " << r.main_header() << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+    --running;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " [host] [user] [password]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#if defined(__cpp_impl_coroutine)
+    try
+    {
+        astxx::manager::connection connection(argv[1]);
+
+        int running = 0;
+        login_and_ping(connection, argv[2], argv[3], running);
+
+        while (running)
+        {
+            connection.wait_response();
+            connection.process_responses();
+        }
+
+        connection(astxx::manager::action::logoff());
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+#else
+    std::cerr << "This example requires C++20 coroutines" << std::endl;
+    return EXIT_FAILURE;
+#endif
+}
@@ -0,0 +1,107 @@
+#include "manager.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <sys/epoll.h>
+
+struct pbx
+{
+    std::string host;
+    boost::shared_ptr<astxx::manager::connection> connection;
+    bool writing;
+};
+
+void print_event(const std::string& host, astxx::manager::message::event e)
+{
+    std::cout << host << ": " << e.main_header() << "\n";
+}
+
+void print_response(const std::string& host, astxx::manager::message::response r)
+{
+    std::cout << host << ": " << r.main_header() << "\n";
+}
+
+// watch for writability only while the connection has something to write
+void rearm(int epfd, pbx& p)
+{
+    if (p.connection->want_write() == p.writing)
+        return;
+
+    p.writing = p.connection->want_write();
+    epoll_event ev = epoll_event();
+    ev.events = EPOLLIN | EPOLLET | (p.writing ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    ev.data.ptr = p.connection.get();
+    epoll_ctl(epfd, EPOLL_CTL_MOD, p.connection->native_handle(), &ev);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " [username] [secret] [host]..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        using namespace astxx;
+
+        int epfd = epoll_create1(0);
+        std::vector<pbx> pbxes;
+
+        for (int i = 3; i < argc; ++i)
+        {
+            pbx p;
+            p.host = argv[i];
+            p.connection.reset(new manager::connection(p.host));
+            p.writing = false;
+
+            manager::action::login(argv[1], argv[2])(*p.connection);
+            p.connection->register_event("", boost::bind(&print_event, p.host, _1));
+            p.connection->start_external_io();
+
+            epoll_event ev = epoll_event();
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.ptr = p.connection.get();
+            epoll_ctl(epfd, EPOLL_CTL_ADD, p.connection->native_handle(), &ev);
+
+            pbxes.push_back(p);
+        }
+
+        for (;;)
+        {
+            epoll_event events[64];
+            int n = epoll_wait(epfd, events, 64, 1000);
+
+            for (int i = 0; i < n; ++i)
+            {
+                manager::connection& connection = *static_cast<manager::connection*>(events[i].data.ptr);
+                if (events[i].events & EPOLLIN)
+                    connection.on_readable();
+                if (events[i].events & EPOLLOUT)
+                    connection.on_writable();
+            }
+
+            for (std::vector<pbx>::iterator p = pbxes.begin(); p != pbxes.end(); ++p)
+            {
+                // ping everyone whenever a second goes by quietly
+                if (n == 0)
+                    p->connection->send_action_async(manager::action::ping(), boost::bind(&print_response, p->host, _1));
+
+                p->connection->pump_messages();
+                p->connection->process_events();
+                p->connection->process_responses();
+                rearm(epfd, *p);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
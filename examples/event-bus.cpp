@@ -0,0 +1,107 @@
+#include "manager.h"
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <poll.h>
+
+// Share one AMI event stream with every process on the host.  The publisher
+// logs in, asks for events and writes them to a shared memory event bus,
+// readers attach to the bus and print the events they see, and how many
+// they missed if they fell behind.
+//
+// usage: event-bus publish [host] [port] [user] [password] [bus name]
+//        event-bus read [bus name]
+
+namespace
+{
+    volatile std::sig_atomic_t stopping = 0;
+
+    void stop(int)
+    {
+        stopping = 1;
+    }
+
+    int publish(const std::string& host, unsigned short port, const std::string& user, const std::string& password, const std::string& name)
+    {
+        using namespace astxx;
+        manager::event_bus_writer bus(name);
+        manager::connection connection(host, port);
+        manager::action::login(user, password)(connection);
+        connection.register_event("", boost::bind(&manager::event_bus_writer::publish, &bus, _1));
+        connection(manager::action::events(true));
+
+        connection.start_external_io();
+
+        // poll() rather than connection::wait_event() so a signal stops us
+        // and the bus is removed
+        std::cout << "publishing to " << bus.name() << " (" << bus.capacity() << " bytes)" << std::endl;
+        while (not stopping)
+        {
+            connection.process_events();
+
+            pollfd pfd = { connection.native_handle(), short(POLLIN | (connection.want_write() ? POLLOUT : 0)), 0 };
+            if (::poll(&pfd, 1, -1) <= 0)
+                continue;
+            if (pfd.revents & POLLOUT)
+                connection.on_writable();
+            if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+                connection.on_readable();
+        }
+        std::cout << bus.published() << " events published" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    int read(const std::string& name)
+    {
+        using namespace astxx;
+        manager::event_bus_reader bus(name);
+        manager::message::event e("");
+        unsigned long long lost = 0;
+
+        for (;;)
+        {
+            // whatever was published before the writer closed is still there
+            bool closed = bus.closed();
+            while (bus.read(e))
+                std::cout << e.main_header() << "\n";
+            if (bus.lost() != lost)
+            {
+                std::cout << "fell behind, " << bus.lost() - lost << " events lost\n";
+                lost = bus.lost();
+            }
+            std::cout.flush();
+            if (closed or stopping)
+                break;
+            bus.wait(std::chrono::seconds(1));
+        }
+        std::cout << bus.received() << " events read, " << bus.lost() << " lost" << std::endl;
+        return EXIT_SUCCESS;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::signal(SIGINT, stop);
+    std::signal(SIGTERM, stop);
+
+    try
+    {
+        if (argc >= 6 and std::strcmp(argv[1], "publish") == 0)
+            return publish(argv[2], boost::lexical_cast<unsigned short>(argv[3]), argv[4], argv[5], argc > 6 ? argv[6] : "/astxx-events");
+        if (argc >= 2 and std::strcmp(argv[1], "read") == 0)
+            return read(argc > 2 ? argv[2] : "/astxx-events");
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << "Usage: " << argv[0] << " publish [host] [port] [user] [password] [bus name]\n"
+              << "       " << argv[0] << " read [bus name]" << std::endl;
+    return EXIT_FAILURE;
+}
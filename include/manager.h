@@ -30,14 +30,36 @@
 #define ASTXX_MANAGER_H
 
 #include "manager/connection.h"
+#include "manager/admission.h"
+#include "manager/async.h"
+#include "manager/expected.h"
+#include "manager/prepared_action.h"
+#include "manager/event_filter.h"
+#include "manager/event_index.h"
+#include "manager/event_batcher.h"
+#include "manager/parser.h"
+#include "manager/projection.h"
+#include "manager/sampling.h"
+#include "manager/latency.h"
+#include "manager/scanner.h"
+#include "manager/uring_loop.h"
+#include "manager/shard_pool.h"
+#include "manager/event_bus.h"
+#include "manager/event_codec.h"
+#include "manager/json_writer.h"
+#include "manager/journal.h"
+#include "manager/columnar.h"
 #include "manager/error.h"
 #include "manager/message.h"
+#include "manager/value.h"
 
 #include "manager/action/queue_status.h"
 #include "manager/action/queue_pause.h"
 #include "manager/action/absolute_timeout.h"
 #include "manager/action/command.h"
+#include "manager/action/events.h"
 #include "manager/action/extension_state.h"
+#include "manager/action/filter.h"
 #include "manager/action/getvar.h"
 #include "manager/action/hangup.h"
 #include "manager/action/list_commands.h"
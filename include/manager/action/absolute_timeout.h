@@ -31,13 +31,11 @@
 #include "manager/message.h"
 #include <string>
 #include <ctime>
-#include <boost/lexical_cast.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace astxx {
    namespace manager {
       namespace action {
-         using boost::lexical_cast;
          using boost::posix_time::time_duration;
          using boost::posix_time::seconds;
 
@@ -70,7 +68,7 @@ namespace astxx {
                      action["Timeout"] = "0";
                   }
                   else {
-                     action["Timeout"] = lexical_cast<std::string>(timeout.total_seconds());
+                     action.set("Timeout", timeout.total_seconds());
                   }
 
                   return action;
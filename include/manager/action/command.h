@@ -37,13 +37,56 @@ namespace astxx {
          /** Execute an Asterisk CLI command.
           * This action is some what of a hack.  If possible use manager 
           * actions instead of CLI commands.
+          *
+          * By default the command's output is collected and returned by 
+          * command::result().  For commands with large output either limit 
+          * how much is kept with command::output_limit() or stream it with 
+          * command::output():
+          *
+          * @code
+          * action::command c("core show channels concise");
+          * c.output(boost::bind(&handle_channel_line, _1));
+          * c(connection); // handle_channel_line() is called for each line
+          * @endcode
           */
          class command : public basic_action {
             public:
                /** Execute an Asterisk CLI command.
                 * @param command the command to execute
                 */
-               command(const std::string& command) : m_command(command) {
+               command(const std::string& command) : m_command(command), m_output_limit(std::string::npos) {
+               }
+
+               /** Stream the output of this command.
+                * @param handler called with each line of output (without the 
+                * trailing newline) as it is read
+                *
+                * The handler is called while the connection reads from the 
+                * network, before the response is processed.  When a handler 
+                * is set the output is not collected.
+                *
+                * @return a reference to this action::command object
+                */
+               action::command& output(output_handler_t handler) {
+                  m_output_handler = handler;
+                  return *this;
+               }
+
+               /** Limit the amount of output collected.
+                * @param bytes the most output to keep, the rest is discarded
+                * @return a reference to this action::command object
+                */
+               action::command& output_limit(std::string::size_type bytes) {
+                  m_output_limit = bytes;
+                  return *this;
+               }
+
+               output_handler_t output_handler() const {
+                  return m_output_handler;
+               }
+
+               std::string::size_type output_limit() const {
+                  return m_output_limit;
                }
          
                message::action action() const {
@@ -72,6 +115,8 @@ namespace astxx {
             private:
                std::string m_command;
                std::string m_result;
+               output_handler_t m_output_handler;
+               std::string::size_type m_output_limit;
          };
       }
    }
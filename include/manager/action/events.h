@@ -27,27 +27,37 @@
 #ifndef ASTXX_MANAGER_ACTION_EVENTS_H
 #define ASTXX_MANAGER_ACTION_EVENTS_H
 
-#include <astxx/manager/basic_action.h>
-#include <astxx/manager/message.h>
+#include "manager/basic_action.h"
+#include "manager/message.h"
 #include <string>
-#include <boost/lexical_cast.hpp>
 
 namespace astxx {
    namespace manager {
       namespace action {
-         using boost::lexical_cast;
 
          /// Set the event mask.
          class events : public basic_action {
             public:
-               static const unsigned short system;  ///< System events such as module load/unload
-               static const unsigned short call;    ///< Call event, such as state change, etc
-               static const unsigned short log;     ///< Log events
-               static const unsigned short verbose; ///< Verbose messages
-               static const unsigned short command; ///< Ability to read/set commands
-               static const unsigned short agent;   ///< Ability to read/set agent info
-               static const unsigned short user;    ///< Ability to read/set user info
-               static const unsigned short config;  ///< Ability to modify configurations
+               // these values are taken from manager.h in the asterisk source
+               static const unsigned int system    = 1 << 0;  ///< System events such as module load/unload
+               static const unsigned int call      = 1 << 1;  ///< Call event, such as state change, etc
+               static const unsigned int log       = 1 << 2;  ///< Log events
+               static const unsigned int verbose   = 1 << 3;  ///< Verbose messages
+               static const unsigned int command   = 1 << 4;  ///< Ability to read/set commands
+               static const unsigned int agent     = 1 << 5;  ///< Ability to read/set agent info
+               static const unsigned int user      = 1 << 6;  ///< Ability to read/set user info
+               static const unsigned int config    = 1 << 7;  ///< Ability to modify configurations
+               static const unsigned int dtmf      = 1 << 8;  ///< DTMF events
+               static const unsigned int reporting = 1 << 9;  ///< Reporting events such as RTCP
+               static const unsigned int cdr       = 1 << 10; ///< CDR events
+               static const unsigned int dialplan  = 1 << 11; ///< Dialplan events such as VarSet and Newexten
+               static const unsigned int originate = 1 << 12; ///< Originate events
+               static const unsigned int agi       = 1 << 13; ///< AGI events
+               static const unsigned int cc        = 1 << 14; ///< Call completion events
+               static const unsigned int aoc       = 1 << 15; ///< Advice of charge events
+               static const unsigned int test      = 1 << 16; ///< Test events
+               static const unsigned int security  = 1 << 17; ///< Security events
+               static const unsigned int message   = 1 << 18; ///< Out of call message events
             public:
                /** Set the mask using an integer mask.
                 * @param mask the integer mask
@@ -56,7 +66,7 @@ namespace astxx {
                 * events(events::system | events::call | events::log);
                 * @endcode
                 */
-               events(unsigned short mask) : int_mask(mask), bool_mask(false), string_mask("") {
+               events(unsigned int mask) : int_mask(mask), bool_mask(false), string_mask("") {
                }
 
                /** Set the mask using a text mask.
@@ -82,7 +92,7 @@ namespace astxx {
                message::action action() const {
                   message::action action("Events");
                   if (int_mask) {
-                     action["EventMask"] = lexical_cast<std::string>(int_mask);
+                     action.set("EventMask", int_mask);
                   }
                   else if (not string_mask.empty()) {
                      action["EventMask"] = string_mask;
@@ -98,21 +108,11 @@ namespace astxx {
                }
 
             private:
-               unsigned short int_mask;
+               unsigned int int_mask;
                bool bool_mask;
                std::string string_mask;
          };
 
-         // these values are taken from manager.h in the asterisk source
-         static const unsigned short events::system  = 1 << 0;
-         static const unsigned short events::call    = 1 << 1;
-         static const unsigned short events::log     = 1 << 2;
-         static const unsigned short events::verbose = 1 << 3;
-         static const unsigned short events::command = 1 << 4;
-         static const unsigned short events::agent   = 1 << 5;
-         static const unsigned short events::user    = 1 << 6;
-         static const unsigned short events::config  = 1 << 7;
-
       }
    }
 }
@@ -0,0 +1,66 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Include this file to use the filter action.  It will be included 
+ * automatically by including astxx/manager.h.
+ */
+
+#ifndef ASTXX_MANAGER_ACTION_FILTER_H
+#define ASTXX_MANAGER_ACTION_FILTER_H
+
+#include "manager/basic_action.h"
+#include "manager/message.h"
+#include <string>
+
+namespace astxx {
+   namespace manager {
+      namespace action {
+         /** Add an event filter to this manager session.
+          * The filter is a regular expression matched against the text of 
+          * each event.  Once a filter has been added only events matching a 
+          * filter are sent, filters starting with '!' exclude matching events 
+          * instead.  Filters can not be removed, they last until the session 
+          * ends.
+          */
+         class filter : public basic_action {
+            public:
+               /** Add an event filter.
+                * @param filter the regular expression
+                */
+               filter(const std::string& filter) : m_filter(filter) {
+               }
+
+               message::action action() const {
+                  message::action action("Filter");
+                  action["Operation"] = "Add";
+                  action["Filter"] = m_filter;
+                  return action;
+               }
+
+            private:
+               std::string m_filter;
+         };
+      }
+   }
+}
+
+#endif
@@ -158,7 +158,7 @@ namespace astxx {
                   }
 
                   if (not m_timeout.is_special() and m_timeout != time_duration()) {
-                     action["Timeout"] = lexical_cast<std::string>(m_timeout.total_milliseconds());
+                     action.set("Timeout", m_timeout.total_milliseconds());
                   }
                   else if (m_timeout == pos_infin) {
                      action["Timeout"] = "-1"; // Asterisk uses -1 for infinite
@@ -0,0 +1,137 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::admission_control class which
+ * limits the number and rate of actions a connection has outstanding.
+ */
+
+#ifndef ASTXX_MANAGER_ADMISSION_H
+#define ASTXX_MANAGER_ADMISSION_H
+
+#include <map>
+#include <string>
+#include <chrono>
+
+namespace astxx {
+   namespace manager {
+      /** Adaptive admission control for outgoing actions.
+       *
+       * Each manager::connection owns one of these.  Before an action is
+       * written to the socket the connection asks admission_control::admit()
+       * whether it may be sent; if not, the action is held in the connection's
+       * backlog until a response frees a slot.
+       *
+       * The number of actions allowed in flight (the window) is adjusted from
+       * observed response latency using additive increase, multiplicative
+       * decrease.  While responses arrive faster than the latency target the
+       * window grows by roughly one action per round trip.  When a response
+       * is slower than the target the window is multiplied by the backoff
+       * factor, at most once per round trip.  This keeps Asterisk's manager
+       * thread busy without letting its queue grow unbounded.
+       *
+       * Optionally a token bucket rate limit can be placed on individual
+       * action types.
+       *
+       * @code
+       * connection.admission()
+       *    .window(4, 1, 64)
+       *    .latency_target(std::chrono::milliseconds(200))
+       *    .rate_limit("Originate", 20, 5);  // 20 per second, bursts of 5
+       * @endcode
+       */
+      class admission_control {
+         public:
+            typedef std::chrono::steady_clock clock_type;
+            typedef clock_type::time_point time_point;
+            typedef clock_type::duration duration;
+
+            admission_control();
+
+            admission_control& enabled(bool state);
+            admission_control& window(unsigned int initial, unsigned int min, unsigned int max);
+            admission_control& latency_target(duration target);
+            admission_control& backoff(double factor);
+            admission_control& rate_limit(const std::string& action, double rate, double burst = 1);
+            admission_control& clear_rate_limit(const std::string& action);
+
+            /** Check if admission control is enabled.
+             * @return whether admission control is enabled
+             */
+            bool enabled() const { return m_enabled; }
+
+            /** Get the current window.
+             * @return the number of actions currently allowed in flight
+             */
+            unsigned int window() const { return static_cast<unsigned int>(m_window); }
+
+            /** Get the number of actions sent but not yet answered.
+             * @return the number of actions in flight
+             */
+            unsigned int in_flight() const { return m_in_flight; }
+
+            /** Get the smoothed response latency.
+             * @return the smoothed response latency
+             */
+            duration latency() const { return m_latency; }
+
+            bool window_full() const;
+            bool admit(const std::string& action, time_point now);
+            time_point next_admission(const std::string& action, time_point now) const;
+
+            void sent(const std::string& action, time_point now);
+            void answered(duration latency, time_point now);
+            void released();
+            void reset();
+
+         private:
+            /// A token bucket for one action type.
+            struct bucket {
+               double rate;
+               double burst;
+               double tokens;
+               time_point updated;
+            };
+            typedef std::map<std::string, bucket> buckets_t;
+
+            void refill(bucket& b, time_point now);
+
+            bool m_enabled;
+
+            double m_window;
+            double m_initial_window;
+            double m_min_window;
+            double m_max_window;
+            double m_backoff;
+            duration m_latency_target;
+
+            unsigned int m_in_flight;
+            duration m_latency;
+            time_point m_last_decrease;
+
+            buckets_t buckets;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,213 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the future and coroutine front-ends for
+ * astxx::manager::connection.  The coroutine support is only available when
+ * compiling with C++20 coroutines enabled.
+ */
+
+#ifndef ASTXX_MANAGER_ASYNC_H
+#define ASTXX_MANAGER_ASYNC_H
+
+#include "manager/message.h"
+#include "manager/error.h"
+
+#include <exception>
+#include <stdexcept>
+#include <boost/asio/error.hpp>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/system_error.hpp>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+namespace astxx {
+   namespace manager {
+      /** Throw the exception matching an action error.
+       * @param error the error passed to a connection error handler
+       * @throw manager::timeout for boost::asio::error::timed_out
+       * @throw manager::cancelled for boost::asio::error::operation_aborted
+       * @throw boost::system::system_error for anything else
+       */
+      inline void throw_action_error(const boost::system::error_code& error) {
+         if (error == boost::asio::error::timed_out)
+            throw manager::timeout();
+         if (error == boost::asio::error::operation_aborted)
+            throw manager::cancelled();
+         throw boost::system::system_error(error);
+      }
+
+      /** Tag type selecting the std::future returning overloads of
+       * connection::send_action_async().
+       */
+      struct use_future_t { };
+
+      /** Pass this to connection::send_action_async() to get a std::future.
+       * @code
+       * std::future<message::response> f = connection.send_action_async(action::ping(), manager::use_future);
+       * @endcode
+       */
+      extern const use_future_t use_future;
+
+      /** The eventual response to an action.
+       *
+       * This is returned by connection::async_send().  It can be polled with
+       * async_response::ready() and async_response::get(), or, when C++20
+       * coroutines are available, awaited:
+       *
+       * @code
+       * manager::task call_sequence(manager::connection& c) {
+       *    message::response r = co_await c.async_send(action::getvar("CHANNEL(state)", channel));
+       *    co_await c.async_send(action::redirect(channel, "default", "100", "1"));
+       * }
+       * @endcode
+       *
+       * A waiting coroutine is resumed from connection::process_responses(),
+       * on the thread driving the connection, so any number of action
+       * sequences can be in progress without a thread blocked on each.
+       */
+      class async_response {
+         public:
+            /// The shared state filled in by the connection.
+            struct state {
+               state() : done(false) { }
+
+               /** The response handler.
+                * @param r the response
+                */
+               void complete(message::response r) {
+                  response = r;
+                  done = true;
+                  resume();
+               }
+
+               /** The error handler.
+                * @param e the reason no response will arrive
+                */
+               void fail(boost::system::error_code e) {
+                  error = e;
+                  done = true;
+                  resume();
+               }
+
+               /// Run the continuation, if one is waiting.
+               void resume() {
+                  if (continuation) {
+                     boost::function<void ()> c;
+                     c.swap(continuation);
+                     c();
+                  }
+               }
+
+               bool done;
+               boost::optional<message::response> response;
+               boost::system::error_code error;
+               boost::function<void ()> continuation;
+            };
+
+            /** Construct from shared state.
+             * @param s the state the connection will fill in
+             */
+            explicit async_response(boost::shared_ptr<state> s) : m_state(s) { }
+
+            /** Check if the response (or an error) has arrived.
+             * @return true if async_response::get() will not throw
+             * std::logic_error
+             */
+            bool ready() const {
+               return m_state->done;
+            }
+
+            /** Get the response.
+             * @return the response
+             * @throw manager::timeout if the action timed out
+             * @throw manager::cancelled if the action was cancelled
+             * @throw std::logic_error if the response has not arrived yet
+             */
+            message::response get() const {
+               if (not m_state->done)
+                  throw std::logic_error("response not ready");
+               if (m_state->error)
+                  throw_action_error(m_state->error);
+               return *m_state->response;
+            }
+
+#if defined(__cpp_impl_coroutine)
+            bool await_ready() const {
+               return ready();
+            }
+
+            template<typename promise_type>
+            void await_suspend(std::coroutine_handle<promise_type> h) {
+               m_state->continuation = [h]() { h.resume(); };
+            }
+
+            message::response await_resume() const {
+               return get();
+            }
+#endif
+
+         private:
+            boost::shared_ptr<state> m_state;
+      };
+
+#if defined(__cpp_impl_coroutine)
+      /** A fire and forget coroutine.
+       *
+       * A function returning manager::task starts running immediately and
+       * runs until its first co_await.  It is resumed from
+       * connection::process_responses() as responses arrive and cleans up
+       * after itself when it returns.
+       *
+       * A suspended task is only ever resumed by the response it awaits, and
+       * its frame is only freed when it returns.  If the connection is
+       * destroyed first, that response fails and the task is resumed from
+       * the destructor with manager::cancelled; it must not use the
+       * connection after that.  A task whose action was cancelled by
+       * connection::disconnect() is resumed by the next
+       * connection::process_responses(), or by the destructor if there is
+       * none.
+       *
+       * @warning Like an exception escaping a std::thread, an exception
+       * escaping a task calls std::terminate().  Catch manager::timeout and
+       * friends inside the coroutine.
+       */
+      class task {
+         public:
+            struct promise_type {
+               task get_return_object() { return task(); }
+               std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+               std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+               void return_void() { }
+               void unhandled_exception() { std::terminate(); }
+            };
+      };
+#endif
+   }
+}
+
+#endif
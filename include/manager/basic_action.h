@@ -32,6 +32,11 @@
 #include "manager/message.h"
 #include "manager/error.h"
 #include "manager/action/error.h"
+#include "manager/expected.h"
+
+#include <string>
+#include <boost/function.hpp>
+#include <boost/system/error_code.hpp>
 
 namespace astxx {
    namespace manager {
@@ -46,6 +51,9 @@ namespace astxx {
        */
       class basic_action {
          public:
+            /// A handler for lines of command output.
+            typedef boost::function<void (const std::string&)> output_handler_t;
+
             basic_action() { }
             virtual ~basic_action() { }
 
@@ -69,8 +77,53 @@ namespace astxx {
                m_action_id = id;
             }
 
+            /** Get the handler for output sent with the response.
+             * Output is what follows a 'Response: Follows' message (or the 
+             * 'Output' headers of newer Asterisk versions).  If a handler is 
+             * returned, each line of output is passed to it as it is read 
+             * instead of being collected in message::response::data.
+             * @return the output handler, empty by default
+             */
+            virtual output_handler_t output_handler() const {
+               return output_handler_t();
+            }
+
+            /** Get the most output to collect in message::response::data.
+             * @return the limit in bytes, unlimited by default
+             */
+            virtual std::string::size_type output_limit() const {
+               return std::string::npos;
+            }
+
+            /** Write this action in its wire format without building a 
+             * message::action.
+             * @param action_id the ActionID to send the action with
+             * @param name set to the name of the action (the value of the 
+             * 'Action' header)
+             * @param data set to the formatted action, including the blank 
+             * line that ends it
+             *
+             * manager::connection tries this before falling back to 
+             * basic_action::action() and message::basic_message::format().  
+             * Actions that can serialize themselves cheaply, like 
+             * manager::prepared_action::instance, override it.
+             *
+             * @return true if the action was written, false (the default) if 
+             * basic_action::action() should be used instead
+             */
+            virtual bool serialize(const std::string& /* action_id */, std::string& /* name */, std::string& /* data */) const {
+               return false;
+            }
+
+            virtual boost::system::error_code check_response(const message::response& response) const;
             virtual message::response handle_response(message::response response);
             message::response operator()(connection& c);
+            expected<message::response> operator()(connection& c, use_expected_t);
+
+            static void register_error(const std::string& message, errc::errc_t error);
+
+         protected:
+            void throw_error(const boost::system::error_code& error, const message::response& response) const;
 
          private:
             std::string m_action_id;
@@ -0,0 +1,235 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::columnar_exporter class which
+ * writes selected event headers to column files, and the
+ * astxx::manager::columnar_reader class which reads them.
+ */
+
+#ifndef ASTXX_MANAGER_COLUMNAR_H
+#define ASTXX_MANAGER_COLUMNAR_H
+
+#include "manager/event_batcher.h"
+#include "manager/message.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace astxx {
+   namespace manager {
+      class connection;
+
+      /// The types a column can have.
+      enum column_type {
+         /// strings, dictionary encoded
+         string_column = 0,
+         /// 64 bit integers
+         integer_column = 1,
+         /// doubles
+         real_column = 2,
+         /// microseconds since the epoch, from "1700000000.123456" or
+         /// "2024-01-31 12:00:00" (taken as UTC)
+         time_column = 3
+      };
+
+      /** Exports events to column files for analytics.
+       *
+       * An exporter is a table: a set of columns, each a header of the
+       * event and a type.  Events are added a row at a time into a column
+       * per header, the values parsed to their type once, and every
+       * block_rows rows the block is written to a memory mapped file:
+       *
+       * @code
+       * manager::columnar_exporter cdr("/var/lib/astxx/cdr", "cdr");
+       * cdr.column("Uniqueid")
+       *    .column("Source")
+       *    .column("Destination")
+       *    .column("Disposition")
+       *    .column("StartTime", manager::time_column)
+       *    .column("Duration", manager::integer_column)
+       *    .column("BillableSeconds", manager::integer_column);
+       * cdr.attach(connection, "Cdr");
+       * @endcode
+       *
+       * attach() registers the exporter as a batch handler that only reads
+       * its columns (see connection::register_batch()), so the parser
+       * skips the other headers of the event.  A table can take several
+       * events; a header an event lacks, or a value that is not of the
+       * column's type, is null.
+       *
+       * Files are named after the table and the time they were started
+       * and hold a schema followed by blocks.  Everything is little endian
+       * and native; offsets are in bytes.
+       *
+       * The file starts with: "ASTXXCOL", u32 version (1), u32 column
+       * count, u64 block count, u64 bytes used, u64 offset of the first
+       * block, u32 rows per block, then for each column u32 type, u32
+       * name size and the name.  The block count and bytes used are
+       * updated as blocks are written.
+       *
+       * Each block starts with: u32 magic "ACBK", u32 rows, u64 block
+       * size, then for each column u64 values offset, u64 validity offset,
+       * u64 dictionary offset, u32 null count, u32 dictionary size, with
+       * offsets relative to the block.  Values are rows of i64, double or
+       * u32 dictionary codes, 64 byte aligned.  The validity bitmap has a
+       * bit per row, least significant first, set for non-null values.
+       * A dictionary is u32 offsets (its size plus one of them) into the
+       * string bytes that follow.  Every block has block_rows rows except
+       * the last one written by flush() or the destructor.
+       */
+      class columnar_exporter {
+         public:
+            columnar_exporter(const std::string& directory, const std::string& table, std::size_t block_rows = 65536, std::size_t file_size = 64 << 20);
+            ~columnar_exporter();
+
+            columnar_exporter& column(const std::string& header, column_type type = string_column);
+
+            event_batcher::handle attach(connection& c, const std::string& event, std::size_t max_size = 0, event_batcher::duration max_latency = event_batcher::duration::zero());
+
+            void add(event_batcher::batch_t events);
+            void add(const message::event& e);
+            void flush();
+
+            /** Get the number of rows added.
+             * @return the number of rows added
+             */
+            unsigned long long rows() const { return m_rows; }
+
+            /** Get the number of rows waiting for their block to be written.
+             * @return the number of rows in the current block
+             */
+            std::size_t pending() const { return m_pending; }
+
+            /** Get the headers the columns are made of.
+             * @return the headers
+             */
+            const std::vector<std::string>& headers() const { return m_headers; }
+
+         private:
+            columnar_exporter(const columnar_exporter&);
+            columnar_exporter& operator=(const columnar_exporter&);
+
+            /// One column of the current block.
+            struct column_data {
+               std::string header;
+               column_type type;
+               std::vector<boost::int64_t> integers;
+               std::vector<double> reals;
+               std::vector<boost::uint32_t> codes;
+               std::vector<unsigned char> validity;
+               std::size_t nulls;
+               boost::unordered_map<std::string, boost::uint32_t> dictionary;
+               std::vector<const std::string*> words;
+            };
+
+            void write_block();
+            void open_file(std::size_t need);
+            void close_file();
+
+            std::string m_directory;
+            std::string m_table;
+            std::size_t m_block_rows;
+            std::size_t m_file_size;
+
+            std::vector<column_data> m_columns;
+            std::vector<std::string> m_headers;
+            std::size_t m_pending;
+            unsigned long long m_rows;
+
+            int m_fd;
+            char* m_map;
+            std::size_t m_mapped;
+            std::size_t m_used;
+      };
+
+      /** Reads a file written by a columnar_exporter.
+       *
+       * The file is memory mapped and columns are handed out as arrays:
+       *
+       * @code
+       * manager::columnar_reader cdr(path);
+       * std::size_t duration = cdr.column("Duration");
+       * long long total = 0;
+       * for (std::size_t b = 0; b < cdr.blocks(); ++b) {
+       *    const boost::int64_t* d = cdr.integers(b, duration);
+       *    for (std::size_t r = 0; r < cdr.rows(b); ++r)
+       *       total += d[r];  // nulls are 0
+       * }
+       * @endcode
+       */
+      class columnar_reader {
+         public:
+            /// A column in the file.
+            struct column_info {
+               std::string name;
+               column_type type;
+            };
+
+            explicit columnar_reader(const std::string& path);
+            ~columnar_reader();
+
+            /** Get the columns.
+             * @return the columns, in file order
+             */
+            const std::vector<column_info>& columns() const { return m_columns; }
+
+            std::size_t column(const std::string& name) const;
+
+            /** Get the number of blocks.
+             * @return the number of blocks
+             */
+            std::size_t blocks() const { return m_blocks.size(); }
+
+            std::size_t rows(std::size_t block) const;
+            std::size_t nulls(std::size_t block, std::size_t column) const;
+            bool valid(std::size_t block, std::size_t column, std::size_t row) const;
+
+            const boost::int64_t* integers(std::size_t block, std::size_t column) const;
+            const double* reals(std::size_t block, std::size_t column) const;
+            const boost::uint32_t* codes(std::size_t block, std::size_t column) const;
+            std::size_t dictionary_size(std::size_t block, std::size_t column) const;
+            std::string word(std::size_t block, std::size_t column, boost::uint32_t code) const;
+            std::string string(std::size_t block, std::size_t column, std::size_t row) const;
+
+         private:
+            columnar_reader(const columnar_reader&);
+            columnar_reader& operator=(const columnar_reader&);
+
+            struct column_entry;
+            const column_entry& entry(std::size_t block, std::size_t column) const;
+            const char* values(std::size_t block, std::size_t column, column_type type) const;
+
+            const char* m_map;
+            std::size_t m_mapped;
+            std::vector<column_info> m_columns;
+            std::vector<const char*> m_blocks;
+      };
+   }
+}
+
+#endif
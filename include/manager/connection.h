@@ -31,14 +31,35 @@
 
 #include "manager/message.h"
 #include "manager/basic_action.h"
+#include "manager/admission.h"
+#include "manager/async.h"
+#include "manager/expected.h"
+#include "manager/event_filter.h"
+#include "manager/event_index.h"
+#include "manager/event_batcher.h"
+#include "manager/parser.h"
+#include "manager/latency.h"
 
 #include <queue>
+#include <deque>
+#include <vector>
+#include <list>
+#include <future>
 #include <map>
+#include <set>
 #include <string>
+#include <atomic>
+#include <thread>
+#include <exception>
 #include <boost/function.hpp>
 #include <boost/asio.hpp>
 #include <boost/signals2.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/optional.hpp>
+#include <boost/array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 
 namespace astxx {
    namespace manager {
@@ -84,6 +105,15 @@ namespace astxx {
        * boost::signals::connection object returned by 
        * connection::register_event().
        *
+       * Handlers interested in only part of an event stream, one queue or 
+       * one channel, can subscribe with a header predicate instead (see 
+       * connection::subscribe()).  Those subscriptions are indexed, so they 
+       * stay cheap to dispatch, add and remove in large numbers.  Handlers 
+       * that would rather take events many at a time can be registered with 
+       * connection::register_batch().  Both can declare the headers they 
+       * read, and when every handler of an event has, the parser skips the 
+       * rest of its headers.
+       *
        * Your main application loop could look something like this:
        * @code
        * connection.wait_event();
@@ -93,28 +123,164 @@ namespace astxx {
        * connection.process_responses(); // if you are sending actions asychronously.
        * @endcode
        *
+       * Actions sent asynchronously pass through an admission_control object 
+       * (see connection::admission()) which limits how many actions may be 
+       * waiting for a response at once.  Actions that are not admitted wait 
+       * in a backlog and are sent as responses arrive, from 
+       * connection::wait_response(), connection::process_responses() or 
+       * connection::pump_messages().
+       *
+       * Every action is tagged with an ActionID (one is generated if the 
+       * action does not carry one) and responses are matched to their 
+       * handlers by it.  An action may be given a timeout, after which its 
+       * error handler is called with boost::asio::error::timed_out and a late 
+       * response is discarded.  Pending actions can be cancelled with 
+       * connection::cancel(), in which case the error handler receives 
+       * boost::asio::error::operation_aborted.  The blocking 
+       * connection::send_action() throws manager::timeout or 
+       * manager::cancelled instead.
+       *
+       * Besides callbacks, responses can be collected through a std::future 
+       * (pass manager::use_future to connection::send_action_async()) or 
+       * awaited from a C++20 coroutine (see connection::async_send()).  
+       * Either way they are delivered by connection::process_responses().
+       *
+       * @code
+       * connection.timeout(std::chrono::seconds(5)); // default for all actions
+       * message::response r = connection.send_action(action::ping(), std::chrono::milliseconds(500));
+       * @endcode
+       *
+       * Connections may share a boost::asio::io_service.  Such connections 
+       * are created unconnected and can be brought up together with 
+       * manager::connect_all(), so starting many connections takes as long 
+       * as the slowest one.
+       *
+       * Reading and parsing can be moved to a dedicated thread with 
+       * connection::start_io_thread().  The I/O thread hands finished 
+       * messages to the application thread through a lock-free single 
+       * producer, single consumer ring, so parsing overlaps with handler work 
+       * and the kernel receive buffer is drained while handlers run.  
+       * Handlers are still only run from the functions above.
+       *
+       * A connection can also be driven by an event loop of the 
+       * application's own (epoll, libuv and the like) after 
+       * connection::start_external_io().  The loop watches 
+       * connection::native_handle() and calls connection::on_readable() and 
+       * connection::on_writable() when the socket is ready, so one thread 
+       * can service any number of connections.
+       *
+       * Where the wake up latency of a blocking wait matters, a connection
+       * can spin on the socket for a while before sleeping (see
+       * connection::spin()).  Either way the time from reading each event
+       * to running its handlers can be recorded and read back as
+       * percentiles (see connection::event_latency()).
+       *
        * @warning This library is not thread safe.  Only one thread of 
        * execution should call functions in the library at a time.
        */
-      class connection {
-         private:
-            std::pair<std::string, std::string> parse_header(const std::string& header);
-            std::string read_line();
-            void read_message();
-            message::response read_response();
-            message::event read_event();
-
+      class connection : private parser::handler {
          public:
             typedef boost::function<void (message::response)> response_handler_t;
+            typedef boost::function<void (boost::system::error_code)> error_handler_t;
+            typedef boost::function<void (boost::system::error_code)> connect_handler_t;
             typedef boost::function<void (message::event)> event_handler_t;
+            typedef admission_control::duration duration;
             typedef std::queue<message::event> events_t;
-            typedef std::queue<message::response> responses_t;
-            typedef std::queue<response_handler_t> response_handlers_t;
+            typedef std::queue<boost::function<void ()> > completions_t;
             typedef std::map<std::string, boost::shared_ptr<boost::signals2::signal<void (message::event)> > > event_handlers_t;
 
+         private:
+            /// A message handed from the I/O thread to the application thread.
+            struct parsed_message {
+               enum kind_t { greeting_line, event_message, response_message, output_line, output_header, failure };
+               kind_t kind;
+               std::string action_id;
+               std::string line;
+               boost::optional<message::event> event;
+               boost::optional<message::response> response;
+               std::exception_ptr error;
+               latency_histogram::clock_type::time_point read;
+            };
+            typedef boost::lockfree::spsc_queue<parsed_message*> ring_t;
+            class ring_writer;
+
+            void on_greeting(const std::string& line);
+            void on_event(message::event& e);
+            void on_response(message::response& r);
+            void on_output(const std::string& action_id, const std::string& line, bool header);
+            void handle_resolve(unsigned int generation, const boost::system::error_code& error, boost::asio::ip::tcp::resolver::results_type results);
+            void start_attempt();
+            void handle_attempt(unsigned int generation, std::size_t attempt, const boost::system::error_code& error);
+            void handle_attempt_timeout(unsigned int generation, std::size_t attempt, const boost::system::error_code& error);
+            void handle_connect_timer(unsigned int generation, const boost::system::error_code& error);
+            void finish_connect(const boost::system::error_code& error);
+            void start_read();
+            void handle_read(unsigned int generation, const boost::system::error_code& error, std::size_t bytes);
+            void run_one();
+            void poll();
+            void complete_response(message::response response);
+            void flush_backlog();
+            void arm_backlog_timer();
+            void handle_backlog_timer(const boost::system::error_code& error);
+            void expire(unsigned long long seq, const boost::system::error_code& error);
+            void fail(unsigned long long seq, const boost::system::error_code& error);
+            void handle_events_response(message::response response);
+            void handle_filter_response(const std::string& filter, message::response response);
+            void io_thread_main(int fd, int cpu, duration spin);
+            void notify_ring();
+            void drain_ring();
+            void dispatch(parsed_message& m);
+            void join_io_thread();
+            void check_io_error();
+            void cancel_read();
+            bool spin_once();
+            boost::system::error_code apply_busy_poll();
+            void send_data(const std::string& data);
+            void track_event_name(const std::string& e);
+            void update_projection();
+
+            /// A registered event handler and what it subscribed to.
+            struct tracked_subscription {
+               boost::signals2::connection connection;
+               event_filter::subscription subscription;
+            };
+            typedef std::list<tracked_subscription> subscriptions_t;
+
+            /// An action that has not been answered yet.
+            struct pending_action {
+               std::string id;
+               std::string name;
+               std::string data;
+               response_handler_t handler;
+               error_handler_t error_handler;
+               basic_action::output_handler_t output_handler;
+               std::string::size_type output_limit;
+               bool in_flight;
+               admission_control::time_point sent;
+               boost::shared_ptr<boost::asio::steady_timer> timer;
+            };
+            /// pending actions keyed by a sequence number (send order)
+            typedef std::map<unsigned long long, pending_action> pending_t;
+            /// sequence numbers of pending actions keyed by ActionID
+            typedef std::multimap<std::string, unsigned long long> action_ids_t;
+            typedef std::deque<unsigned long long> backlog_t;
+
+            /// One of the parallel attempts to connect to an endpoint.
+            struct connect_attempt {
+               connect_attempt(boost::asio::io_service& io_service) : socket(io_service), timer(io_service), done(false) { }
+               boost::asio::ip::tcp::socket socket;
+               boost::asio::steady_timer timer;
+               bool done;
+            };
+
+         public:
             connection(const std::string& host, unsigned short port = 5038);
+            connection(boost::asio::io_service& io_service, const std::string& host, unsigned short port = 5038);
+            ~connection();
 
             void connect(const std::string& host = "", unsigned short port = 0);
+            void async_connect(connect_handler_t handler);
+            void async_connect(const std::string& host, unsigned short port, connect_handler_t handler);
             void disconnect();
             bool is_connected() const;
 
@@ -126,11 +292,59 @@ namespace astxx {
             std::string version() const { return m_version; }
 
             message::response send_action(const manager::basic_action& command);
-            void send_action_async(const manager::basic_action& command, response_handler_t handler);
+            message::response send_action(const manager::basic_action& command, duration timeout);
+            expected<message::response> send_action(const manager::basic_action& command, use_expected_t);
+            expected<message::response> send_action(const manager::basic_action& command, use_expected_t, duration timeout);
+            std::string send_action_async(const manager::basic_action& command, response_handler_t handler);
+            std::string send_action_async(const manager::basic_action& command, response_handler_t handler, error_handler_t error_handler);
+            std::string send_action_async(const manager::basic_action& command, response_handler_t handler, error_handler_t error_handler, duration timeout);
+            std::future<message::response> send_action_async(const manager::basic_action& command, use_future_t);
+            std::future<message::response> send_action_async(const manager::basic_action& command, use_future_t, duration timeout);
+
+            async_response async_send(const manager::basic_action& command);
+            async_response async_send(const manager::basic_action& command, duration timeout);
 
             message::response operator()(const manager::basic_action& command);
             void operator()(const manager::basic_action& command, response_handler_t handler);
 
+            bool cancel(const std::string& action_id);
+            void cancel_all();
+
+            /** Set the connect timeout.
+             * @param timeout how long each connection attempt (and the wait 
+             * for the greeting) may take, zero waits as long as the kernel 
+             * does
+             */
+            void connect_timeout(duration timeout) { m_connect_timeout = timeout; }
+
+            /** Get the connect timeout.
+             * @return the connect timeout
+             */
+            duration connect_timeout() const { return m_connect_timeout; }
+
+            /** Set the delay between parallel connection attempts.
+             * @param delay how long to wait for an attempt before starting 
+             * one to the next address in parallel
+             */
+            void attempt_delay(duration delay) { m_attempt_delay = delay; }
+
+            /** Get the io_service this connection runs on.
+             * @return the io_service
+             */
+            boost::asio::io_service& get_io_service() { return io_service; }
+
+            /** Set the default timeout for actions.
+             * @param timeout how long to wait for a response to an action 
+             * sent without an explicit timeout (zero waits forever, the 
+             * default)
+             */
+            void timeout(duration timeout) { m_timeout = timeout; }
+
+            /** Get the default timeout for actions.
+             * @return the default timeout
+             */
+            duration timeout() const { return m_timeout; }
+
             void process_events();
             void wait_event();
 
@@ -139,12 +353,113 @@ namespace astxx {
 
             void pump_messages();
 
+            void spin(const spin_policy& policy);
+
+            /** Get how the connection waits for data.
+             * @return the spin policy
+             */
+            const spin_policy& spin() const { return m_spin; }
+
+            /** Record the latency of events from the socket to their handlers.
+             * @param state true to record into connection::event_latency()
+             */
+            void record_latency(bool state) { m_record_latency = state; }
+
+            /** Get the latency of events from the socket to their handlers.
+             * This is the time from reading an event off the socket to 
+             * connection::process_events() starting its handlers, recorded 
+             * while connection::record_latency() is on.
+             * @return the latency histogram, reset it to start over
+             */
+            latency_histogram& event_latency() { return m_event_latency; }
+
+            void start_io_thread(int cpu = -1, std::size_t capacity = 4096);
+            void stop_io_thread();
+
+            /** Check if a dedicated I/O thread is reading for this connection.
+             * @return true between connection::start_io_thread() and 
+             * connection::stop_io_thread()
+             */
+            bool io_thread_running() const { return m_io_thread.get() != 0; }
+
+            /** Get the socket, for an event loop to watch.
+             * @return the native socket descriptor, -1 when not connected
+             * @note The descriptor changes when the connection reconnects.
+             */
+            int native_handle() { return socket.is_open() ? static_cast<int>(socket.native_handle()) : -1; }
+
+            void start_external_io(bool defer_writes = false);
+            void stop_external_io();
+
+            /** Check if an external event loop drives this connection.
+             * @return true between connection::start_external_io() and 
+             * connection::stop_external_io()
+             */
+            bool external_io() const { return m_external_io; }
+
+            std::size_t on_readable();
+            bool on_writable();
+            void on_data(const char* data, std::size_t size);
+            void take_writes(std::string& data);
+
+            /** Check if data is waiting for the socket to become writable.
+             * @return true if the event loop should call 
+             * connection::on_writable() when the socket is writable
+             */
+            bool want_write() const { return m_write_offset < m_write_queue.size(); }
+
+            /** Get the admission controller for this connection.
+             * @return a reference to the admission controller
+             */
+            admission_control& admission() { return m_admission; }
+
+            /** Get the number of actions waiting for admission.
+             * @return the number of actions in the backlog
+             */
+            std::size_t backlog_size() const { return backlog.size(); }
+
+            /** Get the number of actions waiting for a response.
+             * @return the number of pending actions, including backlogged 
+             * ones
+             */
+            std::size_t pending_size() const { return pending.size(); }
+
             boost::signals2::connection register_event(const std::string& e, boost::function<void (message::event)> f);
+            boost::signals2::connection register_event(const std::string& e, const std::string& header, const std::string& value, boost::function<void (message::event)> f);
+            event_index::handle subscribe(const std::string& e, const event_index::handler_t& f);
+            event_index::handle subscribe(const std::string& e, const event_index::predicate& p, const event_index::handler_t& f);
+            event_index::handle subscribe(const std::string& e, const event_index::predicate& p, const event_index::handler_t& f, const std::vector<std::string>& headers);
+            event_batcher::handle register_batch(const std::string& e, const event_batcher::handler_t& f, std::size_t max_size = 0, duration max_latency = duration::zero());
+            event_batcher::handle register_batch(const std::string& e, const event_batcher::handler_t& f, const std::vector<std::string>& headers, std::size_t max_size = 0, duration max_latency = duration::zero());
+
+            void sample_events(const std::string& e, std::size_t one_in, unsigned int max_per_second = 0);
+            unsigned long long events_dropped(const std::string& e) const;
+            std::map<std::string, unsigned long long> events_dropped() const;
+
+            void auto_filter(bool state);
+            void update_event_filter();
 
          private:
-            boost::asio::io_service io_service;
+            // only set if we created our own io_service
+            boost::scoped_ptr<boost::asio::io_service> m_io_service;
+            boost::asio::io_service& io_service;
+            // handlers on the io_service hold a weak reference to this, 
+            // which dies with the connection
+            boost::shared_ptr<bool> m_alive;
             boost::asio::ip::tcp::socket socket;
 
+            // connection establishment
+            boost::asio::ip::tcp::resolver resolver;
+            boost::asio::steady_timer connect_timer;
+            std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+            std::size_t m_next_endpoint;
+            std::vector<boost::shared_ptr<connect_attempt> > attempts;
+            connect_handler_t m_connect_handler;
+            bool m_connecting;
+            boost::system::error_code m_connect_error;
+            duration m_connect_timeout;
+            duration m_attempt_delay;
+
             std::string m_name;
             std::string m_version;
 
@@ -152,10 +467,82 @@ namespace astxx {
             std::string m_port;
 
             events_t events;
-            responses_t responses;
-            response_handlers_t response_handlers;
+            // when the data of each queued event was read
+            std::queue<latency_histogram::clock_type::time_point> m_event_reads;
+            completions_t completions;
+            // the states handed out by async_send(), failed on destruction 
+            // so no awaiting coroutine is left suspended
+            std::vector<boost::weak_ptr<async_response::state> > m_async_states;
             event_handlers_t event_handlers;
+
+            // receive buffer and the state of the message being parsed
+            boost::array<char, 8192> read_buffer;
+            parser m_parser;
+            bool reading;
+            unsigned int m_generation;
+            bool m_greeting;
+            latency_histogram::clock_type::time_point m_read_time;
+
+            // waiting for data and how long that takes
+            spin_policy m_spin;
+            bool m_record_latency;
+            latency_histogram m_event_latency;
+
+            // output of the response being read
+            std::string m_output;
+            std::vector<std::string> m_output_headers;
+
+            // the optional I/O thread, only it touches m_parser while running
+            boost::scoped_ptr<ring_t> m_ring;
+            boost::scoped_ptr<std::thread> m_io_thread;
+            boost::scoped_ptr<boost::asio::executor_work_guard<boost::asio::io_service::executor_type> > m_io_work;
+            std::atomic<bool> m_io_stop;
+            std::atomic<bool> m_drain_posted;
+            int m_io_wake[2];
+            std::exception_ptr m_io_error;
+
+            // driven by an external event loop, with the data the socket 
+            // would not take yet
+            bool m_external_io;
+            bool m_defer_writes;
+            std::string m_write_queue;
+            std::string::size_type m_write_offset;
+
+            admission_control m_admission;
+            backlog_t backlog;
+            boost::asio::steady_timer backlog_timer;
+            bool backlog_timer_armed;
+
+            pending_t pending;
+            action_ids_t action_ids;
+            unsigned long long m_seq;
+            duration m_timeout;
+
+            // automatic event filtering
+            subscriptions_t subscriptions;
+            event_index m_event_index;
+            event_batcher m_event_batcher;
+            // event names of index and batch subscriptions in m_event_filter
+            std::set<std::string> m_indexed_events;
+            event_filter m_event_filter;
+            bool m_auto_filter;
+            bool m_mask_sent;
+            unsigned int m_sent_mask;
+            std::set<std::string> m_installed_filters;
+            bool m_filters_supported;
+            admission_control::time_point m_filter_updated;
+
+            // header projection and the interest versions it was built from
+            unsigned long m_index_interest;
+            unsigned long m_batch_interest;
+            bool m_projection_stale;
+
+            // event sampling, the counters outlive the rules
+            boost::shared_ptr<const parser::sampling_t> m_sampling;
+            std::map<std::string, boost::shared_ptr<sample_rule::counters> > m_sample_counts;
       };
+
+      std::vector<boost::system::error_code> connect_all(const std::vector<connection*>& connections);
    }
 }
 
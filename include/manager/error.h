@@ -30,6 +30,7 @@
 
 #include "exception.h"
 #include <string>
+#include <boost/system/error_code.hpp>
 
 namespace astxx {
    namespace manager {
@@ -66,6 +67,18 @@ namespace astxx {
             std::string m_type;
       };
       
+      /// No response was received before an action's deadline.
+      class timeout : public manager::error {
+         public:
+            timeout() throw() : manager::error("timed out waiting for a response") { }
+      };
+
+      /// An action was cancelled before a response was received.
+      class cancelled : public manager::error {
+         public:
+            cancelled() throw() : manager::error("action cancelled") { }
+      };
+
       /** The error string of the 'Message' header for a permission denied 
        * error from Asterisk.
        */
@@ -88,6 +101,45 @@ namespace astxx {
             explicit authentication_required() throw() : manager::error(authentication_error_string) { }
       };
 
+      namespace errc {
+         /** Errors reported by Asterisk in 'Response: Error' messages.
+          *
+          * These are the boost::system::error_code values behind the
+          * exceptions thrown by basic_action::handle_response().  They are
+          * returned instead by the overloads taking manager::use_expected.
+          *
+          * @see basic_action::register_error()
+          */
+         enum errc_t {
+            permission_denied = 1,   ///< manager::permission_denied
+            authentication_required, ///< manager::authentication_required
+            missing_data,            ///< manager::action::missing_data
+            bad_data,                ///< manager::action::bad_data
+            channel_not_found,       ///< manager::action::channel_not_found
+            action_failed            ///< manager::action::error
+         };
+      }
+
+      const boost::system::error_category& error_category();
+
+      namespace errc {
+         /** Make an error_code from a manager::errc::errc_t.
+          * @param e the error
+          * @return the error code
+          */
+         inline boost::system::error_code make_error_code(errc_t e) {
+            return boost::system::error_code(static_cast<int>(e), error_category());
+         }
+      }
+   }
+}
+
+namespace boost {
+   namespace system {
+      template<>
+      struct is_error_code_enum<astxx::manager::errc::errc_t> {
+         static const bool value = true;
+      };
    }
 }
 
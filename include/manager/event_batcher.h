@@ -0,0 +1,158 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::event_batcher class which collects
+ * events and hands them to handlers in batches.
+ */
+
+#ifndef ASTXX_MANAGER_EVENT_BATCHER_H
+#define ASTXX_MANAGER_EVENT_BATCHER_H
+
+#include "manager/message.h"
+#include "manager/projection.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Events collected for batch handlers.
+       *
+       * A batch handler receives the events for its event name as a
+       * contiguous range instead of one call per event:
+       *
+       * @code
+       * void store(event_batcher::batch_t events) {
+       *    for (const message::event* e = events.begin(); e != events.end(); ++e)
+       *       ...
+       * }
+       * @endcode
+       *
+       * Events are added with event_batcher::push() and a batch is handed
+       * over when it reaches the handler's maximum size, or by
+       * event_batcher::flush().  Without a latency bound flush() hands over
+       * whatever has been collected; with one it holds on to the events
+       * until the oldest has waited that long.  The events are only valid
+       * during the call.
+       *
+       * @see connection::register_batch()
+       */
+      class event_batcher {
+         public:
+            typedef std::chrono::steady_clock clock_type;
+            typedef clock_type::time_point time_point;
+            typedef clock_type::duration duration;
+
+            /// A batch of events.
+            typedef boost::iterator_range<const message::event*> batch_t;
+            /// A batch handler.
+            typedef boost::function<void (batch_t)> handler_t;
+
+         private:
+            struct batch;
+            typedef boost::shared_ptr<batch> batch_ptr;
+
+         public:
+            /** A batch subscription, returned by event_batcher::add().
+             * Copies refer to the same subscription.  Letting the handle go
+             * does not remove the subscription.
+             */
+            class handle {
+               public:
+                  handle() { }
+
+                  void disconnect();
+                  bool connected() const;
+
+               private:
+                  friend class event_batcher;
+                  explicit handle(const batch_ptr& b) : m_batch(b) { }
+
+                  boost::weak_ptr<batch> m_batch;
+            };
+
+            event_batcher() : m_size(0) { }
+            ~event_batcher();
+
+            handle add(const std::string& event, const handler_t& f, std::size_t max_size = 0, duration max_latency = duration::zero());
+            handle add(const std::string& event, const handler_t& f, const std::vector<std::string>& headers, std::size_t max_size = 0, duration max_latency = duration::zero());
+            void push(message::event& e);
+            void flush(time_point now = clock_type::now());
+
+            /** Check if any batch handler is for the given event.
+             * @param event the event name, blank for the catch all
+             * @return true if there is one
+             */
+            bool has_event(const std::string& event) const {
+               return m_batches.find(event) != m_batches.end();
+            }
+
+            /** Get the number of batch handlers.
+             * @return the number of batch handlers
+             */
+            std::size_t size() const { return m_size; }
+
+            /** Get the headers the batch handlers read.
+             * @return the headers declared with event_batcher::add()
+             */
+            const header_interest& interest() const { return m_interest; }
+
+         private:
+            event_batcher(const event_batcher&);
+            event_batcher& operator=(const event_batcher&);
+
+            /// One batch handler and the events collected for it.
+            struct batch {
+               event_batcher* batcher;
+               std::string event;
+               handler_t handler;
+               bool every_header;
+               std::vector<std::string> headers;
+               std::size_t max_size;
+               duration max_latency;
+               std::vector<message::event> events;
+               time_point oldest;
+               bool active;
+            };
+            typedef std::vector<batch_ptr> batches_t;
+
+            handle insert(const std::string& event, const handler_t& f, const std::vector<std::string>* headers, std::size_t max_size, duration max_latency);
+            void remove(const batch_ptr& b);
+            static void deliver(const batch_ptr& b);
+
+            boost::unordered_map<std::string, batches_t> m_batches;
+            batches_t m_matches;
+            std::size_t m_size;
+            header_interest m_interest;
+      };
+   }
+}
+
+#endif
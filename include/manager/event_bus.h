@@ -0,0 +1,174 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::event_bus_writer and
+ * astxx::manager::event_bus_reader classes which share events between
+ * processes on the same host through a shared memory ring.
+ */
+
+#ifndef ASTXX_MANAGER_EVENT_BUS_H
+#define ASTXX_MANAGER_EVENT_BUS_H
+
+#include "manager/message.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace astxx {
+   namespace manager {
+      namespace detail {
+         struct event_bus_segment;
+      }
+
+      /** The publishing side of an event bus.
+       *
+       * An event bus is a ring buffer in POSIX shared memory holding events
+       * in a compact binary layout: a record header, then each header of
+       * the event as a length prefixed key and value.  One process reads
+       * the events from Asterisk, parses them once and publishes them;
+       * any number of processes on the same host read them with an
+       * event_bus_reader, straight out of the shared memory, without
+       * talking to the publisher or to each other.
+       *
+       * @code
+       * manager::event_bus_writer bus("/astxx-events");
+       * connection.register_event("", boost::bind(&manager::event_bus_writer::publish, &bus, _1));
+       * @endcode
+       *
+       * There is one writer per bus and publish() never waits for readers:
+       * when the ring is full the oldest events are overwritten and readers
+       * that had not got to them yet find out through
+       * event_bus_reader::lost().  Size the ring for the longest stall a
+       * reader should survive.
+       *
+       * The writer creates the segment, replacing any left behind by an
+       * earlier writer, and removes it when destroyed.
+       */
+      class event_bus_writer {
+         public:
+            explicit event_bus_writer(const std::string& name, std::size_t capacity = 16 << 20);
+            ~event_bus_writer();
+
+            void publish(const message::event& e);
+
+            /** Get the number of events published.
+             * @return the number of events published
+             */
+            unsigned long long published() const { return m_sequence; }
+
+            /** Get the size of the ring.
+             * @return the number of bytes of events the ring holds
+             */
+            std::size_t capacity() const { return m_capacity; }
+
+            /** Get the name of the shared memory segment.
+             * @return the name
+             */
+            const std::string& name() const { return m_name; }
+
+         private:
+            event_bus_writer(const event_bus_writer&);
+            event_bus_writer& operator=(const event_bus_writer&);
+
+            std::string m_name;
+            detail::event_bus_segment* m_segment;
+            std::size_t m_mapped;
+            std::size_t m_capacity;
+            char* m_ring;
+            unsigned long long m_head;
+            unsigned long long m_sequence;
+      };
+
+      /** The consuming side of an event bus.
+       *
+       * Each reader has its own cursor in the ring, starting at the newest
+       * event when it attaches, and reads at its own pace:
+       *
+       * @code
+       * manager::event_bus_reader bus("/astxx-events");
+       * manager::message::event e("");
+       * for (;;) {
+       *    while (bus.read(e))
+       *       handle(e);
+       *    if (bus.lost())
+       *       resync();
+       *    bus.wait(std::chrono::seconds(1));
+       * }
+       * @endcode
+       *
+       * A reader that falls a whole ring behind the writer skips ahead to
+       * the newest event, and the events it missed are counted by
+       * event_bus_reader::lost().  A reader never slows the writer down or
+       * gets a torn event: an event that is overwritten while it is being
+       * read is dropped and counted as lost.
+       *
+       * Reading needs no system calls, only waiting for events does.
+       */
+      class event_bus_reader {
+         public:
+            explicit event_bus_reader(const std::string& name);
+            ~event_bus_reader();
+
+            bool read(message::event& e);
+            bool wait(std::chrono::steady_clock::duration timeout);
+            std::size_t backlog() const;
+            bool closed() const;
+
+            /** Get the number of events this reader missed because it fell
+             * behind.
+             * @return the number of events missed
+             */
+            unsigned long long lost() const { return m_lost; }
+
+            /** Get the number of events this reader has read.
+             * @return the number of events read
+             */
+            unsigned long long received() const { return m_received; }
+
+            /** Get the size of the ring.
+             * @return the number of bytes of events the ring holds
+             */
+            std::size_t capacity() const { return m_capacity; }
+
+         private:
+            event_bus_reader(const event_bus_reader&);
+            event_bus_reader& operator=(const event_bus_reader&);
+
+            void skip();
+
+            detail::event_bus_segment* m_segment;
+            std::size_t m_mapped;
+            std::size_t m_capacity;
+            const char* m_ring;
+            unsigned long long m_cursor;
+            unsigned long long m_next;
+            bool m_started;
+            unsigned long long m_lost;
+            unsigned long long m_received;
+      };
+   }
+}
+
+#endif
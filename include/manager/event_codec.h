@@ -0,0 +1,103 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::event_encoder and
+ * astxx::manager::event_decoder classes which convert events to and from a
+ * compact binary form.
+ */
+
+#ifndef ASTXX_MANAGER_EVENT_CODEC_H
+#define ASTXX_MANAGER_EVENT_CODEC_H
+
+#include "manager/message.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Encodes events as a compact binary stream.
+       *
+       * Each event is a varint length followed by its headers.  Header
+       * names are interned: common AMI header names have fixed ids, and
+       * any other name is written out the first time it appears in the
+       * stream and referred to by a new id after that.  Values are length
+       * prefixed and copied as they are.  An event_decoder fed the same
+       * stream rebuilds the events.
+       *
+       * @code
+       * manager::event_encoder encoder;
+       * std::string out;
+       * encoder.encode(e, out);  // appends
+       * @endcode
+       *
+       * Ids depend on everything encoded since the last
+       * event_encoder::reset(), so a stream must be decoded from the start
+       * (or from a reset, both sides reset at the same point) and in
+       * order.  Reset at the start of each file or block that must be
+       * readable on its own.
+       */
+      class event_encoder {
+         public:
+            event_encoder();
+
+            void encode(const message::event& e, std::string& out);
+            void reset();
+
+         private:
+            typedef boost::unordered_map<std::string, unsigned int> names_t;
+            names_t m_names;
+            unsigned int m_next;
+            std::vector<unsigned int> m_ids;
+      };
+
+      /** Decodes the stream written by an event_encoder.
+       *
+       * @code
+       * manager::event_decoder decoder;
+       * manager::message::event e("");
+       * std::size_t used;
+       * while ((used = decoder.decode(data, size, e))) {
+       *    handle(e);
+       *    data += used;
+       *    size -= used;
+       * }
+       * @endcode
+       */
+      class event_decoder {
+         public:
+            event_decoder();
+
+            std::size_t decode(const char* data, std::size_t size, message::event& e);
+            void reset();
+
+         private:
+            std::vector<std::string> m_names;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,92 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::event_filter class which works out 
+ * the smallest set of events a connection needs Asterisk to send.
+ */
+
+#ifndef ASTXX_MANAGER_EVENT_FILTER_H
+#define ASTXX_MANAGER_EVENT_FILTER_H
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace astxx {
+   namespace manager {
+      /** Track the events a connection's handlers are interested in.
+       *
+       * Each event handler registered with the connection is recorded here 
+       * as a subscription: an event name, optionally narrowed by a header 
+       * that must have a given value.  From the subscriptions this class 
+       * derives the EventMask to request with action::events and the set of 
+       * regular expressions to install with action::filter.  Both are 
+       * supersets of what the handlers want; the connection still dispatches 
+       * on the client side.
+       *
+       * @see connection::auto_filter()
+       */
+      class event_filter {
+         public:
+            /// Mask value meaning every event class is needed.
+            static const unsigned int all = ~0u;
+
+            /// A subscription: event name plus an optional header predicate.
+            struct subscription {
+               subscription(const std::string& event, const std::string& header = "", const std::string& value = "")
+                  : event(event), header(header), value(value) { }
+
+               bool operator<(const subscription& s) const {
+                  if (event != s.event) return event < s.event;
+                  if (header != s.header) return header < s.header;
+                  return value < s.value;
+               }
+
+               std::string event;  ///< the event name, blank for every event
+               std::string header; ///< a header to match, blank for none
+               std::string value;  ///< the value the header must have
+            };
+
+            void add(const subscription& s);
+            void remove(const subscription& s);
+
+            /** Check if nothing is subscribed.
+             * @return true if there are no subscriptions
+             */
+            bool empty() const { return subscriptions.empty(); }
+
+            unsigned int mask() const;
+            std::set<std::string> filters() const;
+
+            static unsigned int event_class(const std::string& event);
+            static std::string filter_expression(const subscription& s);
+
+         private:
+            /// subscriptions and how many handlers use each
+            std::map<subscription, unsigned int> subscriptions;
+      };
+   }
+}
+
+#endif
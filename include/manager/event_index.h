@@ -0,0 +1,235 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::event_index class which dispatches
+ * events to handlers subscribed with header predicates.
+ */
+
+#ifndef ASTXX_MANAGER_EVENT_INDEX_H
+#define ASTXX_MANAGER_EVENT_INDEX_H
+
+#include "manager/message.h"
+#include "manager/projection.h"
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Event handlers indexed by the header values they are interested in.
+       *
+       * Each subscription names an event (or a blank string for every event)
+       * and optionally a predicate on one header: the header equals a value,
+       * starts with a prefix, or is one of a set of values.  Subscriptions
+       * are kept in hash tables keyed on the event name, the header and the
+       * value, and in a trie for prefixes, so dispatching an event costs a
+       * few lookups per header subscribed to plus one call per matching
+       * handler, however many subscriptions there are.
+       *
+       * Adding and removing a subscription are cheap enough to do per call,
+       * for example to follow one channel by its Uniqueid while it exists.
+       *
+       * @see connection::subscribe()
+       */
+      class event_index {
+         public:
+            /// An event handler.
+            typedef boost::function<void (const message::event&)> handler_t;
+
+            /// A condition on the value of one header.
+            class predicate {
+               public:
+                  enum kind_t {
+                     always,      ///< no condition
+                     equal_to,    ///< the header equals the value
+                     starts_with, ///< the header starts with the value
+                     one_of       ///< the header equals one of the values
+                  };
+
+                  /// Construct a predicate that matches every event.
+                  predicate() : m_kind(always) { }
+
+                  /** Match events where a header has a given value.
+                   * @param header the header
+                   * @param value the value
+                   * @return the predicate
+                   */
+                  static predicate equals(const std::string& header, const std::string& value) {
+                     return predicate(equal_to, header, &value, &value + 1);
+                  }
+
+                  /** Match events where a header starts with a given string.
+                   * @param header the header
+                   * @param value the prefix
+                   * @return the predicate
+                   */
+                  static predicate prefix(const std::string& header, const std::string& value) {
+                     return predicate(starts_with, header, &value, &value + 1);
+                  }
+
+                  /** Match events where a header has one of a set of values.
+                   * @param header the header
+                   * @param values a container of std::string values
+                   * @return the predicate
+                   */
+                  template<typename Container>
+                  static predicate in(const std::string& header, const Container& values) {
+                     return predicate(one_of, header, values.begin(), values.end());
+                  }
+
+                  /// Get the kind of predicate.
+                  kind_t kind() const { return m_kind; }
+                  /// Get the header tested.
+                  const std::string& header() const { return m_header; }
+                  /// Get the values (sorted, without duplicates).
+                  const std::vector<std::string>& values() const { return m_values; }
+
+               private:
+                  template<typename Iterator>
+                  predicate(kind_t kind, const std::string& header, Iterator begin, Iterator end) :
+                     m_kind(kind),
+                     m_header(header),
+                     m_values(begin, end) {
+                     std::sort(m_values.begin(), m_values.end());
+                     m_values.erase(std::unique(m_values.begin(), m_values.end()), m_values.end());
+                  }
+
+                  kind_t m_kind;
+                  std::string m_header;
+                  std::vector<std::string> m_values;
+            };
+
+         private:
+            struct entry;
+            typedef boost::shared_ptr<entry> entry_ptr;
+            typedef std::list<entry_ptr> entries_t;
+
+         public:
+            /** A subscription, returned by event_index::add().
+             * Copies refer to the same subscription.  Letting the handle go
+             * does not remove the subscription.
+             */
+            class handle {
+               public:
+                  handle() { }
+
+                  void disconnect();
+                  bool connected() const;
+
+               private:
+                  friend class event_index;
+                  explicit handle(const entry_ptr& e) : m_entry(e) { }
+
+                  boost::weak_ptr<entry> m_entry;
+            };
+
+            event_index() { }
+            ~event_index();
+
+            handle add(const std::string& event, const predicate& p, const handler_t& f);
+            handle add(const std::string& event, const predicate& p, const handler_t& f, const std::vector<std::string>& headers);
+            void dispatch(const message::event& e);
+
+            /** Check if any subscription is for the given event.
+             * @param event the event name, blank for the catch all
+             * @return true if there is one
+             */
+            bool has_event(const std::string& event) const {
+               return m_events.find(event) != m_events.end();
+            }
+
+            /** Get the number of subscriptions.
+             * @return the number of subscriptions
+             */
+            std::size_t size() const { return m_all.size(); }
+
+            /** Check for subscriptions.
+             * @return true if there are none
+             */
+            bool empty() const { return m_all.empty(); }
+
+            /** Get the headers the subscriptions read.
+             * @return the headers declared with event_index::add(), plus the 
+             * headers the predicates test
+             */
+            const header_interest& interest() const { return m_interest; }
+
+         private:
+            event_index(const event_index&);
+            event_index& operator=(const event_index&);
+
+            /// Prefix subscriptions, one node per character.
+            struct trie_node {
+               entries_t entries;
+               std::map<char, boost::shared_ptr<trie_node> > children;
+            };
+
+            /// Subscriptions testing one header.
+            struct header_node {
+               boost::unordered_map<std::string, entries_t> values;
+               trie_node prefixes;
+            };
+
+            /// Subscriptions for one event name.
+            struct event_node {
+               event_node() : count(0) { }
+
+               entries_t always;
+               boost::unordered_map<std::string, header_node> headers;
+               std::size_t count;
+            };
+
+            /// One subscription and where it is filed.
+            struct entry {
+               event_index* index;
+               std::string event;
+               predicate condition;
+               handler_t handler;
+               bool every_header;
+               std::vector<std::string> headers;
+               std::vector<entries_t::iterator> positions;
+               entries_t::iterator self;
+               bool active;
+            };
+
+            handle insert(const std::string& event, const predicate& p, const handler_t& f, const std::vector<std::string>* headers);
+            void remove(const entry_ptr& e);
+            static void collect(const event_node& node, const message::event& e, std::vector<entry_ptr>& matches);
+
+            boost::unordered_map<std::string, event_node> m_events;
+            entries_t m_all;
+            std::vector<entry_ptr> m_matches;
+            header_interest m_interest;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,143 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains astxx::manager::expected, the result of the
+ * non-throwing overloads of connection::send_action() and
+ * basic_action::operator()().
+ */
+
+#ifndef ASTXX_MANAGER_EXPECTED_H
+#define ASTXX_MANAGER_EXPECTED_H
+
+#include <boost/optional.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Tag type selecting the overloads of connection::send_action() and
+       * basic_action::operator()() that return errors instead of throwing
+       * them.
+       */
+      struct use_expected_t { };
+
+      /** Pass this to connection::send_action() or basic_action::operator()()
+       * to get a manager::expected.
+       * @code
+       * manager::expected<message::response> r = action::originate(...)(connection, manager::use_expected);
+       * if (not r)
+       *    std::cerr << r.error().message() << std::endl;
+       * @endcode
+       */
+      extern const use_expected_t use_expected;
+
+      /// An error, for constructing a manager::expected.
+      template<typename E>
+      class unexpected {
+         public:
+            explicit unexpected(const E& error) : m_error(error) { }
+
+            /// Get the error.
+            const E& error() const { return m_error; }
+
+         private:
+            E m_error;
+      };
+
+      /** Make a manager::unexpected.
+       * @param error the error
+       * @return the error wrapped for conversion to a manager::expected
+       */
+      template<typename E>
+      unexpected<E> make_unexpected(const E& error) {
+         return unexpected<E>(error);
+      }
+
+      /** A value or the error that prevented getting one.
+       *
+       * This is a cut down std::expected.  Failures are reported through it
+       * without throwing, which matters when many actions fail at once (an
+       * originate storm against a dead trunk for example).
+       */
+      template<typename T, typename E = boost::system::error_code>
+      class expected {
+         public:
+            /** Construct holding a value.
+             * @param value the value
+             */
+            expected(const T& value) : m_value(value) { }
+
+            /** Construct holding an error.
+             * @param error the error
+             */
+            template<typename G>
+            expected(const unexpected<G>& error) : m_error(error.error()) { }
+
+            /** Check for a value.
+             * @return true if there is a value, false if there is an error
+             */
+            bool has_value() const { return m_value.is_initialized(); }
+
+            /// @see expected::has_value()
+            explicit operator bool() const { return has_value(); }
+
+            /** Get the value.
+             * @return the value
+             * @throw boost::system::system_error if there is an error instead
+             */
+            T& value() {
+               if (not m_value)
+                  throw boost::system::system_error(m_error);
+               return *m_value;
+            }
+
+            /// @see expected::value()
+            const T& value() const {
+               if (not m_value)
+                  throw boost::system::system_error(m_error);
+               return *m_value;
+            }
+
+            /** Get the error.
+             * @return the error, a default constructed E if there is a value
+             */
+            const E& error() const { return m_error; }
+
+            /// Get the value, which must be there.
+            T& operator*() { return *m_value; }
+            /// Get the value, which must be there.
+            const T& operator*() const { return *m_value; }
+            /// Access the value, which must be there.
+            T* operator->() { return m_value.get_ptr(); }
+            /// Access the value, which must be there.
+            const T* operator->() const { return m_value.get_ptr(); }
+
+         private:
+            boost::optional<T> m_value;
+            E m_error;
+      };
+   }
+}
+
+#endif
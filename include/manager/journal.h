@@ -0,0 +1,203 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::journal_writer and
+ * astxx::manager::journal_reader classes which keep events on disk and
+ * find them again by time or by call.
+ */
+
+#ifndef ASTXX_MANAGER_JOURNAL_H
+#define ASTXX_MANAGER_JOURNAL_H
+
+#include "manager/event_codec.h"
+#include "manager/message.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Where a block of events is in a journal segment, and what is in
+       * it.  The journal index holds one of these per block.
+       */
+      struct journal_block {
+         /// the offset of the block in its segment
+         boost::uint64_t offset;
+         /// the size of the block on disk, header included
+         boost::uint32_t size;
+         /// the number of events in the block
+         boost::uint32_t count;
+         /// the earliest and latest event times, in nanoseconds since the epoch
+         boost::int64_t first;
+         boost::int64_t last;
+         /// hashes of the call ids in the block, sorted
+         std::vector<boost::uint64_t> calls;
+      };
+
+      /** Writes events to an append-only journal.
+       *
+       * A journal is a directory of segment files.  Events are collected
+       * in blocks, encoded with an event_encoder, and each block is
+       * compressed with zlib and appended to the current segment once it
+       * is big enough.  When a segment reaches its size limit a new one is
+       * started.  Next to each segment an index file lists its blocks with
+       * their time range and the calls (Uniqueid, Linkedid, DestUniqueid
+       * and DestLinkedid values) they mention, so a journal_reader can go
+       * straight to the blocks it needs.
+       *
+       * @code
+       * manager::journal_writer journal("/var/spool/astxx/journal");
+       * connection.register_event("", boost::bind(&manager::journal_writer::append, &journal, _1));
+       * ...
+       * journal.prune(manager::journal_writer::clock_type::now() - std::chrono::hours(24 * 7));
+       * @endcode
+       *
+       * Events are only written when their block is; at most
+       * journal_writer::max_delay() after they were appended (checked when
+       * the next event is appended) or on journal_writer::flush().  A
+       * crash loses the events not written yet and at worst leaves a torn
+       * block at the end of the last segment, which readers skip.  A new
+       * writer always starts a new segment.
+       *
+       * There should be one writer per directory.
+       */
+      class journal_writer {
+         public:
+            typedef std::chrono::system_clock clock_type;
+            typedef clock_type::time_point time_point;
+
+            explicit journal_writer(const std::string& directory, std::size_t segment_size = 64 << 20, std::size_t block_size = 64 << 10, int level = 1);
+            ~journal_writer();
+
+            void append(const message::event& e);
+            void append_at(const message::event& e, time_point t);
+            void flush(bool sync = false);
+            std::size_t prune(time_point before);
+
+            /** Set how long an event may wait to be written.
+             * @param delay the longest an event waits in an unfinished
+             * block, zero to wait until the block is full
+             */
+            void max_delay(std::chrono::milliseconds delay) { m_max_delay = delay; }
+
+            /** Get how long an event may wait to be written.
+             * @return the delay
+             */
+            std::chrono::milliseconds max_delay() const { return m_max_delay; }
+
+            /** Get the number of events appended.
+             * @return the number of events appended
+             */
+            unsigned long long appended() const { return m_appended; }
+
+            /** Get the number of bytes written to segments.
+             * @return the number of bytes written
+             */
+            unsigned long long written() const { return m_written; }
+
+         private:
+            journal_writer(const journal_writer&);
+            journal_writer& operator=(const journal_writer&);
+
+            void open_segment(boost::int64_t first);
+            void close_segment();
+            void write_block();
+
+            std::string m_directory;
+            std::size_t m_segment_size;
+            std::size_t m_block_size;
+            int m_level;
+            std::chrono::milliseconds m_max_delay;
+
+            int m_segment;
+            int m_index;
+            std::string m_segment_name;
+            boost::uint64_t m_offset;
+
+            event_encoder m_encoder;
+            std::string m_raw;
+            std::string m_compressed;
+            std::string m_index_record;
+            journal_block m_block;
+            std::chrono::steady_clock::time_point m_block_started;
+
+            unsigned long long m_appended;
+            unsigned long long m_written;
+      };
+
+      /** Reads the events in a journal.
+       *
+       * @code
+       * manager::journal_reader journal("/var/spool/astxx/journal");
+       * journal.read(from, to, print);           // everything in a time range
+       * journal.find_call("1700000000.42", print);  // everything about a call
+       * @endcode
+       *
+       * The reader looks at the segments and indexes as they are when it is
+       * constructed or refreshed with journal_reader::refresh(), so it can
+       * follow a journal that is being written.
+       */
+      class journal_reader {
+         public:
+            typedef journal_writer::clock_type clock_type;
+            typedef journal_writer::time_point time_point;
+
+            /// Called with each event found and the time it was journaled.
+            typedef boost::function<void (const message::event&, time_point)> handler_t;
+
+            explicit journal_reader(const std::string& directory);
+
+            void refresh();
+
+            std::size_t read(time_point from, time_point to, handler_t handler);
+            std::size_t find_call(const std::string& id, handler_t handler, time_point from = time_point::min(), time_point to = time_point::max());
+
+            /** Get the number of segments in the journal.
+             * @return the number of segments
+             */
+            std::size_t segments() const { return m_segments.size(); }
+
+         private:
+            struct segment {
+               std::string path;
+               std::vector<journal_block> blocks;
+            };
+
+            std::size_t scan(time_point from, time_point to, const std::string* id, handler_t& handler);
+            bool load_block(const segment& s, const journal_block& b);
+
+            std::string m_directory;
+            std::vector<segment> m_segments;
+            event_decoder m_decoder;
+            std::string m_compressed;
+            std::string m_raw;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,124 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::json_writer class which writes
+ * events as JSON.
+ */
+
+#ifndef ASTXX_MANAGER_JSON_WRITER_H
+#define ASTXX_MANAGER_JSON_WRITER_H
+
+#include "manager/message.h"
+#include "manager/scanner.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace astxx {
+   namespace manager {
+      /** Writes JSON into a reusable buffer.
+       *
+       * Events are written as objects with a member per header; a header
+       * that appears more than once becomes an array of its values.
+       * Everything is appended to one buffer, commas included, so a batch
+       * of events can be written, sent and cleared without the buffer ever
+       * shrinking:
+       *
+       * @code
+       * manager::json_writer json;
+       * for (...) {
+       *    json.write(e);
+       *    json.newline();
+       * }
+       * send(json.buffer());
+       * json.clear();
+       * @endcode
+       *
+       * Events can be wrapped in objects of your own too:
+       *
+       * @code
+       * json.begin_object();
+       * json.key("received");
+       * json.integer(received_at);
+       * json.key("event");
+       * json.write(e);
+       * json.end_object();
+       * @endcode
+       *
+       * Strings are escaped with SSE2 or AVX2 when the cpu has them,
+       * chosen at run time, so the usual header value, which needs no
+       * escaping, is checked a vector at a time and copied in one go.
+       * Bytes of 0x80 and up are copied as they are, Asterisk sends UTF-8.
+       */
+      class json_writer {
+         public:
+            json_writer();
+            explicit json_writer(scanner::isa_t isa);
+
+            void write(const message::event& e);
+
+            void begin_object();
+            void end_object();
+            void begin_array();
+            void end_array();
+            void key(const std::string& name);
+            void value(const std::string& s);
+            void value(const char* s, std::size_t size);
+            void integer(long long n);
+            void number(double n);
+            void boolean(bool b);
+            void null();
+            void newline();
+
+            /** Get the JSON written so far.
+             * @return the buffer, take what you need and call
+             * json_writer::clear()
+             */
+            std::string& buffer() { return m_buffer; }
+
+            void clear();
+
+            /** Get the instruction set this writer escapes strings with.
+             * @return the instruction set
+             */
+            scanner::isa_t isa() const { return m_isa; }
+
+            static void escape(const char* s, std::size_t size, std::string& out, scanner::isa_t isa = scanner::best());
+
+         private:
+            void separate();
+            void string(const char* s, std::size_t size);
+
+            scanner::isa_t m_isa;
+            std::string m_buffer;
+            std::string m_number;
+            /// for each open object or array, whether it has a member yet
+            std::vector<bool> m_open;
+            bool m_after_key;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,123 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::latency_histogram class which
+ * records latencies for percentiles, and the astxx::manager::spin_policy
+ * structure which tells a connection how to wait for data.
+ */
+
+#ifndef ASTXX_MANAGER_LATENCY_H
+#define ASTXX_MANAGER_LATENCY_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace astxx {
+   namespace manager {
+      /** A histogram of latencies.
+       *
+       * Latencies are counted in buckets that are 1/16th of a power of two
+       * wide, so any percentile is accurate to about 6% however large the
+       * latencies get, while recording one costs a few instructions and no
+       * allocation.
+       *
+       * @code
+       * manager::latency_histogram& h = connection.event_latency();
+       * std::cout << "p50 " << h.p50().count() << "ns p99 " << h.p99().count()
+       *           << "ns p999 " << h.p999().count() << "ns\n";
+       * h.reset();
+       * @endcode
+       */
+      class latency_histogram {
+         public:
+            typedef std::chrono::steady_clock clock_type;
+            typedef std::chrono::nanoseconds duration;
+
+            latency_histogram();
+
+            void record(duration latency);
+            duration percentile(double fraction) const;
+            void reset();
+
+            /** Get the median latency.
+             * @return the latency half the samples are under
+             */
+            duration p50() const { return percentile(0.5); }
+
+            /** Get the 99th percentile latency.
+             * @return the latency 99% of the samples are under
+             */
+            duration p99() const { return percentile(0.99); }
+
+            /** Get the 99.9th percentile latency.
+             * @return the latency 99.9% of the samples are under
+             */
+            duration p999() const { return percentile(0.999); }
+
+            /** Get the largest latency recorded.
+             * @return the largest latency
+             */
+            duration max() const { return duration(m_max); }
+
+            /** Get the number of latencies recorded.
+             * @return the number of latencies
+             */
+            unsigned long long count() const { return m_count; }
+
+         private:
+            static std::size_t bucket(unsigned long long ns);
+            static unsigned long long upper_bound(std::size_t bucket);
+
+            std::vector<unsigned long long> m_buckets;
+            unsigned long long m_count;
+            unsigned long long m_max;
+      };
+
+      /** How a connection waits for data.
+       *
+       * By default connection::wait_event() and connection::wait_response()
+       * sleep in the kernel until data arrives, which adds the time it takes
+       * to wake the thread to every message.  With a spin time set they
+       * first poll the socket without blocking for that long, burning the
+       * cpu to see data the moment it arrives, and only then sleep.
+       *
+       * @see connection::spin()
+       */
+      struct spin_policy {
+         spin_policy() : spin(std::chrono::steady_clock::duration::zero()), socket_busy_poll(0), cpu(-1) { }
+
+         /// how long to poll before sleeping, zero to sleep straight away
+         /// and duration::max() to never sleep
+         std::chrono::steady_clock::duration spin;
+         /// SO_BUSY_POLL for the socket in microseconds, so the kernel polls
+         /// the network card as well, 0 to leave the socket alone
+         unsigned int socket_busy_poll;
+         /// the cpu to pin the waiting thread to, -1 to leave it
+         int cpu;
+      };
+   }
+}
+
+#endif
@@ -30,9 +30,13 @@
 #define ASTXX_MANAGER_MESSAGE_H
 
 #include "manager/error.h"
+#include "manager/value.h"
 #include <map>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <boost/asio/buffer.hpp>
 
 namespace astxx {
    namespace manager {
@@ -53,6 +57,23 @@ namespace astxx {
 
          };
 
+         /// A header value could not be converted to the requested type.
+         class invalid_value : public manager::parse_error {
+            public:
+               invalid_value(const std::string& header, const std::string& value) throw() : manager::parse_error("invalid value for " + header + " header: " + value), m_header(header), m_value(value) { }
+               virtual ~invalid_value() throw() { }
+
+               /// Get the header.
+               std::string header() const { return m_header; }
+
+               /// Get the value that could not be converted.
+               std::string value() const { return m_value; }
+
+            private:
+               std::string m_header;
+               std::string m_value;
+         };
+
          /** An Asterisk Manager message.
           *
           * The main method for accessing headers in a manager::basic_message is 
@@ -60,6 +81,19 @@ namespace astxx {
           * same key, the message should be accessed in the same manner as an 
           * std::multimap (i.e. using the equal_range() function).
           *
+          * Numeric, boolean and timestamp headers can be read and written with 
+          * the typed accessors basic_message::get(), basic_message::try_get() 
+          * and basic_message::set(), which convert directly from and to the 
+          * stored value without going through a stream or temporary strings 
+          * (see message::value_traits).
+          *
+          * @code
+          * int count = e.get<int>("Count");
+          * double duration;
+          * if (e.try_get("Duration", duration)) ...
+          * action.set("Timeout", 30000);
+          * @endcode
+          *
           * @note Headers and values for manager::basic_message objects are 
           * stored exactly as they are recieved from Asterisk.  As a result, 
           * the exact case Asterisk for headers must be used to look up values.
@@ -120,6 +154,96 @@ namespace astxx {
                   return headers.insert(std::make_pair(key, ""))->second;
                }
 
+               /** Find the first header with the given key.
+                * @param key the key to use for lookup
+                *
+                * Unlike operator[] this never adds a header, and unlike 
+                * basic_message::get() it does not copy the value.
+                *
+                * @return a pointer to the value, or 0 if there is none
+                */
+               const std::string* find(const std::string& key) const {
+                  header_t::const_iterator i = headers.find(key);
+                  return (i != headers.end()) ? &i->second : 0;
+               }
+
+               /** Get the value of a header converted to T.
+                * @param key the key to use for lookup
+                *
+                * If there are multiple headers with the given key the first 
+                * one is used.
+                *
+                * @return the converted value
+                * @throw message::header_missing if there is no such header
+                * @throw message::invalid_value if the value is not a valid T
+                */
+               template<typename T>
+               T get(const std::string& key) const {
+                  const std::string* v = find(key);
+                  if (not v)
+                     throw message::header_missing(key);
+
+                  T value;
+                  if (not value_traits<T>::parse(v->data(), v->data() + v->size(), value))
+                     throw message::invalid_value(key, *v);
+                  return value;
+               }
+
+               /** Get the value of a header converted to T, without throwing.
+                * @param key the key to use for lookup
+                * @param value set to the converted value on success, left 
+                * alone otherwise
+                * @return false if there is no such header or its value is not 
+                * a valid T
+                */
+               template<typename T>
+               bool try_get(const std::string& key, T& value) const {
+                  const std::string* v = find(key);
+                  return v and value_traits<T>::parse(v->data(), v->data() + v->size(), value);
+               }
+
+               /** Get the value of a header holding the number of an enum.
+                * @param key the key to use for lookup
+                * @return the value as an E
+                * @throw message::header_missing if there is no such header
+                * @throw message::invalid_value if the value is not a number
+                */
+               template<typename E>
+               E get_enum(const std::string& key) const {
+                  return static_cast<E>(get<int>(key));
+               }
+
+               /** Get the value of a header holding the number of an enum, 
+                * without throwing.
+                * @param key the key to use for lookup
+                * @param value set to the value on success
+                * @return false if there is no such header or its value is not 
+                * a number
+                */
+               template<typename E>
+               bool try_get_enum(const std::string& key, E& value) const {
+                  int n;
+                  if (not try_get(key, n))
+                     return false;
+                  value = static_cast<E>(n);
+                  return true;
+               }
+
+               /** Set a header to a typed value.
+                * @param key the key of the header
+                * @param value the value
+                *
+                * Like operator[], this sets the first header with the given 
+                * key, creating it if necessary.
+                *
+                * @return a reference to this message
+                */
+               template<typename T>
+               basic_message& set(const std::string& key, const T& value) {
+                  value_traits<T>::format(value, this->operator[](key));
+                  return *this;
+               }
+
                /** Compare the main header for this message to a string.
                 * @param s the string
                 * @return the result of the compairson
@@ -179,31 +303,135 @@ namespace astxx {
                   return headers.end();
                }
 
+               /** Get an iterator to the first header.
+                * @return an iterator to the first header
+                */
+               header_t::const_iterator begin() const {
+                  return headers.begin();
+               }
+
+               /** Get an iterator to one past the last header.
+                * @return an iterator to one past the last header
+                */
+               header_t::const_iterator end() const {
+                  return headers.end();
+               }
+
                /** Format this message as a string.
                 * @return this message formatted as a string
                 * @throw manager::message::header_missing if the main header is 
                 * missing
                 */
-               std::string format() {
-                  if (this->operator[](traits.main_header()).empty()) {
-                     throw message::header_missing(traits.main_header());
-                  }
+               std::string format() const {
+                  std::string out;
+                  format(out);
+                  return out;
+               }
+
+               /** Append this message, formatted, to a string.
+                * @param out the string to append to
+                *
+                * The string is grown once, to the exact size needed, so a 
+                * buffer that is cleared and reused stops allocating once it 
+                * is big enough.
+                *
+                * @throw manager::message::header_missing if the main header is 
+                * missing
+                */
+               void format(std::string& out) const {
+                  const std::string& key = traits.main_header();
+                  const std::string& value = main_value();
 
-                  std::stringstream ss;
+                  out.reserve(out.size() + format_size());
 
                   // put the main header first
-                  ss << traits.main_header() << ": " << this->operator[](traits.main_header()) << "\r\n";
+                  append(out, key, value);
 
-                  for (header_t::iterator i = headers.begin(); i != headers.end(); ++i) {
+                  for (header_t::const_iterator i = headers.begin(); i != headers.end(); ++i) {
                      // don't repeat the main header
-                     if (i->first != traits.main_header()) {
-                        ss << i->first << ": " << i->second << "\r\n";
+                     if (i->first != key) {
+                        append(out, i->first, i->second);
                      }
                   }
 
-                  ss << "\r\n";
+                  out += "\r\n";
+               }
 
-                  return ss.str();
+               /** Format this message into a caller provided buffer.
+                * @param buffer the buffer
+                * @param size the size of the buffer
+                * @return the size of the formatted message, nothing is 
+                * written if this is larger than size
+                * @throw manager::message::header_missing if the main header is 
+                * missing
+                */
+               std::string::size_type format(char* buffer, std::string::size_type size) const {
+                  std::string::size_type needed = format_size();
+                  if (needed > size)
+                     return needed;
+
+                  const std::string& key = traits.main_header();
+                  char* p = append(buffer, key, main_value());
+                  for (header_t::const_iterator i = headers.begin(); i != headers.end(); ++i) {
+                     if (i->first != key) {
+                        p = append(p, i->first, i->second);
+                     }
+                  }
+                  *p++ = '\r';
+                  *p++ = '\n';
+                  return needed;
+               }
+
+               /** Describe this message as a list of buffers.
+                * @param buffers the list to append to
+                *
+                * The buffers point at the header strings of this message, 
+                * nothing is copied.  Pass them to a gather write (such as 
+                * boost::asio::write()) while the message is still alive and 
+                * unchanged.
+                *
+                * @throw manager::message::header_missing if the main header is 
+                * missing
+                */
+               void format(std::vector<boost::asio::const_buffer>& buffers) const {
+                  static const char separator[] = ": ";
+                  static const char crlf[] = "\r\n";
+
+                  const std::string& key = traits.main_header();
+                  const std::string& value = main_value();
+
+                  buffers.reserve(buffers.size() + headers.size() * 4 + 1);
+                  buffers.push_back(boost::asio::buffer(key));
+                  buffers.push_back(boost::asio::buffer(separator, 2));
+                  buffers.push_back(boost::asio::buffer(value));
+                  buffers.push_back(boost::asio::buffer(crlf, 2));
+
+                  for (header_t::const_iterator i = headers.begin(); i != headers.end(); ++i) {
+                     if (i->first != key) {
+                        buffers.push_back(boost::asio::buffer(i->first));
+                        buffers.push_back(boost::asio::buffer(separator, 2));
+                        buffers.push_back(boost::asio::buffer(i->second));
+                        buffers.push_back(boost::asio::buffer(crlf, 2));
+                     }
+                  }
+
+                  buffers.push_back(boost::asio::buffer(crlf, 2));
+               }
+
+               /** Get the size of this message when formatted.
+                * @return the number of bytes basic_message::format() produces
+                * @throw manager::message::header_missing if the main header is 
+                * missing
+                */
+               std::string::size_type format_size() const {
+                  const std::string& key = traits.main_header();
+                  std::string::size_type size = key.size() + main_value().size() + 6;
+                  for (header_t::const_iterator i = headers.begin(); i != headers.end(); ++i) {
+                     if (i->first != key) {
+                        size += i->first.size() + i->second.size() + 4;
+                     }
+                  }
+                  return size;
                }
 
                /** Get the value of the main header for this message.
@@ -223,6 +451,46 @@ namespace astxx {
                }
             
             private:
+               /** Get the value of the main header for formatting.
+                * @return the value
+                * @throw manager::message::header_missing if the main header is 
+                * missing or blank
+                */
+               const std::string& main_value() const {
+                  const std::string* v = find(traits.main_header());
+                  if (not v or v->empty())
+                     throw message::header_missing(traits.main_header());
+                  return *v;
+               }
+
+               /** Append a formatted header to a string.
+                * @param out the string
+                * @param key the key
+                * @param value the value
+                */
+               static void append(std::string& out, const std::string& key, const std::string& value) {
+                  out += key;
+                  out += ": ";
+                  out += value;
+                  out += "\r\n";
+               }
+
+               /** Write a formatted header to a buffer.
+                * @param p where to write
+                * @param key the key
+                * @param value the value
+                * @return one past the last byte written
+                */
+               static char* append(char* p, const std::string& key, const std::string& value) {
+                  p = std::copy(key.begin(), key.end(), p);
+                  *p++ = ':';
+                  *p++ = ' ';
+                  p = std::copy(value.begin(), value.end(), p);
+                  *p++ = '\r';
+                  *p++ = '\n';
+                  return p;
+               }
+
                header_t headers;
 
          };
@@ -252,7 +520,7 @@ namespace astxx {
          class message_traits {
             public:
                explicit message_traits(const std::string& key) : key(key) { }
-               std::string main_header() const { return key; }
+               const std::string& main_header() const { return key; }
 
             private:
                std::string key;
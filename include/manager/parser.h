@@ -0,0 +1,136 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::parser class which turns the byte
+ * stream from Asterisk into messages.
+ */
+
+#ifndef ASTXX_MANAGER_PARSER_H
+#define ASTXX_MANAGER_PARSER_H
+
+#include "manager/message.h"
+#include "manager/scanner.h"
+#include "manager/sampling.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** An incremental parser for the manager protocol.
+       *
+       * Data read from the socket is passed to parser::feed() in whatever
+       * pieces it arrives in.  Each complete message is handed to a
+       * parser::handler.  The parser knows nothing about pending actions or
+       * event handlers, so it can run on a different thread than the rest
+       * of the connection.
+       */
+      class parser {
+         public:
+            /// Receives what the parser finds.
+            class handler {
+               public:
+                  virtual ~handler() { }
+
+                  /** The greeting line was read.
+                   * @param line the greeting, for example "Asterisk Call Manager/1.1"
+                   */
+                  virtual void on_greeting(const std::string& line) = 0;
+
+                  /** An event was read.
+                   * @param e the event, the handler may modify or swap it
+                   */
+                  virtual void on_event(message::event& e) = 0;
+
+                  /** A response was read.
+                   * @param r the response, the handler may modify or swap it
+                   *
+                   * Any output belonging to the response has already been
+                   * passed to handler::on_output().
+                   */
+                  virtual void on_response(message::response& r) = 0;
+
+                  /** A line of output belonging to the response being read.
+                   * @param action_id the ActionID of the response, blank if it
+                   * has not been seen (yet)
+                   * @param line the line, without its line ending
+                   * @param header true if the line came from an 'Output'
+                   * header rather than the body of a 'Response: Follows'
+                   * message
+                   */
+                  virtual void on_output(const std::string& action_id, const std::string& line, bool header) = 0;
+            };
+
+            /** The headers to keep for each event name.
+             * Each list is sorted and must include every header anything
+             * looks at, 'Event' and 'ActionID' included.  Events not listed
+             * keep all their headers.
+             */
+            typedef boost::unordered_map<std::string, std::vector<std::string> > projection_t;
+
+            /// The sampling rule for each event name, events not listed are all kept.
+            typedef boost::unordered_map<std::string, boost::shared_ptr<sample_rule> > sampling_t;
+
+            parser();
+
+            void expect_greeting();
+            void reset();
+            void feed(const char* data, std::size_t size, handler& h);
+            void project(boost::shared_ptr<const projection_t> projection);
+            void sample(boost::shared_ptr<const sampling_t> sampling);
+
+            static std::pair<std::string, std::string> parse_header(const std::string& header);
+
+         private:
+            static std::pair<std::string, std::string> split_header(const std::string& header, std::string::size_type colon);
+            void process_line(const std::string& line, std::string::size_type colon, handler& h);
+            void process_header(const std::pair<std::string, std::string>& header, handler& h);
+            bool projected_out(const char* key, std::string::size_type size) const;
+
+            scanner m_scanner;
+            scanner::index_t m_index;
+            std::string rx;
+            bool m_greeting;
+            boost::optional<message::event> m_event;
+            boost::optional<message::response> m_response;
+            bool m_follows;
+            std::string m_action_id;
+
+            // set from another thread, read when an event starts
+            boost::shared_ptr<const projection_t> m_projection;
+            boost::shared_ptr<const projection_t> m_event_projection;
+            const std::vector<std::string>* m_keep;
+
+            // set from another thread, read when an event starts
+            boost::shared_ptr<const sampling_t> m_sampling;
+            bool m_skipping;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,156 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::prepared_action class which
+ * serializes the fixed part of an action once and reuses it.
+ */
+
+#ifndef ASTXX_MANAGER_PREPARED_ACTION_H
+#define ASTXX_MANAGER_PREPARED_ACTION_H
+
+#include "manager/basic_action.h"
+#include "manager/message.h"
+#include "manager/value.h"
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** An action whose fixed headers have been serialized in advance.
+       *
+       * Actions sent in bulk, like the originates of a dialer campaign,
+       * usually differ in only one or two headers.  A prepared_action is
+       * built once from an example action and a list of slots, the headers
+       * that change from call to call.  Everything else is formatted into a
+       * byte template straight away.  Each call then gets an instance,
+       * fills in the slots and is sent; sending one costs a copy of the
+       * template and the slot values, no message::action is built.
+       *
+       * @code
+       * std::vector<std::string> slots;
+       * slots.push_back("Channel");
+       * slots.push_back("Variable");
+       * manager::prepared_action campaign(action::originate("", "campaign", "s", "1")
+       *       .caller_id("\"Sales\" <5551000>")
+       *       .async(true), slots);
+       *
+       * for (...) {
+       *    manager::prepared_action::instance call = campaign();
+       *    call.set(0, "PJSIP/" + number).set(1, "LEAD=" + lead);
+       *    connection.send_action_async(call, handler);
+       * }
+       * @endcode
+       *
+       * Slots that are not set (or set to a blank string) are left out.  A
+       * slot header present in the example action provides the slot's
+       * default value.  The ActionID is always filled in per call, an
+       * ActionID in the example action is ignored.
+       */
+      class prepared_action {
+         private:
+            /// The template shared by all instances.
+            struct state {
+               std::string name;
+               std::string head;
+               std::vector<std::string> slots;
+               std::vector<std::string> prefixes;
+               std::vector<std::string> defaults;
+               message::action action;
+
+               state() : action("") { }
+            };
+
+         public:
+            /// One use of a prepared action, fill in the slots and send it.
+            class instance : public basic_action {
+               public:
+                  explicit instance(boost::shared_ptr<const state> s);
+
+                  /** Set a slot.
+                   * @param slot the index of the slot, in the order the slots
+                   * were given to the prepared_action
+                   * @param value the value, any type message::value_traits
+                   * knows about
+                   * @return a reference to this instance
+                   * @throw std::out_of_range if there is no such slot
+                   */
+                  template<typename T>
+                  instance& set(std::size_t slot, const T& value) {
+                     format(value, m_values.at(slot));
+                     return *this;
+                  }
+
+                  /** Set a slot by header name.
+                   * @param header the header of the slot
+                   * @param value the value
+                   * @return a reference to this instance
+                   * @throw std::out_of_range if there is no such slot
+                   */
+                  template<typename T>
+                  instance& set(const std::string& header, const T& value) {
+                     return set(slot(header), value);
+                  }
+
+                  std::size_t slot(const std::string& header) const;
+
+                  message::action action() const;
+                  bool serialize(const std::string& action_id, std::string& name, std::string& data) const;
+
+               private:
+                  static void format(const std::string& value, std::string& out) { out = value; }
+                  static void format(const char* value, std::string& out) { out = value; }
+
+                  template<typename T>
+                  static void format(const T& value, std::string& out) {
+                     message::value_traits<T>::format(value, out);
+                  }
+
+                  boost::shared_ptr<const state> m_state;
+                  std::vector<std::string> m_values;
+            };
+
+            prepared_action(const basic_action& example, const std::vector<std::string>& slots);
+            prepared_action(const message::action& example, const std::vector<std::string>& slots);
+
+            /** Start a new use of this action.
+             * @return an instance with every slot at its default
+             */
+            instance operator()() const { return instance(m_state); }
+
+            /** Get the name of the action.
+             * @return the value of the 'Action' header
+             */
+            const std::string& name() const { return m_state->name; }
+
+         private:
+            void prepare(message::action example, const std::vector<std::string>& slots);
+
+            boost::shared_ptr<const state> m_state;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,83 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::header_interest class which keeps
+ * track of the event headers subscribers have declared they read.
+ */
+
+#ifndef ASTXX_MANAGER_PROJECTION_H
+#define ASTXX_MANAGER_PROJECTION_H
+
+#include "manager/parser.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** The headers subscribers read, per event name.
+       *
+       * Subscribers either declare the headers they look at or want every
+       * header.  From the subscribers of all sources,
+       * header_interest::projection() works out what the parser needs to
+       * keep (see parser::project()).
+       *
+       * The version changes whenever the set of wanted headers does, not
+       * for every subscriber, so subscribers coming and going with the same
+       * headers do not cause the projection to be rebuilt.
+       */
+      class header_interest {
+         public:
+            header_interest() : m_version(0) { }
+
+            void add(const std::string& event, const std::vector<std::string>* headers);
+            void remove(const std::string& event, const std::vector<std::string>* headers);
+
+            /** Get the version of the wanted headers.
+             * @return a number that changes when the wanted headers do
+             */
+            unsigned long version() const { return m_version; }
+
+            static boost::shared_ptr<const parser::projection_t> projection(const std::vector<const header_interest*>& sources, const std::set<std::string>& everything);
+
+         private:
+            /// Subscriber counts for one event.
+            struct counts {
+               counts() : everything(0) { }
+
+               std::size_t everything;
+               std::map<std::string, std::size_t> headers;
+            };
+
+            boost::unordered_map<std::string, counts> m_events;
+            unsigned long m_version;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,99 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::sample_rule class which thins out
+ * noisy event streams.
+ */
+
+#ifndef ASTXX_MANAGER_SAMPLING_H
+#define ASTXX_MANAGER_SAMPLING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <boost/shared_ptr.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Sampling and rate capping for one event type.
+       *
+       * Of the events offered to sample_rule::admit(), every one_in'th is
+       * kept (all of them if one_in is 0 or 1), and of those at most
+       * max_per_second in each one second window.  The rest are dropped and
+       * counted.
+       *
+       * sample_rule::admit() is called by one thread, the one running the
+       * parser; the counters may be read from any thread.
+       *
+       * @see connection::sample_events()
+       */
+      class sample_rule {
+         public:
+            typedef std::chrono::steady_clock clock_type;
+
+            /** What happened to the events of a type.
+             * Rules replacing each other share one, so the counts stay 
+             * exact while a parser still uses the old rule.
+             */
+            struct counters {
+               counters() : dropped(0), kept(0) { }
+
+               std::atomic<unsigned long long> dropped;
+               std::atomic<unsigned long long> kept;
+            };
+
+            sample_rule(std::size_t one_in, unsigned int max_per_second, boost::shared_ptr<counters> counts = boost::shared_ptr<counters>());
+
+            bool admit();
+
+            /// Get the number of events dropped.
+            unsigned long long dropped() const { return m_counts->dropped.load(std::memory_order_relaxed); }
+            /// Get the number of events kept.
+            unsigned long long kept() const { return m_counts->kept.load(std::memory_order_relaxed); }
+            /// Get the counters, to pass to a replacement rule.
+            boost::shared_ptr<counters> counts() const { return m_counts; }
+
+            /// Get the sampling interval.
+            std::size_t one_in() const { return m_one_in; }
+            /// Get the rate cap, 0 for none.
+            unsigned int max_per_second() const { return m_max_per_second; }
+
+         private:
+            sample_rule(const sample_rule&);
+            sample_rule& operator=(const sample_rule&);
+
+            const std::size_t m_one_in;
+            const unsigned int m_max_per_second;
+
+            // only touched by the thread calling admit()
+            std::size_t m_count;
+            clock_type::time_point m_window;
+            unsigned int m_in_window;
+
+            boost::shared_ptr<counters> m_counts;
+      };
+   }
+}
+
+#endif
@@ -0,0 +1,88 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::scanner class which indexes the
+ * lines and header separators in a block of manager protocol data.
+ */
+
+#ifndef ASTXX_MANAGER_SCANNER_H
+#define ASTXX_MANAGER_SCANNER_H
+
+#include <string>
+#include <vector>
+
+namespace astxx {
+   namespace manager {
+      /** Finds line ends and header separators in received data.
+       *
+       * One pass over a block of data records the position of every '\n'
+       * and the first ':' on each line.  The manager::parser consumes this
+       * index directly: a line ending in "\r\n" is a header (with its
+       * separator already known), an empty one ends a message (the
+       * "\r\n\r\n" frame boundary) and one ending in a bare '\n' is command
+       * output.
+       *
+       * The scan uses SSE2 or AVX2 when the cpu has them, chosen at run
+       * time, and plain C++ otherwise.
+       *
+       * @code
+       * manager::scanner s;
+       * manager::scanner::index_t index;
+       * s.scan(data, size, index);
+       * @endcode
+       */
+      class scanner {
+         public:
+            /// The instruction sets a scan can use.
+            enum isa_t { scalar, sse2, avx2 };
+
+            /// One line of scanned data.
+            struct line {
+               /// the offset of the '\n' ending the line
+               std::string::size_type end;
+               /// the offset of the first ':' on the line, or npos
+               std::string::size_type colon;
+            };
+            typedef std::vector<line> index_t;
+
+            scanner();
+            explicit scanner(isa_t isa);
+
+            /** Get the instruction set this scanner uses.
+             * @return the instruction set
+             */
+            isa_t isa() const { return m_isa; }
+
+            static isa_t best();
+            static const char* name(isa_t isa);
+
+            void scan(const char* data, std::string::size_type size, index_t& index) const;
+
+         private:
+            isa_t m_isa;
+      };
+   }
+}
+
+#endif
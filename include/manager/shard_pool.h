@@ -0,0 +1,134 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::shard_pool class which runs many
+ * connections on a thread per core.
+ */
+
+#ifndef ASTXX_MANAGER_SHARD_POOL_H
+#define ASTXX_MANAGER_SHARD_POOL_H
+
+#include "manager/connection.h"
+
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Connections spread over a thread per core.
+       *
+       * Each shard is an io_service run by its own thread, pinned to a cpu.
+       * Connections are assigned to a shard by a hash of their name and
+       * from then on everything about them (connecting, reading, parsing,
+       * running handlers, timers) happens on that shard's thread, so none
+       * of it needs a lock.  The connections are created on their shard's
+       * thread too, so their buffers are allocated on the memory node of
+       * that cpu.  Pick the cpus to keep the pool on one NUMA node.
+       *
+       * Work crosses shards by message passing: shard_pool::post() runs a
+       * function on a shard, or with a connection on whichever shard owns
+       * it.
+       *
+       * @code
+       * manager::shard_pool pool;  // one shard per cpu
+       * for (std::size_t i = 0; i < pbxes.size(); ++i) {
+       *    pool.add(pbxes[i].name, pbxes[i].host, 5038, [](manager::connection& c) {
+       *       manager::action::login("user", "secret")(c);
+       *       c.register_event("Hangup", on_hangup);  // runs on the shard
+       *    });
+       * }
+       * pool.post("pbx7", [](manager::connection& c) {
+       *    c.send_action_async(manager::action::ping(), on_pong);
+       * });
+       * @endcode
+       *
+       * The setup function is called on the shard once the connection is
+       * established and may block, to log in for instance.  After that the
+       * connection is driven by its shard (see
+       * connection::start_external_io()), so handlers and posted functions
+       * must send actions with connection::send_action_async().  A
+       * connection that fails is removed and its error handler is called.
+       */
+      class shard_pool {
+         public:
+            typedef boost::function<void (connection&)> setup_t;
+            typedef boost::function<void (connection&)> connection_task_t;
+            typedef boost::function<void ()> task_t;
+            /// Called on the shard when a connection fails, rethrow the exception to see why.
+            typedef boost::function<void (const std::string&, std::exception_ptr)> error_handler_t;
+
+            explicit shard_pool(std::size_t shards = 0, bool pin = true);
+            explicit shard_pool(const std::vector<int>& cpus);
+            ~shard_pool();
+
+            void add(const std::string& name, const std::string& host, unsigned short port, setup_t setup, error_handler_t error_handler = error_handler_t());
+            void remove(const std::string& name);
+
+            void post(std::size_t shard, task_t task);
+            void post(const std::string& name, connection_task_t task);
+
+            std::size_t shard_of(const std::string& name) const;
+            static std::size_t current();
+            boost::asio::io_service& get_io_service(std::size_t shard);
+
+            void stop();
+
+            /** Get the number of shards.
+             * @return the number of shards
+             */
+            std::size_t size() const { return shards.size(); }
+
+         private:
+            shard_pool(const shard_pool&);
+            shard_pool& operator=(const shard_pool&);
+
+            struct member;
+            struct shard;
+            typedef boost::shared_ptr<member> member_ptr;
+
+            void start(const std::vector<int>& cpus);
+            void run(std::size_t index);
+            void sweep(std::size_t index);
+            void connect(std::size_t index, const std::string& name, const std::string& host, unsigned short port, setup_t setup, error_handler_t error_handler);
+            void handle_connect(std::size_t index, boost::weak_ptr<member> m, const boost::system::error_code& error);
+            void activate(std::size_t index, boost::weak_ptr<member> m);
+            void wait_read(std::size_t index, member_ptr m);
+            void wait_write(std::size_t index, member_ptr m);
+            void handle_ready(std::size_t index, member_ptr m, bool write, const boost::system::error_code& error);
+            void flush(std::size_t index, member_ptr m);
+            void fail(std::size_t index, member_ptr m, std::exception_ptr error);
+            void close(std::size_t index, const std::string& name);
+            void run_task(std::size_t index, const std::string& name, connection_task_t task);
+
+            std::vector<boost::shared_ptr<shard> > shards;
+      };
+   }
+}
+
+#endif
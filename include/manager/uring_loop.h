@@ -0,0 +1,100 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains the astxx::manager::uring_loop class which does the
+ * socket I/O of many connections through Linux io_uring.
+ */
+
+#ifndef ASTXX_MANAGER_URING_LOOP_H
+#define ASTXX_MANAGER_URING_LOOP_H
+
+#include "manager/connection.h"
+
+#include <chrono>
+#include <cstddef>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/system/error_code.hpp>
+
+namespace astxx {
+   namespace manager {
+      /** Socket I/O for many connections through one io_uring.
+       *
+       * Each connection added gets a multishot receive that the kernel
+       * completes into a ring of provided buffers, so data arriving costs no
+       * system call at all until uring_loop::run_once() collects it.  Writes
+       * the connections queue are gathered and submitted together, along
+       * with the wait for completions, in one system call per round.  The
+       * data is fed to the connection's usual parser; events and responses
+       * are dispatched by connection::process_events() and
+       * connection::process_responses() as always.
+       *
+       * @code
+       * manager::uring_loop loop;
+       * loop.add(connection);      // logged in already
+       * for (;;) {
+       *    loop.run_once(std::chrono::seconds(1));
+       *    connection.pump_messages(); // action timeouts
+       *    connection.process_events();
+       *    connection.process_responses();
+       * }
+       * @endcode
+       *
+       * This needs Linux 6.0 or later, check uring_loop::available().  The
+       * buffer ring is tested when the loop is set up, kernels that do not
+       * select from it get the buffers handed over one operation at a time
+       * instead.  A uring_loop and its connections must be used from one
+       * thread.  Remove connections before disconnecting or destroying
+       * them.
+       *
+       * @see connection::start_external_io()
+       */
+      class uring_loop {
+         public:
+            /// Called when a connection fails, it has been removed by then.
+            typedef boost::function<void (connection&, boost::system::error_code)> error_handler_t;
+            typedef std::chrono::steady_clock::duration duration;
+
+            static bool available();
+
+            uring_loop(unsigned int entries = 256, std::size_t buffer_size = 16384, unsigned int buffers = 256);
+            ~uring_loop();
+
+            void add(connection& c, error_handler_t error_handler = error_handler_t());
+            void remove(connection& c);
+            std::size_t run_once(duration timeout = duration::max());
+
+            std::size_t size() const;
+
+         private:
+            uring_loop(const uring_loop&);
+            uring_loop& operator=(const uring_loop&);
+
+            struct impl;
+            boost::scoped_ptr<impl> m_impl;
+      };
+   }
+}
+
+#endif
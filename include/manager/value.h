@@ -0,0 +1,304 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/** @file
+ *
+ * Don't include this file directly, include astxx/manager.h instead.
+ *
+ * This file contains astxx::manager::message::value_traits which converts
+ * header values to and from typed values for basic_message::get() and
+ * basic_message::set().
+ */
+
+#ifndef ASTXX_MANAGER_VALUE_H
+#define ASTXX_MANAGER_VALUE_H
+
+#include <string>
+#include <limits>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/is_signed.hpp>
+
+#if defined(__has_include)
+#if __has_include(<charconv>) && __cplusplus >= 201703L
+#include <charconv>
+#endif
+#endif
+
+namespace astxx {
+   namespace manager {
+      namespace message {
+         /// The type of timestamps (such as the 'Timestamp' header).
+         typedef std::chrono::system_clock::time_point time_point;
+
+         /** Channel states, as found in 'ChannelState' headers.
+          * @code
+          * message::channel_state state = e.get_enum<message::channel_state>("ChannelState");
+          * @endcode
+          */
+         enum channel_state {
+            state_down = 0,
+            state_reserved = 1,
+            state_offhook = 2,
+            state_dialing = 3,
+            state_ring = 4,
+            state_ringing = 5,
+            state_up = 6,
+            state_busy = 7,
+            state_dialing_offhook = 8,
+            state_prering = 9,
+            state_unknown = 10
+         };
+
+         /** Convert header values to and from T.
+          *
+          * Specializations provide:
+          * @code
+          * static bool parse(const char* begin, const char* end, T& value);
+          * static void format(const T& value, std::string& out);
+          * @endcode
+          *
+          * parse() works directly on the stored bytes and returns false
+          * instead of throwing if they are not a valid T.  format() replaces
+          * the contents of out, reusing its storage.  Specialize this for
+          * your own types to use them with basic_message::get() and
+          * basic_message::set().
+          */
+         template<typename T, typename Enable = void>
+         struct value_traits;
+
+         /// Integers, in decimal.
+         template<typename T>
+         struct value_traits<T, typename boost::enable_if_c<boost::is_integral<T>::value and not boost::is_same<T, bool>::value>::type> {
+            static bool parse(const char* begin, const char* end, T& value) {
+               bool negative = false;
+               if (begin != end and *begin == '-' and boost::is_signed<T>::value) {
+                  negative = true;
+                  ++begin;
+               }
+               if (begin == end)
+                  return false;
+
+               // accumulate towards the sign so the most negative value fits
+               T result = 0;
+               for (; begin != end; ++begin) {
+                  if (*begin < '0' or *begin > '9')
+                     return false;
+
+                  T digit = *begin - '0';
+                  if (negative) {
+                     if (result < (std::numeric_limits<T>::min() + digit) / 10)
+                        return false;
+                     result = result * 10 - digit;
+                  }
+                  else {
+                     if (result > (std::numeric_limits<T>::max() - digit) / 10)
+                        return false;
+                     result = result * 10 + digit;
+                  }
+               }
+
+               value = result;
+               return true;
+            }
+
+            static void format(T value, std::string& out) {
+               char buffer[std::numeric_limits<T>::digits10 + 3];
+               char* end = buffer + sizeof(buffer);
+               char* p = end;
+
+               bool negative = value < 0;
+               do {
+                  T digit = value % 10;
+                  *--p = '0' + static_cast<char>(negative ? -digit : digit);
+                  value /= 10;
+               } while (value);
+
+               if (negative)
+                  *--p = '-';
+
+               out.assign(p, end);
+            }
+         };
+
+         /// Booleans, accepting the same spellings as Asterisk's ast_true() and ast_false().
+         template<>
+         struct value_traits<bool> {
+            static bool parse(const char* begin, const char* end, bool& value) {
+               static const char* const yes[] = { "yes", "true", "y", "t", "1", "on" };
+               static const char* const no[] = { "no", "false", "n", "f", "0", "off" };
+
+               for (std::size_t i = 0; i < sizeof(yes) / sizeof(yes[0]); ++i) {
+                  if (matches(begin, end, yes[i])) {
+                     value = true;
+                     return true;
+                  }
+                  if (matches(begin, end, no[i])) {
+                     value = false;
+                     return true;
+                  }
+               }
+               return false;
+            }
+
+            static void format(bool value, std::string& out) {
+               out.assign(value ? "true" : "false");
+            }
+
+            private:
+               /// case insensitive comparison with a lower case word
+               static bool matches(const char* begin, const char* end, const char* word) {
+                  for (; begin != end and *word; ++begin, ++word) {
+                     char c = *begin;
+                     if (c >= 'A' and c <= 'Z')
+                        c += 'a' - 'A';
+                     if (c != *word)
+                        return false;
+                  }
+                  return begin == end and not *word;
+               }
+         };
+
+         /// Floating point numbers.
+         template<>
+         struct value_traits<double> {
+            static bool parse(const char* begin, const char* end, double& value) {
+#if defined(__cpp_lib_to_chars)
+               std::from_chars_result r = std::from_chars(begin, end, value);
+               return r.ec == std::errc() and r.ptr == end;
+#else
+               // strtod() needs a nul after the number, which [begin, end)
+               // need not have, so parse a copy
+               if (begin == end)
+                  return false;
+               std::size_t size = end - begin;
+               char buffer[64];
+               std::string long_value;
+               const char* s = buffer;
+               if (size < sizeof(buffer)) {
+                  std::memcpy(buffer, begin, size);
+                  buffer[size] = '\0';
+               }
+               else {
+                  long_value.assign(begin, end);
+                  s = long_value.c_str();
+               }
+               char* stop;
+               value = std::strtod(s, &stop);
+               return stop == s + size;
+#endif
+            }
+
+            static void format(double value, std::string& out) {
+               char buffer[32];
+#if defined(__cpp_lib_to_chars)
+               std::to_chars_result r = std::to_chars(buffer, buffer + sizeof(buffer), value);
+               out.assign(buffer, r.ptr);
+#else
+               int n = std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+               out.assign(buffer, n);
+#endif
+            }
+         };
+
+         /** Timestamps, as seconds since the epoch with an optional fraction.
+          * A leading '-' applies to the fraction too, so "-1.5" is a second
+          * and a half before the epoch.
+          */
+         template<>
+         struct value_traits<time_point> {
+            static bool parse(const char* begin, const char* end, time_point& value) {
+               bool negative = begin != end and *begin == '-';
+               const char* dot = begin;
+               while (dot != end and *dot != '.')
+                  ++dot;
+
+               boost::int64_t seconds;
+               if (not value_traits<boost::int64_t>::parse(begin, dot, seconds))
+                  return false;
+
+               // keep microseconds, which is what Asterisk sends
+               boost::int64_t micro = 0;
+               if (dot != end) {
+                  const char* p = dot + 1;
+                  if (p == end)
+                     return false;
+                  int digits = 0;
+                  for (; p != end; ++p) {
+                     if (*p < '0' or *p > '9')
+                        return false;
+                     if (digits < 6) {
+                        micro = micro * 10 + (*p - '0');
+                        ++digits;
+                     }
+                  }
+                  for (; digits < 6; ++digits)
+                     micro *= 10;
+               }
+
+               std::chrono::microseconds since = std::chrono::seconds(seconds);
+               since += std::chrono::microseconds(negative ? -micro : micro);
+               value = time_point(std::chrono::duration_cast<time_point::duration>(since));
+               return true;
+            }
+
+            static void format(const time_point& value, std::string& out) {
+               boost::int64_t micro = std::chrono::duration_cast<std::chrono::microseconds>(value.time_since_epoch()).count();
+
+               // write the sign and then the magnitude, the way parse() reads
+               // it, so the fraction digits are never negative
+               bool negative = micro < 0;
+               boost::uint64_t magnitude = negative ? 0 - static_cast<boost::uint64_t>(micro) : static_cast<boost::uint64_t>(micro);
+               value_traits<boost::uint64_t>::format(magnitude / 1000000, out);
+               if (negative)
+                  out.insert(out.begin(), '-');
+
+               char fraction[8];
+               fraction[0] = '.';
+               boost::uint64_t f = magnitude % 1000000;
+               for (int i = 6; i > 0; --i, f /= 10)
+                  fraction[i] = '0' + static_cast<char>(f % 10);
+               out.append(fraction, 7);
+            }
+         };
+
+         /// Strings, as they are.
+         template<>
+         struct value_traits<std::string> {
+            static bool parse(const char* begin, const char* end, std::string& value) {
+               value.assign(begin, end);
+               return true;
+            }
+
+            static void format(const std::string& value, std::string& out) {
+               out = value;
+            }
+         };
+      }
+   }
+}
+
+#endif
@@ -0,0 +1,243 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/admission.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace astxx {
+   namespace manager {
+      /** Construct an admission controller with default settings.
+       *
+       * The defaults allow 8 actions in flight initially and let the window
+       * float between 1 and 256 actions with a latency target of 500ms.  No
+       * rate limits are set.
+       */
+      admission_control::admission_control() :
+         m_enabled(true),
+         m_window(8),
+         m_initial_window(8),
+         m_min_window(1),
+         m_max_window(256),
+         m_backoff(0.5),
+         m_latency_target(std::chrono::milliseconds(500)),
+         m_in_flight(0),
+         m_latency(duration::zero()),
+         m_last_decrease() {
+      }
+
+      /** Enable or disable admission control.
+       * @param state set to false to send every action immediately
+       * @return a reference to this object
+       */
+      admission_control& admission_control::enabled(bool state) {
+         m_enabled = state;
+         return *this;
+      }
+
+      /** Set the window bounds.
+       * @param initial the initial number of actions allowed in flight
+       * @param min the smallest the window may shrink to
+       * @param max the largest the window may grow to
+       *
+       * The current window is reset to the initial value.
+       *
+       * @return a reference to this object
+       */
+      admission_control& admission_control::window(unsigned int initial, unsigned int min, unsigned int max) {
+         m_min_window = std::max(1u, min);
+         m_max_window = std::max(m_min_window, static_cast<double>(max));
+         m_initial_window = std::min(m_max_window, std::max(m_min_window, static_cast<double>(initial)));
+         m_window = m_initial_window;
+         return *this;
+      }
+
+      /** Set the latency target.
+       * @param target responses slower than this shrink the window
+       * @return a reference to this object
+       */
+      admission_control& admission_control::latency_target(duration target) {
+         m_latency_target = target;
+         return *this;
+      }
+
+      /** Set the multiplicative decrease factor.
+       * @param factor the window is multiplied by this value (0 < factor < 1)
+       * when the latency target is exceeded
+       * @return a reference to this object
+       */
+      admission_control& admission_control::backoff(double factor) {
+         if (factor > 0 and factor < 1)
+            m_backoff = factor;
+         return *this;
+      }
+
+      /** Limit the rate of an action type.
+       * @param action the action name (the value of the 'Action' header)
+       * @param rate the sustained number of actions allowed per second
+       * @param burst the number of actions that may be sent back to back
+       * @return a reference to this object
+       * @throw std::invalid_argument if rate is not positive, use
+       * admission_control::clear_rate_limit() to lift a limit
+       */
+      admission_control& admission_control::rate_limit(const std::string& action, double rate, double burst) {
+         if (not (rate > 0))
+            throw std::invalid_argument("admission_control::rate_limit() needs a positive rate");
+
+         bucket b;
+         b.rate = rate;
+         b.burst = std::max(1.0, burst);
+         b.tokens = b.burst;
+         b.updated = clock_type::now();
+         buckets[action] = b;
+         return *this;
+      }
+
+      /** Remove the rate limit on an action type.
+       * @param action the action name
+       * @return a reference to this object
+       */
+      admission_control& admission_control::clear_rate_limit(const std::string& action) {
+         buckets.erase(action);
+         return *this;
+      }
+
+      /** Check if the window is full.
+       * @return true if no more actions may be put in flight right now
+       */
+      bool admission_control::window_full() const {
+         return m_enabled and m_in_flight >= window();
+      }
+
+      /** Check if an action may be sent now.
+       * @param action the action name
+       * @param now the current time
+       * @return true if the action may be sent
+       */
+      bool admission_control::admit(const std::string& action, time_point now) {
+         if (not m_enabled)
+            return true;
+
+         if (window_full())
+            return false;
+
+         buckets_t::iterator i = buckets.find(action);
+         if (i == buckets.end())
+            return true;
+
+         refill(i->second, now);
+         return i->second.tokens >= 1;
+      }
+
+      /** Get the earliest time an action could pass its rate limit.
+       * @param action the action name
+       * @param now the current time
+       * @note This does not take the window into account.
+       * @return the time a token will be available for this action
+       */
+      admission_control::time_point admission_control::next_admission(const std::string& action, time_point now) const {
+         buckets_t::const_iterator i = buckets.find(action);
+         if (not m_enabled or i == buckets.end() or i->second.rate <= 0)
+            return now;
+
+         bucket b = i->second;
+         double tokens = std::min(b.burst, b.tokens + b.rate * std::chrono::duration<double>(now - b.updated).count());
+         if (tokens >= 1)
+            return now;
+
+         return now + std::chrono::duration_cast<duration>(std::chrono::duration<double>((1 - tokens) / b.rate));
+      }
+
+      /** Record that an action was sent.
+       * @param action the action name
+       * @param now the current time
+       */
+      void admission_control::sent(const std::string& action, time_point now) {
+         ++m_in_flight;
+
+         buckets_t::iterator i = buckets.find(action);
+         if (i != buckets.end()) {
+            refill(i->second, now);
+            i->second.tokens -= 1;
+         }
+      }
+
+      /** Record that a response was received.
+       * @param latency the time between sending the action and receiving its
+       * response
+       * @param now the current time
+       */
+      void admission_control::answered(duration latency, time_point now) {
+         if (m_in_flight)
+            --m_in_flight;
+
+         // keep a smoothed latency (1/8 gain, as TCP does for srtt), it
+         // doubles as our idea of a round trip below
+         if (m_latency == duration::zero())
+            m_latency = latency;
+         else
+            m_latency += (latency - m_latency) / 8;
+
+         if (latency > m_latency_target) {
+            // only back off once per round trip, otherwise a single slow
+            // burst would collapse the window
+            if (now - m_last_decrease >= m_latency) {
+               m_window = std::max(m_min_window, m_window * m_backoff);
+               m_last_decrease = now;
+            }
+         }
+         else {
+            // grow by about one action per window's worth of responses
+            m_window = std::min(m_max_window, m_window + 1 / m_window);
+         }
+      }
+
+      /** Record that an action in flight was abandoned.
+       * The action's slot in the window is freed without a latency sample, 
+       * this is used when an action is cancelled.
+       */
+      void admission_control::released() {
+         if (m_in_flight)
+            --m_in_flight;
+      }
+
+      /** Forget all in flight actions and return to the initial window.
+       * This is called when the connection is (re)established.
+       */
+      void admission_control::reset() {
+         m_window = m_initial_window;
+         m_in_flight = 0;
+         m_latency = duration::zero();
+         m_last_decrease = time_point();
+      }
+
+      /** Add the tokens earned since the bucket was last updated.
+       * @param b the bucket
+       * @param now the current time
+       */
+      void admission_control::refill(bucket& b, time_point now) {
+         if (now > b.updated) {
+            b.tokens = std::min(b.burst, b.tokens + b.rate * std::chrono::duration<double>(now - b.updated).count());
+            b.updated = now;
+         }
+      }
+   }
+}
+
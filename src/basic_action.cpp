@@ -23,17 +23,138 @@
 #include "manager/message.h"
 #include "manager/error.h"
 
+#include <boost/unordered_map.hpp>
+
 namespace astxx {
    namespace manager {
+      namespace {
+         /// 'Message' header values and the errors they mean.
+         typedef boost::unordered_map<std::string, errc::errc_t> error_table_t;
+
+         /** Build the table of errors common to most actions.
+          * @return the table
+          */
+         error_table_t default_errors() {
+            error_table_t table;
+            table[permission_error_string] = errc::permission_denied;
+            table[authentication_error_string] = errc::authentication_required;
+            table["No timeout specified"] = errc::missing_data;
+            table["No channel specified"] = errc::missing_data;
+            table["Channel not specified"] = errc::missing_data;
+            table["Extension not specified"] = errc::missing_data;
+            table["No variable specified"] = errc::missing_data;
+            table["No value specified"] = errc::missing_data;
+            table["Mailbox not specified"] = errc::missing_data;
+            table["Invalid priority"] = errc::bad_data;
+            table["Invalid channel"] = errc::bad_data;
+            table["Invalid timeout"] = errc::bad_data;
+            table["No such channel"] = errc::channel_not_found;
+            return table;
+         }
+
+         /** Get the error table.
+          * @return the table, filled with the defaults on first use
+          */
+         error_table_t& error_table() {
+            static error_table_t table = default_errors();
+            return table;
+         }
+      }
+
+      /** Classify an error 'Message'.
+       * @param message the value of the 'Message' header of a 'Response: 
+       * Error' message
+       * @param error the error it means
+       *
+       * basic_action::check_response() looks messages up in a hash table 
+       * which starts out with the errors common to most actions.  This adds 
+       * to it or changes an entry, for example:
+       *
+       * @code
+       * basic_action::register_error("Originate failed", errc::action_failed);
+       * @endcode
+       *
+       * @warning The table is shared and not locked, register errors before 
+       * sending actions from other threads.
+       */
+      void basic_action::register_error(const std::string& message, errc::errc_t error) {
+         error_table()[message] = error;
+      }
+
+      /** Check a response from Asterisk for errors.
+       * @param response the response to check
+       *
+       * The default implementation looks the 'Message' header of 'Response: 
+       * Error' messages up in the table described at 
+       * basic_action::register_error().  Unknown messages are not errors.  
+       * Nothing is copied and no exception is thrown.
+       *
+       * @return the error, or a default constructed error_code if there was 
+       * none
+       */
+      boost::system::error_code basic_action::check_response(const message::response& response) const {
+         const std::string* type = response.find(response.traits.main_header());
+         if (not type or *type != "Error")
+            return boost::system::error_code();
+
+         const std::string* m = response.find("Message");
+         if (not m)
+            return boost::system::error_code();
+
+         error_table_t::const_iterator i = error_table().find(*m);
+         if (i == error_table().end())
+            return boost::system::error_code();
+
+         return make_error_code(i->second);
+      }
+
+      /** Throw the exception for an error.
+       * @param error the error, from basic_action::check_response()
+       * @param response the response the error came from
+       * @throw manager::permission_denied for errc::permission_denied
+       * @throw manager::authentication_required for 
+       * errc::authentication_required
+       * @throw manager::action::missing_data for errc::missing_data
+       * @throw manager::action::bad_data for errc::bad_data
+       * @throw manager::action::channel_not_found for 
+       * errc::channel_not_found
+       * @throw manager::action::error for errc::action_failed
+       * @throw manager::timeout, manager::cancelled or 
+       * boost::system::system_error for errors from other categories, like 
+       * throw_action_error()
+       */
+      void basic_action::throw_error(const boost::system::error_code& error, const message::response& response) const {
+         if (error.category() != error_category())
+            throw_action_error(error);
+
+         const std::string* m = response.find("Message");
+         std::string message = m ? *m : error.message();
+
+         switch (error.value()) {
+            case errc::permission_denied:
+               throw manager::permission_denied();
+            case errc::authentication_required:
+               throw manager::authentication_required();
+            case errc::missing_data:
+               throw action::missing_data(message, action());
+            case errc::bad_data:
+               throw action::bad_data(message, action());
+            case errc::channel_not_found:
+               throw action::channel_not_found(message, action());
+            default:
+               throw action::error(message, action());
+         }
+      }
+
       /** Handle a response from Asterisk.
        * @param response the response to handle
        *
        * This function is called from basic_action::operator()() and passed the 
        * response from Asterisk.  This function may opt to throw exceptions if 
-       * an error occours.  The default implementation handles errors common to 
-       * most manager actions.  Overriding methods should call this method 
-       * before processing the response if they would like to keep this error 
-       * handling.
+       * an error occours.  The default implementation throws for the errors 
+       * basic_action::check_response() finds.  Overriding methods should call 
+       * this method before processing the response if they would like to 
+       * keep this error handling.
        *
        * @return the message::response we were passed
        *
@@ -44,49 +165,13 @@ namespace astxx {
        * (invalid priority, channel, timeout...)
        * @throw manager::action::channel_not_found if the given channel was not 
        * found
+       * @throw manager::action::error for other errors registered with 
+       * basic_action::register_error()
        */
       message::response basic_action::handle_response(message::response response) {
-         if (response == "Error") {
-            if (response["Message"] == permission_error_string) {
-               throw manager::permission_denied();
-            }
-            else if (response["Message"] == authentication_error_string) {
-               throw manager::authentication_required();
-            }
-            else if (response["Message"] == "No timeout specified") {
-               throw action::missing_data(response["Message"], action());
-            }
-            else if (response["Message"] == "No channel specified") {
-               throw action::missing_data(response["Message"], action());
-            }
-            else if (response["Message"] == "Channel not specified") {
-               throw action::missing_data(response["Message"], action());
-            }
-            else if (response["Message"] == "Extension not specified") {
-               throw action::missing_data(response["Message"], action());
-            }
-            else if (response["Message"] == "No variable specified") {
-               throw action::missing_data(response["Message"], action());
-            }
-            else if (response["Message"] == "No value specified") {
-               throw action::missing_data(response["Message"], action());
-            }
-            else if (response["Message"] == "Mailbox not specified") {
-               throw action::missing_data(response["Message"], action());
-            }
-            else if (response["Message"] == "Invalid priority") {
-               throw action::bad_data(response["Message"], action());
-            }
-            else if (response["Message"] == "Invalid channel") {
-               throw action::bad_data(response["Message"], action());
-            }
-            else if (response["Message"] == "Invalid timeout") {
-               throw action::bad_data(response["Message"], action());
-            }
-            else if (response["Message"] == "No such channel") {
-               throw action::channel_not_found(response["Message"], action());
-            }
-         }
+         boost::system::error_code e = check_response(response);
+         if (e)
+            throw_error(e, response);
          return response;
       }
 
@@ -103,6 +188,29 @@ namespace astxx {
       message::response basic_action::operator()(connection& c) {
          return handle_response(c(*this));
       }
+
+      /** Send this action over this connection without throwing on errors.
+       * @param c the connection to use
+       *
+       * Errors found by basic_action::check_response(), timeouts and 
+       * cancellation are returned instead of thrown.  Responses without an 
+       * error are still passed through basic_action::handle_response(), so 
+       * actions that collect results from the response keep working; 
+       * exceptions an overriding handle_response() throws itself (like 
+       * login::error) are not caught.
+       *
+       * @return the response from Asterisk, or the error
+       */
+      expected<message::response> basic_action::operator()(connection& c, use_expected_t) {
+         expected<message::response> r = c.send_action(*this, use_expected);
+         if (not r)
+            return r;
+
+         boost::system::error_code e = check_response(*r);
+         if (e)
+            return make_unexpected(e);
+
+         return handle_response(*r);
+      }
    }
 }
-
@@ -0,0 +1,702 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/columnar.h"
+#include "manager/connection.h"
+#include "manager/error.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         const char file_magic[8] = { 'A', 'S', 'T', 'X', 'X', 'C', 'O', 'L' };
+         const boost::uint32_t file_version = 1;
+         const boost::uint32_t block_magic = 0x4b424341;  // "ACBK"
+         const std::size_t alignment = 64;
+
+         /** The start of a column file, followed by the schema.
+          */
+         struct file_header {
+            char magic[8];
+            boost::uint32_t version;
+            boost::uint32_t columns;
+            boost::uint64_t blocks;
+            boost::uint64_t used;
+            boost::uint64_t data_offset;
+            boost::uint32_t block_rows;
+            boost::uint32_t reserved;
+         };
+
+         /** The start of a block, followed by a block_column per column.
+          */
+         struct block_header {
+            boost::uint32_t magic;
+            boost::uint32_t rows;
+            boost::uint64_t size;
+         };
+
+         struct block_column {
+            boost::uint64_t values;
+            boost::uint64_t validity;
+            boost::uint64_t dictionary;
+            boost::uint32_t nulls;
+            boost::uint32_t words;
+         };
+
+         boost::system::error_code errno_code(int e) {
+            return boost::system::error_code(e, boost::system::system_category());
+         }
+
+         std::size_t align(std::size_t n) {
+            return (n + alignment - 1) & ~(alignment - 1);
+         }
+
+         /** Count the days from 1970-01-01 to a date in the proleptic
+          * Gregorian calendar, without going through the time zone.
+          */
+         boost::int64_t days_from_civil(boost::int64_t y, unsigned m, unsigned d) {
+            y -= m <= 2;
+            boost::int64_t era = (y >= 0 ? y : y - 399) / 400;
+            unsigned yoe = static_cast<unsigned>(y - era * 400);
+            unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+            unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+            return era * 146097 + static_cast<boost::int64_t>(doe) - 719468;
+         }
+
+         bool digits(const char* p, int n, int& value) {
+            value = 0;
+            for (int i = 0; i < n; ++i) {
+               if (p[i] < '0' or p[i] > '9')
+                  return false;
+               value = value * 10 + (p[i] - '0');
+            }
+            return true;
+         }
+
+         /** Parse a time as epoch seconds or as "YYYY-MM-DD HH:MM:SS",
+          * which is how Asterisk writes CDR times.
+          * @return false if it is neither
+          */
+         bool parse_time(const std::string& s, boost::int64_t& micro) {
+            message::time_point t;
+            if (message::value_traits<message::time_point>::parse(s.data(), s.data() + s.size(), t)) {
+               micro = std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+               return true;
+            }
+
+            const char* p = s.data();
+            int y, mo, d, h, mi, se;
+            if (s.size() != 19 or p[4] != '-' or p[7] != '-' or (p[10] != ' ' and p[10] != 'T') or p[13] != ':' or p[16] != ':'
+                  or not digits(p, 4, y) or not digits(p + 5, 2, mo) or not digits(p + 8, 2, d)
+                  or not digits(p + 11, 2, h) or not digits(p + 14, 2, mi) or not digits(p + 17, 2, se)
+                  or mo < 1 or mo > 12 or d < 1 or d > 31 or h > 23 or mi > 59 or se > 60)
+               return false;
+
+            micro = ((days_from_civil(y, mo, d) * 24 + h) * 60 + mi) * 60 + se;
+            micro *= 1000000;
+            return true;
+         }
+
+         template<typename T>
+         void put(char* base, std::size_t& pos, const T& value) {
+            std::memcpy(base + pos, &value, sizeof(value));
+            pos += sizeof(value);
+         }
+      }
+
+      /** Start a table.
+       * @param directory the directory to write files in, created if it
+       * does not exist
+       * @param table the name of the table, which names its files
+       * @param block_rows how many rows to collect before writing a block
+       * @param file_size the size at which to start a new file, files are
+       * this size while they are written and cut down when closed
+       * @throw boost::system::system_error if the directory can't be
+       * created
+       */
+      columnar_exporter::columnar_exporter(const std::string& directory, const std::string& table, std::size_t block_rows, std::size_t file_size) :
+         m_directory(directory),
+         m_table(table),
+         m_block_rows(std::max<std::size_t>(block_rows, 1)),
+         m_file_size(file_size),
+         m_pending(0),
+         m_rows(0),
+         m_fd(-1),
+         m_map(0),
+         m_mapped(0),
+         m_used(0) {
+
+         if (::mkdir(directory.c_str(), 0755) < 0 and errno != EEXIST)
+            throw boost::system::system_error(errno_code(errno));
+      }
+
+      /** Write what is left and close the current file.
+       */
+      columnar_exporter::~columnar_exporter() {
+         try {
+            flush();
+         }
+         catch (...) {
+         }
+         close_file();
+      }
+
+      /** Add a column.
+       * @param header the event header the column holds
+       * @param type the type to store its values as
+       * @return this exporter, so columns can be chained
+       * @throw std::logic_error if rows were added already
+       */
+      columnar_exporter& columnar_exporter::column(const std::string& header, column_type type) {
+         if (m_rows)
+            throw std::logic_error("columnar_exporter::column() called after rows were added");
+
+         column_data c;
+         c.header = header;
+         c.type = type;
+         c.nulls = 0;
+         m_columns.push_back(c);
+         m_headers.push_back(header);
+
+         column_data& added = m_columns.back();
+         if (type == string_column)
+            added.codes.reserve(m_block_rows);
+         else if (type == real_column)
+            added.reals.reserve(m_block_rows);
+         else
+            added.integers.reserve(m_block_rows);
+         added.validity.assign((m_block_rows + 7) / 8, 0);
+         return *this;
+      }
+
+      /** Feed this table from a connection.
+       * @param c the connection
+       * @param event the event to take rows from
+       * @param max_size the most events to deliver at a time, zero for
+       * the connection's default
+       * @param max_latency the longest to hold events for a batch
+       * @return the batch handle, see connection::register_batch()
+       */
+      event_batcher::handle columnar_exporter::attach(connection& c, const std::string& event, std::size_t max_size, event_batcher::duration max_latency) {
+         void (columnar_exporter::*f)(event_batcher::batch_t) = &columnar_exporter::add;
+         return c.register_batch(event, boost::bind(f, this, _1), m_headers, max_size, max_latency);
+      }
+
+      /** Add a row per event.
+       * @param events the events
+       * @throw boost::system::system_error if a block could not be written
+       */
+      void columnar_exporter::add(event_batcher::batch_t events) {
+         for (const message::event* e = events.begin(); e != events.end(); ++e)
+            add(*e);
+      }
+
+      /** Add a row.
+       * @param e the event
+       * @throw boost::system::system_error if a block could not be written
+       */
+      void columnar_exporter::add(const message::event& e) {
+         const std::size_t row = m_pending;
+         for (std::vector<column_data>::iterator c = m_columns.begin(); c != m_columns.end(); ++c) {
+            const std::string* v = e.find(c->header);
+            bool valid = v;
+            switch (c->type) {
+               case string_column: {
+                  boost::uint32_t code = 0;
+                  if (v) {
+                     boost::unordered_map<std::string, boost::uint32_t>::iterator w = c->dictionary.find(*v);
+                     if (w == c->dictionary.end()) {
+                        w = c->dictionary.insert(std::make_pair(*v, static_cast<boost::uint32_t>(c->words.size()))).first;
+                        c->words.push_back(&w->first);
+                     }
+                     code = w->second;
+                  }
+                  c->codes.push_back(code);
+                  break;
+               }
+               case integer_column: {
+                  boost::int64_t n = 0;
+                  valid = v and message::value_traits<boost::int64_t>::parse(v->data(), v->data() + v->size(), n);
+                  c->integers.push_back(valid ? n : 0);
+                  break;
+               }
+               case real_column: {
+                  double n = 0;
+                  valid = v and message::value_traits<double>::parse(v->data(), v->data() + v->size(), n);
+                  c->reals.push_back(valid ? n : 0);
+                  break;
+               }
+               case time_column: {
+                  boost::int64_t micro = 0;
+                  valid = v and parse_time(*v, micro);
+                  c->integers.push_back(valid ? micro : 0);
+                  break;
+               }
+            }
+
+            if (valid)
+               c->validity[row / 8] |= static_cast<unsigned char>(1 << (row % 8));
+            else
+               ++c->nulls;
+         }
+
+         ++m_rows;
+         if (++m_pending == m_block_rows)
+            write_block();
+      }
+
+      /** Write the rows added so far as a block, which may be short.
+       * @throw boost::system::system_error if the block could not be
+       * written
+       */
+      void columnar_exporter::flush() {
+         write_block();
+      }
+
+      void columnar_exporter::write_block() {
+         if (not m_pending)
+            return;
+
+         // lay the block out first, so we know whether it fits
+         const std::size_t rows = m_pending;
+         std::vector<block_column> layout(m_columns.size());
+         std::size_t size = align(sizeof(block_header) + layout.size() * sizeof(block_column));
+         for (std::size_t i = 0; i < m_columns.size(); ++i) {
+            const column_data& c = m_columns[i];
+            block_column& b = layout[i];
+            b.nulls = static_cast<boost::uint32_t>(c.nulls);
+            b.words = static_cast<boost::uint32_t>(c.words.size());
+
+            b.values = size;
+            size = align(size + rows * (c.type == string_column ? sizeof(boost::uint32_t) : sizeof(boost::int64_t)));
+            b.validity = size;
+            size = align(size + (rows + 7) / 8);
+
+            b.dictionary = 0;
+            if (c.type == string_column) {
+               b.dictionary = size;
+               std::size_t bytes = 0;
+               for (std::size_t w = 0; w < c.words.size(); ++w)
+                  bytes += c.words[w]->size();
+               size = align(size + (c.words.size() + 1) * sizeof(boost::uint32_t) + bytes);
+            }
+         }
+
+         if (not m_map or m_used + size > m_mapped) {
+            close_file();
+            open_file(size);
+         }
+
+         char* base = m_map + m_used;
+         std::size_t pos = 0;
+         block_header h = block_header();
+         h.magic = block_magic;
+         h.rows = static_cast<boost::uint32_t>(rows);
+         h.size = size;
+         put(base, pos, h);
+         for (std::size_t i = 0; i < layout.size(); ++i)
+            put(base, pos, layout[i]);
+
+         for (std::size_t i = 0; i < m_columns.size(); ++i) {
+            column_data& c = m_columns[i];
+            const block_column& b = layout[i];
+            switch (c.type) {
+               case string_column:
+                  std::memcpy(base + b.values, &c.codes[0], rows * sizeof(boost::uint32_t));
+                  break;
+               case real_column:
+                  std::memcpy(base + b.values, &c.reals[0], rows * sizeof(double));
+                  break;
+               case integer_column:
+               case time_column:
+                  std::memcpy(base + b.values, &c.integers[0], rows * sizeof(boost::int64_t));
+                  break;
+            }
+            std::memcpy(base + b.validity, &c.validity[0], (rows + 7) / 8);
+
+            if (c.type == string_column) {
+               std::size_t offsets = b.dictionary;
+               std::size_t bytes = offsets + (c.words.size() + 1) * sizeof(boost::uint32_t);
+               boost::uint32_t offset = 0;
+               for (std::size_t w = 0; w < c.words.size(); ++w) {
+                  put(base, offsets, offset);
+                  std::memcpy(base + bytes + offset, c.words[w]->data(), c.words[w]->size());
+                  offset += static_cast<boost::uint32_t>(c.words[w]->size());
+               }
+               put(base, offsets, offset);
+            }
+
+            // dictionaries are per block, so each block reads on its own
+            c.codes.clear();
+            c.reals.clear();
+            c.integers.clear();
+            std::fill(c.validity.begin(), c.validity.end(), 0);
+            c.nulls = 0;
+            c.words.clear();
+            c.dictionary.clear();
+         }
+         m_pending = 0;
+
+         // publish the block, readers only look at what the header covers
+         m_used += size;
+         file_header* f = reinterpret_cast<file_header*>(m_map);
+         ++f->blocks;
+         f->used = m_used;
+         ::msync(m_map, m_used, MS_ASYNC);
+      }
+
+      /** Start a file.
+       * @param need the size of the block that will go in it
+       */
+      void columnar_exporter::open_file(std::size_t need) {
+         std::size_t schema = sizeof(file_header);
+         for (std::size_t i = 0; i < m_columns.size(); ++i)
+            schema += 2 * sizeof(boost::uint32_t) + m_columns[i].header.size();
+         const std::size_t data_offset = align(schema);
+         const std::size_t capacity = std::max(m_file_size, data_offset + need);
+
+         boost::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+         std::string path;
+         int fd;
+         for (;;) {
+            char name[32];
+            std::snprintf(name, sizeof(name), ".%020lld.cols", static_cast<long long>(now));
+            path = m_directory + "/" + m_table + name;
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (fd >= 0)
+               break;
+            if (errno != EEXIST)
+               throw boost::system::system_error(errno_code(errno));
+            ++now;
+         }
+
+         // allocate up front, so a full disk is an error here and not a
+         // SIGBUS when the mapping is written
+         int e = ::posix_fallocate(fd, 0, capacity);
+         void* map = MAP_FAILED;
+         if (not e) {
+            map = ::mmap(0, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED)
+               e = errno;
+         }
+         if (e) {
+            ::close(fd);
+            ::unlink(path.c_str());
+            throw boost::system::system_error(errno_code(e));
+         }
+
+         m_fd = fd;
+         m_map = static_cast<char*>(map);
+         m_mapped = capacity;
+
+         file_header f = file_header();
+         std::memcpy(f.magic, file_magic, sizeof(f.magic));
+         f.version = file_version;
+         f.columns = static_cast<boost::uint32_t>(m_columns.size());
+         f.blocks = 0;
+         f.used = data_offset;
+         f.data_offset = data_offset;
+         f.block_rows = static_cast<boost::uint32_t>(m_block_rows);
+
+         std::size_t pos = 0;
+         put(m_map, pos, f);
+         for (std::size_t i = 0; i < m_columns.size(); ++i) {
+            put(m_map, pos, static_cast<boost::uint32_t>(m_columns[i].type));
+            put(m_map, pos, static_cast<boost::uint32_t>(m_columns[i].header.size()));
+            std::memcpy(m_map + pos, m_columns[i].header.data(), m_columns[i].header.size());
+            pos += m_columns[i].header.size();
+         }
+         m_used = data_offset;
+      }
+
+      /** Close the current file, cutting it down to what was written.
+       */
+      void columnar_exporter::close_file() {
+         if (not m_map)
+            return;
+
+         ::munmap(m_map, m_mapped);
+         if (::ftruncate(m_fd, m_used) < 0) {
+            // the file just keeps its slack, readers go by the header
+         }
+         ::close(m_fd);
+         m_fd = -1;
+         m_map = 0;
+         m_mapped = 0;
+         m_used = 0;
+      }
+
+      struct columnar_reader::column_entry : block_column {
+      };
+
+      /** Open a column file.
+       * @param path the file
+       * @throw boost::system::system_error if it can't be opened
+       * @throw manager::parse_error if it is not a column file
+       */
+      columnar_reader::columnar_reader(const std::string& path) :
+         m_map(0),
+         m_mapped(0) {
+
+         int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+         if (fd < 0)
+            throw boost::system::system_error(errno_code(errno));
+
+         struct stat st;
+         if (::fstat(fd, &st) < 0) {
+            int e = errno;
+            ::close(fd);
+            throw boost::system::system_error(errno_code(e));
+         }
+         m_mapped = st.st_size;
+
+         if (m_mapped) {
+            void* map = ::mmap(0, m_mapped, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) {
+               int e = errno;
+               ::close(fd);
+               throw boost::system::system_error(errno_code(e));
+            }
+            m_map = static_cast<const char*>(map);
+         }
+         ::close(fd);
+
+         try {
+            file_header f;
+            if (m_mapped < sizeof(f))
+               throw parse_error("not a column file");
+            std::memcpy(&f, m_map, sizeof(f));
+            if (std::memcmp(f.magic, file_magic, sizeof(f.magic)) != 0 or f.version != file_version)
+               throw parse_error("not a column file");
+            if (f.used > m_mapped or f.data_offset > f.used)
+               throw parse_error("truncated column file");
+
+            std::size_t pos = sizeof(f);
+            for (boost::uint32_t i = 0; i < f.columns; ++i) {
+               boost::uint32_t type, size;
+               if (f.data_offset - pos < sizeof(type) + sizeof(size))
+                  throw parse_error("malformed column file schema");
+               std::memcpy(&type, m_map + pos, sizeof(type));
+               std::memcpy(&size, m_map + pos + sizeof(type), sizeof(size));
+               pos += sizeof(type) + sizeof(size);
+               if (type > time_column or f.data_offset - pos < size)
+                  throw parse_error("malformed column file schema");
+
+               column_info c;
+               c.name.assign(m_map + pos, size);
+               c.type = static_cast<column_type>(type);
+               m_columns.push_back(c);
+               pos += size;
+            }
+
+            // check every offset once here, so the accessors need not
+            pos = f.data_offset;
+            const std::size_t directory = sizeof(block_header) + m_columns.size() * sizeof(block_column);
+            for (boost::uint64_t b = 0; b < f.blocks; ++b) {
+               block_header h;
+               if (f.used - pos < directory)
+                  throw parse_error("truncated column file");
+               std::memcpy(&h, m_map + pos, sizeof(h));
+               if (h.magic != block_magic or h.size < directory or h.size > f.used - pos)
+                  throw parse_error("malformed column file block");
+
+               for (std::size_t i = 0; i < m_columns.size(); ++i) {
+                  block_column c;
+                  std::memcpy(&c, m_map + pos + sizeof(h) + i * sizeof(c), sizeof(c));
+                  std::size_t width = m_columns[i].type == string_column ? sizeof(boost::uint32_t) : sizeof(boost::int64_t);
+                  bool ok = c.values % width == 0 and c.values <= h.size and (h.size - c.values) / width >= h.rows
+                     and c.validity <= h.size and h.size - c.validity >= (h.rows + 7) / 8
+                     and c.nulls <= h.rows;
+                  if (ok and m_columns[i].type == string_column) {
+                     ok = c.dictionary <= h.size and (h.size - c.dictionary) / sizeof(boost::uint32_t) > c.words;
+                     if (ok) {
+                        const char* offsets = m_map + pos + c.dictionary;
+                        std::size_t bytes = c.dictionary + (c.words + std::size_t(1)) * sizeof(boost::uint32_t);
+                        boost::uint32_t last = 0;
+                        for (boost::uint32_t w = 0; ok and w <= c.words; ++w) {
+                           boost::uint32_t o;
+                           std::memcpy(&o, offsets + w * sizeof(o), sizeof(o));
+                           ok = o >= last and o <= h.size - bytes;
+                           last = o;
+                        }
+                        const boost::uint32_t* codes = reinterpret_cast<const boost::uint32_t*>(m_map + pos + c.values);
+                        for (boost::uint32_t r = 0; ok and r < h.rows; ++r)
+                           ok = codes[r] < c.words or (codes[r] == 0 and not (m_map[pos + c.validity + r / 8] & (1 << (r % 8))));
+                     }
+                  }
+                  if (not ok)
+                     throw parse_error("malformed column file block");
+               }
+
+               m_blocks.push_back(m_map + pos);
+               pos += h.size;
+            }
+         }
+         catch (...) {
+            if (m_map)
+               ::munmap(const_cast<char*>(m_map), m_mapped);
+            throw;
+         }
+      }
+
+      columnar_reader::~columnar_reader() {
+         if (m_map)
+            ::munmap(const_cast<char*>(m_map), m_mapped);
+      }
+
+      /** Find a column.
+       * @param name the header the column holds
+       * @return the index of the column
+       * @throw std::out_of_range if there is no such column
+       */
+      std::size_t columnar_reader::column(const std::string& name) const {
+         for (std::size_t i = 0; i < m_columns.size(); ++i) {
+            if (m_columns[i].name == name)
+               return i;
+         }
+         throw std::out_of_range("no column " + name);
+      }
+
+      const columnar_reader::column_entry& columnar_reader::entry(std::size_t block, std::size_t column) const {
+         return *reinterpret_cast<const column_entry*>(m_blocks.at(block) + sizeof(block_header) + column * sizeof(block_column));
+      }
+
+      const char* columnar_reader::values(std::size_t block, std::size_t column, column_type type) const {
+         if (m_columns.at(column).type != type)
+            return 0;
+         return m_blocks.at(block) + entry(block, column).values;
+      }
+
+      /** Get the number of rows in a block.
+       * @param block the block
+       * @return the number of rows
+       */
+      std::size_t columnar_reader::rows(std::size_t block) const {
+         return reinterpret_cast<const block_header*>(m_blocks.at(block))->rows;
+      }
+
+      /** Get the number of nulls in a column of a block.
+       * @param block the block
+       * @param column the column
+       * @return the number of nulls
+       */
+      std::size_t columnar_reader::nulls(std::size_t block, std::size_t column) const {
+         return entry(block, column).nulls;
+      }
+
+      /** Check whether a value is there.
+       * @param block the block
+       * @param column the column
+       * @param row the row in the block
+       * @return false if the value is null
+       */
+      bool columnar_reader::valid(std::size_t block, std::size_t column, std::size_t row) const {
+         const unsigned char* bits = reinterpret_cast<const unsigned char*>(m_blocks.at(block) + entry(block, column).validity);
+         return bits[row / 8] & (1 << (row % 8));
+      }
+
+      /** Get the values of an integer or time column of a block.
+       * @param block the block
+       * @param column the column
+       * @return a value per row, 0 where null, or 0 if the column holds
+       * something else
+       */
+      const boost::int64_t* columnar_reader::integers(std::size_t block, std::size_t column) const {
+         const char* p = values(block, column, integer_column);
+         if (not p)
+            p = values(block, column, time_column);
+         return reinterpret_cast<const boost::int64_t*>(p);
+      }
+
+      /** Get the values of a real column of a block.
+       * @param block the block
+       * @param column the column
+       * @return a value per row, 0 where null, or 0 if the column holds
+       * something else
+       */
+      const double* columnar_reader::reals(std::size_t block, std::size_t column) const {
+         return reinterpret_cast<const double*>(values(block, column, real_column));
+      }
+
+      /** Get the dictionary codes of a string column of a block.
+       * @param block the block
+       * @param column the column
+       * @return a code per row, 0 where null, or 0 if the column holds
+       * something else
+       */
+      const boost::uint32_t* columnar_reader::codes(std::size_t block, std::size_t column) const {
+         return reinterpret_cast<const boost::uint32_t*>(values(block, column, string_column));
+      }
+
+      /** Get the size of the dictionary of a string column of a block.
+       * @param block the block
+       * @param column the column
+       * @return the number of distinct values
+       */
+      std::size_t columnar_reader::dictionary_size(std::size_t block, std::size_t column) const {
+         return entry(block, column).words;
+      }
+
+      /** Look a dictionary code up.
+       * @param block the block
+       * @param column the column, a string column
+       * @param code the code
+       * @return the string
+       * @throw std::out_of_range if there is no such code
+       */
+      std::string columnar_reader::word(std::size_t block, std::size_t column, boost::uint32_t code) const {
+         const column_entry& c = entry(block, column);
+         if (m_columns.at(column).type != string_column or code >= c.words)
+            throw std::out_of_range("no such dictionary code");
+
+         const char* dictionary = m_blocks[block] + c.dictionary;
+         boost::uint32_t begin, end;
+         std::memcpy(&begin, dictionary + code * sizeof(begin), sizeof(begin));
+         std::memcpy(&end, dictionary + (code + 1) * sizeof(end), sizeof(end));
+         const char* bytes = dictionary + (c.words + std::size_t(1)) * sizeof(boost::uint32_t);
+         return std::string(bytes + begin, bytes + end);
+      }
+
+      /** Get a value of a string column.
+       * @param block the block
+       * @param column the column
+       * @param row the row in the block
+       * @return the value, empty if null
+       */
+      std::string columnar_reader::string(std::size_t block, std::size_t column, std::size_t row) const {
+         const boost::uint32_t* c = codes(block, column);
+         if (not c or row >= rows(block) or not valid(block, column, row))
+            return std::string();
+         return word(block, column, c[row]);
+      }
+   }
+}
@@ -21,21 +21,85 @@
 #include "manager/connection.h"
 #include "manager/message.h"
 #include "manager/error.h"
+#include "manager/action/events.h"
+#include "manager/action/filter.h"
 #include <boost/asio.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
 #include <boost/ref.hpp>
+#include <boost/next_prior.hpp>
+#include <boost/weak_ptr.hpp>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <stdexcept>
+#include <cerrno>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace astxx {
    namespace manager {
       using boost::asio::ip::tcp;
       using boost::lexical_cast;
 
+      /** Tell the cpu we are spinning.
+       * This lets a hyperthread sibling have the core while we wait.
+       */
+      static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+         __builtin_ia32_pause();
+#elif defined(__aarch64__)
+         asm volatile("yield");
+#endif
+      }
+
+      /** A handler bound to a connection that does nothing once the 
+       * connection is gone.
+       * Every operation a connection starts on its io_service completes 
+       * through one of these, so a connection on a shared io_service can be 
+       * destroyed with operations still queued.
+       */
+      template<typename Handler>
+      class guarded_handler {
+         public:
+            guarded_handler(const boost::weak_ptr<bool>& alive, const Handler& handler)
+               : alive(alive), handler(handler) {
+            }
+
+            void operator()() {
+               if (not alive.expired())
+                  handler();
+            }
+
+            template<typename A1>
+            void operator()(const A1& a1) {
+               if (not alive.expired())
+                  handler(a1);
+            }
+
+            template<typename A1, typename A2>
+            void operator()(const A1& a1, const A2& a2) {
+               if (not alive.expired())
+                  handler(a1, a2);
+            }
+
+         private:
+            boost::weak_ptr<bool> alive;
+            Handler handler;
+      };
+
+      template<typename Handler>
+      static guarded_handler<Handler> guard(const boost::shared_ptr<bool>& alive, const Handler& handler) {
+         return guarded_handler<Handler>(alive, handler);
+      }
+
       /** Wait for a response.
        * This is a functior to wait for a response.
        * @code
        * response_waiter rw(connection);
-       * connection(action, boost::ref(rw));
+       * connection.send_action_async(action, boost::ref(rw), boost::bind(&response_waiter::fail, &rw, _1), timeout);
        * message::response r = rw.wait();
        * @endcode
        */
@@ -45,7 +109,7 @@ namespace astxx {
              * @param connection the connection to watch
              */
             response_waiter(manager::connection& connection)
-               : connection(connection), response("") {
+               : connection(connection), response(""), done(false) {
             }
 
             /** The response handling function.
@@ -53,23 +117,58 @@ namespace astxx {
              */
             void operator()(message::response r) {
                response = r;
+               done = true;
+            }
+
+            /** The error handling function.
+             * @param e the reason no response will arrive
+             */
+            void fail(boost::system::error_code e) {
+               error = e;
+               done = true;
             }
 
             /** Wait for a response for this functor.
              * @warning DO NOT call this function with out first registering 
              * this functor as a response handler.  Doing so will cause an 
              * infinte loop.
+             * @throw manager::timeout if the action timed out
+             * @throw manager::cancelled if the action was cancelled
              */
             message::response wait() const {
-               while (response == "") {
+               finish();
+
+               if (error)
+                  throw_action_error(error);
+
+               return response;
+            }
+
+            /** Wait for a response for this functor without throwing.
+             * @warning see response_waiter::wait()
+             * @return the response, or the reason there is none
+             */
+            expected<message::response> try_wait() const {
+               finish();
+
+               if (error)
+                  return make_unexpected(error);
+
+               return response;
+            }
+         private:
+            /// Process responses until ours is done.
+            void finish() const {
+               while (not done) {
                   connection.wait_response();
                   connection.process_responses();
                }
-               return response;
             }
-         private:
+
             manager::connection& connection;
             message::response response;
+            boost::system::error_code error;
+            bool done;
       };
 
       /** Initilize a connection to the given host on the given port.
@@ -78,10 +177,139 @@ namespace astxx {
        * @throw boost::system::system_error if there is a problem connecting to 
        * or resolving a host
        */
-      connection::connection(const std::string& host, unsigned short port) : socket(io_service) {
+      connection::connection(const std::string& host, unsigned short port) :
+         m_io_service(new boost::asio::io_service()),
+         io_service(*m_io_service),
+         m_alive(new bool(true)),
+         socket(io_service),
+         resolver(io_service),
+         connect_timer(io_service),
+         m_next_endpoint(0),
+         m_connecting(false),
+         m_connect_timeout(std::chrono::seconds(10)),
+         m_attempt_delay(std::chrono::milliseconds(250)),
+         reading(false),
+         m_generation(0),
+         m_greeting(false),
+         m_record_latency(false),
+         m_io_stop(false),
+         m_drain_posted(false),
+         m_external_io(false),
+         m_defer_writes(false),
+         m_write_offset(0),
+         backlog_timer(io_service),
+         backlog_timer_armed(false),
+         m_seq(0),
+         m_timeout(duration::zero()),
+         m_auto_filter(false),
+         m_mask_sent(false),
+         m_sent_mask(0),
+         m_filters_supported(true),
+         m_index_interest(0),
+         m_batch_interest(0),
+         m_projection_stale(false) {
+         m_io_wake[0] = m_io_wake[1] = -1;
          connect(host, port);
       }
 
+      /** Initilize a connection on a shared io_service without connecting.
+       * @param io_service the io_service to run on
+       * @param host the host to connect to
+       * @param port the port to connect on
+       *
+       * Any number of connections may share an io_service, which lets one 
+       * thread establish all of them at once (see manager::connect_all()).  
+       * Call connection::connect(), connection::async_connect() or 
+       * manager::connect_all() before using the connection.
+       *
+       * The io_service may outlive the connection.  Handlers of the 
+       * connection still queued on it when the connection is destroyed do 
+       * nothing, so destroy the connection from the thread that runs the 
+       * io_service, or while nothing runs it.
+       */
+      connection::connection(boost::asio::io_service& io_service, const std::string& host, unsigned short port) :
+         io_service(io_service),
+         m_alive(new bool(true)),
+         socket(io_service),
+         resolver(io_service),
+         connect_timer(io_service),
+         m_next_endpoint(0),
+         m_connecting(false),
+         m_connect_timeout(std::chrono::seconds(10)),
+         m_attempt_delay(std::chrono::milliseconds(250)),
+         m_host(host),
+         m_port(lexical_cast<std::string>(port)),
+         reading(false),
+         m_generation(0),
+         m_greeting(false),
+         m_record_latency(false),
+         m_io_stop(false),
+         m_drain_posted(false),
+         m_external_io(false),
+         m_defer_writes(false),
+         m_write_offset(0),
+         backlog_timer(io_service),
+         backlog_timer_armed(false),
+         m_seq(0),
+         m_timeout(duration::zero()),
+         m_auto_filter(false),
+         m_mask_sent(false),
+         m_sent_mask(0),
+         m_filters_supported(true),
+         m_index_interest(0),
+         m_batch_interest(0),
+         m_projection_stale(false) {
+         m_io_wake[0] = m_io_wake[1] = -1;
+      }
+
+      /** Destructor.
+       * Stops the I/O thread, if one was started, and closes the socket.  
+       * Outstanding operations are cancelled, and their handlers, which may 
+       * still run on a shared io_service, see the connection is gone and 
+       * return without touching it.
+       *
+       * Responses from connection::async_send() that have not been 
+       * delivered fail with boost::asio::error::operation_aborted, so a 
+       * coroutine awaiting one is resumed (from the destructor) with 
+       * manager::cancelled and can unwind.  Other handlers still waiting in 
+       * connection::process_responses() are discarded.
+       */
+      connection::~connection() {
+         join_io_thread();
+         m_alive.reset();
+
+         boost::system::error_code ignored;
+         socket.close(ignored);
+         resolver.cancel();
+         connect_timer.cancel();
+         backlog_timer.cancel();
+         for (std::size_t i = 0; i < attempts.size(); ++i) {
+            attempts[i]->socket.close(ignored);
+            attempts[i]->timer.cancel();
+         }
+         for (pending_t::iterator i = pending.begin(); i != pending.end(); ++i) {
+            if (i->second.timer)
+               i->second.timer->cancel();
+         }
+
+         // a resumed coroutine may send another action, fail that one too
+         while (not m_async_states.empty()) {
+            std::vector<boost::weak_ptr<async_response::state> > states;
+            states.swap(m_async_states);
+            for (std::size_t i = 0; i < states.size(); ++i) {
+               boost::shared_ptr<async_response::state> s = states[i].lock();
+               if (s and not s->done)
+                  s->fail(boost::asio::error::operation_aborted);
+            }
+         }
+
+         if (m_ring) {
+            parsed_message* m;
+            while (m_ring->pop(m))
+               delete m;
+         }
+      }
+
       /** Connect to the given host on the given port.
        * @param host the host to connect to
        * @param port the port to connect on
@@ -91,12 +319,57 @@ namespace astxx {
        * wll be used.  In order for the given port to be used, host must be 
        * specified.
        *
-       * @warn Calling this function will disconnect any existing connections.
+       * @warn Calling this function will disconnect any existing connections.  
+       * Actions still waiting for a response are cancelled.
+       *
+       * @see connection::async_connect()
        *
        * @throw boost::system::system_error if there is a problem connecting to 
-       * or resolving a host
+       * or resolving a host, with boost::asio::error::timed_out if no 
+       * address could be reached within the connect timeout
        */
       void connection::connect(const std::string& host, unsigned short port) {
+         async_connect(host, port, connect_handler_t());
+         while (m_connecting) {
+            run_one();
+         }
+
+         if (m_connect_error)
+            throw boost::system::system_error(m_connect_error);
+      }
+
+      /** Start connecting without blocking.
+       * @param handler called with the result once the greeting has been 
+       * read, or connecting failed
+       *
+       * The host and port given on construction (or to the last 
+       * connection::connect() call) are used.
+       *
+       * @see connection::async_connect(const std::string&, unsigned short, connect_handler_t)
+       */
+      void connection::async_connect(connect_handler_t handler) {
+         async_connect("", 0, handler);
+      }
+
+      /** Start connecting without blocking.
+       * @param host the host to connect to (blank for the current host)
+       * @param port the port to connect on (0 for the current port)
+       * @param handler called with the result once the greeting has been 
+       * read, or connecting failed
+       *
+       * The host is resolved asynchronously and its addresses are tried 
+       * happy eyeballs style: address families are interleaved, and if an 
+       * attempt has not succeeded within the attempt delay (250ms by 
+       * default) the next address is tried in parallel.  The first attempt 
+       * to succeed wins and the others are abandoned.  Each attempt, and the 
+       * wait for the greeting, is limited to the connect timeout (10 seconds 
+       * by default).
+       *
+       * The handler is run from the io_service, that is from within 
+       * connection::wait_event(), connection::wait_response(), 
+       * connection::pump_messages() or whatever else drives the io_service.
+       */
+      void connection::async_connect(const std::string& host, unsigned short port, connect_handler_t handler) {
          // update the internal host and port if they are not the default 
          // values
          if (not host.empty()) {
@@ -106,40 +379,310 @@ namespace astxx {
             }
          }
 
-         tcp::resolver resolver(io_service);
-         tcp::resolver::query query(m_host, lexical_cast<std::string>(m_port));
+         stop_io_thread();
+         m_io_error = std::exception_ptr();
+         cancel_all();
+         m_admission.reset();
+         m_external_io = false;
+         m_write_queue.clear();
+         m_write_offset = 0;
 
-         tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-         tcp::resolver::iterator end;
+         // forget anything from a previous connection, outstanding 
+         // operations on it will be ignored when they complete
+         ++m_generation;
+         reading = false;
+         m_parser.reset();
+         m_output.clear();
+         m_output_headers.clear();
+         m_greeting = false;
 
-         // here we loop through all possible endpoints trying to connect to 
-         // each as long as we failed to connect to the previous one
-         boost::system::error_code error = boost::asio::error::host_not_found;
-         while (error && endpoint_iterator != end) {
-            socket.close();
-            socket.connect(*endpoint_iterator++, error);
+         // event filters belong to the session
+         m_mask_sent = false;
+         m_installed_filters.clear();
+         m_filters_supported = true;
+
+         boost::system::error_code ignored;
+         socket.close(ignored);
+         resolver.cancel();
+         connect_timer.cancel();
+         for (std::size_t i = 0; i < attempts.size(); ++i) {
+            attempts[i]->socket.close(ignored);
+            attempts[i]->timer.cancel();
          }
+         attempts.clear();
+         endpoints.clear();
+         m_next_endpoint = 0;
 
-         if (error)
-            throw boost::system::system_error(error);
+         m_connecting = true;
+         m_connect_error = boost::system::error_code();
+         m_connect_handler = handler;
 
-         std::string greeting_line = read_line();
-         
-         // split the version and the name
-         std::string::size_type i = greeting_line.find_last_of('/');
-         if (i != std::string::npos) {
-            m_name.assign(greeting_line, 0, i);
-            if (++i != std::string::npos) {
-               m_version.assign(greeting_line, i, std::string::npos);
+         resolver.async_resolve(m_host, m_port,
+               guard(m_alive, boost::bind(&connection::handle_resolve, this, m_generation,
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::results)));
+      }
+
+      /** Handle the result of resolving the host.
+       * @param generation the connect call this belongs to
+       * @param error the status of the resolve
+       * @param results the addresses of the host
+       */
+      void connection::handle_resolve(unsigned int generation, const boost::system::error_code& error, tcp::resolver::results_type results) {
+         if (generation != m_generation)
+            return;
+
+         if (error) {
+            finish_connect(error);
+            return;
+         }
+
+         // interleave address families, starting with whichever family the 
+         // resolver listed first (RFC 8305 section 4)
+         std::deque<tcp::endpoint> first, second;
+         for (tcp::resolver::results_type::iterator i = results.begin(); i != results.end(); ++i) {
+            if (first.empty() or i->endpoint().protocol() == first.front().protocol())
+               first.push_back(i->endpoint());
+            else
+               second.push_back(i->endpoint());
+         }
+         while (not first.empty() or not second.empty()) {
+            if (not first.empty()) {
+               endpoints.push_back(first.front());
+               first.pop_front();
+            }
+            if (not second.empty()) {
+               endpoints.push_back(second.front());
+               second.pop_front();
+            }
+         }
+
+         if (endpoints.empty()) {
+            finish_connect(boost::asio::error::host_not_found);
+            return;
+         }
+
+         start_attempt();
+      }
+
+      /** Start a connection attempt to the next address.
+       * Unless this is the last address, the connect timer is armed to start 
+       * another attempt in parallel after the attempt delay.
+       */
+      void connection::start_attempt() {
+         if (m_next_endpoint >= endpoints.size())
+            return;
+
+         std::size_t n = attempts.size();
+         boost::shared_ptr<connect_attempt> a(new connect_attempt(io_service));
+         attempts.push_back(a);
+
+         a->socket.async_connect(endpoints[m_next_endpoint++],
+               guard(m_alive, boost::bind(&connection::handle_attempt, this, m_generation, n, boost::asio::placeholders::error)));
+
+         if (m_connect_timeout > duration::zero()) {
+            a->timer.expires_after(m_connect_timeout);
+            a->timer.async_wait(guard(m_alive, boost::bind(&connection::handle_attempt_timeout, this, m_generation, n, boost::asio::placeholders::error)));
+         }
+
+         if (m_next_endpoint < endpoints.size()) {
+            connect_timer.expires_after(m_attempt_delay);
+            connect_timer.async_wait(guard(m_alive, boost::bind(&connection::handle_connect_timer, this, m_generation, boost::asio::placeholders::error)));
+         }
+      }
+
+      /** Handle the result of a connection attempt.
+       * @param generation the connect call this belongs to
+       * @param attempt the index of the attempt
+       * @param error the status of the attempt
+       */
+      void connection::handle_attempt(unsigned int generation, std::size_t attempt, const boost::system::error_code& error) {
+         if (generation != m_generation or attempt >= attempts.size())
+            return;
+
+         boost::shared_ptr<connect_attempt> a = attempts[attempt];
+         a->done = true;
+         a->timer.cancel();
+
+         // somebody else won already
+         if (socket.is_open() or not m_connecting)
+            return;
+
+         if (not error) {
+            socket = std::move(a->socket);
+
+            // abandon the other attempts
+            boost::system::error_code ignored;
+            connect_timer.cancel();
+            for (std::size_t i = 0; i < attempts.size(); ++i) {
+               attempts[i]->timer.cancel();
+               if (i != attempt)
+                  attempts[i]->socket.close(ignored);
+            }
+
+            // the first line we get is the greeting, on_greeting() splits 
+            // it into the name and version and finishes the connect
+            m_greeting = true;
+            m_parser.expect_greeting();
+            start_read();
+
+            if (m_connect_timeout > duration::zero()) {
+               connect_timer.expires_after(m_connect_timeout);
+               connect_timer.async_wait(guard(m_alive, boost::bind(&connection::handle_connect_timer, this, m_generation, boost::asio::placeholders::error)));
+            }
+            return;
+         }
+
+         m_connect_error = (error == boost::asio::error::operation_aborted) ? boost::system::error_code(boost::asio::error::timed_out) : error;
+
+         // don't wait for the attempt delay, go straight to the next address
+         if (m_next_endpoint < endpoints.size()) {
+            connect_timer.cancel();
+            start_attempt();
+            return;
+         }
+
+         for (std::size_t i = 0; i < attempts.size(); ++i) {
+            if (not attempts[i]->done)
+               return;
+         }
+         finish_connect(m_connect_error);
+      }
+
+      /** A connection attempt took too long.
+       * Closing its socket makes connection::handle_attempt() see it fail.
+       * @param generation the connect call this belongs to
+       * @param attempt the index of the attempt
+       * @param error the timer status
+       */
+      void connection::handle_attempt_timeout(unsigned int generation, std::size_t attempt, const boost::system::error_code& error) {
+         if (error == boost::asio::error::operation_aborted or generation != m_generation or attempt >= attempts.size())
+            return;
+
+         boost::system::error_code ignored;
+         attempts[attempt]->socket.close(ignored);
+      }
+
+      /** The connect timer expired.
+       * Before an attempt has succeeded this starts the next attempt, after 
+       * that it means the greeting did not arrive in time.
+       * @param generation the connect call this belongs to
+       * @param error the timer status
+       */
+      void connection::handle_connect_timer(unsigned int generation, const boost::system::error_code& error) {
+         if (error == boost::asio::error::operation_aborted or generation != m_generation or not m_connecting)
+            return;
+
+         if (m_greeting) {
+            boost::system::error_code ignored;
+            socket.close(ignored);
+            finish_connect(boost::asio::error::timed_out);
+         }
+         else {
+            start_attempt();
+         }
+      }
+
+      /** Finish connecting and call the connect handler.
+       * @param error the result
+       */
+      void connection::finish_connect(const boost::system::error_code& error) {
+         m_connecting = false;
+         m_connect_error = error;
+         m_greeting = false;
+         connect_timer.cancel();
+         attempts.clear();
+
+         // not fatal, spinning works without it
+         if (not error and m_spin.socket_busy_poll)
+            apply_busy_poll();
+
+         if (m_connect_handler) {
+            connect_handler_t handler;
+            handler.swap(m_connect_handler);
+            handler(error);
+         }
+      }
+
+      /** Connect a group of connections at once.
+       * @param connections the connections to connect, each is connected to 
+       * the host and port it was constructed with
+       *
+       * All connections are started at the same time, so the time this takes 
+       * is that of the slowest host rather than the sum of all of them.  
+       * Connections sharing an io_service are driven from the calling 
+       * thread; connections on other io_services get a thread each for the 
+       * duration of the call.
+       *
+       * @code
+       * boost::asio::io_service io_service;
+       * manager::connection pbx1(io_service, "pbx1"), pbx2(io_service, "pbx2");
+       * std::vector<manager::connection*> pbxes;
+       * pbxes.push_back(&pbx1);
+       * pbxes.push_back(&pbx2);
+       * std::vector<boost::system::error_code> results = manager::connect_all(pbxes);
+       * @endcode
+       *
+       * @return the result for each connection, in the same order
+       */
+      std::vector<boost::system::error_code> connect_all(const std::vector<connection*>& connections) {
+         std::vector<boost::system::error_code> results(connections.size(), boost::asio::error::would_block);
+
+         // group the connections by io_service
+         std::map<boost::asio::io_service*, std::vector<std::size_t> > groups;
+         for (std::size_t i = 0; i < connections.size(); ++i) {
+            groups[&connections[i]->get_io_service()].push_back(i);
+         }
+
+         struct driver {
+            static void record(boost::system::error_code* result, std::size_t* remaining, boost::system::error_code error) {
+               *result = error;
+               --*remaining;
+            }
+
+            static void run(boost::asio::io_service* io_service, const std::vector<connection*>* connections, const std::vector<std::size_t>* group, std::vector<boost::system::error_code>* results) {
+               std::size_t remaining = group->size();
+               for (std::size_t i = 0; i < group->size(); ++i) {
+                  std::size_t n = (*group)[i];
+                  (*connections)[n]->async_connect(boost::bind(&driver::record, &(*results)[n], &remaining, _1));
+               }
+
+               while (remaining) {
+                  if (io_service->stopped())
+                     io_service->restart();
+                  io_service->run_one();
+               }
+            }
+         };
+
+         std::vector<boost::shared_ptr<std::thread> > threads;
+         std::map<boost::asio::io_service*, std::vector<std::size_t> >::iterator i = groups.begin();
+         if (i != groups.end()) {
+            for (std::map<boost::asio::io_service*, std::vector<std::size_t> >::iterator j = boost::next(i); j != groups.end(); ++j) {
+               threads.push_back(boost::shared_ptr<std::thread>(new std::thread(&driver::run, j->first, &connections, &j->second, &results)));
             }
+            driver::run(i->first, &connections, &i->second, &results);
          }
+
+         for (std::size_t j = 0; j < threads.size(); ++j) {
+            threads[j]->join();
+         }
+
+         return results;
       }
 
       /** Close our connection to Asterisk.
+       * Actions still waiting for a response are cancelled.
        * @note Upon destruction the connection to the manager should be 
        * properly closed automatically.
        */
       void connection::disconnect() {
+         stop_io_thread();
+         m_io_error = std::exception_ptr();
+         cancel_all();
+         m_external_io = false;
+         m_write_queue.clear();
+         m_write_offset = 0;
          socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
          socket.close();
       }
@@ -171,18 +714,79 @@ namespace astxx {
        * @endcode
        *
        * 
-       * @note This function blocks while waiting for a response.
+       * @note This function blocks while waiting for a response.  It waits 
+       * at most the connection's default timeout (see 
+       * connection::timeout()).
        * 
        * @see connection::operator()(const basic_action&, response_handler_t)
        * @see connection::operator()(const basic_action&)
+       * @throw manager::timeout if no response arrived in time
+       * @throw manager::cancelled if the action was cancelled while waiting
        * @return the response from asterisk
        */
       message::response connection::send_action(const basic_action& command) {
+         return send_action(command, m_timeout);
+      }
+
+      /** Send a command to Asterisk, waiting at most the given time.
+       * @param command the command to send
+       * @param timeout how long to wait for the response (zero waits 
+       * forever)
+       *
+       * @see connection::send_action(const basic_action&)
+       * @throw manager::timeout if no response arrived in time
+       * @throw manager::cancelled if the action was cancelled while waiting
+       * @throw std::logic_error if an external event loop drives the 
+       * connection (see connection::start_external_io())
+       * @return the response from asterisk
+       */
+      message::response connection::send_action(const basic_action& command, duration timeout) {
+         if (m_external_io)
+            throw std::logic_error("send_action() called on a connection driven by an external event loop");
+
          response_waiter rw(*this);
-         send_action_async(command, boost::ref(rw));
+         send_action_async(command, boost::ref(rw), boost::bind(&response_waiter::fail, &rw, _1), timeout);
          return rw.wait();
       }
 
+      /** Send a command to Asterisk without throwing if no response arrives.
+       * @param command the command to send
+       *
+       * The connection's default timeout applies.
+       *
+       * @see connection::send_action(const basic_action&, use_expected_t, duration)
+       * @return the response from asterisk, or the error
+       */
+      expected<message::response> connection::send_action(const basic_action& command, use_expected_t) {
+         return send_action(command, use_expected, m_timeout);
+      }
+
+      /** Send a command to Asterisk without throwing if no response arrives.
+       * @param command the command to send
+       * @param timeout how long to wait for the response (zero waits 
+       * forever)
+       *
+       * Like connection::send_action(const basic_action&, duration), but a 
+       * timeout or cancellation is returned as 
+       * boost::asio::error::timed_out or boost::asio::error::operation_aborted 
+       * instead of being thrown.  Like the throwing overloads this returns 
+       * 'Response: Error' messages as they are, use 
+       * basic_action::operator()(connection&, use_expected_t) to have them 
+       * classified.
+       *
+       * @throw std::logic_error if an external event loop drives the 
+       * connection (see connection::start_external_io())
+       * @return the response from asterisk, or the error
+       */
+      expected<message::response> connection::send_action(const basic_action& command, use_expected_t, duration timeout) {
+         if (m_external_io)
+            throw std::logic_error("send_action() called on a connection driven by an external event loop");
+
+         response_waiter rw(*this);
+         send_action_async(command, boost::ref(rw), boost::bind(&response_waiter::fail, &rw, _1), timeout);
+         return rw.try_wait();
+      }
+
       /** Send a command to Asterisk and recieve the response asynchronously.
        * @param command the command to send
        * @param handler the handler function/functor
@@ -204,186 +808,628 @@ namespace astxx {
        * execution.  See its documentation for circumstances when it will be 
        * called.
        *
+       * If the connection's admission_control does not admit the action it 
+       * is queued and sent later, when responses to earlier actions free up 
+       * room in the window or its rate limit allows.
+       *
+       * The connection's default timeout applies.  If it expires the handler 
+       * is simply released, use one of the overloads taking an error handler 
+       * to be told about it.
+       *
        * @see connection::send_action()
        * @see connection::operator()(const basic_action&, response_handler_t)
        * @see connection::process_responses()
-       * @return the response from asterisk
+       * @return the ActionID the action was sent with
        */
-      void connection::send_action_async(const basic_action& command, response_handler_t handler) {
-
-         message::action action = command.action();
-         if (not command.action_id().empty()) {
-            action["ActionID"] = command.action_id();
-         }
-
-         boost::asio::write(socket, boost::asio::buffer(action.format()));
-         response_handlers.push(handler);
+      std::string connection::send_action_async(const basic_action& command, response_handler_t handler) {
+         return send_action_async(command, handler, error_handler_t(), m_timeout);
       }
-      
-      /** Send a command to Asterisk.
+
+      /** Send a command to Asterisk and recieve the response asynchronously.
        * @param command the command to send
+       * @param handler the response handler
+       * @param error_handler called instead of the response handler if the 
+       * action times out or is cancelled
        *
-       * This function executes connection::send_action().
+       * The connection's default timeout applies.
+       *
+       * @see connection::send_action_async(const basic_action&, response_handler_t, error_handler_t, duration)
+       * @return the ActionID the action was sent with
        */
-      message::response connection::operator()(const basic_action& command) {
-         return send_action(command);
+      std::string connection::send_action_async(const basic_action& command, response_handler_t handler, error_handler_t error_handler) {
+         return send_action_async(command, handler, error_handler, m_timeout);
       }
-      
+
       /** Send a command to Asterisk and recieve the response asynchronously.
        * @param command the command to send
-       * @param handler the handler function/functor
+       * @param handler the response handler
+       * @param error_handler called instead of the response handler if the 
+       * action times out or is cancelled
+       * @param timeout how long to wait for the response, including any time 
+       * spent in the admission backlog (zero waits forever)
        *
-       * This function executes connection::send_action_async().
-       */
-      void connection::operator()(const basic_action& command, response_handler_t handler) {
-         send_action_async(command, handler);
-      }
-      
-      /** Parse a colon (:) seperated header.
-       * @param header a string representing the header
-       * @return an key value pair std::pair
-       * @throw manager::parse_error if there is a problem parsing the message
-       * @throw manager::empty_header if we attempt to parse and 
-       * empty header
+       * The signature of the error handler should be:
+       * @code
+       * void error_handler(boost::system::error_code e);
+       * @endcode
+       *
+       * It receives boost::asio::error::timed_out if the deadline passed and 
+       * boost::asio::error::operation_aborted if the action was cancelled.  
+       * Like response handlers, error handlers are run from 
+       * connection::process_responses().  Once either handler has been 
+       * queued the other one is released.
+       *
+       * @see connection::cancel()
+       * @return the ActionID the action was sent with, this can be passed to 
+       * connection::cancel()
        */
-      std::pair<std::string, std::string> connection::parse_header(const std::string& header) {
-         std::string key;
-         std::string value;
-
-         if (header.empty()) {
-            throw manager::empty_header();
+      std::string connection::send_action_async(const basic_action& command, response_handler_t handler, error_handler_t error_handler, duration timeout) {
+         // tag the action so its response can be matched to it
+         unsigned long long seq = ++m_seq;
+         std::string action_id = command.action_id();
+         if (action_id.empty()) {
+            message::value_traits<unsigned long long>::format(seq, action_id);
+            action_id.insert(0, "astxx-");
          }
 
-         std::string::size_type i = header.find_first_of(':');
-         if (i == std::string::npos) {
-            throw manager::parse_error("missing ':' in header: " + header);
-         }
+         std::string name;
+         std::string data;
+         if (not command.serialize(action_id, name, data)) {
+            message::action action = command.action();
+            if (not command.action_id().empty()) {
+               action["ActionID"] = command.action_id();
+            }
 
-         key.assign(header, 0, i++);
-         
-         if (i != std::string::npos) {
-            if (header[i] == ' ') {
-               ++i;
+            std::pair<message::action::header_t::iterator, message::action::header_t::iterator> id = action.equal_range("ActionID");
+            if (id.first == id.second or id.first->second.empty()) {
+               action["ActionID"] = action_id;
             }
-            if (i != std::string::npos) {
-               value.assign(header, i, std::string::npos);
+            else {
+               action_id = id.first->second;
             }
+
+            name = action.main_header();
+            action.format(data);
+         }
+
+         pending_action& p = pending[seq];
+         p.id = action_id;
+         p.name.swap(name);
+         p.data.swap(data);
+         p.handler = handler;
+         p.error_handler = error_handler;
+         p.output_handler = command.output_handler();
+         p.output_limit = command.output_limit();
+         p.in_flight = false;
+         action_ids.insert(std::make_pair(p.id, seq));
+
+         if (timeout > duration::zero()) {
+            p.timer.reset(new boost::asio::steady_timer(io_service));
+            p.timer->expires_after(timeout);
+            p.timer->async_wait(guard(m_alive, boost::bind(&connection::expire, this, seq, boost::asio::placeholders::error)));
          }
-         return std::make_pair(key, value);
+
+         backlog.push_back(seq);
+         flush_backlog();
+         return action_id;
       }
 
-      /** Read a line from Asterisk.
-       * @note This function strips the \r\n off the end of the line
-       * @return the line read
+      /** Fulfill a promise with a response.
+       * @param promise the promise
+       * @param response the response
        */
-      std::string connection::read_line() {
-         std::string line;
+      static void set_promise_response(boost::shared_ptr<std::promise<message::response> > promise, message::response response) {
+         promise->set_value(response);
+      }
 
-         // loop reading one character at a time until we find a '\n'
-         for (char c = 0, cc = 0; !(c == '\n' && cc == '\r'); line += c) {
-            cc = c;
-            boost::asio::read(socket, boost::asio::buffer(&c, 1), boost::asio::transfer_at_least(1));
+      /** Fulfill a promise with an action error.
+       * @param promise the promise
+       * @param error the error
+       */
+      static void set_promise_error(boost::shared_ptr<std::promise<message::response> > promise, boost::system::error_code error) {
+         try {
+            throw_action_error(error);
          }
-
-         // strip the \r\n
-         std::string::size_type rn = line.find("\r\n");
-         if (rn != std::string::npos) {
-            line.erase(rn);
+         catch (...) {
+            promise->set_exception(std::current_exception());
          }
+      }
+
+      /** Send a command to Asterisk and get a future for the response.
+       * @param command the command to send
+       *
+       * The connection's default timeout applies.
+       *
+       * @see connection::send_action_async(const basic_action&, use_future_t, duration)
+       * @return a future for the response
+       */
+      std::future<message::response> connection::send_action_async(const basic_action& command, use_future_t) {
+         return send_action_async(command, use_future, m_timeout);
+      }
 
-         return line;
+      /** Send a command to Asterisk and get a future for the response.
+       * @param command the command to send
+       * @param timeout how long to wait for the response (zero waits 
+       * forever)
+       *
+       * The future is made ready from connection::process_responses(), so 
+       * some thread must keep driving the connection; calling 
+       * std::future::get() on the same thread before the response has been 
+       * processed will block forever.  If the action times out or is 
+       * cancelled the future holds manager::timeout or manager::cancelled.
+       *
+       * @code
+       * std::future<message::response> f = connection.send_action_async(action::ping(), manager::use_future);
+       * while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+       *    connection.wait_response();
+       *    connection.process_responses();
+       * }
+       * message::response r = f.get();
+       * @endcode
+       *
+       * @return a future for the response
+       */
+      std::future<message::response> connection::send_action_async(const basic_action& command, use_future_t, duration timeout) {
+         boost::shared_ptr<std::promise<message::response> > promise(new std::promise<message::response>());
+         send_action_async(command,
+               boost::bind(&set_promise_response, promise, _1),
+               boost::bind(&set_promise_error, promise, _1),
+               timeout);
+         return promise->get_future();
       }
 
-      /** Read a message from Asterisk.
-       * This function reads a message from asterisk and places it in to the 
-       * proper queue.
-       * @throw manager::parse_error if there is a problem parsing a header
-       * @throw manager::unknown_message if the header we recieve is 
-       * anything other than 'Event' or 'Response'
+      /** Send a command to Asterisk and get an awaitable response.
+       * @param command the command to send
+       *
+       * The connection's default timeout applies.
+       *
+       * @see connection::async_send(const basic_action&, duration)
+       * @return the eventual response
        */
-      void connection::read_message() {
-         std::pair<std::string, std::string> pair = parse_header(read_line());
-         if (pair.first == "Event") {
-            message::event event(pair.second);
-            for (;;) {
-               std::string line = read_line();
+      async_response connection::async_send(const basic_action& command) {
+         return async_send(command, m_timeout);
+      }
 
-               // stop if we get a blank line
-               if (line.empty()) {
-                  break;
-               }
-               event.insert(parse_header(line));
+      /** Send a command to Asterisk and get an awaitable response.
+       * @param command the command to send
+       * @param timeout how long to wait for the response (zero waits 
+       * forever)
+       *
+       * The action is sent (or backlogged) immediately.  With C++20 
+       * coroutines the result can be awaited:
+       *
+       * @code
+       * message::response r = co_await connection.async_send(action::getvar("EXTEN", channel));
+       * @endcode
+       *
+       * The awaiting coroutine is resumed from 
+       * connection::process_responses().  co_await throws manager::timeout 
+       * or manager::cancelled if no response will arrive.
+       *
+       * @return the eventual response
+       */
+      async_response connection::async_send(const basic_action& command, duration timeout) {
+         // forget states that are answered or no longer referenced, once the 
+         // list has doubled since the last sweep
+         if (m_async_states.size() >= 64 and m_async_states.size() == m_async_states.capacity()) {
+            std::vector<boost::weak_ptr<async_response::state> > live;
+            for (std::size_t i = 0; i < m_async_states.size(); ++i) {
+               boost::shared_ptr<async_response::state> s = m_async_states[i].lock();
+               if (s and not s->done)
+                  live.push_back(s);
             }
-            // put the event in the queue
-            events.push(event);
+            live.reserve(std::max<std::size_t>(live.size() * 2, 64));
+            m_async_states.swap(live);
          }
-         else if (pair.first == "Response") {
-            message::response response(pair.second);
-            for (;;) {
-               std::string line = read_line();
 
-               // stop if we get a blank line
-               if (line.empty()) {
-                  break;
-               }
-
-               // check for '--END COMMAND--' if necessary
-               if (pair.second == "Follows") {
-                  std::string::size_type ec = line.find("--END COMMAND--");
+         boost::shared_ptr<async_response::state> state(new async_response::state());
+         m_async_states.push_back(state);
+         send_action_async(command,
+               boost::bind(&async_response::state::complete, state, _1),
+               boost::bind(&async_response::state::fail, state, _1),
+               timeout);
+         return async_response(state);
+      }
 
-                  // strip the '--END COMMAND--', if found, otherwise this is a 
-                  // normal header
-                  if (ec != std::string::npos) {
-                     line.erase(ec);
-                     response.data = line;
-                  }
-                  else {
-                     response.insert(parse_header(line));
-                  }
+      /** Send as many backlogged actions as admission control allows.
+       * Actions are sent in the order they were queued, except that an 
+       * action held back by its rate limit does not block actions of other 
+       * types behind it.
+       */
+      void connection::flush_backlog() {
+         admission_control::time_point now = admission_control::clock_type::now();
 
-               } else {
-                  response.insert(parse_header(line));
-               }
+         backlog_t::iterator i = backlog.begin();
+         while (i != backlog.end() and not m_admission.window_full()) {
+            pending_action& p = pending[*i];
+            if (not m_admission.admit(p.name, now)) {
+               ++i;
+               continue;
             }
-            // put the resposne in the queue
-            responses.push(response);
-         }
-         else {
-            throw manager::unknown_message(pair.first);
+
+            send_data(p.data);
+            m_admission.sent(p.name, now);
+
+            p.in_flight = true;
+            p.sent = now;
+            p.data.clear();
+            i = backlog.erase(i);
          }
+
+         arm_backlog_timer();
+      }
+
+      /** Wake up when a rate limited action may be sent.
+       * If nothing is in flight, no response will come along to trigger 
+       * connection::flush_backlog(), so a timer does it instead.
+       */
+      void connection::arm_backlog_timer() {
+         if (backlog.empty() or backlog_timer_armed or m_admission.window_full())
+            return;
+
+         admission_control::time_point now = admission_control::clock_type::now();
+         admission_control::time_point next = admission_control::time_point::max();
+         for (backlog_t::const_iterator i = backlog.begin(); i != backlog.end(); ++i) {
+            next = std::min(next, m_admission.next_admission(pending[*i].name, now));
+         }
+
+         backlog_timer_armed = true;
+         backlog_timer.expires_at(next);
+         backlog_timer.async_wait(guard(m_alive, boost::bind(&connection::handle_backlog_timer, this, boost::asio::placeholders::error)));
+      }
+
+      /** The backlog timer expired.
+       * @param error the timer status
+       */
+      void connection::handle_backlog_timer(const boost::system::error_code& error) {
+         if (error == boost::asio::error::operation_aborted)
+            return;
+
+         backlog_timer_armed = false;
+         flush_backlog();
+      }
+
+      /** An action's timer expired.
+       * @param seq the sequence number of the action
+       * @param error the timer status
+       */
+      void connection::expire(unsigned long long seq, const boost::system::error_code& error) {
+         if (error == boost::asio::error::operation_aborted)
+            return;
+
+         fail(seq, boost::asio::error::timed_out);
+         flush_backlog();
+      }
+
+      /** Give up on a pending action.
+       * @param seq the sequence number of the action
+       * @param error the error to pass to its error handler
+       *
+       * The action is forgotten (a late response will be discarded) and its 
+       * error handler, if any, is queued for connection::process_responses().
+       */
+      void connection::fail(unsigned long long seq, const boost::system::error_code& error) {
+         pending_t::iterator i = pending.find(seq);
+         if (i == pending.end())
+            return;
+
+         pending_action& p = i->second;
+         admission_control::time_point now = admission_control::clock_type::now();
+
+         if (p.in_flight) {
+            // a timeout is the strongest overload signal we can get, report 
+            // it to admission control as a (very) slow response
+            if (error == boost::asio::error::timed_out)
+               m_admission.answered(now - p.sent, now);
+            else
+               m_admission.released();
+         }
+         else {
+            backlog.erase(std::find(backlog.begin(), backlog.end(), seq));
+         }
+
+         if (p.timer)
+            p.timer->cancel();
+
+         if (p.error_handler)
+            completions.push(boost::bind(p.error_handler, error));
+
+         std::pair<action_ids_t::iterator, action_ids_t::iterator> ii = action_ids.equal_range(p.id);
+         for (action_ids_t::iterator j = ii.first; j != ii.second; ++j) {
+            if (j->second == seq) {
+               action_ids.erase(j);
+               break;
+            }
+         }
+         pending.erase(i);
+      }
+
+      /** Cancel a pending action.
+       * @param action_id the ActionID returned by 
+       * connection::send_action_async()
+       *
+       * The action's error handler will be called with 
+       * boost::asio::error::operation_aborted and its response, if one still 
+       * arrives, will be discarded.  If several pending actions share the 
+       * ActionID they are all cancelled.
+       *
+       * @return true if a pending action was cancelled, false if no action 
+       * with this ActionID is waiting for a response
+       */
+      bool connection::cancel(const std::string& action_id) {
+         std::vector<unsigned long long> seqs;
+         std::pair<action_ids_t::iterator, action_ids_t::iterator> ii = action_ids.equal_range(action_id);
+         for (action_ids_t::iterator i = ii.first; i != ii.second; ++i) {
+            seqs.push_back(i->second);
+         }
+
+         for (std::vector<unsigned long long>::iterator i = seqs.begin(); i != seqs.end(); ++i) {
+            fail(*i, boost::asio::error::operation_aborted);
+         }
+
+         flush_backlog();
+         return not seqs.empty();
+      }
+
+      /** Cancel all pending actions.
+       * @see connection::cancel()
+       */
+      void connection::cancel_all() {
+         while (not pending.empty()) {
+            fail(pending.begin()->first, boost::asio::error::operation_aborted);
+         }
+      }
+      
+      /** Send a command to Asterisk.
+       * @param command the command to send
+       *
+       * This function executes connection::send_action().
+       */
+      message::response connection::operator()(const basic_action& command) {
+         return send_action(command);
+      }
+      
+      /** Send a command to Asterisk and recieve the response asynchronously.
+       * @param command the command to send
+       * @param handler the handler function/functor
+       *
+       * This function executes connection::send_action_async().
+       */
+      void connection::operator()(const basic_action& command, response_handler_t handler) {
+         send_action_async(command, handler);
       }
       
-      /** Pull a response out of the response queue or from the network.
-       * This function will return the resposne at the front of the queue.  If 
-       * the queue is empty it will read messages from the network until it 
-       * finds a response.
-       * @return a response from the queue
-       */
-      message::response connection::read_response() {
-         wait_response();
-         message::response response = responses.front();
-         responses.pop();
-         return response;
-      }
-      
-      /** Pull an event out of the response queue or from the network.
-       * This function will return the event at the front of the queue.  If the 
-       * queue is empty it will read messages from the network until it finds 
-       * an event.
-       * @return an event from the queue
+      /** Start reading from the socket if we are not already.
+       * The data is handled by connection::handle_read() when the io_service 
+       * is run.
        */
-      message::event connection::read_event() {
-         wait_event();
-         message::event event = events.front();
-         events.pop();
-         return event;
+      void connection::start_read() {
+         if (reading or m_external_io or not socket.is_open())
+            return;
+
+         reading = true;
+         socket.async_read_some(boost::asio::buffer(read_buffer),
+               guard(m_alive, boost::bind(&connection::handle_read, this, m_generation,
+                  boost::asio::placeholders::error,
+                  boost::asio::placeholders::bytes_transferred)));
       }
 
+      /** Handle data read from the socket.
+       * @param generation the connection the read was started on
+       * @param error the status of the read
+       * @param bytes the number of bytes read
+       * @throw boost::system::system_error if there was a problem reading
+       */
+      void connection::handle_read(unsigned int generation, const boost::system::error_code& error, std::size_t bytes) {
+         // this read belongs to a socket we have since closed
+         if (generation != m_generation)
+            return;
+
+         reading = false;
+
+         // the socket was closed under us (disconnect() or a connect 
+         // timeout), that is not an error
+         if (error == boost::asio::error::operation_aborted)
+            return;
+
+         if (error and m_connecting) {
+            finish_connect(error);
+            return;
+         }
+         if (error)
+            throw boost::system::system_error(error);
+
+         m_read_time = latency_histogram::clock_type::now();
+         m_parser.feed(read_buffer.data(), bytes, *this);
+      }
+
+      /** Handle the greeting.
+       * @param line the greeting line
+       *
+       * The greeting is split into the manager name and version and the 
+       * connect is finished.
+       */
+      void connection::on_greeting(const std::string& line) {
+         // split the version and the name
+         std::string::size_type i = line.find_last_of('/');
+         if (i != std::string::npos) {
+            m_name.assign(line, 0, i);
+            if (++i != std::string::npos) {
+               m_version.assign(line, i, std::string::npos);
+            }
+         }
+         m_greeting = false;
+         finish_connect(boost::system::error_code());
+      }
+
+      /** Put an event in the queue.
+       * @param e the event
+       */
+      void connection::on_event(message::event& e) {
+         events.push(std::move(e));
+         m_event_reads.push(m_read_time);
+      }
+
+      /** Attach collected output to a response and match it to its action.
+       * @param r the response
+       */
+      void connection::on_response(message::response& r) {
+         r.data.swap(m_output);
+         m_output.clear();
+         for (std::vector<std::string>::iterator i = m_output_headers.begin(); i != m_output_headers.end(); ++i) {
+            r.insert(std::make_pair(std::string("Output"), *i));
+         }
+         m_output_headers.clear();
+
+         complete_response(std::move(r));
+      }
+
+      /** Handle a line of command output.
+       * @param action_id the ActionID of the response being read
+       * @param line the line, without its line ending
+       * @param header whether the line came from an 'Output' header
+       *
+       * Output headers of a response to a Command action (or any action 
+       * with an output handler) are treated as command output, for other 
+       * actions they are kept as headers.  If the action the output belongs 
+       * to has an output handler the line is passed to it straight away, 
+       * otherwise it is appended to the response's data, up to the action's 
+       * output limit.
+       */
+      void connection::on_output(const std::string& action_id, const std::string& line, bool header) {
+         pending_t::iterator p = pending.end();
+         if (action_id.empty()) {
+            for (p = pending.begin(); p != pending.end() and not p->second.in_flight; ++p);
+         }
+         else {
+            std::pair<action_ids_t::iterator, action_ids_t::iterator> ii = action_ids.equal_range(action_id);
+            for (action_ids_t::iterator i = ii.first; i != ii.second; ++i) {
+               pending_t::iterator j = pending.find(i->second);
+               if (j != pending.end() and j->second.in_flight) {
+                  p = j;
+                  break;
+               }
+            }
+         }
+
+         if (header and (p == pending.end() or not (p->second.output_handler or p->second.name == "Command"))) {
+            m_output_headers.push_back(line);
+            return;
+         }
+
+         if (p != pending.end() and p->second.output_handler) {
+            p->second.output_handler(line);
+            return;
+         }
+
+         std::string::size_type limit = (p != pending.end()) ? p->second.output_limit : std::string::npos;
+         if (line.size() < limit and m_output.size() < limit - line.size()) {
+            m_output += line;
+            m_output += '\n';
+         }
+      }
+
+      /** Match a response to its pending action.
+       * @param response the response
+       *
+       * The response is matched by ActionID, or to the oldest action in 
+       * flight if it has none.  The action's response handler is queued for 
+       * connection::process_responses().  Responses that match no pending 
+       * action (for example the late response to an action that timed out) 
+       * are discarded.
+       */
+      void connection::complete_response(message::response response) {
+         pending_t::iterator p = pending.end();
+
+         std::pair<message::response::header_t::iterator, message::response::header_t::iterator> id = response.equal_range("ActionID");
+         if (id.first != id.second) {
+            std::pair<action_ids_t::iterator, action_ids_t::iterator> ii = action_ids.equal_range(id.first->second);
+            for (action_ids_t::iterator i = ii.first; i != ii.second; ++i) {
+               pending_t::iterator j = pending.find(i->second);
+               if (j != pending.end() and j->second.in_flight) {
+                  p = j;
+                  action_ids.erase(i);
+                  break;
+               }
+            }
+         }
+         else {
+            for (p = pending.begin(); p != pending.end() and not p->second.in_flight; ++p);
+            if (p != pending.end()) {
+               std::pair<action_ids_t::iterator, action_ids_t::iterator> ii = action_ids.equal_range(p->second.id);
+               for (action_ids_t::iterator i = ii.first; i != ii.second; ++i) {
+                  if (i->second == p->first) {
+                     action_ids.erase(i);
+                     break;
+                  }
+               }
+            }
+         }
+
+         if (p == pending.end())
+            return;
+
+         // feed the response latency to admission control
+         admission_control::time_point now = admission_control::clock_type::now();
+         m_admission.answered(now - p->second.sent, now);
+
+         if (p->second.timer)
+            p->second.timer->cancel();
+
+         if (p->second.handler)
+            completions.push(boost::bind(p->second.handler, response));
+         pending.erase(p);
+
+         // the response may have made room for backlogged actions
+         flush_backlog();
+      }
+
+      /** Run the io_service until at least one handler has run.
+       * This blocks until data is read or a timer expires.  With a spin 
+       * policy set (see connection::spin()) the socket is polled for a 
+       * while first.
+       */
+      void connection::run_one() {
+         if (m_external_io)
+            throw std::logic_error("blocking call on a connection driven by an external event loop");
+
+         if (m_spin.spin > duration::zero() and not m_connecting and socket.is_open() and spin_once()) {
+            check_io_error();
+            return;
+         }
+
+         if (not m_io_thread)
+            start_read();
+         if (io_service.stopped())
+            io_service.restart();
+         io_service.run_one();
+         check_io_error();
+      }
+
+      /** Run every handler that is ready without blocking.
+       */
+      void connection::poll() {
+         std::size_t count;
+         do {
+            if (not m_io_thread)
+               start_read();
+            if (io_service.stopped())
+               io_service.restart();
+            count = io_service.poll();
+            check_io_error();
+         } while (count);
+      }
+      
       /** Process all the events in the queue.
        * This function executes all the registered event handlers that match 
-       * events in the queue.
+       * events in the queue, then hands the batch handlers whatever is due 
+       * (see connection::register_batch()).
        */
       void connection::process_events() {
+         if (m_auto_filter and admission_control::clock_type::now() - m_filter_updated >= std::chrono::seconds(1))
+            update_event_filter();
+         update_projection();
+
          /* Here we pop events off of the queue one by one because it is 
           * possible for our handlers to add events to the queue (by executing 
           * an action which adds events while waiting for a response).  By 
@@ -391,9 +1437,13 @@ namespace astxx {
           * becomming invalid.
           */
          while (not events.empty()) {
-            message::event e = events.front();
+            message::event e(std::move(events.front()));
             events.pop();
 
+            if (m_record_latency)
+               m_event_latency.record(latency_histogram::clock_type::now() - m_event_reads.front());
+            m_event_reads.pop();
+
             event_handlers_t::iterator i = event_handlers.find(e.main_header());
             if (i != event_handlers.end()) {
                (*i->second)(e);
@@ -404,7 +1454,12 @@ namespace astxx {
             if (i != event_handlers.end()) {
                (*i->second)(e);
             }
+
+            m_event_index.dispatch(e);
+            m_event_batcher.push(e);
          }
+
+         m_event_batcher.flush();
       }
 
       /** Wait for an event and put it in the queue.
@@ -414,12 +1469,13 @@ namespace astxx {
        */
       void connection::wait_event() {
          while (events.empty()) {
-            read_message();
+            run_one();
          }
       }
 
       /** Process asynchronous responses.
-       * This function executes handlers for responses waiting.
+       * This function executes handlers for responses waiting, and error 
+       * handlers for actions that timed out or were cancelled.
        *
        * This function is called by connection::send_action() while waiting for 
        * a response.
@@ -430,36 +1486,691 @@ namespace astxx {
           * executing an action synchronously).  By popping events off one by 
           * one, we avoid worring about our iterators becomming invalid.
           */
-         while (not response_handlers.empty() and not responses.empty()) {
-            response_handler_t f = response_handlers.front();
-            response_handlers.pop();
+         while (not completions.empty()) {
+            boost::function<void ()> f = completions.front();
+            completions.pop();
 
-            f(read_response());
+            f();
          }
       }
 
       /** Wait for a response and puts it in the queue.
-       * This function waits for a response.
+       * This function waits for a response, or for a pending action to time 
+       * out.
        * @note If there is alreay a response waiting, this function will not 
        * block.
        */
       void connection::wait_response() {
-         while (responses.empty()) {
-            read_message();
+         while (completions.empty()) {
+            run_one();
          }
       }
       
       /** Read messages from the network until there is no more data waiting.
        * This function does not block.  It reads messages from the network 
        * until there are no more waiting and places them in the proper queues.  
-       * If there are no messages waiting it will simply return.
+       * If there are no messages waiting it will simply return.  Backlogged 
+       * actions that admission control now allows are sent first.
        */
       void connection::pump_messages() {
-         while (socket.available()) {
-            read_message();
+         flush_backlog();
+         poll();
+      }
+
+      /** Passes what the I/O thread parses to the application thread.
+       */
+      class connection::ring_writer : public parser::handler {
+         public:
+            ring_writer(connection& c) : c(c), pushed(false) { }
+
+            void on_greeting(const std::string& line) {
+               parsed_message* m = new parsed_message();
+               m->kind = parsed_message::greeting_line;
+               m->line = line;
+               push(m);
+            }
+
+            void on_event(message::event& e) {
+               parsed_message* m = new parsed_message();
+               m->kind = parsed_message::event_message;
+               m->event = std::move(e);
+               m->read = read;
+               push(m);
+            }
+
+            void on_response(message::response& r) {
+               parsed_message* m = new parsed_message();
+               m->kind = parsed_message::response_message;
+               m->response = std::move(r);
+               push(m);
+            }
+
+            void on_output(const std::string& action_id, const std::string& line, bool header) {
+               parsed_message* m = new parsed_message();
+               m->kind = header ? parsed_message::output_header : parsed_message::output_line;
+               m->action_id = action_id;
+               m->line = line;
+               push(m);
+            }
+
+            /** Push a failure, this is the last message from the thread.
+             * @param error the exception that stopped the thread
+             */
+            void fail(std::exception_ptr error) {
+               parsed_message* m = new parsed_message();
+               m->kind = parsed_message::failure;
+               m->error = error;
+               push(m);
+            }
+
+            /** Wake the application thread if anything was pushed since 
+             * the last call.
+             */
+            void flush() {
+               if (pushed) {
+                  pushed = false;
+                  c.notify_ring();
+               }
+            }
+
+            /// when the data being parsed was read
+            latency_histogram::clock_type::time_point read;
+
+         private:
+            /** Push a message, waiting for room if the ring is full.
+             * @param m the message, ownership passes to the ring
+             *
+             * While we wait the kernel buffers data for us and, once that 
+             * fills, TCP flow control pushes back on Asterisk.
+             */
+            void push(parsed_message* m) {
+               while (not c.m_ring->push(m)) {
+                  c.notify_ring();
+                  if (c.m_io_stop.load()) {
+                     delete m;
+                     return;
+                  }
+                  std::this_thread::yield();
+               }
+               pushed = true;
+            }
+
+            connection& c;
+            bool pushed;
+      };
+
+      /** Set how the connection waits for data.
+       * @param policy the spin policy
+       *
+       * With a spin time set, connection::wait_event(), 
+       * connection::wait_response() and the send_action() calls poll the 
+       * socket without blocking for up to that long before going to sleep 
+       * in the kernel, trading a cpu for the wake up latency.  If the I/O 
+       * thread is running, it spins on the socket the same way and the 
+       * waiting thread spins on the ring between them.  The spin starts 
+       * over each time a wait begins, and for the I/O thread whenever data 
+       * arrives.
+       *
+       * Spinning only pays off with a cpu to spare for it, so the policy 
+       * can pin the calling thread, which should be the one that waits.  
+       * Pin the I/O thread with connection::start_io_thread(), which 
+       * applies the spin time in effect when it starts.
+       *
+       * @code
+       * manager::spin_policy policy;
+       * policy.spin = std::chrono::milliseconds(5);
+       * policy.socket_busy_poll = 50;  // needs CAP_NET_ADMIN over net.core.busy_read
+       * policy.cpu = 2;
+       * connection.spin(policy);
+       * connection.record_latency(true);
+       * @endcode
+       *
+       * @throw boost::system::system_error if SO_BUSY_POLL or the cpu 
+       * affinity could not be set
+       */
+      void connection::spin(const spin_policy& policy) {
+         m_spin = policy;
+
+         if (m_spin.socket_busy_poll and socket.is_open() and not m_connecting) {
+            boost::system::error_code error = apply_busy_poll();
+            if (error)
+               throw boost::system::system_error(error);
+         }
+
+         if (m_spin.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(m_spin.cpu, &set);
+            int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (error)
+               throw boost::system::system_error(boost::system::error_code(error, boost::system::system_category()));
+         }
+      }
+
+      /** Move reading and parsing to a dedicated thread.
+       * @param cpu the cpu to pin the thread to, or -1 to let the scheduler 
+       * decide
+       * @param capacity the number of messages the ring between the I/O 
+       * thread and the application thread holds
+       *
+       * The I/O thread reads from the socket and parses messages as soon as 
+       * data arrives, whether or not the application is busy running 
+       * handlers.  Finished messages are passed through a lock-free single 
+       * producer, single consumer ring and picked up by whichever of 
+       * connection::wait_event(), connection::wait_response() or 
+       * connection::pump_messages() the application calls next.  Matching 
+       * responses, admission control and running handlers stay on the 
+       * application thread, as does sending actions.
+       *
+       * If the ring fills up the I/O thread stops reading until the 
+       * application catches up.  A read or parse error stops the thread and 
+       * is thrown from the application thread.
+       *
+       * @code
+       * manager::connection connection("localhost");
+       * action::login("user", "secret")(connection);
+       * connection.start_io_thread(3);  // read on cpu 3
+       * @endcode
+       *
+       * @throw std::logic_error if the connection is not established
+       * @throw boost::system::system_error if the thread could not be set up
+       */
+      void connection::start_io_thread(int cpu, std::size_t capacity) {
+         if (m_io_thread)
+            return;
+
+         if (m_connecting or not socket.is_open())
+            throw std::logic_error("start_io_thread() called without a connection");
+         if (m_external_io)
+            throw std::logic_error("start_io_thread() called on a connection driven by an external event loop");
+
+         // take over from the io_service, a read it has already completed 
+         // is parsed here before the thread gets the parser
+         cancel_read();
+
+         if (::pipe(m_io_wake) < 0)
+            throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+
+         m_ring.reset(new ring_t(capacity));
+         m_io_stop = false;
+         m_drain_posted = false;
+
+         // keep run_one() waiting for the ring rather than returning for 
+         // lack of work
+         m_io_work.reset(new boost::asio::executor_work_guard<boost::asio::io_service::executor_type>(io_service.get_executor()));
+         m_io_thread.reset(new std::thread(&connection::io_thread_main, this, static_cast<int>(socket.native_handle()), cpu, m_spin.spin));
+      }
+
+      /** Stop the I/O thread and go back to reading from the io_service.
+       * Messages the thread already parsed are put in the queues first.
+       */
+      void connection::stop_io_thread() {
+         if (not m_io_thread)
+            return;
+
+         join_io_thread();
+
+         parsed_message* m;
+         while (m_ring->pop(m)) {
+            boost::scoped_ptr<parsed_message> owner(m);
+            dispatch(*m);
+         }
+         m_ring.reset();
+      }
+
+      /** Tell the I/O thread to stop and wait for it.
+       */
+      void connection::join_io_thread() {
+         if (not m_io_thread)
+            return;
+
+         m_io_stop = true;
+         char c = 0;
+         while (::write(m_io_wake[1], &c, 1) < 0 and errno == EINTR);
+
+         m_io_thread->join();
+         m_io_thread.reset();
+         m_io_work.reset();
+
+         ::close(m_io_wake[0]);
+         ::close(m_io_wake[1]);
+         m_io_wake[0] = m_io_wake[1] = -1;
+      }
+
+      /** The body of the I/O thread.
+       * @param fd the socket
+       * @param cpu the cpu to pin to, or -1
+       * @param spin how long to keep polling the socket before sleeping
+       */
+      void connection::io_thread_main(int fd, int cpu, duration spin) {
+         if (cpu >= 0) {
+            // not fatal, we just run wherever the scheduler puts us
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+         }
+
+         ring_writer writer(*this);
+         boost::array<char, 65536> buffer;
+         latency_histogram::clock_type::time_point idle = latency_histogram::clock_type::now();
+
+         try {
+            while (not m_io_stop.load()) {
+               ssize_t n = ::recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+               if (n > 0) {
+                  writer.read = idle = latency_histogram::clock_type::now();
+                  m_parser.feed(buffer.data(), n, writer);
+                  writer.flush();
+                  continue;
+               }
+
+               if (n == 0)
+                  throw boost::system::system_error(boost::asio::error::eof);
+
+               if (errno == EINTR)
+                  continue;
+               if (errno != EAGAIN and errno != EWOULDBLOCK)
+                  throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+
+               // keep polling for a while after the last data
+               if (spin > duration::zero() and (spin == duration::max() or latency_histogram::clock_type::now() - idle < spin)) {
+                  cpu_relax();
+                  continue;
+               }
+
+               pollfd fds[2];
+               fds[0].fd = fd;
+               fds[0].events = POLLIN;
+               fds[1].fd = m_io_wake[0];
+               fds[1].events = POLLIN;
+               if (::poll(fds, 2, -1) < 0 and errno != EINTR)
+                  throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+               idle = latency_histogram::clock_type::now();
+            }
+         }
+         catch (...) {
+            writer.fail(std::current_exception());
+            writer.flush();
+         }
+      }
+
+      /** Have the application thread drain the ring.
+       * Called from the I/O thread.  Only one drain is posted to the 
+       * io_service at a time, however many messages are waiting.
+       */
+      void connection::notify_ring() {
+         if (not m_drain_posted.exchange(true))
+            boost::asio::post(io_service, guard(m_alive, boost::bind(&connection::drain_ring, this)));
+      }
+
+      /** Handle everything the I/O thread has parsed so far.
+       */
+      void connection::drain_ring() {
+         // clear the flag first, anything pushed after this posts again
+         m_drain_posted = false;
+         if (not m_ring)
+            return;
+
+         try {
+            parsed_message* m;
+            while (m_ring->pop(m)) {
+               boost::scoped_ptr<parsed_message> owner(m);
+               dispatch(*m);
+            }
+         }
+         catch (...) {
+            // come back for the rest
+            notify_ring();
+            throw;
+         }
+
+         if (m_io_error)
+            stop_io_thread();
+      }
+
+      /** Handle a message from the I/O thread.
+       * @param m the message
+       */
+      void connection::dispatch(parsed_message& m) {
+         switch (m.kind) {
+            case parsed_message::greeting_line:
+               on_greeting(m.line);
+               break;
+            case parsed_message::event_message:
+               m_read_time = m.read;
+               on_event(*m.event);
+               break;
+            case parsed_message::response_message:
+               on_response(*m.response);
+               break;
+            case parsed_message::output_line:
+               on_output(m.action_id, m.line, false);
+               break;
+            case parsed_message::output_header:
+               on_output(m.action_id, m.line, true);
+               break;
+            case parsed_message::failure:
+               m_io_error = m.error;
+               break;
+         }
+      }
+
+      /** Throw the error that stopped the I/O thread, if there was one.
+       */
+      void connection::check_io_error() {
+         if (m_io_error) {
+            std::exception_ptr e;
+            std::swap(e, m_io_error);
+            std::rethrow_exception(e);
+         }
+      }
+
+      /** Cancel the read the io_service has outstanding, if any.
+       * A read that has already completed is parsed before this returns.
+       */
+      void connection::cancel_read() {
+         if (not reading)
+            return;
+
+         boost::system::error_code ignored;
+         socket.cancel(ignored);
+         while (reading) {
+            if (io_service.stopped())
+               io_service.restart();
+            io_service.run_one();
+         }
+      }
+
+      /** Poll for something to do without blocking, for as long as the 
+       * spin policy allows.
+       *
+       * Reads the socket, or the ring from the I/O thread, and every so 
+       * often runs whatever the io_service has ready so timers still fire.
+       *
+       * @throw boost::system::system_error if there was a problem reading, 
+       * with boost::asio::error::eof if Asterisk closed the connection
+       * @return true if something was read or run, false if the spin time 
+       * ran out
+       */
+      bool connection::spin_once() {
+         if (not m_io_thread)
+            cancel_read();
+
+         latency_histogram::clock_type::time_point start = latency_histogram::clock_type::now();
+         for (unsigned int i = 1; ; ++i) {
+            if (m_io_thread) {
+               if (m_ring->read_available()) {
+                  drain_ring();
+                  return true;
+               }
+            }
+            else {
+               ssize_t n = ::recv(socket.native_handle(), read_buffer.data(), read_buffer.size(), MSG_DONTWAIT);
+               if (n > 0) {
+                  m_read_time = latency_histogram::clock_type::now();
+                  m_parser.feed(read_buffer.data(), n, *this);
+                  return true;
+               }
+
+               if (n == 0)
+                  throw boost::system::system_error(boost::asio::error::eof);
+               if (errno != EINTR and errno != EAGAIN and errno != EWOULDBLOCK)
+                  throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+            }
+
+            // the io_service costs a system call, check it now and then
+            if (i % 64 == 0) {
+               if (io_service.stopped())
+                  io_service.restart();
+               if (io_service.poll())
+                  return true;
+               if (m_spin.spin != duration::max() and latency_histogram::clock_type::now() - start >= m_spin.spin)
+                  return false;
+            }
+
+            cpu_relax();
+         }
+      }
+
+      /** Set SO_BUSY_POLL on the socket from the spin policy.
+       * @return the result
+       */
+      boost::system::error_code connection::apply_busy_poll() {
+         int usec = static_cast<int>(m_spin.socket_busy_poll);
+         if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+            return boost::system::error_code(errno, boost::system::system_category());
+         return boost::system::error_code();
+      }
+
+      /** Write data to the socket.
+       * @param data the data
+       *
+       * Normally this blocks until the data is written.  When an external 
+       * event loop drives the connection, whatever the socket does not take 
+       * straight away is queued for connection::on_writable(), or all of 
+       * it if writes are deferred.
+       *
+       * @throw boost::system::system_error if there was a problem writing
+       */
+      void connection::send_data(const std::string& data) {
+         if (not m_external_io) {
+            boost::asio::write(socket, boost::asio::buffer(data));
+            return;
+         }
+
+         std::string::size_type sent = 0;
+         if (not want_write() and not m_defer_writes) {
+            while (sent < data.size()) {
+               ssize_t n = ::send(socket.native_handle(), data.data() + sent, data.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+               if (n >= 0) {
+                  sent += n;
+                  continue;
+               }
+
+               if (errno == EINTR)
+                  continue;
+               if (errno == EAGAIN or errno == EWOULDBLOCK)
+                  break;
+               throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+            }
+         }
+
+         m_write_queue.append(data, sent, std::string::npos);
+      }
+
+      /** Hand reading and writing to an external event loop.
+       *
+       * From here on the connection never blocks.  The application watches 
+       * connection::native_handle() in its own loop and calls 
+       * connection::on_readable() when the socket is readable and 
+       * connection::on_writable() when it is writable and 
+       * connection::want_write() says data is waiting.  Actions that do not 
+       * fit in the socket buffer are queued rather than waited for.
+       *
+       * Events and responses are still delivered by 
+       * connection::process_events() and connection::process_responses().  
+       * Action timeouts and rate limited actions run off the io_service, 
+       * call connection::pump_messages() (which does not read the socket in 
+       * this mode) from the loop's timer now and then to drive them.
+       *
+       * Calls that wait, connection::send_action(), 
+       * connection::wait_event() and connection::wait_response(), throw 
+       * std::logic_error in this mode.  Log in before calling this.
+       *
+       * @code
+       * action::login("user", "secret")(connection);
+       * connection.start_external_io();
+       *
+       * epoll_event ev;
+       * ev.events = EPOLLIN | EPOLLET;
+       * ev.data.ptr = &connection;
+       * epoll_ctl(epfd, EPOLL_CTL_ADD, connection.native_handle(), &ev);
+       *
+       * // in the loop
+       * if (ev.events & EPOLLIN)
+       *    connection.on_readable();
+       * if (ev.events & EPOLLOUT)
+       *    connection.on_writable();
+       * connection.process_events();
+       * connection.process_responses();
+       * // and watch for EPOLLOUT if connection.want_write()
+       * @endcode
+       *
+       * A connect or a disconnect ends this mode.
+       *
+       * @param defer_writes queue everything written for the event loop 
+       * instead of trying to write it straight away, for loops that submit 
+       * writes themselves (see connection::take_writes())
+       *
+       * @throw std::logic_error if the connection is not established or an 
+       * I/O thread is running
+       */
+      void connection::start_external_io(bool defer_writes) {
+         if (m_external_io)
+            return;
+
+         if (m_connecting or not socket.is_open())
+            throw std::logic_error("start_external_io() called without a connection");
+         if (m_io_thread)
+            throw std::logic_error("start_external_io() called with an I/O thread running");
+
+         cancel_read();
+         m_external_io = true;
+         m_defer_writes = defer_writes;
+      }
+
+      /** Take reading and writing back from the external event loop.
+       * Queued data is written first, blocking if need be.
+       * @throw boost::system::system_error if there was a problem writing
+       */
+      void connection::stop_external_io() {
+         if (not m_external_io)
+            return;
+
+         m_external_io = false;
+         m_defer_writes = false;
+
+         std::string data;
+         data.swap(m_write_queue);
+         data.erase(0, m_write_offset);
+         m_write_offset = 0;
+         if (not data.empty())
+            boost::asio::write(socket, boost::asio::buffer(data));
+      }
+
+      /** Read and parse whatever the socket has.
+       *
+       * Reads until the socket would block, so the connection may be 
+       * registered edge triggered.  Parsed events and responses are put in 
+       * the queues for connection::process_events() and 
+       * connection::process_responses().
+       *
+       * @throw std::logic_error if connection::start_external_io() was not 
+       * called
+       * @throw boost::system::system_error if there was a problem reading, 
+       * with boost::asio::error::eof if Asterisk closed the connection
+       * @return the number of bytes read
+       */
+      std::size_t connection::on_readable() {
+         if (not m_external_io)
+            throw std::logic_error("on_readable() called without start_external_io()");
+
+         std::size_t total = 0;
+         for (;;) {
+            ssize_t n = ::recv(socket.native_handle(), read_buffer.data(), read_buffer.size(), MSG_DONTWAIT);
+            if (n > 0) {
+               total += n;
+               m_read_time = latency_histogram::clock_type::now();
+               m_parser.feed(read_buffer.data(), n, *this);
+               continue;
+            }
+
+            if (n == 0)
+               throw boost::system::system_error(boost::asio::error::eof);
+
+            if (errno == EINTR)
+               continue;
+            if (errno == EAGAIN or errno == EWOULDBLOCK)
+               return total;
+            throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
          }
       }
 
+      /** Parse data the external event loop read from the socket.
+       * @param data the data
+       * @param size the number of bytes of data
+       *
+       * For loops that read the socket themselves, instead of calling 
+       * connection::on_readable().  Parsed events and responses are put in 
+       * the queues for connection::process_events() and 
+       * connection::process_responses().
+       *
+       * @throw std::logic_error if connection::start_external_io() was not 
+       * called
+       */
+      void connection::on_data(const char* data, std::size_t size) {
+         if (not m_external_io)
+            throw std::logic_error("on_data() called without start_external_io()");
+
+         m_read_time = latency_histogram::clock_type::now();
+         m_parser.feed(data, size, *this);
+      }
+
+      /** Take the queued data for the event loop to write.
+       * @param data replaced with the data waiting to be written, in order
+       *
+       * For loops that write the socket themselves, instead of calling 
+       * connection::on_writable().  The queue is left empty, the loop is 
+       * responsible for writing all of the data before anything taken 
+       * later.
+       */
+      void connection::take_writes(std::string& data) {
+         data.clear();
+         if (not want_write()) {
+            m_write_queue.clear();
+            m_write_offset = 0;
+            return;
+         }
+
+         data.swap(m_write_queue);
+         data.erase(0, m_write_offset);
+         m_write_offset = 0;
+      }
+
+      /** Write as much queued data as the socket takes.
+       *
+       * Writes until the queue is empty or the socket would block.
+       *
+       * @throw std::logic_error if connection::start_external_io() was not 
+       * called
+       * @throw boost::system::system_error if there was a problem writing
+       * @return true if everything has been written, false to wait for the 
+       * socket to become writable again
+       */
+      bool connection::on_writable() {
+         if (not m_external_io)
+            throw std::logic_error("on_writable() called without start_external_io()");
+
+         while (want_write()) {
+            ssize_t n = ::send(socket.native_handle(), m_write_queue.data() + m_write_offset, m_write_queue.size() - m_write_offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n >= 0) {
+               m_write_offset += n;
+               continue;
+            }
+
+            if (errno == EINTR)
+               continue;
+            if (errno == EAGAIN or errno == EWOULDBLOCK)
+               return false;
+            throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+         }
+
+         m_write_queue.clear();
+         m_write_offset = 0;
+         return true;
+      }
+
       /** Register an event handler.
        * @param e the name of the event (case sensitive, use a blank string to 
        * match all events)
@@ -486,7 +2197,400 @@ namespace astxx {
        */
       boost::signals2::connection connection::register_event(const std::string& e, boost::function<void (message::event)> f) {
          std::pair<event_handlers_t::iterator, bool> ii = event_handlers.insert(std::make_pair(e, boost::shared_ptr<boost::signals2::signal<void (message::event)> >(new boost::signals2::signal<void (message::event)>())));
-         return ii.first->second->connect(f);
+         boost::signals2::connection c = ii.first->second->connect(f);
+         m_projection_stale = true;
+         update_projection();
+
+         tracked_subscription t = { c, event_filter::subscription(e) };
+         subscriptions.push_back(t);
+         m_event_filter.add(t.subscription);
+         if (m_auto_filter)
+            update_event_filter();
+
+         return c;
+      }
+
+      /** Calls an event handler if a header has a given value.
+       */
+      class header_match {
+         public:
+            header_match(const std::string& header, const std::string& value, boost::function<void (message::event)> f)
+               : header(header), value(value), f(f) { }
+
+            void operator()(message::event e) {
+               std::pair<message::event::header_t::iterator, message::event::header_t::iterator> ii = e.equal_range(header);
+               if (ii.first != ii.second and ii.first->second == value)
+                  f(e);
+            }
+
+         private:
+            std::string header;
+            std::string value;
+            boost::function<void (message::event)> f;
+      };
+
+      /** Register an event handler for events with a given header value.
+       * @param e the name of the event (case sensitive, use a blank string to 
+       * match all events)
+       * @param header the header to check
+       * @param value the value the header must have
+       * @param f the callback function pointer or functor
+       *
+       * This works like connection::register_event(const std::string&, 
+       * boost::function<void (message::event)>) except that the handler is 
+       * only called for events whose header matches.  With 
+       * connection::auto_filter() enabled the header is also used to narrow 
+       * the filter installed in Asterisk.
+       *
+       * @code
+       * connection.register_event("QueueMemberStatus", "Queue", "sales", handler);
+       * @endcode
+       *
+       * @return a boost::signals::connection object that can be used to 
+       * manager this event handler
+       */
+      boost::signals2::connection connection::register_event(const std::string& e, const std::string& header, const std::string& value, boost::function<void (message::event)> f) {
+         std::pair<event_handlers_t::iterator, bool> ii = event_handlers.insert(std::make_pair(e, boost::shared_ptr<boost::signals2::signal<void (message::event)> >(new boost::signals2::signal<void (message::event)>())));
+         boost::signals2::connection c = ii.first->second->connect(header_match(header, value, f));
+         m_projection_stale = true;
+         update_projection();
+
+         tracked_subscription t = { c, event_filter::subscription(e, header, value) };
+         subscriptions.push_back(t);
+         m_event_filter.add(t.subscription);
+         if (m_auto_filter)
+            update_event_filter();
+
+         return c;
+      }
+
+      /** Subscribe to an event through the event index.
+       * @param e the name of the event (case sensitive, use a blank string to 
+       * match all events)
+       * @param f the handler
+       *
+       * @see connection::subscribe(const std::string&, const event_index::predicate&, const event_index::handler_t&)
+       * @return a handle to remove the subscription with
+       */
+      event_index::handle connection::subscribe(const std::string& e, const event_index::handler_t& f) {
+         return subscribe(e, event_index::predicate(), f);
+      }
+
+      /** Subscribe to events matching a header predicate.
+       * @param e the name of the event (case sensitive, use a blank string to 
+       * match all events)
+       * @param p the predicate the event must satisfy
+       * @param f the handler
+       *
+       * The handler is called from connection::process_events(), after the 
+       * handlers registered with connection::register_event(), for each 
+       * event named e whose headers satisfy p.
+       *
+       * @code
+       * connection.subscribe("QueueMemberStatus", event_index::predicate::equals("Queue", "sales"), handler);
+       * connection.subscribe("", event_index::predicate::prefix("Channel", "PJSIP/trunk-"), handler);
+       * event_index::handle h = connection.subscribe("Hangup", event_index::predicate::in("Uniqueid", ids), handler);
+       * ...
+       * h.disconnect();
+       * @endcode
+       *
+       * Subscriptions are meant to come and go with calls, so with 
+       * connection::auto_filter() enabled only their event names are used 
+       * for the EventMask and server side filters; a filter per value would 
+       * pile up in Asterisk, which can't remove them.
+       *
+       * @return a handle to remove the subscription with
+       */
+      event_index::handle connection::subscribe(const std::string& e, const event_index::predicate& p, const event_index::handler_t& f) {
+         event_index::handle h = m_event_index.add(e, p, f);
+         track_event_name(e);
+         update_projection();
+         return h;
+      }
+
+      /** Subscribe to events matching a header predicate, reading only some 
+       * headers.
+       * @param e the name of the event (case sensitive, use a blank string to 
+       * match all events)
+       * @param p the predicate the event must satisfy
+       * @param f the handler
+       * @param headers the headers the handler reads
+       *
+       * Like connection::subscribe(const std::string&, const event_index::predicate&, const event_index::handler_t&), 
+       * but declares the headers the handler looks at.  Once every handler 
+       * for an event (and every handler for all events) has declared its 
+       * headers, the parser only keeps the headers some handler declared, 
+       * the predicate's header, 'Event' and 'ActionID'; the rest are 
+       * skipped without being copied.  Other handlers of the event may then 
+       * see it without those headers too, so all of them should declare 
+       * what they read.
+       *
+       * @code
+       * std::vector<std::string> headers;
+       * headers.push_back("Channel");
+       * headers.push_back("Uniqueid");
+       * connection.subscribe("Newchannel", event_index::predicate(), handler, headers);
+       * @endcode
+       *
+       * @return a handle to remove the subscription with
+       */
+      event_index::handle connection::subscribe(const std::string& e, const event_index::predicate& p, const event_index::handler_t& f, const std::vector<std::string>& headers) {
+         event_index::handle h = m_event_index.add(e, p, f, headers);
+         track_event_name(e);
+         update_projection();
+         return h;
+      }
+
+      /** Take part in automatic event filtering for an event name.
+       * @param e the event name of an index or batch subscription
+       */
+      void connection::track_event_name(const std::string& e) {
+         if (m_indexed_events.insert(e).second) {
+            m_event_filter.add(event_filter::subscription(e));
+            if (m_auto_filter)
+               update_event_filter();
+         }
+      }
+
+      /** Give the parser a new header projection if handlers changed.
+       * Handlers registered with connection::register_event() read every 
+       * header of their events.
+       */
+      void connection::update_projection() {
+         if (not m_projection_stale and m_index_interest == m_event_index.interest().version() and m_batch_interest == m_event_batcher.interest().version())
+            return;
+
+         m_projection_stale = false;
+         m_index_interest = m_event_index.interest().version();
+         m_batch_interest = m_event_batcher.interest().version();
+
+         std::set<std::string> everything;
+         for (event_handlers_t::const_iterator i = event_handlers.begin(); i != event_handlers.end(); ++i) {
+            if (not i->second->empty())
+               everything.insert(i->first);
+         }
+
+         std::vector<const header_interest*> sources;
+         sources.push_back(&m_event_index.interest());
+         sources.push_back(&m_event_batcher.interest());
+         m_parser.project(header_interest::projection(sources, everything));
+      }
+
+      /** Register a handler that receives events in batches.
+       * @param e the name of the event (case sensitive, use a blank string to 
+       * match all events)
+       * @param f the handler
+       * @param max_size the most events to pass at once, 0 for no limit
+       * @param max_latency how long events may be held back to make a 
+       * bigger batch, zero to pass them on every 
+       * connection::process_events() call
+       *
+       * Instead of a call per event the handler gets the events queued for 
+       * it as one contiguous range, without a copy per event when it is the 
+       * only handler.  With the defaults each connection::process_events() 
+       * call passes everything it processed for the event in one batch.  A 
+       * batch reaching max_size is passed immediately, and with a latency 
+       * bound events are held over until the oldest is max_latency old.  
+       * The bound is only checked from connection::process_events(), so 
+       * call that regularly when events may be held back.
+       *
+       * @code
+       * void insert_rows(event_batcher::batch_t events);
+       * connection.register_batch("Cdr", insert_rows, 500, std::chrono::seconds(1));
+       * @endcode
+       *
+       * @return a handle to remove the handler with
+       */
+      event_batcher::handle connection::register_batch(const std::string& e, const event_batcher::handler_t& f, std::size_t max_size, duration max_latency) {
+         event_batcher::handle h = m_event_batcher.add(e, f, max_size, max_latency);
+         track_event_name(e);
+         update_projection();
+         return h;
+      }
+
+      /** Register a handler that receives events in batches, reading only 
+       * some headers.
+       * @param e the name of the event (case sensitive, use a blank string to 
+       * match all events)
+       * @param f the handler
+       * @param headers the headers the handler reads
+       * @param max_size the most events to pass at once, 0 for no limit
+       * @param max_latency how long events may be held back to make a 
+       * bigger batch
+       *
+       * See connection::register_batch(const std::string&, const event_batcher::handler_t&, std::size_t, duration) 
+       * and, for what declaring headers does, 
+       * connection::subscribe(const std::string&, const event_index::predicate&, const event_index::handler_t&, const std::vector<std::string>&).
+       *
+       * @return a handle to remove the handler with
+       */
+      event_batcher::handle connection::register_batch(const std::string& e, const event_batcher::handler_t& f, const std::vector<std::string>& headers, std::size_t max_size, duration max_latency) {
+         event_batcher::handle h = m_event_batcher.add(e, f, headers, max_size, max_latency);
+         track_event_name(e);
+         update_projection();
+         return h;
+      }
+
+      /** Sample or rate cap an event type.
+       * @param e the name of the event (case sensitive)
+       * @param one_in keep one event of this type in this many, 0 or 1 to 
+       * keep them all
+       * @param max_per_second the most events of this type to keep in any 
+       * one second window, 0 for no limit
+       *
+       * Events dropped by sampling are abandoned by the parser right after 
+       * their 'Event' line, without the rest being copied, parsed, queued 
+       * or dispatched, and are counted exactly (see 
+       * connection::events_dropped()).  This applies to every handler and 
+       * to the connection's own use of events.  Sampling happens on the 
+       * I/O thread when one is running.
+       *
+       * @code
+       * connection.sample_events("RTCPSent", 100);    // keep 1%
+       * connection.sample_events("VarSet", 0, 50);    // at most 50 a second
+       * connection.sample_events("VarSet", 0);        // keep them all again
+       * @endcode
+       */
+      void connection::sample_events(const std::string& e, std::size_t one_in, unsigned int max_per_second) {
+         boost::shared_ptr<parser::sampling_t> sampling(m_sampling ? new parser::sampling_t(*m_sampling) : new parser::sampling_t());
+
+         boost::shared_ptr<sample_rule::counters>& counts = m_sample_counts[e];
+         if (not counts)
+            counts.reset(new sample_rule::counters());
+
+         if (one_in > 1 or max_per_second)
+            (*sampling)[e].reset(new sample_rule(one_in, max_per_second, counts));
+         else
+            sampling->erase(e);
+
+         if (sampling->empty())
+            m_sampling.reset();
+         else
+            m_sampling = sampling;
+         m_parser.sample(m_sampling);
+      }
+
+      /** Get the number of events of a type dropped by sampling.
+       * @param e the name of the event
+       * @return the number of events dropped since sampling was first 
+       * configured for the event
+       */
+      unsigned long long connection::events_dropped(const std::string& e) const {
+         std::map<std::string, boost::shared_ptr<sample_rule::counters> >::const_iterator i = m_sample_counts.find(e);
+         if (i == m_sample_counts.end())
+            return 0;
+         return i->second->dropped.load(std::memory_order_relaxed);
+      }
+
+      /** Get the number of events dropped by sampling for every event type.
+       * @return the drop count of each event type sampling was configured 
+       * for
+       */
+      std::map<std::string, unsigned long long> connection::events_dropped() const {
+         std::map<std::string, unsigned long long> dropped;
+         for (std::map<std::string, boost::shared_ptr<sample_rule::counters> >::const_iterator i = m_sample_counts.begin(); i != m_sample_counts.end(); ++i)
+            dropped[i->first] = i->second->dropped.load(std::memory_order_relaxed);
+         return dropped;
+      }
+
+      /** Enable or disable automatic event filtering.
+       * @param state true to have the connection manage the EventMask and 
+       * event filters of the session
+       *
+       * When enabled the connection derives the smallest EventMask that 
+       * covers the events its handlers are registered for and sends it with 
+       * action::events.  If the server supports the Filter action, a filter 
+       * is installed for each subscription so Asterisk only sends events 
+       * some handler wants.  The mask and filters are updated as handlers 
+       * are registered, and from connection::process_events() (at most once 
+       * a second) as they are disconnected.
+       *
+       * Asterisk can't remove filters, so events for a disconnected handler 
+       * stop only if the EventMask no longer covers their class.
+       *
+       * @note Enable this after logging in, and re-enable it after 
+       * reconnecting.
+       */
+      void connection::auto_filter(bool state) {
+         m_auto_filter = state;
+         if (m_auto_filter)
+            update_event_filter();
+      }
+
+      /** Bring the session's EventMask and filters up to date.
+       * Subscriptions whose handlers have been disconnected are dropped 
+       * first.
+       */
+      void connection::update_event_filter() {
+         m_filter_updated = admission_control::clock_type::now();
+
+         for (subscriptions_t::iterator i = subscriptions.begin(); i != subscriptions.end(); ) {
+            if (not i->connection.connected()) {
+               m_event_filter.remove(i->subscription);
+               i = subscriptions.erase(i);
+            }
+            else {
+               ++i;
+            }
+         }
+
+         for (std::set<std::string>::iterator i = m_indexed_events.begin(); i != m_indexed_events.end(); ) {
+            if (not m_event_index.has_event(*i) and not m_event_batcher.has_event(*i)) {
+               m_event_filter.remove(event_filter::subscription(*i));
+               m_indexed_events.erase(i++);
+            }
+            else {
+               ++i;
+            }
+         }
+
+         if (not m_auto_filter)
+            return;
+
+         unsigned int mask = m_event_filter.mask();
+         if (not m_mask_sent or mask != m_sent_mask) {
+            m_mask_sent = true;
+            m_sent_mask = mask;
+
+            response_handler_t handler = boost::bind(&connection::handle_events_response, this, _1);
+            if (mask == event_filter::all)
+               send_action_async(action::events(true), handler);
+            else if (mask == 0)
+               send_action_async(action::events(false), handler);
+            else
+               send_action_async(action::events(mask), handler);
+         }
+
+         if (not m_filters_supported)
+            return;
+
+         std::set<std::string> filters = m_event_filter.filters();
+         for (std::set<std::string>::iterator i = filters.begin(); i != filters.end(); ++i) {
+            if (m_installed_filters.insert(*i).second)
+               send_action_async(action::filter(*i), boost::bind(&connection::handle_filter_response, this, *i, _1));
+         }
+      }
+
+      /** Handle the response to an automatic action::events.
+       * @param response the response
+       */
+      void connection::handle_events_response(message::response response) {
+         // try again next time
+         if (response == "Error")
+            m_mask_sent = false;
+      }
+
+      /** Handle the response to an automatic action::filter.
+       * @param filter the filter expression
+       * @param response the response
+       */
+      void connection::handle_filter_response(const std::string& filter, message::response response) {
+         if (response == "Error") {
+            if (response["Message"] == "Invalid/unknown command")
+               m_filters_supported = false;
+            else
+               m_installed_filters.erase(filter); // try again next time
+         }
       }
 
    }
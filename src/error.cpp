@@ -24,6 +24,43 @@ namespace astxx {
    namespace manager {
       const char* permission_error_string     = "Permission denied";
       const char* authentication_error_string = "Authentication Required";
+
+      namespace {
+         /// The category of manager::errc::errc_t error codes.
+         class manager_category : public boost::system::error_category {
+            public:
+               const char* name() const BOOST_SYSTEM_NOEXCEPT {
+                  return "astxx.manager";
+               }
+
+               std::string message(int e) const {
+                  switch (e) {
+                     case errc::permission_denied:
+                        return permission_error_string;
+                     case errc::authentication_required:
+                        return authentication_error_string;
+                     case errc::missing_data:
+                        return "required data missing";
+                     case errc::bad_data:
+                        return "invalid data";
+                     case errc::channel_not_found:
+                        return "channel not found";
+                     case errc::action_failed:
+                        return "action failed";
+                     default:
+                        return "unknown manager error";
+                  }
+               }
+         };
+      }
+
+      /** Get the category of manager::errc::errc_t error codes.
+       * @return the category
+       */
+      const boost::system::error_category& error_category() {
+         static const manager_category category;
+         return category;
+      }
    }
 }
 
@@ -0,0 +1,214 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/event_batcher.h"
+
+#include <algorithm>
+
+namespace astxx {
+   namespace manager {
+      /** Remove the batch handler.
+       * Events collected for it and not handed over yet are dropped.
+       */
+      void event_batcher::handle::disconnect() {
+         batch_ptr b = m_batch.lock();
+         if (b and b->active)
+            b->batcher->remove(b);
+      }
+
+      /** Check if the batch handler is still there.
+       * @return true until event_batcher::handle::disconnect() is called or
+       * the batcher is destroyed
+       */
+      bool event_batcher::handle::connected() const {
+         batch_ptr b = m_batch.lock();
+         return b and b->active;
+      }
+
+      /// Destructor, disconnects every handle.
+      event_batcher::~event_batcher() {
+         for (boost::unordered_map<std::string, batches_t>::iterator i = m_batches.begin(); i != m_batches.end(); ++i) {
+            for (batches_t::iterator b = i->second.begin(); b != i->second.end(); ++b) {
+               (*b)->active = false;
+               (*b)->batcher = 0;
+            }
+         }
+      }
+
+      /** Add a batch handler.
+       * @param event the name of the event (case sensitive, use a blank
+       * string to match all events)
+       * @param f the handler
+       * @param max_size the most events to hand over at once, 0 for no limit
+       * @param max_latency how long events may be held back waiting for
+       * more, zero to hand them over on every event_batcher::flush()
+       * @return a handle to remove the batch handler with
+       */
+      event_batcher::handle event_batcher::add(const std::string& event, const handler_t& f, std::size_t max_size, duration max_latency) {
+         return insert(event, f, 0, max_size, max_latency);
+      }
+
+      /** Add a batch handler that reads only some headers.
+       * @param event the name of the event (case sensitive, use a blank
+       * string to match all events)
+       * @param f the handler
+       * @param headers the headers the handler reads; the events it gets
+       * may lack any other header (see parser::project())
+       * @param max_size the most events to hand over at once, 0 for no limit
+       * @param max_latency how long events may be held back waiting for
+       * more, zero to hand them over on every event_batcher::flush()
+       * @return a handle to remove the batch handler with
+       */
+      event_batcher::handle event_batcher::add(const std::string& event, const handler_t& f, const std::vector<std::string>& headers, std::size_t max_size, duration max_latency) {
+         return insert(event, f, &headers, max_size, max_latency);
+      }
+
+      /** Create a batch handler.
+       * @param event the name of the event
+       * @param f the handler
+       * @param headers the headers the handler reads, null for all of them
+       * @param max_size the most events to hand over at once
+       * @param max_latency how long events may be held back
+       * @return a handle to remove the batch handler with
+       */
+      event_batcher::handle event_batcher::insert(const std::string& event, const handler_t& f, const std::vector<std::string>* headers, std::size_t max_size, duration max_latency) {
+         batch_ptr b(new batch());
+         b->batcher = this;
+         b->event = event;
+         b->handler = f;
+         b->every_header = not headers;
+         if (headers)
+            b->headers = *headers;
+         b->max_size = max_size;
+         b->max_latency = max_latency;
+         b->active = true;
+         if (max_size)
+            b->events.reserve(max_size);
+
+         m_batches[event].push_back(b);
+         m_interest.add(event, b->every_header ? 0 : &b->headers);
+         ++m_size;
+         return handle(b);
+      }
+
+      /** Remove a batch handler.
+       * @param b the batch handler
+       */
+      void event_batcher::remove(const batch_ptr& b) {
+         b->active = false;
+         b->events.clear();
+
+         boost::unordered_map<std::string, batches_t>::iterator i = m_batches.find(b->event);
+         i->second.erase(std::find(i->second.begin(), i->second.end(), b));
+         if (i->second.empty())
+            m_batches.erase(i);
+         m_interest.remove(b->event, b->every_header ? 0 : &b->headers);
+         --m_size;
+      }
+
+      /** Hand the collected events to a batch handler.
+       * @param b the batch handler
+       */
+      void event_batcher::deliver(const batch_ptr& b) {
+         // the handler may push more events or remove itself, so work on a
+         // vector of our own and give the storage back afterwards
+         std::vector<message::event> events;
+         events.swap(b->events);
+         b->handler(batch_t(events.data(), events.data() + events.size()));
+
+         events.clear();
+         if (b->active and b->events.empty())
+            b->events.swap(events);
+      }
+
+      /** Add an event to the batches that want it.
+       * @param e the event, which may be moved from
+       *
+       * A batch that reaches its maximum size is handed over straight away.
+       */
+      void event_batcher::push(message::event& e) {
+         if (m_batches.empty())
+            return;
+
+         const std::string* name = e.find(e.traits.main_header());
+         if (not name)
+            return;
+
+         batches_t matches;
+         matches.swap(m_matches);
+
+         boost::unordered_map<std::string, batches_t>::const_iterator i = m_batches.find(*name);
+         if (i != m_batches.end())
+            matches.insert(matches.end(), i->second.begin(), i->second.end());
+         if (not name->empty()) {
+            i = m_batches.find("");
+            if (i != m_batches.end())
+               matches.insert(matches.end(), i->second.begin(), i->second.end());
+         }
+
+         time_point now = matches.empty() ? time_point() : clock_type::now();
+         for (batches_t::iterator b = matches.begin(); b != matches.end(); ++b) {
+            if (not (*b)->active)
+               continue;
+
+            if ((*b)->events.empty())
+               (*b)->oldest = now;
+
+            // the last batch can have the event itself
+            if (b + 1 == matches.end())
+               (*b)->events.push_back(std::move(e));
+            else
+               (*b)->events.push_back(e);
+
+            if ((*b)->max_size and (*b)->events.size() >= (*b)->max_size)
+               deliver(*b);
+         }
+
+         matches.clear();
+         if (matches.capacity() > m_matches.capacity())
+            matches.swap(m_matches);
+      }
+
+      /** Hand over the batches that are due.
+       * @param now the current time
+       *
+       * Batches without a latency bound are due whenever they hold events,
+       * others once their oldest event has waited max_latency.
+       */
+      void event_batcher::flush(time_point now) {
+         if (m_batches.empty())
+            return;
+
+         batches_t due;
+         for (boost::unordered_map<std::string, batches_t>::iterator i = m_batches.begin(); i != m_batches.end(); ++i) {
+            for (batches_t::iterator b = i->second.begin(); b != i->second.end(); ++b) {
+               if (not (*b)->events.empty() and now - (*b)->oldest >= (*b)->max_latency)
+                  due.push_back(*b);
+            }
+         }
+
+         for (batches_t::iterator b = due.begin(); b != due.end(); ++b) {
+            if ((*b)->active and not (*b)->events.empty())
+               deliver(*b);
+         }
+      }
+   }
+}
+
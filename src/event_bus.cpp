@@ -0,0 +1,472 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/event_bus.h"
+#include "manager/error.h"
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <boost/cstdint.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace astxx {
+   namespace manager {
+      namespace detail {
+         /** The start of the shared memory segment, the ring follows it.
+          *
+          * The writer bumps claimed before it touches the ring and
+          * published after, so a reader that copied a record starting at
+          * cursor knows it is intact if claimed is still within a ring of
+          * cursor afterwards.
+          */
+         struct event_bus_segment {
+            boost::uint32_t magic;
+            boost::uint32_t version;
+            boost::uint64_t capacity;
+            std::atomic<boost::uint32_t> closed;
+
+            alignas(64) std::atomic<boost::uint64_t> claimed;
+            std::atomic<boost::uint64_t> published;
+
+            // readers waiting for events sleep on signal
+            alignas(64) std::atomic<boost::uint32_t> signal;
+            std::atomic<boost::uint32_t> waiters;
+         };
+      }
+
+      namespace {
+         using detail::event_bus_segment;
+
+         static_assert(std::atomic<boost::uint64_t>::is_always_lock_free, "the event bus needs lock free 64 bit atomics");
+
+         const boost::uint32_t magic = 0x41535842;  // "ASXB"
+         const boost::uint32_t version = 1;
+
+         /// Where the ring starts in the segment.
+         const std::size_t ring_offset = 4096;
+         const std::size_t min_capacity = 4096;
+
+         enum record_type { padding_record = 0, event_record = 1 };
+
+         /** A record is this header, then each message header as a
+          * 16 bit key size, a 32 bit value size, the key and the value,
+          * then the data, rounded up to 8 bytes.
+          */
+         struct record_header {
+            boost::uint32_t size;
+            boost::uint32_t type;
+            boost::uint64_t sequence;
+            boost::uint32_t headers;
+            boost::uint32_t data;
+         };
+
+         const std::size_t header_prefix = sizeof(boost::uint16_t) + sizeof(boost::uint32_t);
+
+         std::size_t align(std::size_t size) {
+            return (size + 7) & ~std::size_t(7);
+         }
+
+         boost::system::error_code errno_code(int e) {
+            return boost::system::error_code(e, boost::system::system_category());
+         }
+
+         std::string shm_name(const std::string& name) {
+            return (not name.empty() and name[0] == '/') ? name : "/" + name;
+         }
+
+         long futex(std::atomic<boost::uint32_t>* word, int op, boost::uint32_t value, const timespec* timeout) {
+            return ::syscall(SYS_futex, reinterpret_cast<boost::uint32_t*>(word), op, value, timeout, 0, 0);
+         }
+
+         event_bus_segment* map(int fd, std::size_t size) {
+            void* p = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+               int e = errno;
+               ::close(fd);
+               throw boost::system::system_error(errno_code(e));
+            }
+            ::close(fd);
+            return static_cast<event_bus_segment*>(p);
+         }
+      }
+
+      /** Create an event bus.
+       * @param name the name of the shared memory segment, "/astxx-events"
+       * for instance
+       * @param capacity the size of the ring in bytes, rounded up to a
+       * power of two
+       *
+       * An existing segment with the same name is replaced; readers still
+       * attached to it see it closed.  The segment is readable and
+       * writable by the user and group of this process.
+       *
+       * @throw boost::system::system_error if the segment can't be created
+       */
+      event_bus_writer::event_bus_writer(const std::string& name, std::size_t capacity) :
+         m_name(shm_name(name)),
+         m_segment(0),
+         m_mapped(0),
+         m_capacity(min_capacity),
+         m_ring(0),
+         m_head(0),
+         m_sequence(0) {
+
+         while (m_capacity < capacity)
+            m_capacity <<= 1;
+         m_mapped = ring_offset + m_capacity;
+
+         // readers of an old segment keep their mapping, tell them
+         int fd = ::shm_open(m_name.c_str(), O_RDWR, 0);
+         if (fd >= 0) {
+            struct stat st;
+            if (::fstat(fd, &st) == 0 and static_cast<std::size_t>(st.st_size) >= sizeof(event_bus_segment)) {
+               event_bus_segment* old = map(fd, sizeof(event_bus_segment));
+               if (old->magic == magic) {
+                  old->closed.store(1);
+                  old->signal.fetch_add(1);
+                  futex(&old->signal, FUTEX_WAKE, INT_MAX, 0);
+               }
+               ::munmap(old, sizeof(event_bus_segment));
+            }
+            else {
+               ::close(fd);
+            }
+            ::shm_unlink(m_name.c_str());
+         }
+
+         fd = ::shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+         if (fd < 0)
+            throw boost::system::system_error(errno_code(errno));
+         if (::ftruncate(fd, m_mapped) < 0) {
+            int e = errno;
+            ::close(fd);
+            ::shm_unlink(m_name.c_str());
+            throw boost::system::system_error(errno_code(e));
+         }
+
+         try {
+            m_segment = map(fd, m_mapped);
+         }
+         catch (...) {
+            ::shm_unlink(m_name.c_str());
+            throw;
+         }
+         m_ring = reinterpret_cast<char*>(m_segment) + ring_offset;
+
+         new (m_segment) event_bus_segment();
+         m_segment->version = version;
+         m_segment->capacity = m_capacity;
+         m_segment->closed.store(0);
+         m_segment->claimed.store(0);
+         m_segment->published.store(0);
+         m_segment->signal.store(0);
+         m_segment->waiters.store(0);
+         std::atomic_thread_fence(std::memory_order_release);
+         m_segment->magic = magic;
+      }
+
+      /** Close the event bus.
+       *
+       * Readers see it closed with event_bus_reader::closed(), and can
+       * still read what was published before.
+       */
+      event_bus_writer::~event_bus_writer() {
+         m_segment->closed.store(1);
+         m_segment->signal.fetch_add(1);
+         futex(&m_segment->signal, FUTEX_WAKE, INT_MAX, 0);
+         ::munmap(m_segment, m_mapped);
+         ::shm_unlink(m_name.c_str());
+      }
+
+      /** Publish an event.
+       * @param e the event
+       *
+       * The event is written to the ring once, overwriting the oldest
+       * events if there is no room, and readers waiting in
+       * event_bus_reader::wait() are woken up.
+       *
+       * @throw std::length_error if the event takes more than half the ring
+       * or has a header name longer than 65535 bytes
+       */
+      void event_bus_writer::publish(const message::event& e) {
+         std::size_t size = sizeof(record_header) + e.data.size();
+         boost::uint32_t headers = 0;
+         for (message::event::header_t::const_iterator i = e.begin(); i != e.end(); ++i, ++headers) {
+            if (i->first.size() > 0xffff)
+               throw std::length_error("event header name too long for the event bus");
+            size += header_prefix + i->first.size() + i->second.size();
+         }
+
+         std::size_t need = align(size);
+         if (need > m_capacity / 2)
+            throw std::length_error("event too large for the event bus");
+
+         std::size_t offset = m_head & (m_capacity - 1);
+         std::size_t pad = (m_capacity - offset < need) ? m_capacity - offset : 0;
+
+         // claim the space before overwriting anything in it
+         m_segment->claimed.store(m_head + pad + need, std::memory_order_relaxed);
+         std::atomic_thread_fence(std::memory_order_release);
+
+         if (pad) {
+            record_header r = record_header();
+            r.size = pad;
+            r.type = padding_record;
+            std::memcpy(m_ring + offset, &r, sizeof(boost::uint32_t) * 2);
+            m_head += pad;
+            offset = 0;
+         }
+
+         char* p = m_ring + offset;
+         record_header r;
+         r.size = need;
+         r.type = event_record;
+         r.sequence = m_sequence++;
+         r.headers = headers;
+         r.data = e.data.size();
+         std::memcpy(p, &r, sizeof(r));
+         p += sizeof(r);
+
+         for (message::event::header_t::const_iterator i = e.begin(); i != e.end(); ++i) {
+            boost::uint16_t key_size = i->first.size();
+            boost::uint32_t value_size = i->second.size();
+            std::memcpy(p, &key_size, sizeof(key_size));
+            p += sizeof(key_size);
+            std::memcpy(p, &value_size, sizeof(value_size));
+            p += sizeof(value_size);
+            std::memcpy(p, i->first.data(), key_size);
+            p += key_size;
+            std::memcpy(p, i->second.data(), value_size);
+            p += value_size;
+         }
+         std::memcpy(p, e.data.data(), e.data.size());
+
+         m_head += need;
+         m_segment->published.store(m_head, std::memory_order_release);
+
+         // pairs with the fence in event_bus_reader::wait(), either the
+         // reader sees the new event or we see the reader
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if (m_segment->waiters.load(std::memory_order_relaxed)) {
+            m_segment->signal.fetch_add(1, std::memory_order_relaxed);
+            futex(&m_segment->signal, FUTEX_WAKE, INT_MAX, 0);
+         }
+      }
+
+      /** Attach to an event bus.
+       * @param name the name the writer created it with
+       *
+       * The reader starts at the newest event, it sees what is published
+       * from now on.
+       *
+       * @throw boost::system::system_error if the segment can't be opened,
+       * ENOENT if there is no writer
+       * @throw manager::error if the segment is not an event bus
+       */
+      event_bus_reader::event_bus_reader(const std::string& name) :
+         m_segment(0),
+         m_mapped(0),
+         m_capacity(0),
+         m_ring(0),
+         m_cursor(0),
+         m_next(0),
+         m_started(false),
+         m_lost(0),
+         m_received(0) {
+
+         std::string path = shm_name(name);
+         int fd = ::shm_open(path.c_str(), O_RDWR, 0);
+         if (fd < 0)
+            throw boost::system::system_error(errno_code(errno));
+
+         struct stat st;
+         if (::fstat(fd, &st) < 0) {
+            int e = errno;
+            ::close(fd);
+            throw boost::system::system_error(errno_code(e));
+         }
+         m_mapped = st.st_size;
+         if (m_mapped <= ring_offset) {
+            ::close(fd);
+            throw manager::error("not an event bus: " + path);
+         }
+
+         m_segment = map(fd, m_mapped);
+         std::atomic_thread_fence(std::memory_order_acquire);
+         if (m_segment->magic != magic or m_segment->version != version or m_segment->capacity != m_mapped - ring_offset) {
+            ::munmap(m_segment, m_mapped);
+            throw manager::error("not an event bus: " + path);
+         }
+
+         m_capacity = m_segment->capacity;
+         m_ring = reinterpret_cast<const char*>(m_segment) + ring_offset;
+         m_cursor = m_segment->published.load(std::memory_order_acquire);
+      }
+
+      /** Detach from the event bus.
+       */
+      event_bus_reader::~event_bus_reader() {
+         ::munmap(m_segment, m_mapped);
+      }
+
+      /** Read the next event.
+       * @param e set to the event
+       *
+       * If the reader had fallen a ring behind it skips to the newest
+       * event, and the events it missed are added to
+       * event_bus_reader::lost() once it reads that one.
+       *
+       * @return true if an event was read, false if there are no new events,
+       * in which case e may have been changed
+       */
+      bool event_bus_reader::read(message::event& e) {
+         for (;;) {
+            boost::uint64_t published = m_segment->published.load(std::memory_order_acquire);
+            if (m_cursor == published)
+               return false;
+            if (published - m_cursor > m_capacity) {
+               skip();
+               continue;
+            }
+
+            std::size_t offset = m_cursor & (m_capacity - 1);
+            const char* p = m_ring + offset;
+            record_header r;
+            std::memcpy(&r, p, sizeof(boost::uint32_t) * 2);
+
+            // a record that makes no sense was overwritten as we looked
+            if (r.size < sizeof(boost::uint32_t) * 2 or r.size % 8 or r.size > m_capacity - offset
+                  or (r.type == event_record and r.size < sizeof(r))) {
+               skip();
+               continue;
+            }
+
+            bool intact = true;
+            if (r.type == event_record) {
+               std::memcpy(&r, p, sizeof(r));
+               const char* end = p + r.size;
+               p += sizeof(r);
+
+               e = message::event(message::event::header_t());
+               for (boost::uint32_t i = 0; i < r.headers and intact; ++i) {
+                  boost::uint16_t key_size;
+                  boost::uint32_t value_size;
+                  if (static_cast<std::size_t>(end - p) < header_prefix) {
+                     intact = false;
+                     break;
+                  }
+                  std::memcpy(&key_size, p, sizeof(key_size));
+                  p += sizeof(key_size);
+                  std::memcpy(&value_size, p, sizeof(value_size));
+                  p += sizeof(value_size);
+                  if (static_cast<std::size_t>(end - p) < std::size_t(key_size) + value_size) {
+                     intact = false;
+                     break;
+                  }
+                  e.insert(std::make_pair(std::string(p, key_size), std::string(p + key_size, value_size)));
+                  p += key_size + value_size;
+               }
+               if (intact and static_cast<std::size_t>(end - p) >= r.data)
+                  e.data.assign(p, r.data);
+               else
+                  intact = false;
+            }
+
+            // did the writer get here while we were copying?
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (not intact or m_segment->claimed.load(std::memory_order_relaxed) - m_cursor > m_capacity) {
+               skip();
+               continue;
+            }
+
+            m_cursor += r.size;
+            if (r.type != event_record)
+               continue;
+
+            if (m_started and r.sequence > m_next)
+               m_lost += r.sequence - m_next;
+            m_next = r.sequence + 1;
+            m_started = true;
+            ++m_received;
+            return true;
+         }
+      }
+
+      /** Wait for an event to be published.
+       * @param timeout how long to wait
+       * @return true if there is an event to read, false if the timeout
+       * passed or the writer closed the bus
+       */
+      bool event_bus_reader::wait(std::chrono::steady_clock::duration timeout) {
+         if (m_cursor != m_segment->published.load(std::memory_order_acquire))
+            return true;
+
+         m_segment->waiters.fetch_add(1);
+         boost::uint32_t signal = m_segment->signal.load();
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if (m_cursor == m_segment->published.load(std::memory_order_relaxed) and not m_segment->closed.load()) {
+            std::chrono::nanoseconds ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+            if (ns.count() < 0)
+               ns = std::chrono::nanoseconds::zero();
+            timespec ts;
+            ts.tv_sec = ns.count() / 1000000000;
+            ts.tv_nsec = ns.count() % 1000000000;
+            futex(&m_segment->signal, FUTEX_WAIT, signal, &ts);
+         }
+         m_segment->waiters.fetch_sub(1);
+
+         return m_cursor != m_segment->published.load(std::memory_order_acquire);
+      }
+
+      /** Get how far behind the writer this reader is.
+       * @return the number of bytes of events published and not yet read,
+       * once it reaches event_bus_reader::capacity() events are being lost
+       */
+      std::size_t event_bus_reader::backlog() const {
+         boost::uint64_t behind = m_segment->published.load(std::memory_order_acquire) - m_cursor;
+         return behind > m_capacity ? m_capacity : behind;
+      }
+
+      /** Check if the writer has gone away.
+       * @return true if the writer closed the bus or was replaced by a new
+       * one, reattach to follow the new one
+       */
+      bool event_bus_reader::closed() const {
+         return m_segment->closed.load();
+      }
+
+      /** Give up on the events we were behind on and carry on from the
+       * newest, the sequence numbers tell us how many we missed.
+       */
+      void event_bus_reader::skip() {
+         m_cursor = m_segment->published.load(std::memory_order_acquire);
+      }
+   }
+}
@@ -0,0 +1,245 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/event_codec.h"
+#include "manager/error.h"
+
+#include <boost/cstdint.hpp>
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         /** Header names with fixed ids, the id is the index plus one.
+          * Encoded data depends on this table: only ever add to the end.
+          */
+         const char* const well_known[] = {
+            "Event", "Privilege", "SystemName", "Timestamp",
+            "Channel", "ChannelState", "ChannelStateDesc", "CallerIDNum",
+            "CallerIDName", "ConnectedLineNum", "ConnectedLineName", "Language",
+            "AccountCode", "Context", "Exten", "Priority",
+            "Uniqueid", "Linkedid", "DestChannel", "DestChannelState",
+            "DestChannelStateDesc", "DestCallerIDNum", "DestCallerIDName", "DestConnectedLineNum",
+            "DestConnectedLineName", "DestLanguage", "DestAccountCode", "DestContext",
+            "DestExten", "DestPriority", "DestUniqueid", "DestLinkedid",
+            "DialString", "DialStatus", "Cause", "Cause-txt",
+            "Application", "AppData", "Variable", "Value",
+            "BridgeUniqueid", "BridgeType", "BridgeTechnology", "BridgeCreator",
+            "BridgeName", "BridgeNumChannels", "Queue", "Interface",
+            "MemberName", "StateInterface", "Membership", "Penalty",
+            "CallsTaken", "LastCall", "LastPause", "InCall",
+            "Status", "Paused", "PausedReason", "Ringinuse",
+            "Position", "Count", "HoldTime", "TalkTime",
+            "RingTime", "OriginalPosition", "Reason", "Source",
+            "Destination", "DestinationContext", "CallerID", "LastApplication",
+            "LastData", "Start", "Answer", "End",
+            "Duration", "BillableSeconds", "Disposition", "AMAFlags",
+            "UserField", "Peer", "PeerStatus", "ChannelType",
+            "Address", "Device", "State", "Hint",
+            "Response", "Message", "ActionID", "Output",
+         };
+         const unsigned int well_known_count = sizeof(well_known) / sizeof(well_known[0]);
+
+         /// The most names a stream interns, later ones are written out each time.
+         const unsigned int max_names = 4096;
+
+         /// The id of a name written out in full.
+         const unsigned int literal = 0;
+
+         void put_varint(std::string& out, boost::uint32_t v) {
+            while (v >= 0x80) {
+               out.push_back(static_cast<char>(v | 0x80));
+               v >>= 7;
+            }
+            out.push_back(static_cast<char>(v));
+         }
+
+         std::size_t varint_size(boost::uint32_t v) {
+            std::size_t size = 1;
+            while (v >= 0x80) {
+               v >>= 7;
+               ++size;
+            }
+            return size;
+         }
+
+         /** Read a varint.
+          * @return false if the data ends first or it is too long
+          */
+         bool get_varint(const char*& p, const char* end, boost::uint32_t& v) {
+            v = 0;
+            for (int shift = 0; shift < 35 and p != end; shift += 7) {
+               unsigned char c = *p++;
+               v |= boost::uint32_t(c & 0x7f) << shift;
+               if (not (c & 0x80))
+                  return true;
+            }
+            return false;
+         }
+
+         /** Read a length prefixed string.
+          * @return false if the data ends first
+          */
+         bool get_string(const char*& p, const char* end, const char*& s, boost::uint32_t& size) {
+            if (not get_varint(p, end, size) or static_cast<std::size_t>(end - p) < size)
+               return false;
+            s = p;
+            p += size;
+            return true;
+         }
+
+         void malformed() {
+            throw parse_error("malformed binary event");
+         }
+      }
+
+      /** Construct an encoder at the start of a stream.
+       */
+      event_encoder::event_encoder() {
+         reset();
+      }
+
+      /** Start a new stream, forgetting the names interned so far.
+       */
+      void event_encoder::reset() {
+         m_names.clear();
+         for (unsigned int i = 0; i < well_known_count; ++i)
+            m_names.insert(std::make_pair(std::string(well_known[i]), i + 1));
+         m_next = well_known_count + 1;
+      }
+
+      /** Encode an event.
+       * @param e the event
+       * @param out the string to append the encoded event to
+       */
+      void event_encoder::encode(const message::event& e, std::string& out) {
+         // the size comes first, add it up before writing anything
+         m_ids.clear();
+         std::size_t size = 0;
+         for (message::event::header_t::const_iterator i = e.begin(); i != e.end(); ++i) {
+            names_t::const_iterator n = m_names.find(i->first);
+            m_ids.push_back(n != m_names.end() ? n->second : literal);
+            if (n != m_names.end())
+               size += varint_size(n->second);
+            else
+               size += varint_size(literal) + varint_size(i->first.size()) + i->first.size();
+            size += varint_size(i->second.size()) + i->second.size();
+         }
+         size += varint_size(m_ids.size()) + varint_size(e.data.size()) + e.data.size();
+
+         out.reserve(out.size() + varint_size(size) + size);
+         put_varint(out, size);
+         put_varint(out, m_ids.size());
+         std::vector<unsigned int>::const_iterator id = m_ids.begin();
+         for (message::event::header_t::const_iterator i = e.begin(); i != e.end(); ++i, ++id) {
+            put_varint(out, *id);
+            if (*id == literal) {
+               put_varint(out, i->first.size());
+               out.append(i->first);
+
+               // every literal takes the next id, even a name that appears
+               // twice in one event, the decoder does the same
+               if (m_next < max_names) {
+                  m_names.insert(std::make_pair(i->first, m_next));
+                  ++m_next;
+               }
+            }
+            put_varint(out, i->second.size());
+            out.append(i->second);
+         }
+         put_varint(out, e.data.size());
+         out.append(e.data);
+      }
+
+      /** Construct a decoder at the start of a stream.
+       */
+      event_decoder::event_decoder() {
+         reset();
+      }
+
+      /** Start a new stream, forgetting the names interned so far.
+       */
+      void event_decoder::reset() {
+         m_names.assign(1, std::string());
+         m_names.reserve(well_known_count + 1);
+         for (unsigned int i = 0; i < well_known_count; ++i)
+            m_names.push_back(well_known[i]);
+      }
+
+      /** Decode an event.
+       * @param data the encoded data
+       * @param size the number of bytes of data
+       * @param e set to the event
+       * @return the number of bytes the event took up, zero if data does
+       * not hold a whole event yet (e is left alone)
+       * @throw manager::parse_error if the data is not an encoded event or
+       * refers to a name this decoder has not seen
+       */
+      std::size_t event_decoder::decode(const char* data, std::size_t size, message::event& e) {
+         const char* p = data;
+         const char* end = data + size;
+         boost::uint32_t length;
+         if (not get_varint(p, end, length)) {
+            if (size >= 5)
+               malformed();
+            return 0;
+         }
+         if (static_cast<std::size_t>(end - p) < length)
+            return 0;
+         end = p + length;
+
+         boost::uint32_t count;
+         if (not get_varint(p, end, count))
+            malformed();
+
+         e = message::event(message::event::header_t());
+         for (boost::uint32_t i = 0; i < count; ++i) {
+            boost::uint32_t id;
+            if (not get_varint(p, end, id))
+               malformed();
+
+            const char* value;
+            boost::uint32_t value_size;
+            if (id == literal) {
+               const char* key;
+               boost::uint32_t key_size;
+               if (not get_string(p, end, key, key_size) or not get_string(p, end, value, value_size))
+                  malformed();
+               std::string name(key, key_size);
+               if (m_names.size() < max_names)
+                  m_names.push_back(name);
+               e.insert(std::make_pair(name, std::string(value, value_size)));
+            }
+            else {
+               if (id >= m_names.size() or not get_string(p, end, value, value_size))
+                  malformed();
+               e.insert(std::make_pair(m_names[id], std::string(value, value_size)));
+            }
+         }
+
+         const char* d;
+         boost::uint32_t data_size;
+         if (not get_string(p, end, d, data_size) or p != end)
+            malformed();
+         e.data.assign(d, data_size);
+
+         return end - data;
+      }
+   }
+}
@@ -0,0 +1,255 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/event_filter.h"
+#include "manager/action/events.h"
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         using action::events;
+
+         /// The class (EventMask bit) Asterisk sends each well known event in.
+         struct event_class_entry {
+            const char* event;
+            unsigned int mask;
+         };
+
+         /** Only events every Asterisk version sends in the same class are
+          * listed.  Anything else is unknown, and subscribing to it makes
+          * the EventMask fall back to all.
+          */
+         const event_class_entry event_classes[] = {
+            // call
+            { "Newchannel", events::call },
+            { "Newstate", events::call },
+            { "Hangup", events::call },
+            { "HangupRequest", events::call },
+            { "SoftHangupRequest", events::call },
+            { "Rename", events::call },
+            { "NewCallerid", events::call },
+            { "NewConnectedLine", events::call },
+            { "NewAccountCode", events::call },
+            { "Dial", events::call },
+            { "DialBegin", events::call },
+            { "DialState", events::call },
+            { "DialEnd", events::call },
+            { "Link", events::call },
+            { "Unlink", events::call },
+            { "Bridge", events::call },
+            { "BridgeCreate", events::call },
+            { "BridgeDestroy", events::call },
+            { "BridgeEnter", events::call },
+            { "BridgeLeave", events::call },
+            { "BridgeMerge", events::call },
+            { "Masquerade", events::call },
+            { "Hold", events::call },
+            { "Unhold", events::call },
+            { "MusicOnHoldStart", events::call },
+            { "MusicOnHoldStop", events::call },
+            { "OriginateResponse", events::call },
+            { "LocalBridge", events::call },
+            { "AttendedTransfer", events::call },
+            { "BlindTransfer", events::call },
+            { "ParkedCall", events::call },
+            { "ParkedCallTimeOut", events::call },
+            { "ParkedCallGiveUp", events::call },
+            { "UnParkedCall", events::call },
+            { "Pickup", events::call },
+            { "ChanSpyStart", events::call },
+            { "ChanSpyStop", events::call },
+            { "MeetmeJoin", events::call },
+            { "MeetmeLeave", events::call },
+            { "ConfbridgeStart", events::call },
+            { "ConfbridgeEnd", events::call },
+            { "ConfbridgeJoin", events::call },
+            { "ConfbridgeLeave", events::call },
+            { "ConfbridgeTalking", events::call },
+            { "MixMonitorStart", events::call },
+            { "MixMonitorStop", events::call },
+            { "ExtensionStatus", events::call },
+            { "DeviceStateChange", events::call },
+            { "Status", events::call },
+            { "Join", events::call },     // app_queue before Asterisk 12
+            { "Leave", events::call },
+            // system
+            { "FullyBooted", events::system },
+            { "Reload", events::system },
+            { "Shutdown", events::system },
+            { "Registry", events::system },
+            { "PeerStatus", events::system },
+            { "ContactStatus", events::system },
+            { "ModuleLoadReport", events::system },
+            { "ChannelReload", events::system },
+            { "Alarm", events::system },
+            { "AlarmClear", events::system },
+            { "DNDState", events::system },
+            { "LogChannel", events::system },
+            // agent
+            { "QueueCallerJoin", events::agent },
+            { "QueueCallerLeave", events::agent },
+            { "QueueCallerAbandon", events::agent },
+            { "QueueMemberAdded", events::agent },
+            { "QueueMemberRemoved", events::agent },
+            { "QueueMemberStatus", events::agent },
+            { "QueueMemberPause", events::agent },
+            { "QueueMemberPaused", events::agent },
+            { "QueueMemberPenalty", events::agent },
+            { "QueueMemberRinginuse", events::agent },
+            { "AgentCalled", events::agent },
+            { "AgentConnect", events::agent },
+            { "AgentComplete", events::agent },
+            { "AgentDump", events::agent },
+            { "AgentRingNoAnswer", events::agent },
+            { "AgentLogin", events::agent },
+            { "AgentLogoff", events::agent },
+            { "Agentlogin", events::agent },
+            { "Agentlogoff", events::agent },
+            // everything else
+            { "UserEvent", events::user },
+            { "DTMF", events::dtmf },
+            { "DTMFBegin", events::dtmf },
+            { "DTMFEnd", events::dtmf },
+            { "RTCPSent", events::reporting },
+            { "RTCPReceived", events::reporting },
+            { "JitterBufStats", events::reporting },
+            { "Cdr", events::cdr },
+            { "VarSet", events::dialplan },
+            { "Newexten", events::dialplan },
+            { "AGIExec", events::agi },
+            { "AGIExecStart", events::agi },
+            { "AGIExecEnd", events::agi },
+            { "AsyncAGI", events::agi },
+            { "AsyncAGIStart", events::agi },
+            { "AsyncAGIExec", events::agi },
+            { "AsyncAGIEnd", events::agi },
+            { "SuccessfulAuth", events::security },
+            { "FailedACL", events::security },
+            { "InvalidAccountID", events::security },
+            { "InvalidPassword", events::security },
+            { "ChallengeSent", events::security },
+            { "ChallengeResponseFailed", events::security },
+            { "RequestBadFormat", events::security },
+            { "RequestNotAllowed", events::security },
+            { "UnexpectedAddress", events::security },
+         };
+
+         /** Index the event class table by name.
+          * @return a map of event name to class
+          */
+         std::map<std::string, unsigned int> build_event_classes() {
+            std::map<std::string, unsigned int> classes;
+            for (std::size_t i = 0; i < sizeof(event_classes) / sizeof(event_classes[0]); ++i) {
+               classes[event_classes[i].event] = event_classes[i].mask;
+            }
+            return classes;
+         }
+
+         /** Escape POSIX extended regular expression characters.
+          * @param s the string to escape
+          * @return the escaped string
+          */
+         std::string escape(const std::string& s) {
+            std::string out;
+            for (std::string::const_iterator i = s.begin(); i != s.end(); ++i) {
+               if (std::string("\\^$.|?*+()[]{}").find(*i) != std::string::npos)
+                  out += '\\';
+               out += *i;
+            }
+            return out;
+         }
+      }
+
+      /** Add a subscription.
+       * @param s the subscription
+       */
+      void event_filter::add(const subscription& s) {
+         ++subscriptions[s];
+      }
+
+      /** Remove a subscription.
+       * @param s the subscription, as it was added
+       */
+      void event_filter::remove(const subscription& s) {
+         std::map<subscription, unsigned int>::iterator i = subscriptions.find(s);
+         if (i != subscriptions.end() and --i->second == 0)
+            subscriptions.erase(i);
+      }
+
+      /** Get the EventMask needed by the subscriptions.
+       * @return the union of the classes of all subscribed events, 0 if 
+       * there are no subscriptions, or event_filter::all if a catch all 
+       * handler or an event of unknown class is subscribed
+       */
+      unsigned int event_filter::mask() const {
+         unsigned int m = 0;
+         for (std::map<subscription, unsigned int>::const_iterator i = subscriptions.begin(); i != subscriptions.end(); ++i) {
+            unsigned int c = event_class(i->first.event);
+            if (c == 0)
+               return all;
+            m |= c;
+         }
+         return m;
+      }
+
+      /** Get the filter expressions needed by the subscriptions.
+       * @return the regular expressions to install with action::filter
+       */
+      std::set<std::string> event_filter::filters() const {
+         std::set<std::string> f;
+         for (std::map<subscription, unsigned int>::const_iterator i = subscriptions.begin(); i != subscriptions.end(); ++i) {
+            f.insert(filter_expression(i->first));
+         }
+         return f;
+      }
+
+      /** Look up the class of an event.
+       * @param event the event name
+       * @return the action::events class bit Asterisk sends this event with, 
+       * or 0 if the event is unknown (or blank)
+       */
+      unsigned int event_filter::event_class(const std::string& event) {
+         static const std::map<std::string, unsigned int> classes = build_event_classes();
+
+         std::map<std::string, unsigned int>::const_iterator i = classes.find(event);
+         return (i == classes.end()) ? 0 : i->second;
+      }
+
+      /** Build the filter expression for a subscription.
+       * @param s the subscription
+       *
+       * Asterisk matches filters against the whole text of an event, headers 
+       * separated by \\r\\n.  [[:space:]] is used to anchor the end of a 
+       * value since the regular expression can't contain a line break.
+       *
+       * @return the regular expression
+       */
+      std::string event_filter::filter_expression(const subscription& s) {
+         if (s.event.empty())
+            return "Event: ";
+
+         std::string f = "Event: " + escape(s.event) + "[[:space:]]";
+         if (not s.header.empty())
+            f += ".*" + escape(s.header) + ": " + escape(s.value) + "[[:space:]]";
+         return f;
+      }
+   }
+}
+
@@ -0,0 +1,258 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/event_index.h"
+
+namespace astxx {
+   namespace manager {
+      /** Remove the subscription.
+       * Does nothing if it was already removed.  A handler may remove its
+       * own subscription, or any other, while it is being called.
+       */
+      void event_index::handle::disconnect() {
+         entry_ptr e = m_entry.lock();
+         if (e and e->active)
+            e->index->remove(e);
+      }
+
+      /** Check if the subscription is still there.
+       * @return true until event_index::handle::disconnect() is called or
+       * the index is destroyed
+       */
+      bool event_index::handle::connected() const {
+         entry_ptr e = m_entry.lock();
+         return e and e->active;
+      }
+
+      /// Destructor, disconnects every handle.
+      event_index::~event_index() {
+         for (entries_t::iterator i = m_all.begin(); i != m_all.end(); ++i) {
+            (*i)->active = false;
+            (*i)->index = 0;
+         }
+      }
+
+      /** Subscribe to events.
+       * @param event the name of the event (case sensitive, use a blank
+       * string to match all events)
+       * @param p the predicate events must satisfy
+       * @param f the handler
+       * @return a handle to remove the subscription with
+       */
+      event_index::handle event_index::add(const std::string& event, const predicate& p, const handler_t& f) {
+         return insert(event, p, f, 0);
+      }
+
+      /** Subscribe to events, reading only some of their headers.
+       * @param event the name of the event (case sensitive, use a blank
+       * string to match all events)
+       * @param p the predicate events must satisfy
+       * @param f the handler
+       * @param headers the headers the handler reads; the events it gets
+       * may lack any other header (see parser::project())
+       * @return a handle to remove the subscription with
+       */
+      event_index::handle event_index::add(const std::string& event, const predicate& p, const handler_t& f, const std::vector<std::string>& headers) {
+         return insert(event, p, f, &headers);
+      }
+
+      /** File a subscription.
+       * @param event the name of the event
+       * @param p the predicate events must satisfy
+       * @param f the handler
+       * @param headers the headers the handler reads, null for all of them
+       * @return a handle to remove the subscription with
+       */
+      event_index::handle event_index::insert(const std::string& event, const predicate& p, const handler_t& f, const std::vector<std::string>* headers) {
+         entry_ptr e(new entry());
+         e->index = this;
+         e->event = event;
+         e->condition = p;
+         e->handler = f;
+         e->every_header = not headers;
+         if (headers) {
+            e->headers = *headers;
+            if (p.kind() != predicate::always)
+               e->headers.push_back(p.header());
+         }
+         e->active = true;
+         m_interest.add(event, e->every_header ? 0 : &e->headers);
+
+         event_node& node = m_events[event];
+         switch (p.kind()) {
+            case predicate::always:
+               e->positions.push_back(node.always.insert(node.always.end(), e));
+               break;
+            case predicate::equal_to:
+            case predicate::one_of: {
+               header_node& h = node.headers[p.header()];
+               for (std::vector<std::string>::const_iterator i = p.values().begin(); i != p.values().end(); ++i) {
+                  entries_t& bucket = h.values[*i];
+                  e->positions.push_back(bucket.insert(bucket.end(), e));
+               }
+               break;
+            }
+            case predicate::starts_with: {
+               trie_node* t = &node.headers[p.header()].prefixes;
+               const std::string& prefix = p.values().front();
+               for (std::string::const_iterator i = prefix.begin(); i != prefix.end(); ++i) {
+                  boost::shared_ptr<trie_node>& child = t->children[*i];
+                  if (not child)
+                     child.reset(new trie_node());
+                  t = child.get();
+               }
+               e->positions.push_back(t->entries.insert(t->entries.end(), e));
+               break;
+            }
+         }
+
+         ++node.count;
+         e->self = m_all.insert(m_all.end(), e);
+         return handle(e);
+      }
+
+      /** Remove a subscription, dropping nodes it leaves empty.
+       * @param e the subscription
+       */
+      void event_index::remove(const entry_ptr& e) {
+         e->active = false;
+
+         boost::unordered_map<std::string, event_node>::iterator n = m_events.find(e->event);
+         event_node& node = n->second;
+         const predicate& p = e->condition;
+
+         switch (p.kind()) {
+            case predicate::always:
+               node.always.erase(e->positions.front());
+               break;
+            case predicate::equal_to:
+            case predicate::one_of: {
+               boost::unordered_map<std::string, header_node>::iterator h = node.headers.find(p.header());
+               for (std::size_t i = 0; i < p.values().size(); ++i) {
+                  boost::unordered_map<std::string, entries_t>::iterator bucket = h->second.values.find(p.values()[i]);
+                  bucket->second.erase(e->positions[i]);
+                  if (bucket->second.empty())
+                     h->second.values.erase(bucket);
+               }
+               if (h->second.values.empty() and h->second.prefixes.entries.empty() and h->second.prefixes.children.empty())
+                  node.headers.erase(h);
+               break;
+            }
+            case predicate::starts_with: {
+               boost::unordered_map<std::string, header_node>::iterator h = node.headers.find(p.header());
+               const std::string& prefix = p.values().front();
+
+               std::vector<trie_node*> path(1, &h->second.prefixes);
+               for (std::string::const_iterator i = prefix.begin(); i != prefix.end(); ++i)
+                  path.push_back(path.back()->children[*i].get());
+
+               path.back()->entries.erase(e->positions.front());
+
+               // prune from the leaf up
+               for (std::size_t i = prefix.size(); i > 0; --i) {
+                  if (not path[i]->entries.empty() or not path[i]->children.empty())
+                     break;
+                  path[i - 1]->children.erase(prefix[i - 1]);
+               }
+
+               if (h->second.values.empty() and h->second.prefixes.entries.empty() and h->second.prefixes.children.empty())
+                  node.headers.erase(h);
+               break;
+            }
+         }
+
+         if (--node.count == 0)
+            m_events.erase(n);
+
+         m_interest.remove(e->event, e->every_header ? 0 : &e->headers);
+         e->positions.clear();
+         m_all.erase(e->self);
+      }
+
+      /** Gather the subscriptions of one event node that match an event.
+       * @param node the node
+       * @param e the event
+       * @param matches where to put the matching subscriptions
+       */
+      void event_index::collect(const event_node& node, const message::event& e, std::vector<entry_ptr>& matches) {
+         matches.insert(matches.end(), node.always.begin(), node.always.end());
+
+         for (boost::unordered_map<std::string, header_node>::const_iterator h = node.headers.begin(); h != node.headers.end(); ++h) {
+            const std::string* value = e.find(h->first);
+            if (not value)
+               continue;
+
+            boost::unordered_map<std::string, entries_t>::const_iterator bucket = h->second.values.find(*value);
+            if (bucket != h->second.values.end())
+               matches.insert(matches.end(), bucket->second.begin(), bucket->second.end());
+
+            const trie_node* t = &h->second.prefixes;
+            matches.insert(matches.end(), t->entries.begin(), t->entries.end());
+            for (std::string::const_iterator i = value->begin(); i != value->end(); ++i) {
+               std::map<char, boost::shared_ptr<trie_node> >::const_iterator child = t->children.find(*i);
+               if (child == t->children.end())
+                  break;
+               t = child->second.get();
+               matches.insert(matches.end(), t->entries.begin(), t->entries.end());
+            }
+         }
+      }
+
+      /** Call the handlers of every subscription matching an event.
+       * @param e the event
+       *
+       * The matches are collected before any handler runs.  Subscriptions
+       * added by a handler see the next event, subscriptions removed by a
+       * handler are not called.
+       */
+      void event_index::dispatch(const message::event& e) {
+         if (m_events.empty())
+            return;
+
+         const std::string* name = e.find(e.traits.main_header());
+         if (not name)
+            return;
+
+         // use a spare vector so handlers may dispatch recursively
+         std::vector<entry_ptr> matches;
+         matches.swap(m_matches);
+
+         boost::unordered_map<std::string, event_node>::const_iterator n = m_events.find(*name);
+         if (n != m_events.end())
+            collect(n->second, e, matches);
+
+         if (not name->empty()) {
+            n = m_events.find("");
+            if (n != m_events.end())
+               collect(n->second, e, matches);
+         }
+
+         for (std::vector<entry_ptr>::iterator i = matches.begin(); i != matches.end(); ++i) {
+            if ((*i)->active)
+               (*i)->handler(e);
+         }
+
+         matches.clear();
+         if (matches.capacity() > m_matches.capacity())
+            matches.swap(m_matches);
+      }
+   }
+}
+
@@ -0,0 +1,609 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/journal.h"
+#include "manager/error.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <boost/system/system_error.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         const boost::uint32_t block_magic = 0x4b424a41;  // "AJBK"
+
+         /** The start of each block in a segment, followed by the zlib
+          * compressed events.  Uncompressed, each event is its time as 8
+          * bytes of nanoseconds since the epoch followed by the event as
+          * an event_encoder writes it, the encoder reset for each block.
+          */
+         struct block_header {
+            boost::uint32_t magic;
+            boost::uint32_t raw_size;
+            boost::uint32_t compressed_size;
+            boost::uint32_t count;
+            boost::int64_t first;
+            boost::int64_t last;
+            boost::uint32_t crc;
+            boost::uint32_t reserved;
+         };
+
+         /** An index record is its size, then these, then the call hashes.
+          */
+         struct index_header {
+            boost::uint64_t offset;
+            boost::uint32_t size;
+            boost::uint32_t count;
+            boost::int64_t first;
+            boost::int64_t last;
+            boost::uint32_t calls;
+         };
+
+         const char segment_suffix[] = ".journal";
+         const char index_suffix[] = ".index";
+
+         /// The headers that say which call an event is about.
+         const char* const call_headers[] = { "Uniqueid", "Linkedid", "DestUniqueid", "DestLinkedid" };
+
+         boost::system::error_code errno_code(int e) {
+            return boost::system::error_code(e, boost::system::system_category());
+         }
+
+         boost::uint64_t hash(const std::string& s) {
+            boost::uint64_t h = 14695981039346656037ULL;
+            for (std::string::const_iterator i = s.begin(); i != s.end(); ++i) {
+               h ^= static_cast<unsigned char>(*i);
+               h *= 1099511628211ULL;
+            }
+            return h;
+         }
+
+         boost::int64_t nanoseconds(journal_writer::time_point t) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+         }
+
+         journal_writer::time_point from_nanoseconds(boost::int64_t ns) {
+            return journal_writer::time_point(std::chrono::duration_cast<journal_writer::clock_type::duration>(std::chrono::nanoseconds(ns)));
+         }
+
+         void write_all(int fd, const char* data, std::size_t size) {
+            while (size) {
+               ssize_t n = ::write(fd, data, size);
+               if (n < 0) {
+                  if (errno == EINTR)
+                     continue;
+                  throw boost::system::system_error(errno_code(errno));
+               }
+               data += n;
+               size -= n;
+            }
+         }
+
+         bool read_file(const std::string& path, std::string& data) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+               return false;
+            data.clear();
+            char buffer[65536];
+            ssize_t n;
+            while ((n = ::read(fd, buffer, sizeof(buffer))) > 0 or (n < 0 and errno == EINTR)) {
+               if (n > 0)
+                  data.append(buffer, n);
+            }
+            ::close(fd);
+            return n == 0;
+         }
+
+         bool read_at(int fd, boost::uint64_t offset, std::size_t size, std::string& data) {
+            data.resize(size);
+            std::size_t done = 0;
+            while (done < size) {
+               ssize_t n = ::pread(fd, &data[done], size - done, offset + done);
+               if (n < 0 and errno == EINTR)
+                  continue;
+               if (n <= 0)
+                  return false;
+               done += n;
+            }
+            return true;
+         }
+
+         /** List the segments in a journal, oldest first.
+          * @return the paths of the segments without their suffix
+          */
+         std::vector<std::string> list_segments(const std::string& directory) {
+            std::vector<std::string> names;
+            DIR* dir = ::opendir(directory.c_str());
+            if (not dir)
+               throw boost::system::system_error(errno_code(errno));
+
+            const std::size_t suffix = sizeof(segment_suffix) - 1;
+            while (dirent* d = ::readdir(dir)) {
+               std::string name = d->d_name;
+               if (name.size() > suffix and name.compare(name.size() - suffix, suffix, segment_suffix) == 0)
+                  names.push_back(name.substr(0, name.size() - suffix));
+            }
+            ::closedir(dir);
+
+            // names are fixed width times, so they sort in time order
+            std::sort(names.begin(), names.end());
+            for (std::size_t i = 0; i < names.size(); ++i)
+               names[i] = directory + "/" + names[i];
+            return names;
+         }
+
+         /** Read an index file, stopping at a torn record.
+          */
+         void load_index(const std::string& path, std::vector<journal_block>& blocks) {
+            std::string data;
+            if (not read_file(path, data))
+               return;
+
+            std::size_t pos = 0;
+            while (data.size() - pos >= sizeof(boost::uint32_t) + sizeof(index_header)) {
+               boost::uint32_t size;
+               index_header h;
+               std::memcpy(&size, data.data() + pos, sizeof(size));
+               std::memcpy(&h, data.data() + pos + sizeof(size), sizeof(h));
+               if (size != sizeof(h) + h.calls * sizeof(boost::uint64_t) or data.size() - pos - sizeof(size) < size)
+                  break;
+
+               journal_block b;
+               b.offset = h.offset;
+               b.size = h.size;
+               b.count = h.count;
+               b.first = h.first;
+               b.last = h.last;
+               b.calls.resize(h.calls);
+               if (h.calls)
+                  std::memcpy(&b.calls[0], data.data() + pos + sizeof(size) + sizeof(h), h.calls * sizeof(boost::uint64_t));
+               blocks.push_back(b);
+               pos += sizeof(size) + size;
+            }
+         }
+
+         /** Read and check a block.
+          * @param fd the segment
+          * @param offset where the block starts
+          * @param h set to the block header
+          * @param compressed set to the compressed events
+          * @param raw set to the events
+          * @return false if there is no intact block there
+          */
+         bool read_block(int fd, boost::uint64_t offset, block_header& h, std::string& compressed, std::string& raw) {
+            if (not read_at(fd, offset, sizeof(h), compressed))
+               return false;
+            std::memcpy(&h, compressed.data(), sizeof(h));
+            if (h.magic != block_magic or not read_at(fd, offset + sizeof(h), h.compressed_size, compressed))
+               return false;
+            if (crc32(0, reinterpret_cast<const Bytef*>(compressed.data()), compressed.size()) != h.crc)
+               return false;
+
+            raw.resize(h.raw_size);
+            uLongf size = h.raw_size;
+            if (uncompress(reinterpret_cast<Bytef*>(&raw[0]), &size, reinterpret_cast<const Bytef*>(compressed.data()), compressed.size()) != Z_OK
+                  or size != h.raw_size)
+               return false;
+            return true;
+         }
+
+         /** Add the call ids an event mentions.
+          */
+         void add_calls(const message::event& e, std::vector<boost::uint64_t>& calls) {
+            for (std::size_t i = 0; i < sizeof(call_headers) / sizeof(call_headers[0]); ++i) {
+               const std::string* id = e.find(call_headers[i]);
+               if (id and not id->empty())
+                  calls.push_back(hash(*id));
+            }
+         }
+
+         bool mentions(const message::event& e, const std::string& id) {
+            for (std::size_t i = 0; i < sizeof(call_headers) / sizeof(call_headers[0]); ++i) {
+               const std::string* v = e.find(call_headers[i]);
+               if (v and *v == id)
+                  return true;
+            }
+            return false;
+         }
+
+         /** Call f with each event in a block.
+          * @return false if the block ended early
+          */
+         template<typename F>
+         bool for_each_event(const std::string& raw, event_decoder& decoder, F f) {
+            decoder.reset();
+            message::event e("");
+            const char* p = raw.data();
+            std::size_t left = raw.size();
+            while (left) {
+               boost::int64_t t;
+               if (left < sizeof(t))
+                  return false;
+               std::memcpy(&t, p, sizeof(t));
+
+               std::size_t used;
+               try {
+                  used = decoder.decode(p + sizeof(t), left - sizeof(t), e);
+               }
+               catch (const parse_error&) {
+                  return false;
+               }
+               if (not used)
+                  return false;
+               p += sizeof(t) + used;
+               left -= sizeof(t) + used;
+               f(e, t);
+            }
+            return true;
+         }
+
+         struct collect_calls {
+            std::vector<boost::uint64_t>* calls;
+            void operator()(const message::event& e, boost::int64_t) const {
+               add_calls(e, *calls);
+            }
+         };
+
+         struct deliver {
+            boost::int64_t begin;
+            boost::int64_t end;
+            const std::string* id;
+            journal_reader::handler_t* handler;
+            std::size_t* found;
+            void operator()(const message::event& e, boost::int64_t t) const {
+               if (t < begin or t >= end or (id and not mentions(e, *id)))
+                  return;
+               ++*found;
+               (*handler)(e, from_nanoseconds(t));
+            }
+         };
+      }
+
+      /** Open a journal for writing.
+       * @param directory the directory to keep the journal in, created if it
+       * does not exist
+       * @param segment_size the size at which to start a new segment
+       * @param block_size how many bytes of events to compress at a time,
+       * bigger blocks compress better and smaller ones are quicker to
+       * find a call in
+       * @param level the zlib compression level, 1 is fastest
+       * @throw boost::system::system_error if the directory can't be
+       * created
+       */
+      journal_writer::journal_writer(const std::string& directory, std::size_t segment_size, std::size_t block_size, int level) :
+         m_directory(directory),
+         m_segment_size(segment_size),
+         m_block_size(block_size),
+         m_level(level),
+         m_max_delay(std::chrono::seconds(1)),
+         m_segment(-1),
+         m_index(-1),
+         m_offset(0),
+         m_appended(0),
+         m_written(0) {
+
+         if (::mkdir(directory.c_str(), 0755) < 0 and errno != EEXIST)
+            throw boost::system::system_error(errno_code(errno));
+
+         m_block.count = 0;
+         m_raw.reserve(block_size + block_size / 4);
+      }
+
+      /** Write what is left and close the journal.
+       */
+      journal_writer::~journal_writer() {
+         try {
+            flush();
+         }
+         catch (...) {
+         }
+         close_segment();
+      }
+
+      /** Append an event, timed now.
+       * @param e the event
+       * @throw boost::system::system_error if a block could not be written
+       */
+      void journal_writer::append(const message::event& e) {
+         append_at(e, clock_type::now());
+      }
+
+      /** Append an event.
+       * @param e the event
+       * @param t the time to file the event under
+       * @throw boost::system::system_error if a block could not be written
+       */
+      void journal_writer::append_at(const message::event& e, time_point t) {
+         boost::int64_t ns = nanoseconds(t);
+         if (not m_block.count) {
+            m_block.first = m_block.last = ns;
+            if (m_max_delay.count())
+               m_block_started = std::chrono::steady_clock::now();
+         }
+         else {
+            m_block.first = std::min(m_block.first, ns);
+            m_block.last = std::max(m_block.last, ns);
+         }
+
+         m_raw.append(reinterpret_cast<const char*>(&ns), sizeof(ns));
+         m_encoder.encode(e, m_raw);
+         add_calls(e, m_block.calls);
+         ++m_block.count;
+         ++m_appended;
+
+         if (m_raw.size() >= m_block_size
+               or (m_max_delay.count() and std::chrono::steady_clock::now() - m_block_started >= m_max_delay))
+            write_block();
+      }
+
+      /** Write the events appended so far.
+       * @param sync true to wait for them to reach the disk too
+       * @throw boost::system::system_error if they could not be written
+       */
+      void journal_writer::flush(bool sync) {
+         write_block();
+         if (sync and m_segment >= 0) {
+            if (::fdatasync(m_segment) < 0 or ::fdatasync(m_index) < 0)
+               throw boost::system::system_error(errno_code(errno));
+         }
+      }
+
+      /** Remove old segments.
+       * @param before remove segments with nothing newer than this
+       * @return the number of segments removed
+       */
+      std::size_t journal_writer::prune(time_point before) {
+         boost::int64_t limit = nanoseconds(before);
+         std::vector<std::string> segments = list_segments(m_directory);
+         std::size_t removed = 0;
+         for (std::size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i] == m_segment_name)
+               continue;
+
+            std::vector<journal_block> blocks;
+            load_index(segments[i] + index_suffix, blocks);
+            boost::int64_t last = std::numeric_limits<boost::int64_t>::min();
+            for (std::size_t b = 0; b < blocks.size(); ++b)
+               last = std::max(last, blocks[b].last);
+            if (blocks.empty() or last >= limit)
+               continue;
+
+            ::unlink((segments[i] + segment_suffix).c_str());
+            ::unlink((segments[i] + index_suffix).c_str());
+            ++removed;
+         }
+         return removed;
+      }
+
+      /** Start a segment.
+       * @param first the time of its first event, which names it
+       */
+      void journal_writer::open_segment(boost::int64_t first) {
+         for (;;) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%020lld", static_cast<long long>(first));
+            m_segment_name = m_directory + "/" + name;
+
+            m_segment = ::open((m_segment_name + segment_suffix).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+            if (m_segment >= 0)
+               break;
+            if (errno != EEXIST)
+               throw boost::system::system_error(errno_code(errno));
+            ++first;
+         }
+
+         m_index = ::open((m_segment_name + index_suffix).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+         if (m_index < 0) {
+            int e = errno;
+            close_segment();
+            throw boost::system::system_error(errno_code(e));
+         }
+         m_offset = 0;
+      }
+
+      /** Close the current segment, if there is one.
+       */
+      void journal_writer::close_segment() {
+         if (m_segment >= 0)
+            ::close(m_segment);
+         if (m_index >= 0)
+            ::close(m_index);
+         m_segment = m_index = -1;
+         m_segment_name.clear();
+      }
+
+      /** Compress the current block and append it to the segment, and its
+       * entry to the index.
+       */
+      void journal_writer::write_block() {
+         if (not m_block.count)
+            return;
+
+         uLongf size = compressBound(m_raw.size());
+         m_compressed.resize(sizeof(block_header) + size);
+         if (compress2(reinterpret_cast<Bytef*>(&m_compressed[sizeof(block_header)]), &size,
+                  reinterpret_cast<const Bytef*>(m_raw.data()), m_raw.size(), m_level) != Z_OK)
+            throw boost::system::system_error(errno_code(ENOMEM));
+         m_compressed.resize(sizeof(block_header) + size);
+
+         block_header h = block_header();
+         h.magic = block_magic;
+         h.raw_size = m_raw.size();
+         h.compressed_size = size;
+         h.count = m_block.count;
+         h.first = m_block.first;
+         h.last = m_block.last;
+         h.crc = crc32(0, reinterpret_cast<const Bytef*>(m_compressed.data() + sizeof(h)), size);
+         std::memcpy(&m_compressed[0], &h, sizeof(h));
+
+         if (m_segment >= 0 and m_offset and m_offset + m_compressed.size() > m_segment_size)
+            close_segment();
+         if (m_segment < 0)
+            open_segment(m_block.first);
+
+         write_all(m_segment, m_compressed.data(), m_compressed.size());
+
+         std::sort(m_block.calls.begin(), m_block.calls.end());
+         m_block.calls.erase(std::unique(m_block.calls.begin(), m_block.calls.end()), m_block.calls.end());
+
+         index_header ih = index_header();
+         ih.offset = m_offset;
+         ih.size = m_compressed.size();
+         ih.count = m_block.count;
+         ih.first = m_block.first;
+         ih.last = m_block.last;
+         ih.calls = m_block.calls.size();
+         boost::uint32_t record_size = sizeof(ih) + ih.calls * sizeof(boost::uint64_t);
+         m_index_record.assign(reinterpret_cast<const char*>(&record_size), sizeof(record_size));
+         m_index_record.append(reinterpret_cast<const char*>(&ih), sizeof(ih));
+         if (ih.calls)
+            m_index_record.append(reinterpret_cast<const char*>(&m_block.calls[0]), ih.calls * sizeof(boost::uint64_t));
+         write_all(m_index, m_index_record.data(), m_index_record.size());
+
+         m_offset += m_compressed.size();
+         m_written += m_compressed.size();
+
+         m_raw.clear();
+         m_encoder.reset();
+         m_block.count = 0;
+         m_block.calls.clear();
+      }
+
+      /** Open a journal for reading.
+       * @param directory the directory the journal is in
+       * @throw boost::system::system_error if the directory can't be read
+       */
+      journal_reader::journal_reader(const std::string& directory) : m_directory(directory) {
+         refresh();
+      }
+
+      /** Look at the segments and indexes again, to see what has been
+       * written since.
+       * @throw boost::system::system_error if the directory can't be read
+       */
+      void journal_reader::refresh() {
+         std::vector<std::string> names = list_segments(m_directory);
+         m_segments.clear();
+         m_segments.reserve(names.size());
+
+         for (std::size_t i = 0; i < names.size(); ++i) {
+            segment s;
+            s.path = names[i] + segment_suffix;
+            load_index(names[i] + index_suffix, s.blocks);
+
+            // blocks written after the last index entry, after a crash
+            // or a torn read of a journal being written, are found by
+            // walking the segment
+            int fd = ::open(s.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+               continue;
+            struct stat st;
+            boost::uint64_t offset = s.blocks.empty() ? 0 : s.blocks.back().offset + s.blocks.back().size;
+            if (::fstat(fd, &st) == 0) {
+               block_header h;
+               while (offset + sizeof(h) <= static_cast<boost::uint64_t>(st.st_size)
+                     and read_block(fd, offset, h, m_compressed, m_raw)) {
+                  journal_block b;
+                  b.offset = offset;
+                  b.size = sizeof(h) + h.compressed_size;
+                  b.count = h.count;
+                  b.first = h.first;
+                  b.last = h.last;
+                  collect_calls c = { &b.calls };
+                  for_each_event(m_raw, m_decoder, c);
+                  std::sort(b.calls.begin(), b.calls.end());
+                  b.calls.erase(std::unique(b.calls.begin(), b.calls.end()), b.calls.end());
+                  s.blocks.push_back(b);
+                  offset += b.size;
+               }
+            }
+            ::close(fd);
+
+            m_segments.push_back(s);
+         }
+      }
+
+      /** Read the events in a time range.
+       * @param from the start of the range
+       * @param to the end of the range, not included
+       * @param handler called with each event in the range, in the order
+       * they were appended
+       * @return the number of events found
+       */
+      std::size_t journal_reader::read(time_point from, time_point to, handler_t handler) {
+         return scan(from, to, 0, handler);
+      }
+
+      /** Read the events about a call.
+       * @param id a Uniqueid or Linkedid, a Linkedid finds every channel of
+       * the call
+       * @param handler called with each event with that id as its
+       * Uniqueid, Linkedid, DestUniqueid or DestLinkedid, in the order
+       * they were appended
+       * @param from the start of the range to look in
+       * @param to the end of the range to look in, not included
+       * @return the number of events found
+       */
+      std::size_t journal_reader::find_call(const std::string& id, handler_t handler, time_point from, time_point to) {
+         return scan(from, to, &id, handler);
+      }
+
+      /** Read the events in a time range, about a call if given one.
+       */
+      std::size_t journal_reader::scan(time_point from, time_point to, const std::string* id, handler_t& handler) {
+         boost::int64_t begin = nanoseconds(from);
+         boost::int64_t end = nanoseconds(to);
+         boost::uint64_t call = id ? hash(*id) : 0;
+         std::size_t found = 0;
+
+         for (std::vector<segment>::const_iterator s = m_segments.begin(); s != m_segments.end(); ++s) {
+            int fd = -1;
+            for (std::vector<journal_block>::const_iterator b = s->blocks.begin(); b != s->blocks.end(); ++b) {
+               if (b->last < begin or b->first >= end)
+                  continue;
+               if (id and not std::binary_search(b->calls.begin(), b->calls.end(), call))
+                  continue;
+
+               if (fd < 0 and (fd = ::open(s->path.c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+                  break;
+               block_header h;
+               if (not read_block(fd, b->offset, h, m_compressed, m_raw))
+                  continue;
+
+               deliver d = { begin, end, id, &handler, &found };
+               for_each_event(m_raw, m_decoder, d);
+            }
+            if (fd >= 0)
+               ::close(fd);
+         }
+         return found;
+      }
+   }
+}
@@ -0,0 +1,425 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/json_writer.h"
+#include "manager/value.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ASTXX_JSON_X86
+#include <immintrin.h>
+#endif
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         /* Strings are escaped in place: the caller makes room in out for
+          * the string as it is, and each byte that has to be escaped grows
+          * out by the five bytes more it takes, so there is always room
+          * for the rest of the string, and for whatever else the caller
+          * made room for after it.
+          */
+
+         /// Which bytes need escaping.
+         struct escape_table {
+            bool table[256];
+
+            escape_table() {
+               for (int c = 0; c < 256; ++c)
+                  table[c] = c < 0x20 or c == '"' or c == '\\';
+            }
+         };
+         const escape_table escapes;
+
+         inline bool needs_escape(unsigned char c) {
+            return escapes.table[c];
+         }
+
+         /** Escape one byte.
+          * @return where the escape ends
+          */
+         std::size_t escape_char(unsigned char c, std::string& out, std::size_t pos) {
+            static const char hex[] = "0123456789abcdef";
+            out.resize(out.size() + 5);
+            char* p = &out[pos];
+            *p++ = '\\';
+            switch (c) {
+               case '"':
+                  *p++ = '"';
+                  break;
+               case '\\':
+                  *p++ = '\\';
+                  break;
+               case '\n':
+                  *p++ = 'n';
+                  break;
+               case '\r':
+                  *p++ = 'r';
+                  break;
+               case '\t':
+                  *p++ = 't';
+                  break;
+               case '\b':
+                  *p++ = 'b';
+                  break;
+               case '\f':
+                  *p++ = 'f';
+                  break;
+               default:
+                  *p++ = 'u';
+                  *p++ = '0';
+                  *p++ = '0';
+                  *p++ = hex[c >> 4];
+                  *p++ = hex[c & 0xf];
+            }
+            return p - out.data();
+         }
+
+         /** Copy bytes that need no escaping.
+          * @return where the copy ends
+          */
+         inline std::size_t copy(const char* s, std::size_t size, std::string& out, std::size_t pos) {
+            std::memcpy(&out[pos], s, size);
+            return pos + size;
+         }
+
+         /** Escape the rest of a string a byte at a time.
+          * @param s the string
+          * @param i where to carry on looking
+          * @param run where the bytes not yet copied start
+          * @param size the size of the string
+          * @param out where to write
+          * @param pos where in out to write
+          * @return where the escaped string ends
+          */
+         std::size_t escape_scalar(const char* s, std::size_t i, std::size_t run, std::size_t size, std::string& out, std::size_t pos) {
+            for (; i < size; ++i) {
+               if (needs_escape(s[i])) {
+                  pos = copy(s + run, i - run, out, pos);
+                  pos = escape_char(s[i], out, pos);
+                  run = i + 1;
+               }
+            }
+            return copy(s + run, size - run, out, pos);
+         }
+
+#ifdef ASTXX_JSON_X86
+         __attribute__((target("sse2")))
+         std::size_t escape_sse2(const char* s, std::size_t size, std::string& out, std::size_t pos) {
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            const __m128i control = _mm_set1_epi8(0x1f);
+
+            std::size_t run = 0;
+            std::size_t i = 0;
+            while (i + 16 <= size) {
+               __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+               __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                     _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+               unsigned int mask = _mm_movemask_epi8(special);
+               if (not mask) {
+                  i += 16;
+                  continue;
+               }
+
+               std::size_t j = i + __builtin_ctz(mask);
+               pos = copy(s + run, j - run, out, pos);
+               pos = escape_char(s[j], out, pos);
+               run = i = j + 1;
+            }
+
+            return escape_scalar(s, i, run, size, out, pos);
+         }
+
+         __attribute__((target("avx2")))
+         std::size_t escape_avx2(const char* s, std::size_t size, std::string& out, std::size_t pos) {
+            const __m256i quote = _mm256_set1_epi8('"');
+            const __m256i backslash = _mm256_set1_epi8('\\');
+            const __m256i control = _mm256_set1_epi8(0x1f);
+
+            std::size_t run = 0;
+            std::size_t i = 0;
+            while (i + 32 <= size) {
+               __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+               __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                     _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+               unsigned int mask = _mm256_movemask_epi8(special);
+               if (not mask) {
+                  i += 32;
+                  continue;
+               }
+
+               std::size_t j = i + __builtin_ctz(mask);
+               pos = copy(s + run, j - run, out, pos);
+               pos = escape_char(s[j], out, pos);
+               run = i = j + 1;
+            }
+
+            // header values are often shorter than a 32 byte vector
+            pos = copy(s + run, i - run, out, pos);
+            return escape_sse2(s + i, size - i, out, pos);
+         }
+#endif
+
+         /** Escape a string.
+          * @return where the escaped string ends
+          */
+         std::size_t escape_at(const char* s, std::size_t size, std::string& out, std::size_t pos, scanner::isa_t isa) {
+            // most keys and values are shorter than a vector
+            if (size < 16)
+               return escape_scalar(s, 0, 0, size, out, pos);
+
+            switch (isa) {
+#ifdef ASTXX_JSON_X86
+               case scanner::avx2:
+                  return escape_avx2(s, size, out, pos);
+               case scanner::sse2:
+                  return escape_sse2(s, size, out, pos);
+#endif
+               default:
+                  return escape_scalar(s, 0, 0, size, out, pos);
+            }
+         }
+
+         /** Write a quoted, escaped string, with room for it and its quotes
+          * already made.
+          * @return where the string ends
+          */
+         inline std::size_t quoted(const std::string& s, std::string& out, std::size_t pos, scanner::isa_t isa) {
+            out[pos++] = '"';
+            pos = escape_at(s.data(), s.size(), out, pos, isa);
+            out[pos++] = '"';
+            return pos;
+         }
+      }
+
+      /** Construct a writer using the best instruction set available.
+       */
+      json_writer::json_writer() : m_isa(scanner::best()), m_after_key(false) {
+      }
+
+      /** Construct a writer using the given instruction set.
+       * @param isa the instruction set, if the cpu does not support it the
+       * best one it does support is used instead
+       */
+      json_writer::json_writer(scanner::isa_t isa) : m_isa(isa <= scanner::best() ? isa : scanner::best()), m_after_key(false) {
+      }
+
+      /** Write an event as an object.
+       * @param e the event
+       */
+      void json_writer::write(const message::event& e) {
+         separate();
+
+         // room for everything if nothing needs escaping: each header
+         // takes at most its quotes, a colon, a comma and its share of an
+         // array's brackets on top of its key and value
+         std::size_t room = 2;
+         for (message::event::header_t::const_iterator i = e.begin(); i != e.end(); ++i)
+            room += i->first.size() + i->second.size() + 8;
+         std::size_t pos = m_buffer.size();
+         m_buffer.resize(pos + room);
+
+         m_buffer[pos++] = '{';
+         message::event::header_t::const_iterator i = e.begin();
+         while (i != e.end()) {
+            if (i != e.begin())
+               m_buffer[pos++] = ',';
+            pos = quoted(i->first, m_buffer, pos, m_isa);
+            m_buffer[pos++] = ':';
+
+            // headers with the same key are next to each other
+            message::event::header_t::const_iterator next = i;
+            ++next;
+            if (next == e.end() or next->first != i->first) {
+               pos = quoted(i->second, m_buffer, pos, m_isa);
+               i = next;
+               continue;
+            }
+
+            m_buffer[pos++] = '[';
+            const std::string& name = i->first;
+            for (bool first = true; i != e.end() and i->first == name; ++i, first = false) {
+               if (not first)
+                  m_buffer[pos++] = ',';
+               pos = quoted(i->second, m_buffer, pos, m_isa);
+            }
+            m_buffer[pos++] = ']';
+         }
+         m_buffer[pos++] = '}';
+         m_buffer.resize(pos);
+      }
+
+      /** Start an object.
+       */
+      void json_writer::begin_object() {
+         separate();
+         m_buffer.push_back('{');
+         m_open.push_back(false);
+      }
+
+      /** End the innermost object.
+       */
+      void json_writer::end_object() {
+         m_buffer.push_back('}');
+         m_open.pop_back();
+      }
+
+      /** Start an array.
+       */
+      void json_writer::begin_array() {
+         separate();
+         m_buffer.push_back('[');
+         m_open.push_back(false);
+      }
+
+      /** End the innermost array.
+       */
+      void json_writer::end_array() {
+         m_buffer.push_back(']');
+         m_open.pop_back();
+      }
+
+      /** Write the name of an object member, its value comes next.
+       * @param name the name
+       */
+      void json_writer::key(const std::string& name) {
+         separate();
+         string(name.data(), name.size());
+         m_buffer.push_back(':');
+         m_after_key = true;
+      }
+
+      /** Write a string.
+       * @param s the string
+       */
+      void json_writer::value(const std::string& s) {
+         separate();
+         string(s.data(), s.size());
+      }
+
+      /** Write a string.
+       * @param s the string
+       * @param size the number of bytes of s
+       */
+      void json_writer::value(const char* s, std::size_t size) {
+         separate();
+         string(s, size);
+      }
+
+      /** Write an integer.
+       * @param n the integer
+       */
+      void json_writer::integer(long long n) {
+         separate();
+         message::value_traits<long long>::format(n, m_number);
+         m_buffer.append(m_number);
+      }
+
+      /** Write a number.
+       * @param n the number, infinities and NaNs are written as null
+       */
+      void json_writer::number(double n) {
+         separate();
+         if (not std::isfinite(n)) {
+            m_buffer.append("null", 4);
+            return;
+         }
+         message::value_traits<double>::format(n, m_number);
+         m_buffer.append(m_number);
+      }
+
+      /** Write a boolean.
+       * @param b the boolean
+       */
+      void json_writer::boolean(bool b) {
+         separate();
+         if (b)
+            m_buffer.append("true", 4);
+         else
+            m_buffer.append("false", 5);
+      }
+
+      /** Write a null.
+       */
+      void json_writer::null() {
+         separate();
+         m_buffer.append("null", 4);
+      }
+
+      /** Write a newline, to separate top level values as JSON lines.
+       */
+      void json_writer::newline() {
+         m_buffer.push_back('\n');
+      }
+
+      /** Empty the buffer and forget any open objects and arrays.  The
+       * buffer keeps its storage.
+       */
+      void json_writer::clear() {
+         m_buffer.clear();
+         m_open.clear();
+         m_after_key = false;
+      }
+
+      /** Escape a string for JSON, without the quotes.
+       * @param s the string
+       * @param size the number of bytes of s
+       * @param out where to append the escaped string
+       * @param isa the instruction set to use, it must be one the cpu
+       * supports
+       */
+      void json_writer::escape(const char* s, std::size_t size, std::string& out, scanner::isa_t isa) {
+         std::size_t pos = out.size();
+         out.resize(pos + size);
+         out.resize(escape_at(s, size, out, pos, isa));
+      }
+
+      /** Put a comma before a value or member if it is not the first.
+       */
+      void json_writer::separate() {
+         if (m_after_key) {
+            m_after_key = false;
+            return;
+         }
+         if (m_open.empty())
+            return;
+         if (m_open.back())
+            m_buffer.push_back(',');
+         else
+            m_open.back() = true;
+      }
+
+      /** Write a quoted, escaped string.
+       * @param s the string
+       * @param size the number of bytes of s
+       */
+      void json_writer::string(const char* s, std::size_t size) {
+         std::size_t pos = m_buffer.size();
+         m_buffer.resize(pos + size + 2);
+         m_buffer[pos++] = '"';
+         pos = escape_at(s, size, m_buffer, pos, m_isa);
+         m_buffer[pos++] = '"';
+         m_buffer.resize(pos);
+      }
+   }
+}
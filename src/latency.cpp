@@ -0,0 +1,111 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/latency.h"
+
+#include <algorithm>
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         /// buckets per power of two, as a number of bits
+         const int sub_bits = 4;
+         const std::size_t sub_buckets = 1 << sub_bits;
+         const std::size_t bucket_count = (64 - sub_bits + 1) * sub_buckets;
+      }
+
+      /** Construct an empty histogram.
+       */
+      latency_histogram::latency_histogram() :
+         m_buckets(bucket_count, 0),
+         m_count(0),
+         m_max(0) {
+      }
+
+      /** Record a latency.
+       * @param latency the latency, negative latencies count as zero
+       */
+      void latency_histogram::record(duration latency) {
+         unsigned long long ns = latency.count() > 0 ? latency.count() : 0;
+         ++m_buckets[bucket(ns)];
+         ++m_count;
+         if (ns > m_max)
+            m_max = ns;
+      }
+
+      /** Get a percentile.
+       * @param fraction the fraction of samples, 0.99 for the 99th
+       * percentile
+       * @return the latency that fraction of the samples are at or under,
+       * rounded up to the top of its bucket, zero if nothing was recorded
+       */
+      latency_histogram::duration latency_histogram::percentile(double fraction) const {
+         if (not m_count)
+            return duration::zero();
+
+         unsigned long long rank = static_cast<unsigned long long>(fraction * m_count + 0.5);
+         rank = std::max(1ULL, std::min(rank, m_count));
+
+         unsigned long long seen = 0;
+         for (std::size_t i = 0; i < m_buckets.size(); ++i) {
+            seen += m_buckets[i];
+            if (seen >= rank)
+               return duration(std::min(upper_bound(i), m_max));
+         }
+         return duration(m_max);
+      }
+
+      /** Forget everything recorded.
+       */
+      void latency_histogram::reset() {
+         std::fill(m_buckets.begin(), m_buckets.end(), 0);
+         m_count = 0;
+         m_max = 0;
+      }
+
+      /** Find the bucket of a latency.
+       * @param ns the latency in nanoseconds
+       * @return the bucket index
+       *
+       * Latencies under sub_buckets get a bucket each, above that each power
+       * of two is split into sub_buckets buckets.
+       */
+      std::size_t latency_histogram::bucket(unsigned long long ns) {
+         if (ns < sub_buckets)
+            return ns;
+
+         int shift = 63 - __builtin_clzll(ns) - sub_bits;
+         return (shift + 1) * sub_buckets + ((ns >> shift) & (sub_buckets - 1));
+      }
+
+      /** Find the largest latency a bucket holds.
+       * @param bucket the bucket index
+       * @return the latency in nanoseconds
+       */
+      unsigned long long latency_histogram::upper_bound(std::size_t bucket) {
+         if (bucket < sub_buckets)
+            return bucket;
+
+         int shift = bucket / sub_buckets - 1;
+         unsigned long long lower = static_cast<unsigned long long>(sub_buckets + bucket % sub_buckets) << shift;
+         return lower + (1ULL << shift) - 1;
+      }
+   }
+}
@@ -0,0 +1,322 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/parser.h"
+#include "manager/error.h"
+
+namespace astxx {
+   namespace manager {
+      parser::parser() :
+         m_greeting(false),
+         m_follows(false),
+         m_keep(0),
+         m_skipping(false) {
+      }
+
+      /** Treat the next line as the greeting.
+       * This is called once a new connection is established.
+       */
+      void parser::expect_greeting() {
+         m_greeting = true;
+      }
+
+      /** Forget any partial message.
+       */
+      void parser::reset() {
+         rx.clear();
+         m_greeting = false;
+         m_event = boost::none;
+         m_response = boost::none;
+         m_follows = false;
+         m_action_id.clear();
+         m_event_projection.reset();
+         m_keep = 0;
+         m_skipping = false;
+      }
+
+      /** Only keep some headers of some events.
+       * @param projection the headers to keep for each event name, or null 
+       * to keep everything
+       *
+       * Headers left out are skipped without being copied.  This may be 
+       * called from another thread than the one feeding the parser, it 
+       * takes effect from the next event.
+       */
+      void parser::project(boost::shared_ptr<const projection_t> projection) {
+         boost::atomic_store(&m_projection, projection);
+      }
+
+      /** Drop some of the events of some types.
+       * @param sampling the rule for each event name, or null to keep every 
+       * event
+       *
+       * An event a rule drops is abandoned right after its 'Event' line, 
+       * the rest of it is skipped without being copied or parsed.  This may 
+       * be called from another thread than the one feeding the parser, it 
+       * takes effect from the next event.
+       */
+      void parser::sample(boost::shared_ptr<const sampling_t> sampling) {
+         boost::atomic_store(&m_sampling, sampling);
+      }
+
+      /** Parse data read from Asterisk.
+       * @param data the data
+       * @param size the number of bytes of data
+       * @param h the handler to pass messages to
+       *
+       * Every complete line is processed.  Whatever is left after the last
+       * "\r\n" is kept until more data arrives.
+       *
+       * @throw manager::parse_error if there is a problem parsing a header
+       * @throw manager::unknown_message if a message is anything other than
+       * an 'Event' or a 'Response'
+       */
+      void parser::feed(const char* data, std::size_t size, handler& h) {
+         rx.append(data, size);
+
+         m_index.clear();
+         m_scanner.scan(rx.data(), rx.size(), m_index);
+
+         // the start of the current line and its first ':'
+         std::string::size_type begin = 0;
+         std::string::size_type colon = std::string::npos;
+
+         for (scanner::index_t::const_iterator i = m_index.begin(); i != m_index.end(); ++i) {
+            if (colon == std::string::npos)
+               colon = i->colon;
+
+            if (i->end > begin and rx[i->end - 1] == '\r') {
+               if (m_skipping) {
+                  // a blank line ends the dropped event
+                  if (i->end - 1 == begin)
+                     m_skipping = false;
+                  begin = i->end + 1;
+                  colon = std::string::npos;
+                  continue;
+               }
+
+               std::string::size_type c = (colon != std::string::npos) ? colon - begin : std::string::npos;
+               if (m_keep and c != std::string::npos and projected_out(rx.data() + begin, c)) {
+                  // nobody wants this header, don't even copy it
+                  begin = i->end + 1;
+                  colon = std::string::npos;
+                  continue;
+               }
+
+               std::string line(rx, begin, i->end - 1 - begin);
+               begin = i->end + 1;
+               colon = std::string::npos;
+               process_line(line, c, h);
+            }
+            else if (m_follows) {
+               /* The body of a 'Response: Follows' message is CLI output, 
+                * made of lines ending in a bare \n and terminated by 
+                * '--END COMMAND--\r\n'.  Lines ending in \r\n are still 
+                * headers (or the end marker), anything else is output and is 
+                * handed on without waiting for the rest of the message.
+                */
+               std::string line(rx, begin, i->end - begin);
+               begin = i->end + 1;
+               colon = std::string::npos;
+               h.on_output(m_action_id, line, false);
+            }
+            // otherwise a bare \n is part of the line
+         }
+
+         rx.erase(0, begin);
+      }
+
+      /** Parse a colon (:) seperated header.
+       * @param header a string representing the header
+       * @return an key value pair std::pair
+       * @throw manager::parse_error if there is a problem parsing the message
+       * @throw manager::empty_header if we attempt to parse and
+       * empty header
+       */
+      std::pair<std::string, std::string> parser::parse_header(const std::string& header) {
+         return split_header(header, header.find(':'));
+      }
+
+      /** Split a header whose separator has already been found.
+       * @param header a string representing the header
+       * @param colon the offset of the first ':' in the header, or npos
+       * @return an key value pair std::pair
+       * @throw manager::parse_error if there is no ':'
+       * @throw manager::empty_header if the header is empty
+       */
+      std::pair<std::string, std::string> parser::split_header(const std::string& header, std::string::size_type colon) {
+         std::string key;
+         std::string value;
+
+         if (header.empty()) {
+            throw manager::empty_header();
+         }
+
+         std::string::size_type i = colon;
+         if (i == std::string::npos) {
+            throw manager::parse_error("missing ':' in header: " + header);
+         }
+
+         key.assign(header, 0, i++);
+
+         if (i != std::string::npos) {
+            if (header[i] == ' ') {
+               ++i;
+            }
+            if (i != std::string::npos) {
+               value.assign(header, i, std::string::npos);
+            }
+         }
+         return std::make_pair(key, value);
+      }
+
+      /** Process a line read from Asterisk.
+       * @param line the line, without the trailing \r\n
+       * @param colon the offset of the first ':' in the line, or npos
+       * @param h the handler to pass messages to
+       *
+       * This function builds messages a line at a time and hands each one
+       * to the handler once its terminating blank line is seen.
+       *
+       * @throw manager::parse_error if there is a problem parsing a header
+       * @throw manager::unknown_message if the header we recieve is
+       * anything other than 'Event' or 'Response'
+       */
+      void parser::process_line(const std::string& line, std::string::size_type colon, handler& h) {
+         if (m_greeting) {
+            m_greeting = false;
+            h.on_greeting(line);
+            return;
+         }
+
+         if (m_event) {
+            // stop if we get a blank line
+            if (line.empty()) {
+               message::event e("");
+               std::swap(e, *m_event);
+               m_event = boost::none;
+               m_event_projection.reset();
+               m_keep = 0;
+               h.on_event(e);
+            }
+            else {
+               m_event->insert(split_header(line, colon));
+            }
+         }
+         else if (m_response) {
+            // stop if we get a blank line
+            if (line.empty()) {
+               message::response r("");
+               std::swap(r, *m_response);
+               m_response = boost::none;
+               m_follows = false;
+               m_action_id.clear();
+               h.on_response(r);
+            }
+            // check for '--END COMMAND--' if necessary
+            else if (m_follows) {
+               std::string::size_type ec = line.find("--END COMMAND--");
+
+               // strip the '--END COMMAND--', if found, anything before it
+               // is the last line of output
+               if (ec != std::string::npos) {
+                  if (ec)
+                     h.on_output(m_action_id, line.substr(0, ec), false);
+               }
+               // a header, unless it can't be one
+               else if (colon != std::string::npos) {
+                  process_header(split_header(line, colon), h);
+               }
+               else {
+                  h.on_output(m_action_id, line, false);
+               }
+            }
+            else {
+               process_header(split_header(line, colon), h);
+            }
+         }
+         // skip blank lines between messages
+         else if (not line.empty()) {
+            std::pair<std::string, std::string> pair = split_header(line, colon);
+            if (pair.first == "Event") {
+               boost::shared_ptr<const sampling_t> sampling = boost::atomic_load(&m_sampling);
+               if (sampling) {
+                  sampling_t::const_iterator r = sampling->find(pair.second);
+                  if (r != sampling->end() and not r->second->admit()) {
+                     m_skipping = true;
+                     return;
+                  }
+               }
+
+               m_event = message::event(pair.second);
+
+               m_event_projection = boost::atomic_load(&m_projection);
+               if (m_event_projection) {
+                  projection_t::const_iterator p = m_event_projection->find(pair.second);
+                  if (p != m_event_projection->end())
+                     m_keep = &p->second;
+               }
+            }
+            else if (pair.first == "Response") {
+               m_response = message::response(pair.second);
+               m_follows = (pair.second == "Follows");
+               m_action_id.clear();
+            }
+            else {
+               throw manager::unknown_message(pair.first);
+            }
+         }
+      }
+
+      /** Check a header of the current event against the projection.
+       * @param key the start of the header name
+       * @param size the length of the header name
+       * @return true if the header is not wanted
+       */
+      bool parser::projected_out(const char* key, std::string::size_type size) const {
+         for (std::vector<std::string>::const_iterator i = m_keep->begin(); i != m_keep->end(); ++i) {
+            if (i->size() == size and i->compare(0, size, key, size) == 0)
+               return false;
+         }
+         return true;
+      }
+
+      /** Add a header to the response being parsed.
+       * @param header the header
+       * @param h the handler to pass output to
+       *
+       * The ActionID header tells the handler which action any output that
+       * follows belongs to.  Output headers are passed to the handler,
+       * which decides whether they are command output or ordinary headers.
+       */
+      void parser::process_header(const std::pair<std::string, std::string>& header, handler& h) {
+         if (header.first == "ActionID") {
+            m_action_id = header.second;
+         }
+         else if (header.first == "Output") {
+            h.on_output(m_action_id, header.second, true);
+            return;
+         }
+
+         m_response->insert(header);
+      }
+   }
+}
+
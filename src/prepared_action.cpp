@@ -0,0 +1,156 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/prepared_action.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace astxx {
+   namespace manager {
+      /** Prepare an action.
+       * @param example an action with the fixed headers filled in
+       * @param slots the headers that are set for each call
+       * @throw message::header_missing if the action has no 'Action' header
+       */
+      prepared_action::prepared_action(const basic_action& example, const std::vector<std::string>& slots) {
+         prepare(example.action(), slots);
+      }
+
+      /** Prepare an action.
+       * @param example an action with the fixed headers filled in
+       * @param slots the headers that are set for each call
+       * @throw message::header_missing if the action has no 'Action' header
+       */
+      prepared_action::prepared_action(const message::action& example, const std::vector<std::string>& slots) {
+         prepare(example, slots);
+      }
+
+      /** Build the template.
+       * @param example an action with the fixed headers filled in
+       * @param slots the headers that are set for each call
+       */
+      void prepared_action::prepare(message::action example, const std::vector<std::string>& slots) {
+         boost::shared_ptr<state> s(new state());
+         s->name = example.main_header();
+         s->slots = slots;
+         s->defaults.resize(slots.size());
+
+         // the main header goes first, like basic_message::format() does it
+         s->head = "Action: " + s->name + "\r\n";
+         s->action["Action"] = s->name;
+
+         for (message::action::header_t::iterator i = example.begin(); i != example.end(); ++i) {
+            if (i->first == "Action" or i->first == "ActionID")
+               continue;
+
+            std::vector<std::string>::iterator slot = std::find(s->slots.begin(), s->slots.end(), i->first);
+            if (slot != s->slots.end()) {
+               std::string& d = s->defaults[slot - s->slots.begin()];
+               if (d.empty())
+                  d = i->second;
+               continue;
+            }
+
+            s->head += i->first;
+            s->head += ": ";
+            s->head += i->second;
+            s->head += "\r\n";
+            s->action.insert(*i);
+         }
+
+         for (std::vector<std::string>::iterator i = s->slots.begin(); i != s->slots.end(); ++i) {
+            s->prefixes.push_back(*i + ": ");
+         }
+
+         m_state = s;
+      }
+
+      /** Construct an instance.
+       * @param s the template
+       */
+      prepared_action::instance::instance(boost::shared_ptr<const state> s) :
+         m_state(s),
+         m_values(s->defaults) {
+      }
+
+      /** Find a slot.
+       * @param header the header of the slot
+       * @return the index of the slot, pass it to instance::set() to skip
+       * this lookup
+       * @throw std::out_of_range if there is no such slot
+       */
+      std::size_t prepared_action::instance::slot(const std::string& header) const {
+         std::vector<std::string>::const_iterator i = std::find(m_state->slots.begin(), m_state->slots.end(), header);
+         if (i == m_state->slots.end())
+            throw std::out_of_range("no slot for header " + header);
+         return i - m_state->slots.begin();
+      }
+
+      /** Build the action as a message::action.
+       * This is not used to send the action, only where a message is needed,
+       * for example in the exceptions thrown by
+       * basic_action::handle_response().
+       * @return the action
+       */
+      message::action prepared_action::instance::action() const {
+         message::action a = m_state->action;
+         for (std::size_t i = 0; i < m_values.size(); ++i) {
+            if (not m_values[i].empty())
+               a.insert(std::make_pair(m_state->slots[i], m_values[i]));
+         }
+         if (not action_id().empty())
+            a["ActionID"] = action_id();
+         return a;
+      }
+
+      /** Write the action from the template and the slot values.
+       * @param action_id the ActionID to send the action with
+       * @param name set to the name of the action
+       * @param data set to the formatted action
+       * @return true
+       */
+      bool prepared_action::instance::serialize(const std::string& action_id, std::string& name, std::string& data) const {
+         static const std::string id_prefix("ActionID: ");
+
+         std::string::size_type size = m_state->head.size() + id_prefix.size() + action_id.size() + 4;
+         for (std::size_t i = 0; i < m_values.size(); ++i) {
+            if (not m_values[i].empty())
+               size += m_state->prefixes[i].size() + m_values[i].size() + 2;
+         }
+
+         name = m_state->name;
+         data.clear();
+         data.reserve(size);
+         data += m_state->head;
+         for (std::size_t i = 0; i < m_values.size(); ++i) {
+            if (not m_values[i].empty()) {
+               data += m_state->prefixes[i];
+               data += m_values[i];
+               data += "\r\n";
+            }
+         }
+         data += id_prefix;
+         data += action_id;
+         data += "\r\n\r\n";
+         return true;
+      }
+   }
+}
+
@@ -0,0 +1,131 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/projection.h"
+
+namespace astxx {
+   namespace manager {
+      /** Record a subscriber.
+       * @param event the event name, blank for every event
+       * @param headers the headers it reads, or null for every header
+       */
+      void header_interest::add(const std::string& event, const std::vector<std::string>* headers) {
+         std::pair<boost::unordered_map<std::string, counts>::iterator, bool> i = m_events.insert(std::make_pair(event, counts()));
+         if (i.second)
+            ++m_version;
+
+         counts& c = i.first->second;
+         if (not headers) {
+            if (c.everything++ == 0)
+               ++m_version;
+            return;
+         }
+
+         for (std::vector<std::string>::const_iterator h = headers->begin(); h != headers->end(); ++h) {
+            if (c.headers[*h]++ == 0)
+               ++m_version;
+         }
+      }
+
+      /** Forget a subscriber.
+       * @param event the event name it was added with
+       * @param headers the headers it was added with
+       */
+      void header_interest::remove(const std::string& event, const std::vector<std::string>* headers) {
+         boost::unordered_map<std::string, counts>::iterator i = m_events.find(event);
+         if (i == m_events.end())
+            return;
+
+         counts& c = i->second;
+         if (not headers) {
+            if (--c.everything == 0)
+               ++m_version;
+         }
+         else {
+            for (std::vector<std::string>::const_iterator h = headers->begin(); h != headers->end(); ++h) {
+               std::map<std::string, std::size_t>::iterator n = c.headers.find(*h);
+               if (--n->second == 0) {
+                  c.headers.erase(n);
+                  ++m_version;
+               }
+            }
+         }
+
+         if (c.everything == 0 and c.headers.empty()) {
+            m_events.erase(i);
+            ++m_version;
+         }
+      }
+
+      /** Work out what the parser has to keep.
+       * @param sources the subscribers of each source
+       * @param everything event names with subscribers outside of the
+       * sources that read every header (a blank name for every event)
+       *
+       * An event keeps every header if anything subscribed to it, or to
+       * every event, wants every header.  Otherwise it keeps the union of
+       * the headers declared for it and for every event, plus 'Event' and
+       * 'ActionID'.  Events nobody subscribed to are left alone.
+       *
+       * @return the projection, or null if every header of every event is
+       * needed
+       */
+      boost::shared_ptr<const parser::projection_t> header_interest::projection(const std::vector<const header_interest*>& sources, const std::set<std::string>& everything) {
+         std::set<std::string> all(everything);
+         std::map<std::string, std::set<std::string> > wanted;
+
+         for (std::vector<const header_interest*>::const_iterator s = sources.begin(); s != sources.end(); ++s) {
+            for (boost::unordered_map<std::string, counts>::const_iterator i = (*s)->m_events.begin(); i != (*s)->m_events.end(); ++i) {
+               if (i->second.everything)
+                  all.insert(i->first);
+
+               std::set<std::string>& w = wanted[i->first];
+               for (std::map<std::string, std::size_t>::const_iterator h = i->second.headers.begin(); h != i->second.headers.end(); ++h)
+                  w.insert(h->first);
+            }
+         }
+
+         if (all.count(""))
+            return boost::shared_ptr<const parser::projection_t>();
+
+         std::set<std::string> common;
+         common.insert("Event");
+         common.insert("ActionID");
+         std::map<std::string, std::set<std::string> >::const_iterator catch_all = wanted.find("");
+         if (catch_all != wanted.end())
+            common.insert(catch_all->second.begin(), catch_all->second.end());
+
+         boost::shared_ptr<parser::projection_t> p(new parser::projection_t());
+         for (std::map<std::string, std::set<std::string> >::const_iterator i = wanted.begin(); i != wanted.end(); ++i) {
+            if (i->first.empty() or all.count(i->first))
+               continue;
+
+            std::set<std::string> keep(common);
+            keep.insert(i->second.begin(), i->second.end());
+            (*p)[i->first].assign(keep.begin(), keep.end());
+         }
+
+         if (p->empty())
+            return boost::shared_ptr<const parser::projection_t>();
+         return p;
+      }
+   }
+}
+
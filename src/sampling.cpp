@@ -0,0 +1,68 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/sampling.h"
+
+namespace astxx {
+   namespace manager {
+      /** Construct a rule.
+       * @param one_in keep one event in this many, 0 or 1 to keep them all
+       * @param max_per_second the most events to keep in a second, 0 for no
+       * limit
+       * @param counts the counters of the rule this one replaces, null to 
+       * start from zero
+       */
+      sample_rule::sample_rule(std::size_t one_in, unsigned int max_per_second, boost::shared_ptr<counters> counts) :
+         m_one_in(one_in),
+         m_max_per_second(max_per_second),
+         m_count(0),
+         m_in_window(0),
+         m_counts(counts ? counts : boost::shared_ptr<counters>(new counters())) {
+      }
+
+      /** Decide the fate of an event.
+       * @return true to keep the event, false to drop it
+       */
+      bool sample_rule::admit() {
+         if (m_one_in > 1 and m_count++ % m_one_in != 0) {
+            m_counts->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+         }
+
+         if (m_max_per_second) {
+            clock_type::time_point now = clock_type::now();
+            if (now - m_window >= std::chrono::seconds(1)) {
+               m_window = now;
+               m_in_window = 0;
+            }
+
+            if (m_in_window >= m_max_per_second) {
+               m_counts->dropped.fetch_add(1, std::memory_order_relaxed);
+               return false;
+            }
+            ++m_in_window;
+         }
+
+         m_counts->kept.fetch_add(1, std::memory_order_relaxed);
+         return true;
+      }
+   }
+}
+
@@ -0,0 +1,189 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/scanner.h"
+#include <boost/cstdint.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ASTXX_SCANNER_X86
+#include <immintrin.h>
+#endif
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         const std::string::size_type npos = std::string::npos;
+
+         /** Scan data one byte at a time.
+          * @param data the data
+          * @param begin where to start
+          * @param size the size of the data
+          * @param colon the first ':' on the current line so far
+          * @param index where to add lines
+          */
+         void scan_scalar(const char* data, std::string::size_type begin, std::string::size_type size, std::string::size_type& colon, scanner::index_t& index) {
+            for (std::string::size_type i = begin; i < size; ++i) {
+               if (data[i] == '\n') {
+                  scanner::line l = { i, colon };
+                  index.push_back(l);
+                  colon = npos;
+               }
+               else if (data[i] == ':' and colon == npos) {
+                  colon = i;
+               }
+            }
+         }
+
+#ifdef ASTXX_SCANNER_X86
+         /** Add the lines found in one vector's worth of data.
+          * @param base the offset of the vector
+          * @param nl a bit for each '\n'
+          * @param co a bit for each ':'
+          * @param colon the first ':' on the current line so far
+          * @param index where to add lines
+          */
+         inline void emit(std::string::size_type base, boost::uint64_t nl, boost::uint64_t co, std::string::size_type& colon, scanner::index_t& index) {
+            while (nl) {
+               unsigned int bit = __builtin_ctzll(nl);
+               boost::uint64_t before = co & ((boost::uint64_t(1) << bit) - 1);
+               if (colon == npos and before)
+                  colon = base + __builtin_ctzll(before);
+
+               scanner::line l = { base + bit, colon };
+               index.push_back(l);
+               colon = npos;
+
+               co &= ~before;
+               nl &= nl - 1;
+            }
+
+            if (colon == npos and co)
+               colon = base + __builtin_ctzll(co);
+         }
+
+         __attribute__((target("sse2")))
+         void scan_sse2(const char* data, std::string::size_type size, scanner::index_t& index) {
+            const __m128i nl = _mm_set1_epi8('\n');
+            const __m128i co = _mm_set1_epi8(':');
+            std::string::size_type colon = npos;
+
+            std::string::size_type i = 0;
+            for (; i + 16 <= size; i += 16) {
+               __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+               boost::uint64_t m_nl = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+               boost::uint64_t m_co = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, co)));
+               if (m_nl | m_co)
+                  emit(i, m_nl, m_co, colon, index);
+            }
+
+            scan_scalar(data, i, size, colon, index);
+         }
+
+         __attribute__((target("avx2")))
+         void scan_avx2(const char* data, std::string::size_type size, scanner::index_t& index) {
+            const __m256i nl = _mm256_set1_epi8('\n');
+            const __m256i co = _mm256_set1_epi8(':');
+            std::string::size_type colon = npos;
+
+            // two vectors at a time, header lines are short enough that
+            // most 64 byte blocks have something in them anyway
+            std::string::size_type i = 0;
+            for (; i + 64 <= size; i += 64) {
+               __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+               __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+               boost::uint64_t m_nl = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl)))
+                  | (boost::uint64_t(static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)))) << 32);
+               boost::uint64_t m_co = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, co)))
+                  | (boost::uint64_t(static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, co)))) << 32);
+               if (m_nl | m_co)
+                  emit(i, m_nl, m_co, colon, index);
+            }
+
+            scan_scalar(data, i, size, colon, index);
+         }
+#endif
+      }
+
+      /** Construct a scanner using the best instruction set available.
+       */
+      scanner::scanner() : m_isa(best()) {
+      }
+
+      /** Construct a scanner using the given instruction set.
+       * @param isa the instruction set, if the cpu does not support it the
+       * best one it does support is used instead
+       */
+      scanner::scanner(isa_t isa) : m_isa(isa <= best() ? isa : best()) {
+      }
+
+      /** Find the best instruction set the cpu supports.
+       * @return the best instruction set
+       */
+      scanner::isa_t scanner::best() {
+#ifdef ASTXX_SCANNER_X86
+         static const isa_t isa = __builtin_cpu_supports("avx2") ? avx2 : (__builtin_cpu_supports("sse2") ? sse2 : scalar);
+         return isa;
+#else
+         return scalar;
+#endif
+      }
+
+      /** Get the name of an instruction set.
+       * @param isa the instruction set
+       * @return the name
+       */
+      const char* scanner::name(isa_t isa) {
+         switch (isa) {
+            case avx2:
+               return "avx2";
+            case sse2:
+               return "sse2";
+            default:
+               return "scalar";
+         }
+      }
+
+      /** Index the lines in a block of data.
+       * @param data the data
+       * @param size the number of bytes of data
+       * @param index the index to append to, offsets are relative to data
+       *
+       * Only lines ending in '\n' are indexed, anything after the last
+       * '\n' is left for the next scan.
+       */
+      void scanner::scan(const char* data, std::string::size_type size, index_t& index) const {
+         switch (m_isa) {
+#ifdef ASTXX_SCANNER_X86
+            case avx2:
+               scan_avx2(data, size, index);
+               return;
+            case sse2:
+               scan_sse2(data, size, index);
+               return;
+#endif
+            default: {
+               std::string::size_type colon = npos;
+               scan_scalar(data, 0, size, colon, index);
+            }
+         }
+      }
+   }
+}
+
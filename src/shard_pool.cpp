@@ -0,0 +1,517 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/shard_pool.h"
+
+#include <map>
+#include <thread>
+#include <stdexcept>
+#include <cerrno>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace astxx {
+   namespace manager {
+      namespace {
+         /// the shard the calling thread runs, if any
+         thread_local std::size_t this_shard = static_cast<std::size_t>(-1);
+
+         /** Does nothing, posting it keeps p alive until the handler that 
+          * dropped p has returned.
+          */
+         template<typename T>
+         void release(const boost::shared_ptr<T>&) {
+         }
+      }
+
+      /// A connection and its state on the shard that owns it.
+      struct shard_pool::member {
+         member(boost::asio::io_service& io_service, const std::string& name, const std::string& host, unsigned short port, setup_t setup, error_handler_t error_handler) :
+            name(name),
+            connection(io_service, host, port),
+            descriptor(io_service),
+            setup(setup),
+            error_handler(error_handler),
+            active(false),
+            writing(false),
+            closed(false) {
+         }
+
+         std::string name;
+         manager::connection connection;
+         // a duplicate of the socket, to wait for it to become ready
+         boost::asio::posix::stream_descriptor descriptor;
+         setup_t setup;
+         error_handler_t error_handler;
+         // tasks posted before the connection was up
+         std::vector<connection_task_t> waiting;
+         bool active;
+         bool writing;
+         bool closed;
+      };
+
+      /// One thread, its io_service and the connections it owns.
+      struct shard_pool::shard {
+         shard(int cpu) : work(boost::asio::make_work_guard(io_service)), cpu(cpu), handled(false) { }
+
+         boost::asio::io_service io_service;
+         boost::asio::executor_work_guard<boost::asio::io_service::executor_type> work;
+         boost::scoped_ptr<std::thread> thread;
+         int cpu;
+         // only touched from the shard's thread
+         std::map<std::string, member_ptr> members;
+         // the last handler took care of its own connection
+         bool handled;
+      };
+
+      /** Start a pool.
+       * @param shards the number of shards, 0 for one per cpu this process
+       * may run on
+       * @param pin whether to pin each shard to a cpu, in turn
+       * @throw boost::system::system_error if the cpus could not be found
+       */
+      shard_pool::shard_pool(std::size_t shards, bool pin) {
+         cpu_set_t set;
+         CPU_ZERO(&set);
+         if (::sched_getaffinity(0, sizeof(set), &set) < 0)
+            throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+
+         std::vector<int> available;
+         for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &set))
+               available.push_back(i);
+         }
+         if (available.empty())
+            available.push_back(-1);
+
+         std::vector<int> cpus(shards ? shards : available.size());
+         for (std::size_t i = 0; i < cpus.size(); ++i)
+            cpus[i] = pin ? available[i % available.size()] : -1;
+         start(cpus);
+      }
+
+      /** Start a pool with a shard on each of the given cpus.
+       * @param cpus the cpu of each shard, -1 for a shard that is not pinned
+       * @throw std::invalid_argument if no cpus are given
+       */
+      shard_pool::shard_pool(const std::vector<int>& cpus) {
+         if (cpus.empty())
+            throw std::invalid_argument("shard_pool needs at least one shard");
+         start(cpus);
+      }
+
+      /** Destructor.
+       * Stops the shards and closes their connections.
+       */
+      shard_pool::~shard_pool() {
+         stop();
+      }
+
+      /** Create the shards and start their threads.
+       * @param cpus the cpu of each shard
+       */
+      void shard_pool::start(const std::vector<int>& cpus) {
+         for (std::size_t i = 0; i < cpus.size(); ++i)
+            shards.push_back(boost::shared_ptr<shard>(new shard(cpus[i])));
+         for (std::size_t i = 0; i < shards.size(); ++i)
+            shards[i]->thread.reset(new std::thread(&shard_pool::run, this, i));
+      }
+
+      /** Stop the shards and close their connections.
+       * Functions posted but not yet run are dropped.
+       */
+      void shard_pool::stop() {
+         for (std::size_t i = 0; i < shards.size(); ++i)
+            shards[i]->io_service.stop();
+
+         for (std::size_t i = 0; i < shards.size(); ++i) {
+            shard& s = *shards[i];
+            if (not s.thread)
+               continue;
+
+            s.thread->join();
+            s.thread.reset();
+
+            // waits still outstanding hold on to their members until the 
+            // io_service is destroyed
+            boost::system::error_code ignored;
+            for (std::map<std::string, member_ptr>::iterator m = s.members.begin(); m != s.members.end(); ++m) {
+               m->second->closed = true;
+               m->second->descriptor.close(ignored);
+            }
+            s.members.clear();
+         }
+      }
+
+      /** Connect to a PBX on its shard.
+       * @param name the name of the connection, which picks the shard
+       * @param host the host to connect to
+       * @param port the port to connect on
+       * @param setup called on the shard once connected, to log in and
+       * register handlers
+       * @param error_handler called on the shard if connecting, the setup
+       * or the connection later fails
+       *
+       * This returns straight away, the connection is made on its shard.
+       * A connection already using the name is closed first.
+       */
+      void shard_pool::add(const std::string& name, const std::string& host, unsigned short port, setup_t setup, error_handler_t error_handler) {
+         std::size_t index = shard_of(name);
+         boost::asio::post(shards[index]->io_service, boost::bind(&shard_pool::connect, this, index, name, host, port, setup, error_handler));
+      }
+
+      /** Close a connection.
+       * @param name the name of the connection
+       *
+       * This returns straight away, the connection is closed on its shard
+       * after writing whatever it has queued.
+       */
+      void shard_pool::remove(const std::string& name) {
+         std::size_t index = shard_of(name);
+         boost::asio::post(shards[index]->io_service, boost::bind(&shard_pool::close, this, index, name));
+      }
+
+      /** Run a function on a shard.
+       * @param shard the shard
+       * @param task the function, it must not throw
+       * @throw std::out_of_range if there is no such shard
+       */
+      void shard_pool::post(std::size_t shard, task_t task) {
+         if (shard >= shards.size())
+            throw std::out_of_range("no such shard");
+         boost::asio::post(shards[shard]->io_service, task);
+      }
+
+      /** Run a function with a connection, on its shard.
+       * @param name the name of the connection
+       * @param task the function, if it throws the connection fails
+       *
+       * Functions posted while the connection is being made run once it is
+       * up.  If there is no such connection the function is dropped.
+       */
+      void shard_pool::post(const std::string& name, connection_task_t task) {
+         std::size_t index = shard_of(name);
+         boost::asio::post(shards[index]->io_service, boost::bind(&shard_pool::run_task, this, index, name, task));
+      }
+
+      /** Find the shard that owns a connection.
+       * @param name the name of the connection
+       * @return the index of the shard
+       */
+      std::size_t shard_pool::shard_of(const std::string& name) const {
+         return boost::hash<std::string>()(name) % shards.size();
+      }
+
+      /** Find the shard the calling thread runs.
+       * @return the index of the shard, or std::size_t(-1) if called from
+       * outside the pool
+       */
+      std::size_t shard_pool::current() {
+         return this_shard;
+      }
+
+      /** Get the io_service of a shard.
+       * @param shard the shard
+       *
+       * Sockets, timers and the like created on it are run by the shard's 
+       * thread, alongside its connections and without locking against 
+       * them.
+       *
+       * @throw std::out_of_range if there is no such shard
+       * @return the io_service
+       */
+      boost::asio::io_service& shard_pool::get_io_service(std::size_t shard) {
+         if (shard >= shards.size())
+            throw std::out_of_range("no such shard");
+         return shards[shard]->io_service;
+      }
+
+      /** The body of a shard's thread.
+       * @param index the shard
+       */
+      void shard_pool::run(std::size_t index) {
+         shard& s = *shards[index];
+         this_shard = index;
+
+         if (s.cpu >= 0) {
+            // not fatal, we just run wherever the scheduler puts us
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(s.cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+         }
+
+         while (not s.io_service.stopped()) {
+            s.handled = false;
+            if (not s.io_service.run_one())
+               break;
+
+            // a timer or a posted function may have touched any of them
+            if (not s.handled)
+               sweep(index);
+         }
+      }
+
+      /** Deliver the responses and errors of every connection on a shard.
+       * @param index the shard
+       */
+      void shard_pool::sweep(std::size_t index) {
+         shard& s = *shards[index];
+
+         // handlers may close connections
+         std::vector<member_ptr> members;
+         members.reserve(s.members.size());
+         for (std::map<std::string, member_ptr>::iterator i = s.members.begin(); i != s.members.end(); ++i) {
+            if (i->second->active)
+               members.push_back(i->second);
+         }
+
+         for (std::size_t i = 0; i < members.size(); ++i) {
+            if (members[i]->closed)
+               continue;
+
+            try {
+               members[i]->connection.process_responses();
+               flush(index, members[i]);
+            }
+            catch (...) {
+               fail(index, members[i], std::current_exception());
+            }
+         }
+      }
+
+      /** Start connecting, on the shard.
+       * @see shard_pool::add()
+       */
+      void shard_pool::connect(std::size_t index, const std::string& name, const std::string& host, unsigned short port, setup_t setup, error_handler_t error_handler) {
+         shard& s = *shards[index];
+         close(index, name);
+
+         member_ptr m(new member(s.io_service, name, host, port, setup, error_handler));
+         s.members[name] = m;
+         m->connection.async_connect(boost::bind(&shard_pool::handle_connect, this, index, boost::weak_ptr<member>(m), _1));
+      }
+
+      /** Handle the result of connecting.
+       * @param index the shard
+       * @param m the member
+       * @param error the result
+       */
+      void shard_pool::handle_connect(std::size_t index, boost::weak_ptr<member> m, const boost::system::error_code& error) {
+         member_ptr p = m.lock();
+         if (not p or p->closed)
+            return;
+
+         if (error) {
+            fail(index, p, std::make_exception_ptr(boost::system::system_error(error)));
+            return;
+         }
+
+         // we are inside the connection's read handler, run the setup
+         // after it has returned
+         boost::asio::post(shards[index]->io_service, boost::bind(&shard_pool::activate, this, index, m));
+      }
+
+      /** Run the setup and hand the connection to the shard.
+       * @param index the shard
+       * @param m the member
+       */
+      void shard_pool::activate(std::size_t index, boost::weak_ptr<member> m) {
+         member_ptr p = m.lock();
+         if (not p or p->closed)
+            return;
+
+         shards[index]->handled = true;
+         try {
+            if (p->setup)
+               p->setup(p->connection);
+
+            p->connection.start_external_io();
+            int fd = ::dup(p->connection.native_handle());
+            if (fd < 0)
+               throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()));
+            p->descriptor.assign(fd);
+            p->active = true;
+            wait_read(index, p);
+
+            std::vector<connection_task_t> waiting;
+            waiting.swap(p->waiting);
+            for (std::size_t i = 0; i < waiting.size(); ++i)
+               waiting[i](p->connection);
+
+            // anything the setup left queued
+            p->connection.process_events();
+            p->connection.process_responses();
+            flush(index, p);
+         }
+         catch (...) {
+            fail(index, p, std::current_exception());
+         }
+      }
+
+      /** Wait for a connection's socket to become readable.
+       * @param index the shard
+       * @param m the member
+       */
+      void shard_pool::wait_read(std::size_t index, member_ptr m) {
+         m->descriptor.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+               boost::bind(&shard_pool::handle_ready, this, index, m, false, boost::asio::placeholders::error));
+      }
+
+      /** Wait for a connection's socket to become writable.
+       * @param index the shard
+       * @param m the member
+       */
+      void shard_pool::wait_write(std::size_t index, member_ptr m) {
+         m->writing = true;
+         m->descriptor.async_wait(boost::asio::posix::stream_descriptor::wait_write,
+               boost::bind(&shard_pool::handle_ready, this, index, m, true, boost::asio::placeholders::error));
+      }
+
+      /** Read or write a connection whose socket is ready.
+       * @param index the shard
+       * @param m the member
+       * @param write true if the socket became writable, false if readable
+       * @param error the result of the wait
+       */
+      void shard_pool::handle_ready(std::size_t index, member_ptr m, bool write, const boost::system::error_code& error) {
+         if (write)
+            m->writing = false;
+         if (m->closed or error == boost::asio::error::operation_aborted)
+            return;
+
+         shards[index]->handled = true;
+         try {
+            if (error)
+               throw boost::system::system_error(error);
+
+            if (write) {
+               m->connection.on_writable();
+            }
+            else {
+               m->connection.on_readable();
+               m->connection.process_events();
+               m->connection.process_responses();
+               wait_read(index, m);
+            }
+            flush(index, m);
+         }
+         catch (...) {
+            fail(index, m, std::current_exception());
+         }
+      }
+
+      /** Wait for the socket to take data the connection has queued.
+       * @param index the shard
+       * @param m the member
+       */
+      void shard_pool::flush(std::size_t index, member_ptr m) {
+         if (not m->closed and not m->writing and m->connection.want_write())
+            wait_write(index, m);
+      }
+
+      /** Drop a connection that failed and tell its error handler.
+       * @param index the shard
+       * @param m the member
+       * @param error why it failed
+       */
+      void shard_pool::fail(std::size_t index, member_ptr m, std::exception_ptr error) {
+         if (m->closed)
+            return;
+
+         shard& s = *shards[index];
+         m->closed = true;
+         boost::system::error_code ignored;
+         m->descriptor.close(ignored);
+
+         std::map<std::string, member_ptr>::iterator i = s.members.find(m->name);
+         if (i != s.members.end() and i->second == m)
+            s.members.erase(i);
+
+         // we may be inside one of the connection's own handlers (a failed
+         // connect is reported from its read handler), so don't let it be
+         // destroyed until that has returned
+         boost::asio::post(s.io_service, boost::bind(&release<member>, m));
+
+         if (m->error_handler)
+            m->error_handler(m->name, error);
+      }
+
+      /** Close a connection, on its shard.
+       * @see shard_pool::remove()
+       */
+      void shard_pool::close(std::size_t index, const std::string& name) {
+         shard& s = *shards[index];
+         std::map<std::string, member_ptr>::iterator i = s.members.find(name);
+         if (i == s.members.end())
+            return;
+
+         member_ptr m = i->second;
+         s.members.erase(i);
+         m->closed = true;
+
+         boost::system::error_code ignored;
+         m->descriptor.close(ignored);
+         try {
+            if (m->connection.external_io())
+               m->connection.stop_external_io();
+            m->connection.disconnect();
+         }
+         catch (const boost::system::system_error&) {
+            // it is going anyway, still connecting if the socket is not open
+         }
+
+         // handlers of the connection still queued do nothing once it is
+         // destroyed, destroy it after whatever handler called us
+         boost::asio::post(s.io_service, boost::bind(&release<member>, m));
+      }
+
+      /** Run a function with a connection, on its shard.
+       * @see shard_pool::post(const std::string&, connection_task_t)
+       */
+      void shard_pool::run_task(std::size_t index, const std::string& name, connection_task_t task) {
+         shard& s = *shards[index];
+         std::map<std::string, member_ptr>::iterator i = s.members.find(name);
+         if (i == s.members.end())
+            return;
+
+         member_ptr m = i->second;
+         if (not m->active) {
+            m->waiting.push_back(task);
+            return;
+         }
+
+         s.handled = true;
+         try {
+            task(m->connection);
+            m->connection.process_responses();
+            flush(index, m);
+         }
+         catch (...) {
+            fail(index, m, std::current_exception());
+         }
+      }
+   }
+}
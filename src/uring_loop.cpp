@@ -0,0 +1,766 @@
+/* vim: set et sw=3 tw=0 fo=croqlaw cino=t0:
+ *
+ * Astxx, the Asterisk C++ API and Utility Library.
+ * Copyright (C) 2005-2007  Matthew A. Nicholson
+ * Copyright (C) 2005-2007  Digium, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "manager/uring_loop.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ASTXX_HAVE_IO_URING 1
+#endif
+#endif
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/system/system_error.hpp>
+#include <boost/unordered_map.hpp>
+
+#ifdef ASTXX_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace astxx {
+   namespace manager {
+#ifdef ASTXX_HAVE_IO_URING
+      namespace {
+         // there is no liburing to lean on, the system calls are simple
+         // enough
+         int io_uring_setup(unsigned int entries, io_uring_params* params) {
+            return ::syscall(__NR_io_uring_setup, entries, params);
+         }
+
+         int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, const void* arg, std::size_t size) {
+            return ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size);
+         }
+
+         int io_uring_register(int fd, unsigned int opcode, const void* arg, unsigned int count) {
+            return ::syscall(__NR_io_uring_register, fd, opcode, arg, count);
+         }
+
+         boost::system::error_code errno_code(int e) {
+            return boost::system::error_code(e, boost::system::system_category());
+         }
+
+         /// What a completion is for, kept in the low bits of its user data.
+         enum op_t { recv_op = 0, send_op = 1, cancel_op = 2, provide_op = 3 };
+
+         /// The group id of our provided buffers.
+         const unsigned short buffer_group = 0;
+      }
+
+      /// The ring, the buffers and the connections.
+      struct uring_loop::impl {
+         /// A connection and the operations it has in flight.
+         struct peer {
+            connection* c;
+            int fd;
+            error_handler_t error_handler;
+            std::string sending;
+            std::string::size_type sent;
+            bool receiving;
+            bool send_in_flight;
+            bool removed;
+         };
+         typedef boost::unordered_map<unsigned long long, peer> peers_t;
+         typedef std::vector<std::pair<unsigned long long, boost::system::error_code> > errors_t;
+
+         impl(unsigned int entries, std::size_t buffer_size, unsigned int buffers);
+         ~impl() { release(); }
+
+         void release();
+         io_uring_sqe* get_sqe();
+         void submit(bool wait, duration timeout);
+         std::size_t reap();
+         void complete(const io_uring_cqe& cqe);
+         void arm_recv(unsigned long long id, peer& p);
+         void start_send(unsigned long long id, peer& p);
+         void detach(unsigned long long id, peer& p);
+         void recycle(unsigned short bid);
+         bool buffer_ring_works();
+         void prune();
+         void handle_errors();
+
+         int fd;
+
+         // the submission queue, shared with the kernel
+         void* sq_ring;
+         std::size_t sq_ring_size;
+         unsigned int* sq_head;
+         unsigned int* sq_tail;
+         unsigned int* sq_array;
+         unsigned int sq_mask;
+         unsigned int sq_entries;
+         unsigned int sq_local_tail;
+         io_uring_sqe* sqes;
+         std::size_t sqes_size;
+
+         // the completion queue, shared with the kernel
+         void* cq_ring;
+         std::size_t cq_ring_size;
+         unsigned int* cq_head;
+         unsigned int* cq_tail;
+         unsigned int cq_mask;
+         io_uring_cqe* cqes;
+
+         // the provided buffers the kernel receives into
+         io_uring_buf_ring* buf_ring;
+         std::size_t buf_ring_size;
+         unsigned int buf_count;
+         unsigned short buf_tail;
+         bool legacy_buffers;
+         std::size_t buffer_size;
+         std::vector<char> buffer_memory;
+
+         peers_t peers;
+         std::map<connection*, unsigned long long> ids;
+         std::vector<unsigned long long> retired;
+         errors_t errors;
+         unsigned long long next_id;
+      };
+
+      /** Set up the ring and register the buffers.
+       * @param entries the size of the submission queue
+       * @param buffer_size the size of each receive buffer
+       * @param buffers the number of receive buffers
+       * @throw boost::system::system_error if the kernel can't do it
+       */
+      uring_loop::impl::impl(unsigned int entries, std::size_t buffer_size, unsigned int buffers) :
+         fd(-1),
+         sq_ring(MAP_FAILED),
+         sq_ring_size(0),
+         sq_local_tail(0),
+         sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+         sqes_size(0),
+         cq_ring(MAP_FAILED),
+         cq_ring_size(0),
+         buf_ring(static_cast<io_uring_buf_ring*>(MAP_FAILED)),
+         buf_ring_size(0),
+         buf_count(1),
+         buf_tail(0),
+         legacy_buffers(false),
+         buffer_size(buffer_size),
+         next_id(0) {
+         try {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            params.flags = IORING_SETUP_COOP_TASKRUN;
+            fd = io_uring_setup(entries, &params);
+            if (fd < 0 and errno == EINVAL) {
+               params.flags = 0;
+               fd = io_uring_setup(entries, &params);
+            }
+            if (fd < 0)
+               throw boost::system::system_error(errno_code(errno));
+
+            // the timeout argument of io_uring_enter() came with 5.11,
+            // multishot receive into provided buffer rings needs 6.0
+            if (not (params.features & IORING_FEAT_EXT_ARG))
+               throw boost::system::system_error(errno_code(EOPNOTSUPP));
+
+            sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+            cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+               sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+            sq_ring = ::mmap(0, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sq_ring == MAP_FAILED)
+               throw boost::system::system_error(errno_code(errno));
+
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+               cq_ring = sq_ring;
+            }
+            else {
+               cq_ring = ::mmap(0, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+               if (cq_ring == MAP_FAILED)
+                  throw boost::system::system_error(errno_code(errno));
+            }
+
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(::mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+            if (sqes == MAP_FAILED)
+               throw boost::system::system_error(errno_code(errno));
+
+            char* sq = static_cast<char*>(sq_ring);
+            sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+            sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+            sq_mask = *reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+            sq_entries = params.sq_entries;
+            sq_local_tail = *sq_tail;
+            for (unsigned int i = 0; i < sq_entries; ++i)
+               sq_array[i] = i;
+
+            char* cq = static_cast<char*>(cq_ring);
+            cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+            cq_mask = *reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            // buffer rings are a power of two entries, at most 32768
+            while (buf_count < buffers and buf_count < 32768)
+               buf_count <<= 1;
+
+            buf_ring_size = buf_count * sizeof(io_uring_buf);
+            buf_ring = static_cast<io_uring_buf_ring*>(::mmap(0, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (buf_ring == MAP_FAILED)
+               throw boost::system::system_error(errno_code(errno));
+
+            io_uring_buf_reg reg;
+            std::memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = reinterpret_cast<unsigned long long>(buf_ring);
+            reg.ring_entries = buf_count;
+            reg.bgid = buffer_group;
+            if (io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+               throw boost::system::system_error(errno_code(errno));
+
+            buffer_memory.resize(buf_count * buffer_size);
+            for (unsigned int i = 0; i < buf_count; ++i)
+               recycle(i);
+
+            // some kernels accept the ring and never select from it, the
+            // buffers are handed over one operation at a time there
+            if (not buffer_ring_works()) {
+               io_uring_register(fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+               legacy_buffers = true;
+
+               io_uring_sqe* sqe = get_sqe();
+               sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+               sqe->fd = buf_count;
+               sqe->addr = reinterpret_cast<unsigned long long>(&buffer_memory[0]);
+               sqe->len = buffer_size;
+               sqe->off = 0;
+               sqe->buf_group = buffer_group;
+               sqe->user_data = provide_op;
+               submit(true, duration::max());
+
+               io_uring_cqe cqe = cqes[*cq_head & cq_mask];
+               __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+               if (cqe.res < 0)
+                  throw boost::system::system_error(errno_code(-cqe.res));
+            }
+         }
+         catch (...) {
+            release();
+            throw;
+         }
+      }
+
+      /// Unmap and close everything.
+      void uring_loop::impl::release() {
+         if (buf_ring != MAP_FAILED)
+            ::munmap(buf_ring, buf_ring_size);
+         if (sqes != MAP_FAILED)
+            ::munmap(sqes, sqes_size);
+         if (cq_ring != MAP_FAILED and cq_ring != sq_ring)
+            ::munmap(cq_ring, cq_ring_size);
+         if (sq_ring != MAP_FAILED)
+            ::munmap(sq_ring, sq_ring_size);
+         if (fd >= 0)
+            ::close(fd);
+
+         buf_ring = static_cast<io_uring_buf_ring*>(MAP_FAILED);
+         sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+         cq_ring = sq_ring = MAP_FAILED;
+         fd = -1;
+      }
+
+      /** Get a blank submission queue entry.
+       * Submits what is queued if the queue is full.
+       * @return the entry
+       */
+      io_uring_sqe* uring_loop::impl::get_sqe() {
+         if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            submit(false, duration::zero());
+            if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+               throw boost::system::system_error(errno_code(EBUSY));
+         }
+
+         io_uring_sqe* sqe = &sqes[sq_local_tail & sq_mask];
+         std::memset(sqe, 0, sizeof(*sqe));
+         ++sq_local_tail;
+         return sqe;
+      }
+
+      /** Submit the queued entries and optionally wait for a completion.
+       * @param wait whether to wait for at least one completion
+       * @param timeout how long to wait at most, duration::max() for ever
+       */
+      void uring_loop::impl::submit(bool wait, duration timeout) {
+         __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+         unsigned int to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+         if (not to_submit and not wait)
+            return;
+
+         unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+         __kernel_timespec ts;
+         io_uring_getevents_arg arg;
+         const void* argp = 0;
+         std::size_t arg_size = 0;
+         if (wait and timeout != duration::max()) {
+            long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            std::memset(&arg, 0, sizeof(arg));
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = reinterpret_cast<unsigned long long>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            arg_size = sizeof(arg);
+         }
+
+         if (io_uring_enter(fd, to_submit, wait ? 1 : 0, flags, argp, arg_size) < 0) {
+            // a timeout or a signal ends the wait, a full completion queue
+            // needs reaping before anything more can be submitted
+            if (errno != ETIME and errno != EINTR and errno != EAGAIN and errno != EBUSY)
+               throw boost::system::system_error(errno_code(errno));
+         }
+      }
+
+      /** Handle every completion waiting.
+       * @return the number of completions handled
+       */
+      std::size_t uring_loop::impl::reap() {
+         std::size_t count = 0;
+         unsigned int head = *cq_head;
+         while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            // give the slot back before handling it, handling may submit
+            // more work
+            io_uring_cqe cqe = cqes[head & cq_mask];
+            __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+            complete(cqe);
+            ++count;
+         }
+         return count;
+      }
+
+      /** Handle a completion.
+       * @param cqe the completion
+       */
+      void uring_loop::impl::complete(const io_uring_cqe& cqe) {
+         unsigned long long id = cqe.user_data >> 2;
+         op_t op = static_cast<op_t>(cqe.user_data & 3);
+         if (op == cancel_op or op == provide_op)
+            return;
+
+         peers_t::iterator i = peers.find(id);
+         if (i == peers.end())
+            return;
+         peer& p = i->second;
+
+         if (op == send_op) {
+            p.send_in_flight = false;
+            if (cqe.res < 0) {
+               if (not p.removed)
+                  errors.push_back(std::make_pair(id, errno_code(-cqe.res)));
+               return;
+            }
+
+            p.sent += cqe.res;
+            if (p.sent < p.sending.size()) {
+               if (not p.removed)
+                  start_send(id, p);
+            }
+            else {
+               p.sending.clear();
+               p.sent = 0;
+            }
+            return;
+         }
+
+         if (not (cqe.flags & IORING_CQE_F_MORE))
+            p.receiving = false;
+
+         if (cqe.res == 0) {
+            if (not p.removed)
+               errors.push_back(std::make_pair(id, boost::system::error_code(boost::asio::error::eof)));
+         }
+         else if (cqe.res < 0) {
+            // out of buffers ends a multishot receive, the buffers are
+            // handed back as the data in them is parsed
+            if (cqe.res != -ENOBUFS and cqe.res != -ECANCELED and not p.removed)
+               errors.push_back(std::make_pair(id, errno_code(-cqe.res)));
+         }
+
+         if (not p.receiving and not p.removed and (cqe.res > 0 or cqe.res == -ENOBUFS))
+            arm_recv(id, p);
+
+         if (cqe.flags & IORING_CQE_F_BUFFER) {
+            unsigned short bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+            // the buffer goes back to the kernel even if parsing throws
+            struct recycler {
+               impl* i;
+               unsigned short bid;
+               ~recycler() { i->recycle(bid); }
+            } r = { this, bid };
+
+            if (cqe.res > 0 and not p.removed)
+               p.c->on_data(&buffer_memory[bid * buffer_size], cqe.res);
+         }
+      }
+
+      /** Start a multishot receive for a connection.
+       * @param id the connection's id
+       * @param p the connection
+       */
+      void uring_loop::impl::arm_recv(unsigned long long id, peer& p) {
+         io_uring_sqe* sqe = get_sqe();
+         sqe->opcode = IORING_OP_RECV;
+         sqe->fd = p.fd;
+         sqe->ioprio = IORING_RECV_MULTISHOT;
+         sqe->flags = IOSQE_BUFFER_SELECT;
+         sqe->buf_group = buffer_group;
+         sqe->user_data = (id << 2) | recv_op;
+         p.receiving = true;
+      }
+
+      /** Send what is left of a connection's outgoing data.
+       * @param id the connection's id
+       * @param p the connection
+       */
+      void uring_loop::impl::start_send(unsigned long long id, peer& p) {
+         io_uring_sqe* sqe = get_sqe();
+         sqe->opcode = IORING_OP_SEND;
+         sqe->fd = p.fd;
+         sqe->addr = reinterpret_cast<unsigned long long>(p.sending.data() + p.sent);
+         sqe->len = p.sending.size() - p.sent;
+         sqe->msg_flags = MSG_NOSIGNAL;
+         sqe->user_data = (id << 2) | send_op;
+         p.send_in_flight = true;
+      }
+
+      /** Stop handling a connection.
+       * Its operations are cancelled, it is forgotten once they complete.
+       * @param id the connection's id
+       * @param p the connection
+       */
+      void uring_loop::impl::detach(unsigned long long id, peer& p) {
+         p.removed = true;
+         ids.erase(p.c);
+         retired.push_back(id);
+
+         if (p.receiving or p.send_in_flight) {
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = p.fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = (id << 2) | cancel_op;
+         }
+      }
+
+      /** Give a buffer back to the kernel.
+       * @param bid the buffer id
+       */
+      void uring_loop::impl::recycle(unsigned short bid) {
+         if (legacy_buffers) {
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+            sqe->fd = 1;
+            sqe->addr = reinterpret_cast<unsigned long long>(&buffer_memory[bid * buffer_size]);
+            sqe->len = buffer_size;
+            sqe->off = bid;
+            sqe->buf_group = buffer_group;
+            sqe->user_data = provide_op;
+            return;
+         }
+
+         io_uring_buf& b = buf_ring->bufs[buf_tail & (buf_count - 1)];
+         b.addr = reinterpret_cast<unsigned long long>(&buffer_memory[bid * buffer_size]);
+         b.len = buffer_size;
+         b.bid = bid;
+         __atomic_store_n(&buf_ring->tail, ++buf_tail, __ATOMIC_RELEASE);
+      }
+
+      /** Check that receives pick buffers from the ring.
+       * @return true if a receive on a socket pair got a buffer
+       */
+      bool uring_loop::impl::buffer_ring_works() {
+         int sv[2];
+         if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+            throw boost::system::system_error(errno_code(errno));
+
+         char c = 0;
+         while (::write(sv[1], &c, 1) < 0 and errno == EINTR);
+
+         io_uring_sqe* sqe = get_sqe();
+         sqe->opcode = IORING_OP_RECV;
+         sqe->fd = sv[0];
+         sqe->flags = IOSQE_BUFFER_SELECT;
+         sqe->buf_group = buffer_group;
+         sqe->user_data = recv_op;
+         submit(true, duration::max());
+
+         io_uring_cqe cqe = cqes[*cq_head & cq_mask];
+         __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+         ::close(sv[0]);
+         ::close(sv[1]);
+
+         if (cqe.flags & IORING_CQE_F_BUFFER)
+            recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+         return cqe.res > 0;
+      }
+
+      /// Forget removed connections whose operations have all completed.
+      void uring_loop::impl::prune() {
+         std::vector<unsigned long long>::iterator i = retired.begin();
+         while (i != retired.end()) {
+            peers_t::iterator p = peers.find(*i);
+            if (p->second.receiving or p->second.send_in_flight) {
+               ++i;
+               continue;
+            }
+            peers.erase(p);
+            i = retired.erase(i);
+         }
+      }
+
+      /** Remove the connections that failed and tell their error handlers.
+       * @throw boost::system::system_error for the first failure without an
+       * error handler
+       */
+      void uring_loop::impl::handle_errors() {
+         errors_t failed;
+         failed.swap(errors);
+
+         boost::system::error_code unhandled;
+         for (errors_t::iterator i = failed.begin(); i != failed.end(); ++i) {
+            peers_t::iterator p = peers.find(i->first);
+            if (p == peers.end() or p->second.removed)
+               continue;
+
+            connection& c = *p->second.c;
+            error_handler_t handler = p->second.error_handler;
+            detach(i->first, p->second);
+
+            if (handler)
+               handler(c, i->second);
+            else if (not unhandled)
+               unhandled = i->second;
+         }
+
+         prune();
+         if (unhandled)
+            throw boost::system::system_error(unhandled);
+      }
+
+      /** Check if io_uring can be used.
+       * @return true if the kernel supports everything uring_loop needs
+       */
+      bool uring_loop::available() {
+         struct probe {
+            static bool run() {
+               try {
+                  impl i(4, 4096, 1);
+                  return true;
+               }
+               catch (const boost::system::system_error&) {
+                  return false;
+               }
+            }
+         };
+
+         static const bool result = probe::run();
+         return result;
+      }
+
+      /** Set up an io_uring.
+       * @param entries the size of the submission queue, the most
+       * operations submitted at once
+       * @param buffer_size the size of each receive buffer
+       * @param buffers the number of receive buffers shared by all
+       * connections (rounded up to a power of two)
+       * @throw boost::system::system_error if io_uring is not available
+       * (see uring_loop::available())
+       */
+      uring_loop::uring_loop(unsigned int entries, std::size_t buffer_size, unsigned int buffers) :
+         m_impl(new impl(entries, buffer_size, buffers)) {
+      }
+
+      /// Destructor, outstanding operations are abandoned.
+      uring_loop::~uring_loop() {
+      }
+
+      /** Do a connection's socket I/O from now on.
+       * @param c the connection, which must be connected (and normally
+       * logged in)
+       * @param error_handler called if reading or writing fails, if there is
+       * none the error is thrown from uring_loop::run_once()
+       *
+       * The connection is switched to external I/O with deferred writes
+       * (see connection::start_external_io()), so calls that would block
+       * throw until it is removed again.
+       *
+       * @throw std::logic_error if the connection was already added or is
+       * not connected
+       */
+      void uring_loop::add(connection& c, error_handler_t error_handler) {
+         if (m_impl->ids.find(&c) != m_impl->ids.end())
+            throw std::logic_error("connection added to a uring_loop twice");
+
+         c.start_external_io(true);
+
+         unsigned long long id = ++m_impl->next_id;
+         impl::peer& p = m_impl->peers[id];
+         p.c = &c;
+         p.fd = c.native_handle();
+         p.error_handler = error_handler;
+         p.sent = 0;
+         p.receiving = false;
+         p.send_in_flight = false;
+         p.removed = false;
+         m_impl->ids[&c] = id;
+
+         m_impl->arm_recv(id, p);
+      }
+
+      /** Hand a connection's socket I/O back to it.
+       * @param c the connection
+       *
+       * Its receive is cancelled and data still to be written is written,
+       * blocking if need be.  Does nothing if the connection was not added
+       * (or was removed because it failed).
+       *
+       * @throw boost::system::system_error if there was a problem writing
+       */
+      void uring_loop::remove(connection& c) {
+         std::map<connection*, unsigned long long>::iterator i = m_impl->ids.find(&c);
+         if (i == m_impl->ids.end())
+            return;
+
+         unsigned long long id = i->second;
+         impl::peer& p = m_impl->peers[id];
+         m_impl->detach(id, p);
+         while (p.receiving or p.send_in_flight) {
+            m_impl->submit(true, duration::max());
+            m_impl->reap();
+         }
+
+         // a cancelled send leaves the rest of its data to us
+         while (p.sent < p.sending.size()) {
+            ssize_t n = ::send(p.fd, p.sending.data() + p.sent, p.sending.size() - p.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n >= 0) {
+               p.sent += n;
+               continue;
+            }
+
+            if (errno == EAGAIN or errno == EWOULDBLOCK) {
+               pollfd fds;
+               fds.fd = p.fd;
+               fds.events = POLLOUT;
+               ::poll(&fds, 1, -1);
+            }
+            else if (errno != EINTR) {
+               throw boost::system::system_error(errno_code(errno));
+            }
+         }
+
+         c.stop_external_io();
+         m_impl->handle_errors();
+      }
+
+      /** Do one round of I/O.
+       * @param timeout how long to wait for something to complete, zero to
+       * not wait at all, duration::max() to wait for ever
+       *
+       * The data every connection has queued is submitted for writing,
+       * along with the wait, in one system call.  Then everything that
+       * completed is handled: received data is parsed into the
+       * connections' queues and the buffers are handed back to the kernel.
+       * Call connection::process_events() and
+       * connection::process_responses() afterwards to run the handlers.
+       *
+       * @throw boost::system::system_error if a connection without an error
+       * handler failed, it has been removed
+       * @return the number of operations that completed
+       */
+      std::size_t uring_loop::run_once(duration timeout) {
+         for (impl::peers_t::iterator i = m_impl->peers.begin(); i != m_impl->peers.end(); ++i) {
+            impl::peer& p = i->second;
+            if (p.removed or p.send_in_flight or not p.c->want_write())
+               continue;
+
+            p.c->take_writes(p.sending);
+            p.sent = 0;
+            m_impl->start_send(i->first, p);
+         }
+
+         bool ready = *m_impl->cq_head != __atomic_load_n(m_impl->cq_tail, __ATOMIC_ACQUIRE);
+         m_impl->submit(not ready and timeout > duration::zero(), timeout);
+
+         std::size_t count = m_impl->reap();
+         m_impl->handle_errors();
+         return count;
+      }
+
+      /** Get the number of connections handled.
+       * @return the number of connections
+       */
+      std::size_t uring_loop::size() const {
+         return m_impl->ids.size();
+      }
+
+#else
+
+      /// Without io_uring there is nothing.
+      struct uring_loop::impl {
+         std::map<connection*, unsigned long long> ids;
+      };
+
+      bool uring_loop::available() {
+         return false;
+      }
+
+      uring_loop::uring_loop(unsigned int, std::size_t, unsigned int) {
+         throw boost::system::system_error(boost::system::errc::make_error_code(boost::system::errc::operation_not_supported));
+      }
+
+      uring_loop::~uring_loop() {
+      }
+
+      void uring_loop::add(connection&, error_handler_t) {
+      }
+
+      void uring_loop::remove(connection&) {
+      }
+
+      std::size_t uring_loop::run_once(duration) {
+         return 0;
+      }
+
+      std::size_t uring_loop::size() const {
+         return 0;
+      }
+
+#endif
+   }
+}
+
@@ -0,0 +1,851 @@
+#include "manager.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+// A local AMI multiplexer.  Each listener is paired with one Asterisk
+// server; the proxy keeps a single login to every server and lets any
+// number of AMI clients connect to its listeners instead.  Every client
+// logs in, chooses its events (Events action, Filter action, Events header
+// of Login) and sends actions as if it were talking to Asterisk.  Actions
+// are forwarded with an ActionID of the proxy's own, so the response and
+// any events that follow (list events, the OriginateResponse of an async
+// Originate) go back to the client that asked, with its ActionID
+// restored.  Every event is formatted once however many clients receive
+// it.
+//
+// Listeners take an [address:]port (127.0.0.1 if no address is given) or
+// the path of a Unix socket.  Each server gets a shard (see
+// manager::shard_pool), its clients are served on the same thread.
+//
+// usage: astxx-ami-proxy [-u username] [-s secret] [-a username:secret] [-t seconds] listener=host[:port]...
+//
+//   -u, -s   the login to use with Asterisk
+//   -a       the login clients must use, any login is accepted without it
+//   -t       how long to wait for Asterisk to answer an action, 30 seconds
+//            by default
+
+using namespace astxx;
+namespace asio = boost::asio;
+typedef asio::generic::stream_protocol protocol;
+
+namespace
+{
+    // a client writing slower than its events arrive is dropped once this
+    // much is waiting for it
+    const std::size_t max_queued = 16 * 1024 * 1024;
+
+    // a client is dropped if it sends this much without ending an action
+    const std::size_t max_request = 64 * 1024;
+
+    // the ActionIDs the proxy gives forwarded actions start with this
+    const std::string proxy_prefix = "proxy-";
+
+    // answered actions keep their route this long, for events that follow
+    // the response, but no more than max_finished of them are kept
+    const std::chrono::seconds linger(300);
+    const std::size_t max_finished = 65536;
+
+    struct options
+    {
+        std::string username;
+        std::string secret;
+        std::string client_login;
+        int timeout;
+    };
+
+    class client;
+    typedef std::shared_ptr<client> client_ptr;
+    typedef std::shared_ptr<const std::string> data_ptr;
+
+    // where the response to a forwarded action goes
+    struct route
+    {
+        std::weak_ptr<client> to;
+        std::string action_id;
+        bool list;
+        // when the action was answered, for finished routes
+        std::chrono::steady_clock::time_point answered;
+    };
+
+    // one Asterisk server, its listener and its clients, all used from its
+    // shard only
+    struct upstream
+    {
+        upstream(asio::io_service& io_service)
+            : io_service(io_service), acceptor(io_service), retry(io_service), connection(0), greeting("Asterisk Call Manager/5.0.0"), sequence(0)
+        {
+        }
+
+        asio::io_service& io_service;
+        std::string name;
+        std::string host;
+        unsigned short port;
+        std::string listen;
+        asio::basic_socket_acceptor<protocol> acceptor;
+        asio::steady_timer retry;
+        manager::connection* connection;
+        std::string greeting;
+        std::set<client_ptr> clients;
+        std::map<std::string, route> routes;
+        // routes of answered actions, oldest first in finished_order
+        std::map<std::string, route> finished;
+        std::deque<std::string> finished_order;
+        unsigned long long sequence;
+    };
+
+    // an action from a client, sent on as it came
+    class forwarded : public manager::basic_action
+    {
+    public:
+        forwarded(const manager::message::action& a) : a(a) { }
+
+        manager::message::action action() const
+        {
+            return a;
+        }
+
+    private:
+        manager::message::action a;
+    };
+
+    bool iequals(const std::string& a, const std::string& b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (std::string::size_type i = 0; i < a.size(); ++i)
+        {
+            if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+                return false;
+        }
+        return true;
+    }
+
+    typedef manager::message::action::header_t headers_t;
+
+    std::string header(const headers_t& headers, const std::string& key)
+    {
+        headers_t::const_iterator i = headers.find(key);
+        return i != headers.end() ? i->second : std::string();
+    }
+
+    // a message with its ActionID replaced, or removed if id is empty
+    template<typename Message>
+    std::string format_for(Message& m, const std::string& id)
+    {
+        headers_t headers;
+        for (headers_t::iterator i = m.begin(); i != m.end(); ++i)
+        {
+            if (i->first != "ActionID")
+                headers.insert(*i);
+        }
+        if (not id.empty())
+            headers.insert(std::make_pair("ActionID", id));
+        return Message(headers).format();
+    }
+
+    std::string format_response(manager::message::response r, const std::string& id)
+    {
+        std::string out = format_for(r, id);
+        if (r.data.empty())
+            return out;
+
+        // command output goes back the way current versions of Asterisk
+        // send it
+        out.erase(out.size() - 2);
+        std::string::size_type begin = 0, end;
+        while ((end = r.data.find('\n', begin)) != std::string::npos)
+        {
+            out += "Output: " + r.data.substr(begin, end - begin) + "\r\n";
+            begin = end + 1;
+        }
+        return out + "\r\n";
+    }
+
+    std::string reply(const std::string& response, const std::string& id, const std::string& message)
+    {
+        std::string out = "Response: " + response + "\r\n";
+        if (not id.empty())
+            out += "ActionID: " + id + "\r\n";
+        return out + "Message: " + message + "\r\n\r\n";
+    }
+
+    // a downstream AMI client
+    class client : public std::enable_shared_from_this<client>
+    {
+    public:
+        client(upstream& pbx, const options& opts, asio::io_service& io_service)
+            : pbx(pbx), opts(opts), socket(io_service), queued(0), writing(0), closing(false),
+              logged_in(false), all_events(true)
+        {
+        }
+
+        void start()
+        {
+            pbx.clients.insert(shared_from_this());
+            send(pbx.greeting + "\r\n");
+            read();
+        }
+
+        // queue data, shared with every other client it goes to
+        void send(const data_ptr& data)
+        {
+            if (not socket.is_open())
+                return;
+
+            queued += data->size();
+            if (queued > max_queued)
+            {
+                std::cerr << pbx.name << ": dropping a client that can't keep up\n";
+                close();
+                return;
+            }
+
+            out.push_back(data);
+            write();
+        }
+
+        void send(const std::string& data)
+        {
+            send(data_ptr(new std::string(data)));
+        }
+
+        bool wants(const manager::message::event& e, const std::vector<std::string>& lines) const
+        {
+            if (not logged_in)
+                return false;
+
+            if (not all_events)
+            {
+                const std::string* privilege = e.find("Privilege");
+                if (not privilege)
+                    return false;
+
+                bool match = false;
+                std::string::size_type begin = 0;
+                while (not match and begin <= privilege->size())
+                {
+                    std::string::size_type end = std::min(privilege->find(',', begin), privilege->size());
+                    match = classes.count(privilege->substr(begin, end - begin)) != 0;
+                    begin = end + 1;
+                }
+                if (not match)
+                    return false;
+            }
+
+            // the rules of Asterisk's own filters: with any whitelist one
+            // of them must match, and none of the blacklist may
+            bool whitelisted = whitelist.empty();
+            for (std::size_t i = 0; i < lines.size(); ++i)
+            {
+                for (std::size_t j = 0; not whitelisted and j < whitelist.size(); ++j)
+                    whitelisted = std::regex_search(lines[i], whitelist[j]);
+                for (std::size_t j = 0; j < blacklist.size(); ++j)
+                {
+                    if (std::regex_search(lines[i], blacklist[j]))
+                        return false;
+                }
+            }
+            return whitelisted;
+        }
+
+        bool filtered() const
+        {
+            return not whitelist.empty() or not blacklist.empty();
+        }
+
+        void close()
+        {
+            boost::system::error_code ignored;
+            socket.close(ignored);
+            pbx.clients.erase(shared_from_this());
+        }
+
+        protocol::socket& get_socket() { return socket; }
+
+    private:
+        void read()
+        {
+            socket.async_read_some(asio::buffer(buffer),
+                boost::bind(&client::handle_read, shared_from_this(), asio::placeholders::error, asio::placeholders::bytes_transferred));
+        }
+
+        void handle_read(const boost::system::error_code& error, std::size_t bytes)
+        {
+            if (error)
+            {
+                close();
+                return;
+            }
+
+            input.append(buffer.data(), bytes);
+
+            std::string::size_type end;
+            while (socket.is_open() and (end = input.find("\r\n\r\n")) != std::string::npos)
+            {
+                headers_t a;
+
+                std::string::size_type begin = 0;
+                while (begin < end)
+                {
+                    std::string::size_type eol = input.find("\r\n", begin);
+                    std::string::size_type colon = input.find(':', begin);
+                    if (colon < eol)
+                    {
+                        std::string::size_type value = colon + 1;
+                        while (value < eol and input[value] == ' ')
+                            ++value;
+                        a.insert(std::make_pair(input.substr(begin, colon - begin), input.substr(value, eol - value)));
+                    }
+                    begin = eol + 2;
+                }
+                input.erase(0, end + 4);
+
+                // whatever goes wrong with one action is that client's
+                // problem, not the other clients'
+                std::string id = header(a, "ActionID");
+                try
+                {
+                    handle_action(a);
+                }
+                catch (const std::exception& e)
+                {
+                    send(reply("Error", id, e.what()));
+                }
+            }
+
+            if (input.size() > max_request)
+            {
+                std::cerr << pbx.name << ": dropping a client that sent an oversized action\n";
+                close();
+                return;
+            }
+
+            if (socket.is_open())
+                read();
+        }
+
+        void handle_action(headers_t& a)
+        {
+            std::string name = header(a, "Action");
+            std::string id = header(a, "ActionID");
+
+            if (name.empty())
+            {
+                send(reply("Error", id, "Missing action in request"));
+                return;
+            }
+
+            if (iequals(name, "Login"))
+            {
+                if (not opts.client_login.empty() and header(a, "Username") + ":" + header(a, "Secret") != opts.client_login)
+                {
+                    send(reply("Error", id, "Authentication failed"));
+                    close();
+                    return;
+                }
+
+                logged_in = true;
+                std::string events = header(a, "Events");
+                if (not events.empty())
+                    event_mask(events);
+                send(reply("Success", id, "Authentication accepted"));
+                send("Event: FullyBooted\r\nPrivilege: system,all\r\nStatus: Fully Booted\r\n\r\n");
+                return;
+            }
+
+            if (not logged_in)
+            {
+                send(reply("Error", id, "Authentication Required"));
+                return;
+            }
+
+            if (iequals(name, "Logoff"))
+            {
+                send(reply("Goodbye", id, "Thanks for all the fish."));
+                closing = true;
+                write();
+                return;
+            }
+
+            if (iequals(name, "Events"))
+            {
+                event_mask(header(a, "EventMask"));
+                std::string out = "Response: Success\r\n";
+                if (not id.empty())
+                    out += "ActionID: " + id + "\r\n";
+                send(out + "Events: " + (all_events or not classes.empty() ? "On" : "Off") + "\r\n\r\n");
+                return;
+            }
+
+            if (iequals(name, "Filter"))
+            {
+                add_filter(header(a, "Operation"), header(a, "Filter"), id);
+                return;
+            }
+
+            forward(a, id);
+        }
+
+        void event_mask(const std::string& mask)
+        {
+            classes.clear();
+            all_events = false;
+            if (iequals(mask, "on") or mask == "-1")
+            {
+                all_events = true;
+                return;
+            }
+            if (iequals(mask, "off") or mask == "0")
+                return;
+
+            std::string::size_type begin = 0;
+            while (begin <= mask.size())
+            {
+                std::string::size_type end = std::min(mask.find(',', begin), mask.size());
+                if (end > begin)
+                    classes.insert(mask.substr(begin, end - begin));
+                begin = end + 1;
+            }
+            if (classes.count("all"))
+                all_events = true;
+        }
+
+        // filters are kept here, the upstream connection gets every event
+        void add_filter(const std::string& operation, const std::string& filter, const std::string& id)
+        {
+            if (not operation.empty() and not iequals(operation, "Add"))
+            {
+                send(reply("Error", id, "Unknown operation"));
+                return;
+            }
+
+            try
+            {
+                if (not filter.empty() and filter[0] == '!')
+                    blacklist.push_back(std::regex(filter.substr(1)));
+                else
+                    whitelist.push_back(std::regex(filter));
+                send(reply("Success", id, "Filter Added Successfully"));
+            }
+            catch (const std::regex_error&)
+            {
+                send(reply("Error", id, "Filter Not Added"));
+            }
+        }
+
+        void forward(headers_t& a, const std::string& id);
+
+        void write()
+        {
+            if (writing or not socket.is_open())
+                return;
+
+            if (out.empty())
+            {
+                if (closing)
+                    close();
+                return;
+            }
+
+            std::vector<asio::const_buffer> buffers;
+            for (std::deque<data_ptr>::iterator i = out.begin(); i != out.end() and buffers.size() < 64; ++i)
+                buffers.push_back(asio::buffer(**i));
+            writing = buffers.size();
+
+            asio::async_write(socket, buffers,
+                boost::bind(&client::handle_write, shared_from_this(), asio::placeholders::error, asio::placeholders::bytes_transferred));
+        }
+
+        void handle_write(const boost::system::error_code& error, std::size_t bytes)
+        {
+            out.erase(out.begin(), out.begin() + writing);
+            queued -= bytes;
+            writing = 0;
+
+            if (error)
+            {
+                close();
+                return;
+            }
+            write();
+        }
+
+        upstream& pbx;
+        const options& opts;
+        protocol::socket socket;
+        boost::array<char, 4096> buffer;
+        std::string input;
+
+        std::deque<data_ptr> out;
+        std::size_t queued;
+        std::size_t writing;
+        bool closing;
+
+        bool logged_in;
+        bool all_events;
+        std::set<std::string> classes;
+        std::vector<std::regex> whitelist;
+        std::vector<std::regex> blacklist;
+    };
+
+    // an action is answered, keep its route a while for events that follow
+    // (async Originate sends OriginateResponse well after its response)
+    void finish(upstream* pbx, std::map<std::string, route>::iterator i)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (not i->second.to.expired())
+        {
+            route& r = pbx->finished[i->first];
+            r = i->second;
+            r.list = false;
+            r.answered = now;
+            pbx->finished_order.push_back(i->first);
+        }
+        pbx->routes.erase(i);
+
+        while (not pbx->finished_order.empty())
+        {
+            std::map<std::string, route>::iterator oldest = pbx->finished.find(pbx->finished_order.front());
+            if (pbx->finished_order.size() <= max_finished and now - oldest->second.answered < linger)
+                break;
+            pbx->finished.erase(oldest);
+            pbx->finished_order.pop_front();
+        }
+    }
+
+    void deliver_response(upstream* pbx, std::string id, manager::message::response r)
+    {
+        std::map<std::string, route>::iterator i = pbx->routes.find(id);
+        if (i == pbx->routes.end())
+            return;
+
+        client_ptr c = i->second.to.lock();
+        if (c)
+            c->send(format_response(r, i->second.action_id));
+
+        // list events follow, keep the route until the last one
+        const std::string* list = r.find("EventList");
+        if (list and iequals(*list, "start") and c)
+            i->second.list = true;
+        else
+            finish(pbx, i);
+    }
+
+    void deliver_error(upstream* pbx, std::string id, boost::system::error_code error)
+    {
+        std::map<std::string, route>::iterator i = pbx->routes.find(id);
+        if (i == pbx->routes.end())
+            return;
+
+        client_ptr c = i->second.to.lock();
+        if (c)
+            c->send(reply("Error", i->second.action_id, error == asio::error::timed_out ? "Timed out waiting for Asterisk" : "Lost the connection to Asterisk"));
+        finish(pbx, i);
+    }
+
+    void client::forward(headers_t& a, const std::string& id)
+    {
+        if (not pbx.connection)
+        {
+            send(reply("Error", id, "Not connected to Asterisk"));
+            return;
+        }
+
+        // tag it with an ActionID of our own, unique among all clients
+        std::string upstream_id = proxy_prefix + boost::lexical_cast<std::string>(++pbx.sequence);
+        a.erase("ActionID");
+        a.insert(std::make_pair("ActionID", upstream_id));
+        pbx.connection->send_action_async(forwarded(manager::message::action(a)),
+            boost::bind(deliver_response, &pbx, upstream_id, _1), boost::bind(deliver_error, &pbx, upstream_id, _1),
+            std::chrono::seconds(opts.timeout));
+
+        route& r = pbx.routes[upstream_id];
+        r.to = shared_from_this();
+        r.action_id = id;
+        r.list = false;
+    }
+
+    void deliver_event(upstream* pbx, manager::message::event e)
+    {
+        // events answering a client's action go to that client only
+        const std::string* id = e.find("ActionID");
+        if (id)
+        {
+            std::map<std::string, route>::iterator i = pbx->routes.find(*id);
+            if (i != pbx->routes.end())
+            {
+                client_ptr c = i->second.to.lock();
+                if (c)
+                    c->send(format_for(e, i->second.action_id));
+
+                const std::string* list = e.find("EventList");
+                if (not c)
+                    pbx->routes.erase(i);
+                else if (list and iequals(*list, "Complete"))
+                    finish(pbx, i);
+                return;
+            }
+
+            i = pbx->finished.find(*id);
+            if (i != pbx->finished.end())
+            {
+                if (client_ptr c = i->second.to.lock())
+                    c->send(format_for(e, i->second.action_id));
+                return;
+            }
+
+            // answering a client's action that is gone or long finished,
+            // it is nobody else's business
+            if (id->compare(0, proxy_prefix.size(), proxy_prefix) == 0)
+                return;
+        }
+
+        // the lines filters are matched against, only if someone has one
+        std::vector<std::string> lines;
+        for (std::set<client_ptr>::iterator i = pbx->clients.begin(); i != pbx->clients.end(); ++i)
+        {
+            if ((*i)->filtered())
+            {
+                for (manager::message::event::header_t::iterator h = e.begin(); h != e.end(); ++h)
+                    lines.push_back(h->first + ": " + h->second);
+                break;
+            }
+        }
+
+        data_ptr data;
+        std::vector<client_ptr> clients(pbx->clients.begin(), pbx->clients.end());
+        for (std::size_t i = 0; i < clients.size(); ++i)
+        {
+            if (not clients[i]->wants(e, lines))
+                continue;
+            if (not data)
+                data.reset(new std::string(e.format()));
+            clients[i]->send(data);
+        }
+    }
+
+    void start_accept(upstream* pbx, const options* opts);
+
+    void handle_accept(upstream* pbx, const options* opts, client_ptr c, const boost::system::error_code& error)
+    {
+        if (error == asio::error::operation_aborted)
+            return;
+        if (not error)
+            c->start();
+        start_accept(pbx, opts);
+    }
+
+    void start_accept(upstream* pbx, const options* opts)
+    {
+        client_ptr c(new client(*pbx, *opts, pbx->io_service));
+        pbx->acceptor.async_accept(c->get_socket(), boost::bind(handle_accept, pbx, opts, c, asio::placeholders::error));
+    }
+
+    // open the listener, on the shard
+    void open_listener(upstream* pbx, const options* opts)
+    {
+        try
+        {
+            protocol::endpoint endpoint;
+            if (pbx->listen.find('/') != std::string::npos)
+            {
+                ::unlink(pbx->listen.c_str());
+                endpoint = asio::local::stream_protocol::endpoint(pbx->listen);
+            }
+            else
+            {
+                std::string address = "127.0.0.1";
+                std::string port = pbx->listen;
+                std::string::size_type colon = pbx->listen.rfind(':');
+                if (colon != std::string::npos)
+                {
+                    address = pbx->listen.substr(0, colon);
+                    port = pbx->listen.substr(colon + 1);
+                }
+                endpoint = asio::ip::tcp::endpoint(asio::ip::make_address(address), boost::lexical_cast<unsigned short>(port));
+            }
+
+            pbx->acceptor.open(endpoint.protocol());
+            pbx->acceptor.set_option(asio::socket_base::reuse_address(true));
+            pbx->acceptor.bind(endpoint);
+            pbx->acceptor.listen();
+            start_accept(pbx, opts);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << pbx->name << ": can't listen on " << pbx->listen << ": " << e.what() << std::endl;
+        }
+    }
+
+    void setup(upstream* pbx, const options* opts, manager::connection& c)
+    {
+        manager::action::login(opts->username, opts->secret)(c);
+        c.register_event("", boost::bind(deliver_event, pbx, _1));
+        pbx->connection = &c;
+        pbx->greeting = c.name() + "/" + c.version();
+        std::cerr << pbx->name << ": connected" << std::endl;
+    }
+
+    void connect_upstream(manager::shard_pool* pool, upstream* pbx, const options* opts);
+    void handle_retry(manager::shard_pool* pool, upstream* pbx, const options* opts, const boost::system::error_code& error);
+
+    void handle_failure(manager::shard_pool* pool, upstream* pbx, const options* opts, const std::string&, std::exception_ptr error)
+    {
+        try
+        {
+            std::rethrow_exception(error);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << pbx->name << ": " << e.what() << std::endl;
+        }
+
+        // whatever was waiting won't be answered
+        pbx->connection = 0;
+        std::vector<std::string> ids;
+        for (std::map<std::string, route>::iterator i = pbx->routes.begin(); i != pbx->routes.end(); ++i)
+            ids.push_back(i->first);
+        for (std::size_t i = 0; i < ids.size(); ++i)
+            deliver_error(pbx, ids[i], asio::error::connection_aborted);
+
+        pbx->retry.expires_after(std::chrono::seconds(2));
+        pbx->retry.async_wait(boost::bind(handle_retry, pool, pbx, opts, asio::placeholders::error));
+    }
+
+    void handle_retry(manager::shard_pool* pool, upstream* pbx, const options* opts, const boost::system::error_code& error)
+    {
+        if (not error)
+            connect_upstream(pool, pbx, opts);
+    }
+
+    void connect_upstream(manager::shard_pool* pool, upstream* pbx, const options* opts)
+    {
+        pool->add(pbx->name, pbx->host, pbx->port, boost::bind(setup, pbx, opts, _1), boost::bind(handle_failure, pool, pbx, opts, _1, _2));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    opts.timeout = 30;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "u:s:a:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u': opts.username = optarg; break;
+        case 's': opts.secret = optarg; break;
+        case 'a': opts.client_login = optarg; break;
+        case 't': opts.timeout = std::atoi(optarg); break;
+        default: optind = argc + 1; break;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-u username] [-s secret] [-a username:secret] [-t seconds] listener=host[:port]..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // leave the signals to sigwait() below, not the shard threads
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        std::size_t servers = argc - optind;
+        manager::shard_pool pool(std::min<std::size_t>(servers, std::max(1u, std::thread::hardware_concurrency())));
+        std::vector<std::shared_ptr<upstream> > pbxes;
+
+        for (int i = optind; i < argc; ++i)
+        {
+            std::string spec = argv[i];
+            std::string::size_type equals = spec.find('=');
+            if (equals == std::string::npos)
+            {
+                std::cerr << "expected listener=host[:port], not " << spec << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            std::size_t shard = pool.shard_of(spec);
+            std::shared_ptr<upstream> pbx(new upstream(pool.get_io_service(shard)));
+            pbx->name = spec;
+            pbx->listen = spec.substr(0, equals);
+            pbx->host = spec.substr(equals + 1);
+            pbx->port = 5038;
+            std::string::size_type colon = pbx->host.rfind(':');
+            if (colon != std::string::npos)
+            {
+                pbx->port = boost::lexical_cast<unsigned short>(pbx->host.substr(colon + 1));
+                pbx->host.erase(colon);
+            }
+            pbxes.push_back(pbx);
+
+            pool.post(shard, boost::bind(open_listener, pbx.get(), &opts));
+            connect_upstream(&pool, pbx.get(), &opts);
+        }
+
+        int received;
+        sigwait(&signals, &received);
+
+        // close the listeners, clients and connections on their shards, 
+        // then stop
+        std::vector<std::future<void> > closed;
+        for (std::size_t i = 0; i < pbxes.size(); ++i)
+        {
+            upstream* pbx = pbxes[i].get();
+            std::shared_ptr<std::promise<void> > done(new std::promise<void>());
+            closed.push_back(done->get_future());
+            pool.remove(pbx->name);
+            pool.post(pool.shard_of(pbx->name), [pbx, done]()
+            {
+                boost::system::error_code ignored;
+                pbx->acceptor.close(ignored);
+                pbx->retry.cancel();
+                std::vector<client_ptr> clients(pbx->clients.begin(), pbx->clients.end());
+                for (std::size_t j = 0; j < clients.size(); ++j)
+                    clients[j]->close();
+                done->set_value();
+            });
+        }
+        for (std::size_t i = 0; i < closed.size(); ++i)
+            closed[i].wait();
+        pool.stop();
+
+        for (std::size_t i = 0; i < pbxes.size(); ++i)
+        {
+            if (pbxes[i]->listen.find('/') != std::string::npos)
+                ::unlink(pbxes[i]->listen.c_str());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}